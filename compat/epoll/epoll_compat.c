@@ -0,0 +1,12 @@
+#include <sys/epoll.h>
+
+#include <stdlib.h>
+
+int
+main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	(void)epoll_create1(EPOLL_CLOEXEC);
+	exit(0);
+}
@@ -0,0 +1,16 @@
+#include <stdlib.h>
+
+#include "fuse_lowlevel.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct fuse_lowlevel_ops ops;
+
+	(void)argc;
+	(void)argv;
+	ops.readdirplus = NULL;
+	(void)ops;
+	(void)fuse_add_direntry_plus;
+	exit(0);
+}
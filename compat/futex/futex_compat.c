@@ -0,0 +1,17 @@
+#include <sys/syscall.h>
+
+#include <linux/futex.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+int
+main(int argc, char *argv[])
+{
+	int v = 0;
+
+	(void)argc;
+	(void)argv;
+	syscall(SYS_futex, &v, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	exit(0);
+}
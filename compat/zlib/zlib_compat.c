@@ -0,0 +1,12 @@
+#include <stdlib.h>
+#include <zlib.h>
+
+int
+main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	(void)compress2;
+	(void)uncompress;
+	exit(0);
+}
@@ -201,6 +201,9 @@ endif
 ifneq ($(filter ctlcli,${MODULES}),)
   SRCS+=	${PFL_BASE}/ctlcli.c
   MODULES+=	lnet-hdrs
+  ifdef PICKLE_HAVE_ZLIB
+    MODULES+=	z
+  endif
 endif
 
 ifneq ($(filter lnet,${MODULES}),)
@@ -289,6 +292,9 @@ endif
 ifneq ($(filter ctl,${MODULES}),)
   SRCS+=	${PFL_BASE}/ctlsvr.c
   DEFINES+=	-DPFL_CTL
+  ifdef PICKLE_HAVE_ZLIB
+    LDFLAGS+=	${LIBZ}
+  endif
 endif
 
 ifneq ($(filter sgio,${MODULES}),)
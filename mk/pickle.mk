@@ -147,6 +147,18 @@ ifeq ($(filter $(realpath ${ROOTDIR})/compat/%,${CURDIR}),)
   DEFINES+=						-DHAVE_SYNC_FILE_RANGE
  endif
 
+ ifdef PICKLE_HAVE_FUTEX
+  DEFINES+=						-DHAVE_FUTEX
+ endif
+
+ ifdef PICKLE_HAVE_EPOLL
+  DEFINES+=						-DHAVE_EPOLL
+ endif
+
+ ifdef PICKLE_HAVE_ZLIB
+  DEFINES+=						-DHAVE_ZLIB
+ endif
+
  ifdef PICKLE_HAVE_FUSE_DEBUGLEVEL
   DEFINES+=						-DHAVE_FUSE_DEBUGLEVEL
  endif
@@ -159,6 +171,10 @@ ifeq ($(filter $(realpath ${ROOTDIR})/compat/%,${CURDIR}),)
   DEFINES+=						-DHAVE_FUSE_REQ_GETCHANNEL
  endif
 
+ ifdef PICKLE_HAVE_FUSE_READDIRPLUS
+  DEFINES+=						-DHAVE_FUSE_READDIRPLUS
+ endif
+
  ifdef PICKLE_HAVE_FUSE
   DEFINES+=						-DHAVE_FUSE
   PSCFS_SRCS+=						${PFL_BASE}/fuse.c
@@ -34,7 +34,9 @@
 #include "pfl/alloc.h"
 #include "pfl/cdefs.h"
 #include "pfl/hashtbl.h"
+#include "pfl/heapprof.h"
 #include "pfl/log.h"
+#include "pfl/slab.h"
 #include "pfl/str.h"
 
 #if PFL_DEBUG > 1
@@ -148,14 +150,8 @@ pscmem_checkinnerguard(struct psc_memalloc *pma)
 void _psc_lru_sysfree(struct psc_memalloc *);
 #endif
 
-/*
- * Allocate or resize a chunk of memory.
- * @oldp: current chunk of memory to resize or NULL for new chunk.
- * @size: desired size of memory chunk.
- * @flags: operational flags.
- */
-void *
-_psc_realloc(void *oldp, size_t size, int flags)
+static void *
+_psc_realloc_impl(void *oldp, size_t size, int flags)
 {
 	int rc, save_errno;
 	void *newp;
@@ -217,6 +213,28 @@ _psc_realloc(void *oldp, size_t size, int flags)
 	if (oldp)
 		pfl_assert(size);
 
+#if PFL_DEBUG < 2
+	if (oldp && pfl_slab_owns(oldp)) {
+		size_t osize;
+
+		/* Move out of the slab object if it no longer fits. */
+		osize = pfl_slab_objsize(oldp);
+		if (size <= osize)
+			return (oldp);
+		newp = _psc_realloc_impl(NULL, size, flags | PAF_NOZERO);
+		if (newp == NULL)
+			return (NULL);
+		memcpy(newp, oldp, osize);
+		pfl_slab_free(oldp);
+		return (newp);
+	}
+	if (oldp == NULL) {
+		newp = pfl_slab_alloc(size, flags);
+		if (newp)
+			goto slabdone;
+	}
+#endif
+
 #if PFL_DEBUG > 1
 	if ((flags & PAF_NOGUARD) == 0) {
 		specsize = size;
@@ -336,6 +354,9 @@ _psc_realloc(void *oldp, size_t size, int flags)
 	}
 #endif
 
+#if PFL_DEBUG < 2
+ slabdone:
+#endif
 	if ((flags & PAF_LOCK) && mlock(newp, size) == -1) {
 		if (flags & PAF_CANFAIL) {
 psc_fatalx("not ready");
@@ -352,6 +373,27 @@ psc_fatalx("not ready");
 	return (newp);
 }
 
+/*
+ * Allocate or resize a chunk of memory.
+ * @oldp: current chunk of memory to resize or NULL for new chunk.
+ * @size: desired size of memory chunk.
+ * @flags: operational flags.
+ */
+void *
+_psc_realloc(void *oldp, size_t size, int flags)
+{
+	void *newp;
+
+	newp = _psc_realloc_impl(oldp, size, flags);
+	if (newp == NULL)
+		/* PAF_CANFAIL: the old chunk is still live */
+		return (NULL);
+	if (oldp)
+		PFL_HEAPPROF_FREE(oldp);
+	PFL_HEAPPROF_ALLOC(newp, size);
+	return (newp);
+}
+
 /*
  * Allocate zeroed memory for an array.
  * @size: size of chunk to allocate.
@@ -404,6 +446,8 @@ _psc_lru_userfree(void *p, int flags, ...)
 {
 	struct psc_memalloc *pma;
 
+	PFL_HEAPPROF_FREE(p);
+
 	if (flags & PAF_LOCK) {
 		size_t len;
 		va_list ap;
@@ -452,6 +496,8 @@ _psc_free(void *p, int flags, ...)
 {
 	va_list ap;
 
+	PFL_HEAPPROF_FREE(p);
+
 	if (flags & PAF_LOCK) {
 		size_t len;
 
@@ -463,6 +509,13 @@ _psc_free(void *p, int flags, ...)
 			psc_fatal("munlock %p", p);
 	}
 
+#if PFL_DEBUG < 2
+	if (pfl_slab_owns(p)) {
+		pfl_slab_free(p);
+		return;
+	}
+#endif
+
 #if PFL_DEBUG > 1
 	if ((flags & PAF_NOGUARD) == 0) {
 		struct psc_memalloc *pma;
@@ -527,5 +580,15 @@ psc_memallocs_init(void)
  bail:
 		fclose(fp);
 	}
+#else
+	char *p;
+	int rc;
+
+	p = getenv("PSC_SLAB_ALLOC");
+	if (p && strcmp(p, "0")) {
+		rc = pfl_slab_init();
+		if (rc)
+			warnx("slab allocator: %s", strerror(rc));
+	}
 #endif
 }
@@ -0,0 +1,198 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Region (arena) allocator for memory scoped to a request.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pfl/alloc.h"
+#include "pfl/arena.h"
+#include "pfl/atomic.h"
+#include "pfl/cdefs.h"
+#include "pfl/opstats.h"
+#include "pfl/pool.h"
+
+struct psc_poolmaster	 pfl_arena_poolmaster;
+struct psc_poolmgr	*pfl_arena_pool;
+
+struct pfl_opstat	*pfl_arena_opst_hwm;
+struct pfl_opstat	*pfl_arena_opst_overflow;
+struct pfl_opstat	*pfl_arena_opst_oversize;
+
+/* largest pa_hwm reported, to skip the opstat lock when not raised */
+__static psc_atomic64_t	 pfl_arena_hwm = PSC_ATOMIC64_INIT(0);
+
+/*
+ * Push a new chunk onto an arena able to hold at least @len bytes.
+ * Requests larger than a pool chunk get a dedicated allocation.
+ */
+__static struct pfl_arena_chunk *
+pfl_arena_grow(struct pfl_arena *pa, size_t len)
+{
+	struct pfl_arena_chunk *pac;
+
+	if (len > PFL_ARENA_CHUNKSZ) {
+		pac = psc_alloc(offsetof(struct pfl_arena_chunk,
+		    pac_data) + len, PAF_NOZERO);
+		pac->pac_flags = PACF_OVERSIZE;
+		pac->pac_size = len;
+		pfl_opstat_incr(pfl_arena_opst_oversize);
+	} else {
+		pac = psc_pool_get(pfl_arena_pool);
+		pac->pac_flags = 0;
+		pac->pac_size = PFL_ARENA_CHUNKSZ;
+	}
+	pac->pac_used = 0;
+	pac->pac_prev = pa->pa_cur;
+	pa->pa_cur = pac;
+	if (pa->pa_nchunks++)
+		pfl_opstat_incr(pfl_arena_opst_overflow);
+	return (pac);
+}
+
+__static void
+pfl_arena_pop(struct pfl_arena *pa)
+{
+	struct pfl_arena_chunk *pac;
+
+	pac = pa->pa_cur;
+	pa->pa_cur = pac->pac_prev;
+	pa->pa_nchunks--;
+	if (pac->pac_flags & PACF_OVERSIZE)
+		PSCFREE(pac);
+	else
+		psc_pool_return(pfl_arena_pool, pac);
+}
+
+/*
+ * Allocate memory from an arena.
+ * @pa: arena.
+ * @len: number of bytes.
+ * @flags: PAF_NOZERO to skip zeroing the returned memory.
+ */
+void *
+_pfl_arena_alloc(struct pfl_arena *pa, size_t len, int flags)
+{
+	struct pfl_arena_chunk *pac;
+	void *p;
+
+	len = PSC_ALIGN(len ? len : 1, PFL_ARENA_ALIGN);
+	pac = pa->pa_cur;
+	if (pac == NULL || pac->pac_size - pac->pac_used < len)
+		pac = pfl_arena_grow(pa, len);
+	p = pac->pac_data + pac->pac_used;
+	pac->pac_used += len;
+	pa->pa_inuse += len;
+	if (pa->pa_inuse > pa->pa_hwm)
+		pa->pa_hwm = pa->pa_inuse;
+	if ((flags & PAF_NOZERO) == 0)
+		memset(p, 0, len);
+	return (p);
+}
+
+char *
+pfl_arena_strdup(struct pfl_arena *pa, const char *str)
+{
+	size_t len;
+	char *p;
+
+	len = strlen(str) + 1;
+	p = PFL_ARENA_ALLOC_NOZERO(pa, len);
+	memcpy(p, str, len);
+	return (p);
+}
+
+/*
+ * Record the current allocation point of an arena so it may later be
+ * restored with pfl_arena_rewind().
+ */
+void
+pfl_arena_mark(struct pfl_arena *pa, struct pfl_arena_mark *pam)
+{
+	pam->pam_chunk = pa->pa_cur;
+	pam->pam_used = pa->pa_cur ? pa->pa_cur->pac_used : 0;
+	pam->pam_inuse = pa->pa_inuse;
+}
+
+/*
+ * Release all memory allocated from an arena since a checkpoint.
+ * Chunks acquired after the checkpoint are returned to the pool.
+ */
+void
+pfl_arena_rewind(struct pfl_arena *pa, const struct pfl_arena_mark *pam)
+{
+	while (pa->pa_cur != pam->pam_chunk)
+		pfl_arena_pop(pa);
+	if (pa->pa_cur)
+		pa->pa_cur->pac_used = pam->pam_used;
+	pa->pa_inuse = pam->pam_inuse;
+}
+
+/*
+ * Release all memory allocated from an arena, leaving it empty.
+ */
+void
+pfl_arena_reset(struct pfl_arena *pa)
+{
+	if (pa->pa_cur == NULL)
+		return;
+	if ((int64_t)pa->pa_hwm > psc_atomic64_read(&pfl_arena_hwm)) {
+		psc_atomic64_setmax(&pfl_arena_hwm, pa->pa_hwm);
+		pfl_opstat_setmax(pfl_arena_opst_hwm, pa->pa_hwm);
+	}
+	while (pa->pa_cur)
+		pfl_arena_pop(pa);
+	pfl_arena_init(pa);
+}
+
+__static pthread_once_t	pfl_arenas_once = PTHREAD_ONCE_INIT;
+
+__static void
+pfl_arenas_doinit(void)
+{
+	psc_poolmaster_init(&pfl_arena_poolmaster,
+	    struct pfl_arena_chunk, pac_lentry, PPMF_AUTO, 16, 16, 0,
+	    NULL, "arena");
+	pfl_arena_pool = psc_poolmaster_getmgr(&pfl_arena_poolmaster);
+
+	pfl_arena_opst_hwm = pfl_opstat_init("arena.hwm");
+	pfl_arena_opst_overflow = pfl_opstat_initf(OPSTF_BASE10,
+	    "arena.overflow");
+	pfl_arena_opst_oversize = pfl_opstat_initf(OPSTF_BASE10,
+	    "arena.oversize");
+}
+
+/*
+ * Initialize the chunk pool shared by all arenas.  Safe to call from
+ * each subsystem that embeds arenas; concurrent callers return only
+ * once the pool is ready.
+ */
+void
+pfl_arenas_init(void)
+{
+	pthread_once(&pfl_arenas_once, pfl_arenas_doinit);
+}
@@ -0,0 +1,87 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Arenas are bump allocators for memory whose lifetime is bounded by
+ * some owning object, such as an RPC or file system request.  Memory
+ * is carved from a chain of chunks recycled through a pool and is
+ * released all at once by pfl_arena_reset() or back to a checkpoint by
+ * pfl_arena_rewind().  Individual allocations are never freed.
+ *
+ * An arena that has been zeroed is valid and empty, so arenas embedded
+ * in pool-managed structures need no explicit initialization.
+ */
+
+#ifndef _PFL_ARENA_H_
+#define _PFL_ARENA_H_
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pfl/alloc.h"
+#include "pfl/list.h"
+
+#define PFL_ARENA_CHUNKSZ	8192		/* usable bytes per pool chunk */
+#define PFL_ARENA_ALIGN		16
+
+struct pfl_arena_chunk {
+	struct psc_listentry	 pac_lentry;	/* pool membership */
+	struct pfl_arena_chunk	*pac_prev;	/* next older chunk in arena */
+	size_t			 pac_size;	/* usable bytes in pac_data */
+	size_t			 pac_used;
+	int			 pac_flags;	/* see PACF_* below */
+	char			 pac_data[PFL_ARENA_CHUNKSZ]
+				    __aligned(PFL_ARENA_ALIGN);
+};
+
+/* arena chunk flags */
+#define PACF_OVERSIZE		(1 << 0)	/* allocated directly, not from pool */
+
+struct pfl_arena {
+	struct pfl_arena_chunk	*pa_cur;	/* newest chunk */
+	size_t			 pa_inuse;	/* bytes handed out */
+	size_t			 pa_hwm;	/* high-water mark of pa_inuse */
+	int			 pa_nchunks;
+};
+
+struct pfl_arena_mark {
+	struct pfl_arena_chunk	*pam_chunk;
+	size_t			 pam_used;
+	size_t			 pam_inuse;
+};
+
+#define PFL_ARENA_ALLOC(pa, sz)		_pfl_arena_alloc((pa), (sz), 0)
+#define PFL_ARENA_ALLOC_NOZERO(pa, sz)	_pfl_arena_alloc((pa), (sz), PAF_NOZERO)
+
+#define pfl_arena_init(pa)		memset((pa), 0, sizeof(*(pa)))
+
+void	*_pfl_arena_alloc(struct pfl_arena *, size_t, int);
+void	 pfl_arena_mark(struct pfl_arena *, struct pfl_arena_mark *);
+void	 pfl_arena_reset(struct pfl_arena *);
+void	 pfl_arena_rewind(struct pfl_arena *, const struct pfl_arena_mark *);
+char	*pfl_arena_strdup(struct pfl_arena *, const char *);
+void	 pfl_arenas_init(void);
+
+#endif /* _PFL_ARENA_H_ */
@@ -171,6 +171,18 @@ psc_atomic32_setmax(psc_atomic32_t *v, int32_t val)
 	} while (psc_atomic32_cmpxchg(v, oldval, val) != oldval);
 }
 
+static __inline void
+psc_atomic64_setmax(psc_atomic64_t *v, int64_t val)
+{
+	int64_t oldval;
+
+	do {
+		oldval = psc_atomic64_read(v);
+		if (val <= oldval)
+			break;
+	} while (psc_atomic64_cmpxchg(v, oldval, val) != oldval);
+}
+
 /* default width */
 typedef psc_atomic32_t psc_atomic_t;
 
@@ -76,12 +76,50 @@ struct psc_ctlmsg_hashtable {
 	char			pcht_name[PSC_HTNAME_MAX];
 };
 
+#define PFLCTL_HEAPPROF_MAXDEPTH	32
+#define PFLCTL_HEAPPROF_LINEMAX		(PFLCTL_HEAPPROF_MAXDEPTH * 8)
+
+/* heap profile records, emitted in pprof legacy heap profile order */
+struct pfl_ctlmsg_heapprof {
+	 int32_t		pchp_type;	/* see PFLCTL_HPT_* below */
+	 int32_t		pchp_depth;
+	uint64_t		pchp_rate;
+	uint64_t		pchp_inuse_objs;
+	uint64_t		pchp_inuse_bytes;
+	uint64_t		pchp_alloc_objs;
+	uint64_t		pchp_alloc_bytes;
+	union {
+		uint64_t	pchpu_pcs[PFLCTL_HEAPPROF_MAXDEPTH];
+		char		pchpu_line[PFLCTL_HEAPPROF_LINEMAX];
+	} pchp_u;
+#define pchp_pcs	pchp_u.pchpu_pcs
+#define pchp_line	pchp_u.pchpu_line
+};
+
+#define PFLCTL_HPT_TOTAL	0		/* profile header with totals */
+#define PFLCTL_HPT_SITE		1		/* allocation site */
+#define PFLCTL_HPT_LINE		2		/* verbatim text (memory maps) */
+
 #define OPST_NAME_MAX 64
 struct psc_ctlmsg_opstat {
 	char			pco_name[OPST_NAME_MAX];
 	struct pfl_opstat	pco_opst;
 };
 
+/* histogram summary; percentiles are computed by the daemon */
+struct pfl_ctlmsg_histogram {
+	char			pchg_name[OPST_NAME_MAX];
+	int32_t			pchg_flags;
+	int32_t			pchg_precision;
+	uint64_t		pchg_count;
+	uint64_t		pchg_sum;
+	uint64_t		pchg_p50;
+	uint64_t		pchg_p90;
+	uint64_t		pchg_p99;
+	uint64_t		pchg_p999;
+	uint64_t		pchg_max;
+};
+
 #define PCI_NAME_ALL		"all"
 
 struct psc_ctlmsg_journal {
@@ -122,6 +160,19 @@ struct psc_ctlmsg_lnetif {
 	int32_t			pclni_refcount;
 };
 
+/* contention profile of a lock acquisition site, times in nsec */
+struct pfl_ctlmsg_lockprof {
+	char			pclp_file[64];	/* basename */
+	int32_t			pclp_line;
+	int32_t			pclp_type;
+	uint64_t		pclp_nacq;
+	uint64_t		pclp_ncontended;
+	uint64_t		pclp_wait;
+	uint64_t		pclp_waitmax;
+	uint64_t		pclp_hold;
+	uint64_t		pclp_holdmax;
+};
+
 struct psc_ctlmsg_thread {
 	char			pct_thrname[PSC_THRNAME_MAX];
 	char			pct_waitname[PFL_WAITQ_NAME_MAX];
@@ -175,6 +226,9 @@ struct psc_ctlmsg_pool {
 	uint64_t		pcpl_ngrow;
 	uint64_t		pcpl_nshrink;
 	uint64_t		pcpl_nseen;
+	int32_t			pcpl_nregions;		/* PPMF_REGION mappings */
+	int32_t			pcpl_regionsz;
+	int64_t			pcpl_tlbpages;		/* estimated TLB footprint */
 	char			pcpl_name[PEXL_NAME_MAX];
 };
 
@@ -225,6 +279,20 @@ struct psc_ctlmsg_rpcrq {
 	 int32_t		 pcrq_nwaiters;
 };
 
+/* per-opcode RPC service latency, in usec */
+struct psc_ctlmsg_rpcop {
+	char			pcro_svcname[PSCRPC_SVCNAME_MAX];
+	uint32_t		pcro_opc;
+	int32_t			pcro_topn;	/* request: N slowest recently */
+	uint64_t		pcro_count[PSCRPC_NOPPH];
+	uint64_t		pcro_mean[PSCRPC_NOPPH];
+	uint64_t		pcro_p99[PSCRPC_NOPPH];
+	uint64_t		pcro_wincount;	/* requests handled in window */
+	uint64_t		pcro_winmean;	/* queue + handle over window */
+	int32_t			pcro_winsecs;	/* window length */
+	int32_t			pcro__pad;
+};
+
 struct psc_ctlmsg_rpcsvc {
 	char			pcrs_name[PSCRPC_SVCNAME_MAX];
 	uint32_t		pcrs_flags;
@@ -268,25 +336,73 @@ struct pfl_ctlmsg_fsrq {
 struct pfl_ctlmsg_workrq {
 	uint64_t		 pcw_addr;
 	char			 pcw_type[32];
+	char			 pcw_thrname[PSC_THRNAME_MAX];
+	 int32_t		 pcw_pri;
+	 int32_t		 pcw_flags;
+	 int32_t		 pcw_nqueued;	/* worker deque depth */
+	 int32_t		 pcw_cpu;
+	uint64_t		 pcw_nrun;
+	uint64_t		 pcw_nsteals;
+	uint64_t		 pcw_nstolen;
+};
+
+#define PFLCTL_WKRQF_WORKER	(1 << 0)	/* record summarizes a worker */
+
+struct pfl_ctlmsg_slab {
+	 int32_t		 pcsl_class;
+	 int32_t		 pcsl_nperrun;
+	uint64_t		 pcsl_size;
+	uint64_t		 pcsl_nruns;
+	uint64_t		 pcsl_nout;
+	uint64_t		 pcsl_nrefills;
+	uint64_t		 pcsl_nflushes;
+	uint64_t		 pcsl_nreleased;
+};
+
+/*
+ * Batched snapshot: the request names a record type (PCMT_GETLISTCACHE,
+ * PCMT_GETOPSTATS or PCMT_GETPOOL) and a filter evaluated by the daemon;
+ * each reply frame packs many matching records back to back.
+ */
+#define PFLCTL_SNAP_FILTER_MAX	256
+#define PFLCTL_SNAP_FRAMESZ	(64 * 1024)	/* max raw payload per frame */
+
+struct pfl_ctlmsg_snapshot {
+	 int32_t		 pcsn_type;	/* PCMT_* of records */
+	 int32_t		 pcsn_flags;
+	uint32_t		 pcsn_nrecs;	/* reply: #records in frame */
+	uint32_t		 pcsn_recsz;	/* reply: size of each record */
+	uint32_t		 pcsn_rawlen;	/* reply: payload size decoded */
+	uint32_t		 pcsn_len;	/* reply: payload size on wire */
+	char			 pcsn_filter[PFLCTL_SNAP_FILTER_MAX];
+	unsigned char		 pcsn_data[0];
 };
 
+#define PFLCTL_SNAPF_ZLIB	(1 << 0)	/* payload is deflated */
+
 /* Control message types. The folowing must match PSC_CTLDEFOPS */
 enum {
 	PCMT_ERROR = 0,
 	PCMT_GETFAULT,
 	PCMT_GETFSRQ,
 	PCMT_GETHASHTABLE,
+	PCMT_GETHEAPPROF,
+	PCMT_GETHISTOGRAM,
 	PCMT_GETJOURNAL,
 	PCMT_GETLISTCACHE,
 	PCMT_GETLNETIF,
+	PCMT_GETLOCKPROF,
 	PCMT_GETMETER,
 	PCMT_GETMLIST,
 	PCMT_GETODTABLE,
 	PCMT_GETOPSTATS,
 	PCMT_GETPARAM,
 	PCMT_GETPOOL,
+	PCMT_GETRPCOP,
 	PCMT_GETRPCRQ,
 	PCMT_GETRPCSVC,
+	PCMT_GETSLAB,
+	PCMT_GETSNAPSHOT,
 	PCMT_GETSUBSYS,
 	PCMT_GETTHREAD,
 	PCMT_GETWORKRQ,
@@ -29,6 +29,7 @@
 #include <curses.h>
 #include <err.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <paths.h>
 #include <pthread.h>
 #include <signal.h>
@@ -39,6 +40,10 @@
 #include <termios.h>
 #include <unistd.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "pfl/cdefs.h"
 #include "pfl/ctl.h"
 #include "pfl/ctlcli.h"
@@ -46,6 +51,7 @@
 #include "pfl/fmtstr.h"
 #include "pfl/getopt.h"
 #include "pfl/list.h"
+#include "pfl/lockprof.h"
 #include "pfl/log.h"
 #include "pfl/meter.h"
 #include "pfl/net.h"
@@ -259,6 +265,21 @@ psc_ctl_packshow_lnetif(char *lni)
 	}
 }
 
+void
+pfl_ctl_packshow_lockprof(char *file)
+{
+	struct pfl_ctlmsg_lockprof *pclp;
+	size_t n;
+
+	pclp = psc_ctlmsg_push(PCMT_GETLOCKPROF, sizeof(*pclp));
+	if (file) {
+		n = strlcpy(pclp->pclp_file, file,
+		    sizeof(pclp->pclp_file));
+		if (n == 0 || n >= sizeof(pclp->pclp_file))
+			errx(1, "invalid lock site file name: %s", file);
+	}
+}
+
 void
 psc_ctl_packshow_thread(char *thr)
 {
@@ -336,6 +357,33 @@ psc_ctl_packshow_pool(char *pool)
 	}
 }
 
+/*
+ * Request RPC opcode latencies: of one service if a name is given, or
+ * of the N slowest opcodes over the last minute if a number is.
+ */
+void
+psc_ctl_packshow_rpcop(char *spec)
+{
+	struct psc_ctlmsg_rpcop *pcro;
+	char *endp;
+	long l;
+	int n;
+
+	pcro = psc_ctlmsg_push(PCMT_GETRPCOP, sizeof(*pcro));
+	if (spec == NULL)
+		return;
+	l = strtol(spec, &endp, 10);
+	if (*spec && *endp == '\0') {
+		if (l <= 0 || l > INT_MAX)
+			errx(1, "invalid number of RPC opcodes: %s", spec);
+		pcro->pcro_topn = l;
+		return;
+	}
+	n = strlcpy(pcro->pcro_svcname, spec, sizeof(pcro->pcro_svcname));
+	if (n == 0 || n >= (int)sizeof(pcro->pcro_svcname))
+		errx(1, "invalid rpcsvc name: %s", spec);
+}
+
 void
 psc_ctl_packshow_rpcrq(__unusedx char *rpcrq)
 {
@@ -368,6 +416,83 @@ pfl_ctl_packshow_fsrq(__unusedx char *rpcrq)
 	psc_ctlmsg_push(PCMT_GETFSRQ, sizeof(*pcfr));
 }
 
+void
+pfl_ctl_packshow_heapprof(__unusedx char *heapprof)
+{
+	struct pfl_ctlmsg_heapprof *pchp;
+
+	psc_ctlmsg_push(PCMT_GETHEAPPROF, sizeof(*pchp));
+}
+
+void
+pfl_ctl_packshow_histogram(char *histogram)
+{
+	struct pfl_ctlmsg_histogram *pchg;
+	size_t n;
+
+	pchg = psc_ctlmsg_push(PCMT_GETHISTOGRAM, sizeof(*pchg));
+	if (histogram) {
+		n = strlcpy(pchg->pchg_name, histogram,
+		    sizeof(pchg->pchg_name));
+		if (n == 0 || n >= sizeof(pchg->pchg_name))
+			errx(1, "invalid histogram name: %s", histogram);
+	}
+}
+
+void
+pfl_ctl_packshow_slab(__unusedx char *slab)
+{
+	struct pfl_ctlmsg_slab *pcsl;
+
+	psc_ctlmsg_push(PCMT_GETSLAB, sizeof(*pcsl));
+}
+
+/*
+ * Request a batched snapshot.  The subspec has the form kind[:filter],
+ * where kind is one of listcaches, opstats or pools and the filter is
+ * evaluated by the daemon, e.g. "pools:free<10&name=buf*".
+ */
+void
+pfl_ctl_packshow_snapshot(char *spec)
+{
+	static const struct {
+		const char	*name;
+		int		 type;
+	} kinds[] = {
+		{ "listcaches",	PCMT_GETLISTCACHE },
+		{ "opstats",	PCMT_GETOPSTATS },
+		{ "pools",	PCMT_GETPOOL }
+	};
+	struct pfl_ctlmsg_snapshot *pcsn;
+	char *filter;
+	size_t n, i;
+
+	if (spec == NULL)
+		errx(1, "snapshot: record kind required");
+	filter = strchr(spec, ':');
+	if (filter)
+		*filter++ = '\0';
+	n = strlen(spec);
+	for (i = 0; i < nitems(kinds); i++)
+		if (n && strncmp(kinds[i].name, spec, n) == 0)
+			break;
+	if (i == nitems(kinds))
+		errx(1, "invalid snapshot kind: %s", spec);
+
+	pcsn = psc_ctlmsg_push(PCMT_GETSNAPSHOT, sizeof(*pcsn));
+	pcsn->pcsn_type = kinds[i].type;
+#ifdef HAVE_ZLIB
+	if (getenv("CTL_SNAPSHOT_ZLIB"))
+		pcsn->pcsn_flags |= PFLCTL_SNAPF_ZLIB;
+#endif
+	if (filter) {
+		n = strlcpy(pcsn->pcsn_filter, filter,
+		    sizeof(pcsn->pcsn_filter));
+		if (n >= sizeof(pcsn->pcsn_filter))
+			errx(1, "snapshot filter too long: %s", filter);
+	}
+}
+
 void
 pfl_ctl_packshow_workrq(__unusedx char *rpcrq)
 {
@@ -748,12 +873,12 @@ psc_ctlmsg_pool_prhdr(__unusedx struct psc_ctlmsghdr *mh,
 {
 	printf("%-12s %4s %8s %8s %8s "
 	    "%7s %6s %6s %5s "
-	    "%10s %3s %3s\n",
+	    "%10s %3s %3s %4s %7s\n",
 	    "mem-pool", "flag", "#free", "#use", "total",
 	    "%use", "min", "max", "thrsh",
-	    "#shrnx", "#em", "#wa");
+	    "#shrnx", "#em", "#wa", "#rgn", "tlbpg");
 	/* XXX add ngets and waiting/sleep time */
-	return(PSC_CTL_DISPLAY_WIDTH+11);
+	return(PSC_CTL_DISPLAY_WIDTH+24);
 }
 
 void
@@ -765,13 +890,14 @@ psc_ctlmsg_pool_prdat(__unusedx const struct psc_ctlmsghdr *mh,
 
 	pfl_fmt_ratio(rbuf, pcpl->pcpl_total - pcpl->pcpl_free,
 	    pcpl->pcpl_total);
-	printf("%-12s  %c%c%c "
+	printf("%-12s %c%c%c%c "
 	    "%8d %8d "
 	    "%8d %7s",
 	    pcpl->pcpl_name,
 	    pcpl->pcpl_flags & PPMF_AUTO	? 'A' : '-',
 	    pcpl->pcpl_flags & PPMF_PIN		? 'P' : '-',
 	    pcpl->pcpl_flags & PPMF_MLIST	? 'M' : '-',
+	    pcpl->pcpl_flags & PPMF_REGION	? 'R' : '-',
 	    pcpl->pcpl_free, pcpl->pcpl_total - pcpl->pcpl_free,
 	    pcpl->pcpl_total, rbuf);
 	if (pcpl->pcpl_flags & PPMF_AUTO) {
@@ -794,6 +920,11 @@ psc_ctlmsg_pool_prdat(__unusedx const struct psc_ctlmsghdr *mh,
 		printf("   -");
 	else
 		printf(" %3d", pcpl->pcpl_nw_want);
+	if (pcpl->pcpl_flags & PPMF_REGION)
+		printf(" %4d ", pcpl->pcpl_nregions);
+	else
+		printf(" %4s ", "-");
+	psc_ctl_prnumber(1, pcpl->pcpl_tlbpages, 7, "");
 	printf("\n");
 }
 
@@ -937,6 +1068,38 @@ psc_ctlmsg_lnetif_prdat(__unusedx const struct psc_ctlmsghdr *mh,
 	    pclni->pclni_peertxcredits, pclni->pclni_refcount);
 }
 
+int
+pfl_ctlmsg_lockprof_prhdr(__unusedx struct psc_ctlmsghdr *mh,
+    __unusedx const void *m)
+{
+	printf("%-26s %-6s %8s %8s %9s %8s %8s %8s\n",
+	    "lock site", "type", "acquired", "contend", "wait-us",
+	    "maxw-us", "avgh-us", "maxh-us");
+	return (PSC_CTL_DISPLAY_WIDTH + 9);
+}
+
+void
+pfl_ctlmsg_lockprof_prdat(__unusedx const struct psc_ctlmsghdr *mh,
+    const void *m)
+{
+	const struct pfl_ctlmsg_lockprof *pclp = m;
+	char site[80];
+
+	snprintf(site, sizeof(site), "%s:%d", pclp->pclp_file,
+	    pclp->pclp_line);
+	printf("%-26s %-6s ", site,
+	    pclp->pclp_type >= 0 && pclp->pclp_type < PFL_LOCKPROF_NTYPES ?
+	    pfl_lockprof_typenames[pclp->pclp_type] : "?");
+	psc_ctl_prnumber(1, pclp->pclp_nacq, 8, " ");
+	psc_ctl_prnumber(1, pclp->pclp_ncontended, 8, " ");
+	psc_ctl_prnumber(1, pclp->pclp_wait / 1000, 9, " ");
+	psc_ctl_prnumber(1, pclp->pclp_waitmax / 1000, 8, " ");
+	psc_ctl_prnumber(1, pclp->pclp_nacq ?
+	    pclp->pclp_hold / pclp->pclp_nacq / 1000 : 0, 8, " ");
+	psc_ctl_prnumber(1, pclp->pclp_holdmax / 1000, 8, "");
+	printf("\n");
+}
+
 int
 psc_ctlmsg_mlist_prhdr(__unusedx struct psc_ctlmsghdr *mh,
     __unusedx const void *m)
@@ -1131,6 +1294,34 @@ psc_ctlmsg_rpcrq_prdat(__unusedx const struct psc_ctlmsghdr *mh,
 	(void)printf("\n");
 }
 
+int
+psc_ctlmsg_rpcop_prhdr(__unusedx struct psc_ctlmsghdr *mh,
+    __unusedx const void *m)
+{
+	printf("%-10s %4s %6s %7s %8s %7s %7s %7s %7s %7s\n",
+	    "rpcsvc", "opc", "#1m", "lat-1m", "#total",
+	    "queue", "handle", "hdl-p99", "reply", "bulk");
+	return(PSC_CTL_DISPLAY_WIDTH);
+}
+
+void
+psc_ctlmsg_rpcop_prdat(__unusedx const struct psc_ctlmsghdr *mh,
+    const void *m)
+{
+	const struct psc_ctlmsg_rpcop *pcro = m;
+
+	printf("%-10s %4u ", pcro->pcro_svcname, pcro->pcro_opc);
+	psc_ctl_prnumber(1, pcro->pcro_wincount, 6, " ");
+	psc_ctl_prnumber(1, pcro->pcro_winmean, 7, " ");
+	psc_ctl_prnumber(1, pcro->pcro_count[PSCRPC_OPPH_HANDLE], 8, " ");
+	psc_ctl_prnumber(1, pcro->pcro_mean[PSCRPC_OPPH_QUEUE], 7, " ");
+	psc_ctl_prnumber(1, pcro->pcro_mean[PSCRPC_OPPH_HANDLE], 7, " ");
+	psc_ctl_prnumber(1, pcro->pcro_p99[PSCRPC_OPPH_HANDLE], 7, " ");
+	psc_ctl_prnumber(1, pcro->pcro_mean[PSCRPC_OPPH_REPLY], 7, " ");
+	psc_ctl_prnumber(1, pcro->pcro_mean[PSCRPC_OPPH_BULK], 7, "");
+	printf("\n");
+}
+
 int
 psc_ctlmsg_rpcsvc_prhdr(__unusedx struct psc_ctlmsghdr *mh,
     __unusedx const void *m)
@@ -1167,6 +1358,146 @@ psc_ctlmsg_rpcsvc_prdat(__unusedx const struct psc_ctlmsghdr *mh,
 	    pcrs->pcrs_nwq, pcrs->pcrs_nrep, pcrs->pcrs_nrqbd);
 }
 
+/*
+ * Print heap profile records as a pprof legacy heap profile, suitable
+ * for e.g. `pprof --text daemon profile.txt'.
+ */
+void
+pfl_ctlmsg_heapprof_prdat(__unusedx const struct psc_ctlmsghdr *mh,
+    const void *m)
+{
+	const struct pfl_ctlmsg_heapprof *pchp = m;
+	int i;
+
+	switch (pchp->pchp_type) {
+	case PFLCTL_HPT_TOTAL:
+		printf("heap profile: ");
+		break;
+	case PFLCTL_HPT_LINE:
+		printf("%.*s\n", (int)sizeof(pchp->pchp_line),
+		    pchp->pchp_line);
+		return;
+	}
+	printf("%6"PRIu64": %8"PRIu64" [%6"PRIu64": %8"PRIu64"] @",
+	    pchp->pchp_inuse_objs, pchp->pchp_inuse_bytes,
+	    pchp->pchp_alloc_objs, pchp->pchp_alloc_bytes);
+	if (pchp->pchp_type == PFLCTL_HPT_TOTAL)
+		printf(" heap_v2/%"PRIu64, pchp->pchp_rate);
+	else
+		for (i = 0; i < pchp->pchp_depth &&
+		    i < PFLCTL_HEAPPROF_MAXDEPTH; i++)
+			printf(" 0x%"PRIx64, pchp->pchp_pcs[i]);
+	printf("\n");
+}
+
+int
+pfl_ctlmsg_histogram_prhdr(__unusedx struct psc_ctlmsghdr *mh,
+    __unusedx const void *m)
+{
+	printf("%-34s %8s %7s %7s %7s %7s %7s %7s\n",
+	    "histogram", "count", "mean", "p50", "p90", "p99", "p99.9",
+	    "max");
+	return (PSC_CTL_DISPLAY_WIDTH + 7);
+}
+
+void
+pfl_ctlmsg_histogram_prdat(__unusedx const struct psc_ctlmsghdr *mh,
+    const void *m)
+{
+	const struct pfl_ctlmsg_histogram *pchg = m;
+	int base10 = 0;
+
+	if (pchg->pchg_flags & OPSTF_BASE10 || psc_ctl_inhuman)
+		base10 = 1;
+
+	printf("%-34s ", pchg->pchg_name);
+	psc_ctl_prnumber(1, pchg->pchg_count, 8, " ");
+	psc_ctl_prnumber(base10, pchg->pchg_count ?
+	    pchg->pchg_sum / pchg->pchg_count : 0, 7, " ");
+	psc_ctl_prnumber(base10, pchg->pchg_p50, 7, " ");
+	psc_ctl_prnumber(base10, pchg->pchg_p90, 7, " ");
+	psc_ctl_prnumber(base10, pchg->pchg_p99, 7, " ");
+	psc_ctl_prnumber(base10, pchg->pchg_p999, 7, " ");
+	psc_ctl_prnumber(base10, pchg->pchg_max, 7, "");
+	printf("\n");
+}
+
+int
+pfl_ctlmsg_slab_prhdr(__unusedx struct psc_ctlmsghdr *mh,
+    __unusedx const void *m)
+{
+	printf("%-5s %6s %6s %8s %10s %8s %8s %8s\n",
+	    "class", "size", "perrun", "runs", "out",
+	    "refills", "flushes", "released");
+	return(PSC_CTL_DISPLAY_WIDTH);
+}
+
+void
+pfl_ctlmsg_slab_prdat(__unusedx const struct psc_ctlmsghdr *mh,
+    const void *m)
+{
+	const struct pfl_ctlmsg_slab *pcsl = m;
+
+	printf("%5d %6"PRIu64" %6d %8"PRIu64" %10"PRIu64" ",
+	    pcsl->pcsl_class, pcsl->pcsl_size, pcsl->pcsl_nperrun,
+	    pcsl->pcsl_nruns, pcsl->pcsl_nout);
+	psc_ctl_prnumber(1, pcsl->pcsl_nrefills, 8, " ");
+	psc_ctl_prnumber(1, pcsl->pcsl_nflushes, 8, " ");
+	psc_ctl_prnumber(1, pcsl->pcsl_nreleased, 8, "\n");
+}
+
+__static void psc_ctlmsg_print(struct psc_ctlmsghdr *, const void *);
+
+/*
+ * Decode a snapshot frame and print each record it carries as if it
+ * had arrived in a message of its own.
+ */
+int
+pfl_ctlmsg_snapshot_check(struct psc_ctlmsghdr *mh, const void *m)
+{
+	static unsigned char *buf;
+	static size_t bufsz;
+
+	const struct pfl_ctlmsg_snapshot *pcsn = m;
+	const unsigned char *p;
+	struct psc_ctlmsghdr rmh;
+	uint32_t n;
+
+	if (mh->mh_size < sizeof(*pcsn) ||
+	    mh->mh_size != sizeof(*pcsn) + pcsn->pcsn_len)
+		return (sizeof(*pcsn));
+	if (pcsn->pcsn_type == PCMT_GETSNAPSHOT ||
+	    pcsn->pcsn_recsz == 0 || pcsn->pcsn_rawlen !=
+	    (uint64_t)pcsn->pcsn_nrecs * pcsn->pcsn_recsz)
+		psc_fatalx("invalid snapshot frame");
+
+	p = pcsn->pcsn_data;
+	if (pcsn->pcsn_flags & PFLCTL_SNAPF_ZLIB) {
+#ifdef HAVE_ZLIB
+		uLongf len = pcsn->pcsn_rawlen;
+
+		if (bufsz < len) {
+			buf = psc_realloc(buf, len, 0);
+			bufsz = len;
+		}
+		if (uncompress(buf, &len, pcsn->pcsn_data,
+		    pcsn->pcsn_len) != Z_OK || len != pcsn->pcsn_rawlen)
+			psc_fatalx("corrupt snapshot frame");
+		p = buf;
+#else
+		psc_fatalx("compressed snapshot frames not supported");
+#endif
+	} else if (pcsn->pcsn_len != pcsn->pcsn_rawlen)
+		psc_fatalx("invalid snapshot frame");
+
+	rmh.mh_type = pcsn->pcsn_type;
+	rmh.mh_id = mh->mh_id;
+	rmh.mh_size = pcsn->pcsn_recsz;
+	for (n = 0; n < pcsn->pcsn_nrecs; n++, p += pcsn->pcsn_recsz)
+		psc_ctlmsg_print(&rmh, p);
+	return (-1);
+}
+
 int
 pfl_ctlmsg_fsrq_prhdr(__unusedx struct psc_ctlmsghdr *mh,
     __unusedx const void *m)
@@ -1198,7 +1529,9 @@ int
 pfl_ctlmsg_workrq_prhdr(__unusedx struct psc_ctlmsghdr *mh,
     __unusedx const void *m)
 {
-	(void)printf("%-16s %-30s\n", "workrq-address", "type");
+	(void)printf("%-16s %-16s %-16s %4s %5s %8s %8s\n",
+	    "workrq-address", "type", "thread", "pri", "depth", "steals",
+	    "stolen");
 	return(PSC_CTL_DISPLAY_WIDTH);
 }
 
@@ -1206,10 +1539,21 @@ void
 pfl_ctlmsg_workrq_prdat(__unusedx const struct psc_ctlmsghdr *mh,
     const void *m)
 {
+	static const char *pri[] = { "urg", "norm", "bg" };
 	const struct pfl_ctlmsg_workrq *pcw = m;
 
-	(void)printf("%016"PRIx64" %-30s\n", pcw->pcw_addr,
-	    pcw->pcw_type);
+	if (pcw->pcw_flags & PFLCTL_WKRQF_WORKER) {
+		(void)printf("%016"PRIx64" %-16s %-16s %4s %5d ",
+		    pcw->pcw_addr, "<worker>", pcw->pcw_thrname, "-",
+		    pcw->pcw_nqueued);
+		psc_ctl_prnumber(1, pcw->pcw_nsteals, 8, " ");
+		psc_ctl_prnumber(1, pcw->pcw_nstolen, 8, "\n");
+		return;
+	}
+	(void)printf("%016"PRIx64" %-16s %-16s %4s\n", pcw->pcw_addr,
+	    pcw->pcw_type, pcw->pcw_thrname,
+	    pcw->pcw_pri >= 0 && pcw->pcw_pri < nitems(pri) ?
+	    pri[pcw->pcw_pri] : "?");
 }
 
 __static void
@@ -40,17 +40,23 @@ struct psc_ctlmsghdr;
 	{ psc_ctlmsg_fault_prhdr,	psc_ctlmsg_fault_prdat,		sizeof(struct psc_ctlmsg_fault),	NULL },				\
 	{ pfl_ctlmsg_fsrq_prhdr,	pfl_ctlmsg_fsrq_prdat,		sizeof(struct pfl_ctlmsg_fsrq),		NULL },				\
 	{ psc_ctlmsg_hashtable_prhdr,	psc_ctlmsg_hashtable_prdat,	sizeof(struct psc_ctlmsg_hashtable),	NULL },				\
+	{ NULL /* GETHEAPPROF */,	pfl_ctlmsg_heapprof_prdat,	sizeof(struct pfl_ctlmsg_heapprof),	NULL },				\
+	{ pfl_ctlmsg_histogram_prhdr,	pfl_ctlmsg_histogram_prdat,	sizeof(struct pfl_ctlmsg_histogram),	NULL },				\
 	{ psc_ctlmsg_journal_prhdr,	psc_ctlmsg_journal_prdat,	sizeof(struct psc_ctlmsg_journal),	NULL },				\
 	{ psc_ctlmsg_listcache_prhdr,	psc_ctlmsg_listcache_prdat,	sizeof(struct psc_ctlmsg_listcache),	NULL },				\
 	{ psc_ctlmsg_lnetif_prhdr,	psc_ctlmsg_lnetif_prdat,	sizeof(struct psc_ctlmsg_lnetif),	NULL },				\
+	{ pfl_ctlmsg_lockprof_prhdr,	pfl_ctlmsg_lockprof_prdat,	sizeof(struct pfl_ctlmsg_lockprof),	NULL },				\
 	{ psc_ctlmsg_meter_prhdr,	psc_ctlmsg_meter_prdat,		sizeof(struct psc_ctlmsg_meter),	NULL },				\
 	{ psc_ctlmsg_mlist_prhdr,	psc_ctlmsg_mlist_prdat,		sizeof(struct psc_ctlmsg_mlist),	NULL },				\
 	{ psc_ctlmsg_odtable_prhdr,	psc_ctlmsg_odtable_prdat,	sizeof(struct psc_ctlmsg_odtable),	NULL },				\
 	{ psc_ctlmsg_opstat_prhdr,	psc_ctlmsg_opstat_prdat,	sizeof(struct psc_ctlmsg_opstat),	NULL },				\
 	{ psc_ctlmsg_param_prhdr,	psc_ctlmsg_param_prdat,		sizeof(struct psc_ctlmsg_param),	NULL },				\
 	{ psc_ctlmsg_pool_prhdr,	psc_ctlmsg_pool_prdat,		sizeof(struct psc_ctlmsg_pool),		NULL },				\
+	{ psc_ctlmsg_rpcop_prhdr,	psc_ctlmsg_rpcop_prdat,		sizeof(struct psc_ctlmsg_rpcop),	NULL },				\
 	{ psc_ctlmsg_rpcrq_prhdr,	psc_ctlmsg_rpcrq_prdat,		sizeof(struct psc_ctlmsg_rpcrq),	NULL },				\
 	{ psc_ctlmsg_rpcsvc_prhdr,	psc_ctlmsg_rpcsvc_prdat,	sizeof(struct psc_ctlmsg_rpcsvc),	NULL },				\
+	{ pfl_ctlmsg_slab_prhdr,	pfl_ctlmsg_slab_prdat,		sizeof(struct pfl_ctlmsg_slab),		NULL },				\
+	{ NULL /* GETSNAPSHOT */,	NULL,				0,					pfl_ctlmsg_snapshot_check },	\
 	{ NULL /* GETSUBSYS */,		NULL,				0,					psc_ctlmsg_subsys_check },	\
 	{ psc_ctlmsg_thread_prhdr,	psc_ctlmsg_thread_prdat,	0,					psc_ctlmsg_thread_check },	\
 	{ pfl_ctlmsg_workrq_prhdr,	pfl_ctlmsg_workrq_prdat,	sizeof(struct pfl_ctlmsg_workrq),	NULL },				\
@@ -60,16 +66,22 @@ struct psc_ctlmsghdr;
 	{ "faults",		psc_ctl_packshow_fault },		\
 	{ "fsrq",		pfl_ctl_packshow_fsrq },		\
 	{ "hashtables",		psc_ctl_packshow_hashtable },		\
+	{ "heapprof",		pfl_ctl_packshow_heapprof },		\
+	{ "histograms",		pfl_ctl_packshow_histogram },		\
 	{ "journals",		psc_ctl_packshow_journal },		\
 	{ "listcaches",		psc_ctl_packshow_listcache },		\
 	{ "lnetif",		psc_ctl_packshow_lnetif },		\
+	{ "lockprof",		pfl_ctl_packshow_lockprof },		\
 	{ "meters",		psc_ctl_packshow_meter },		\
 	{ "mlists",		psc_ctl_packshow_mlist },		\
 	{ "odtables",		psc_ctl_packshow_odtable },		\
 	{ "opstats",		psc_ctl_packshow_opstat },		\
 	{ "pools",		psc_ctl_packshow_pool },		\
+	{ "rpcops",		psc_ctl_packshow_rpcop },		\
 	{ "rpcrqs",		psc_ctl_packshow_rpcrq },		\
 	{ "rpcsvcs",		psc_ctl_packshow_rpcsvc },		\
+	{ "slabs",		pfl_ctl_packshow_slab },		\
+	{ "snapshot",		pfl_ctl_packshow_snapshot },		\
 	{ "threads",		psc_ctl_packshow_thread },		\
 	{ "workrq",		pfl_ctl_packshow_workrq }
 
@@ -109,16 +121,22 @@ void  psc_ctlparse_show(char *);
 void  psc_ctl_packshow_fault(char *);
 void  pfl_ctl_packshow_fsrq(char *);
 void  psc_ctl_packshow_hashtable(char *);
+void  pfl_ctl_packshow_heapprof(char *);
+void  pfl_ctl_packshow_histogram(char *);
 void  psc_ctl_packshow_journal(char *);
 void  psc_ctl_packshow_listcache(char *);
 void  psc_ctl_packshow_lnetif(char *);
+void  pfl_ctl_packshow_lockprof(char *);
 void  psc_ctl_packshow_meter(char *);
 void  psc_ctl_packshow_mlist(char *);
 void  psc_ctl_packshow_odtable(char *);
 void  psc_ctl_packshow_opstat(char *);
 void  psc_ctl_packshow_pool(char *);
+void  psc_ctl_packshow_rpcop(char *);
 void  psc_ctl_packshow_rpcrq(char *);
 void  psc_ctl_packshow_rpcsvc(char *);
+void  pfl_ctl_packshow_slab(char *);
+void  pfl_ctl_packshow_snapshot(char *);
 void  psc_ctl_packshow_thread(char *);
 void  pfl_ctl_packshow_workrq(char *);
 
@@ -132,12 +150,17 @@ void  pfl_ctlmsg_fsrq_prdat(const struct psc_ctlmsghdr *, const void *);
 int   pfl_ctlmsg_fsrq_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_hashtable_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_hashtable_prhdr(struct psc_ctlmsghdr *, const void *);
+void  pfl_ctlmsg_heapprof_prdat(const struct psc_ctlmsghdr *, const void *);
+void  pfl_ctlmsg_histogram_prdat(const struct psc_ctlmsghdr *, const void *);
+int   pfl_ctlmsg_histogram_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_opstat_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_opstat_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_journal_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_journal_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_lnetif_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_lnetif_prhdr(struct psc_ctlmsghdr *, const void *);
+void  pfl_ctlmsg_lockprof_prdat(const struct psc_ctlmsghdr *, const void *);
+int   pfl_ctlmsg_lockprof_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_listcache_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_listcache_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_meter_prdat(const struct psc_ctlmsghdr *, const void *);
@@ -150,10 +173,15 @@ void  psc_ctlmsg_param_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_param_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_pool_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_pool_prhdr(struct psc_ctlmsghdr *, const void *);
+void  psc_ctlmsg_rpcop_prdat(const struct psc_ctlmsghdr *, const void *);
+int   psc_ctlmsg_rpcop_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_rpcrq_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_rpcrq_prhdr(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_rpcsvc_prdat(const struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_rpcsvc_prhdr(struct psc_ctlmsghdr *, const void *);
+void  pfl_ctlmsg_slab_prdat(const struct psc_ctlmsghdr *, const void *);
+int   pfl_ctlmsg_slab_prhdr(struct psc_ctlmsghdr *, const void *);
+int   pfl_ctlmsg_snapshot_check(struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_subsys_check(struct psc_ctlmsghdr *, const void *);
 int   psc_ctlmsg_thread_check(struct psc_ctlmsghdr *, const void *);
 void  psc_ctlmsg_thread_prdat(const struct psc_ctlmsghdr *, const void *);
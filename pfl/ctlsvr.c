@@ -26,22 +26,34 @@
  * daemon instance.
  */
 
+#include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/uio.h>
 #include <sys/resource.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "pfl/atomic.h"
 #include "pfl/cdefs.h"
 #include "pfl/ctl.h"
@@ -50,11 +62,13 @@
 #include "pfl/fault.h"
 #include "pfl/fmtstr.h"
 #include "pfl/hashtbl.h"
+#include "pfl/heapprof.h"
 #include "pfl/opstats.h"
 #include "pfl/journal.h"
 #include "pfl/list.h"
 #include "pfl/listcache.h"
 #include "pfl/lock.h"
+#include "pfl/lockprof.h"
 #include "pfl/log.h"
 #include "pfl/mlist.h"
 #include "pfl/net.h"
@@ -63,15 +77,24 @@
 #include "pfl/random.h"
 #include "pfl/rlimit.h"
 #include "pfl/rpc_intrfc.h"
+#include "pfl/slab.h"
 #include "pfl/str.h"
 #include "pfl/stree.h"
+#include "pfl/subsys.h"
 #include "pfl/thread.h"
+#include "pfl/trace.h"
 #include "pfl/umask.h"
 #include "pfl/waitq.h"
 #include "pfl/workthr.h"
 
 #define QLEN 15	/* listen(2) queue */
 
+__static struct pfl_ctl_conn *
+	pfl_ctlconn_lookup(int);
+__static int
+	pfl_ctlconn_queue(struct pfl_ctl_conn *,
+	    const struct psc_ctlmsghdr *, const void *);
+
 /*
  * Send a control message back to client.
  * @fd: client socket descriptor.
@@ -82,6 +105,7 @@ int
 psc_ctlmsg_sendv(int fd, const struct psc_ctlmsghdr *mh, const void *m,
     struct pfl_mutex *lock)
 {
+	struct pfl_ctl_conn *pcc;
 	struct pfl_ctl_data *pcd;
 	struct psc_thread *thr;
 	struct psc_ctlthr *pct;
@@ -90,6 +114,10 @@ psc_ctlmsg_sendv(int fd, const struct psc_ctlmsghdr *mh, const void *m,
 	size_t tsiz;
 	ssize_t n;
 
+	pcc = pfl_ctlconn_lookup(fd);
+	if (pcc)
+		return (pfl_ctlconn_queue(pcc, mh, m));
+
 	if (lock == NULL) {
 		thr = pscthr_get();
 		pct = psc_ctlthr(thr);
@@ -276,6 +304,109 @@ psc_ctlrep_getthread(int fd, struct psc_ctlmsghdr *mh, void *m)
 	    psc_ctlmsg_thread_send));
 }
 
+/*
+ * Respond to a "GETHISTOGRAM" inquiry with the percentiles of each
+ * matching histogram.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to examine and reuse.
+ */
+int
+pfl_ctlrep_gethistogram(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct pfl_ctlmsg_histogram *pchg = m, *p;
+	struct psc_dynarray all = DYNARRAY_INIT;
+	struct pfl_histogram_snap phs;
+	struct pfl_histogram *phg;
+	char name[OPST_NAME_MAX];
+	int rc = 1, i;
+
+	strlcpy(name, pchg->pchg_name, sizeof(name));
+
+	/*
+	 * Snapshot without dropping the lock: pfl_histogram_destroy()
+	 * frees a histogram as soon as it is unlinked.
+	 */
+	spinlock(&pfl_opstats_lock);
+	DYNARRAY_FOREACH(phg, i, &pfl_histograms) {
+		if (name[0] && fnmatch(name, phg->phg_name, 0))
+			continue;
+
+		_pfl_histogram_snapshot(phg, &phs);
+		p = PSCALLOC(sizeof(*p));
+		strlcpy(p->pchg_name, phg->phg_name,
+		    sizeof(p->pchg_name));
+		p->pchg_flags = phg->phg_flags;
+		p->pchg_precision = phg->phg_precision;
+		p->pchg_count = phs.phs_count;
+		p->pchg_sum = phs.phs_sum;
+		p->pchg_p50 = pfl_histogram_snap_percentile(&phs, 50);
+		p->pchg_p90 = pfl_histogram_snap_percentile(&phs, 90);
+		p->pchg_p99 = pfl_histogram_snap_percentile(&phs, 99);
+		p->pchg_p999 = pfl_histogram_snap_percentile(&phs, 99.9);
+		p->pchg_max = pfl_histogram_snap_percentile(&phs, 100);
+		pfl_histogram_snap_free(&phs);
+		psc_dynarray_add(&all, p);
+	}
+	freelock(&pfl_opstats_lock);
+
+	DYNARRAY_FOREACH(p, i, &all) {
+		if (rc) {
+			*pchg = *p;
+			rc = psc_ctlmsg_sendv(fd, mh, pchg, NULL);
+		}
+		PSCFREE(p);
+	}
+	if (rc && psc_dynarray_len(&all) == 0 && name[0])
+		rc = psc_ctlsenderr(fd, mh, NULL,
+		    "unknown histogram: %s", name);
+	psc_dynarray_free(&all);
+	return (rc);
+}
+
+/*
+ * Respond to a "GETLOCKPROF" inquiry with the contention profile of
+ * each lock acquisition site, most time spent waiting first.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to examine and reuse.
+ */
+int
+pfl_ctlrep_getlockprof(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct pfl_ctlmsg_lockprof *pclp = m;
+	struct pfl_lockprof_stat *st, *p;
+	char file[sizeof(pclp->pclp_file)];
+	const char *base;
+	int rc = 1, i, n;
+
+	strlcpy(file, pclp->pclp_file, sizeof(file));
+
+	n = pfl_lockprof_snapshot(&st);
+	for (i = 0, p = st; i < n; i++, p++) {
+		base = pfl_basename(p->pls_file);
+		if (file[0] && fnmatch(file, base, 0))
+			continue;
+
+		memset(pclp, 0, sizeof(*pclp));
+		strlcpy(pclp->pclp_file, base, sizeof(pclp->pclp_file));
+		pclp->pclp_line = p->pls_line;
+		pclp->pclp_type = p->pls_type;
+		pclp->pclp_nacq = p->pls_nacq;
+		pclp->pclp_ncontended = p->pls_ncontended;
+		pclp->pclp_wait = p->pls_wait;
+		pclp->pclp_waitmax = p->pls_waitmax;
+		pclp->pclp_hold = p->pls_hold;
+		pclp->pclp_holdmax = p->pls_holdmax;
+
+		rc = psc_ctlmsg_sendv(fd, mh, pclp, NULL);
+		if (!rc)
+			break;
+	}
+	PSCFREE(st);
+	return (rc);
+}
+
 /*
  * Respond to a "GETHASHTABLE" inquiry.  This computes bucket usage
  * statistics of a hash table and sends the results back to the client.
@@ -326,6 +457,120 @@ psc_ctlrep_gethashtable(int fd, struct psc_ctlmsghdr *mh, void *m)
 	return (rc);
 }
 
+struct pfl_ctl_heapprof_arg {
+	int				 fd;
+	struct psc_ctlmsghdr		*mh;
+	struct pfl_ctlmsg_heapprof	*pchp;
+};
+
+int
+pfl_ctl_heapprof_sendsite(const struct pfl_heapprof_site *phs,
+    void *arg)
+{
+	struct pfl_ctl_heapprof_arg *a = arg;
+	struct pfl_ctlmsg_heapprof *pchp = a->pchp;
+	int i;
+
+	memset(pchp, 0, sizeof(*pchp));
+	pchp->pchp_type = PFLCTL_HPT_SITE;
+	pchp->pchp_rate = pfl_heapprof_rate;
+	pchp->pchp_inuse_objs = phs->phs_inuse_objs;
+	pchp->pchp_inuse_bytes = phs->phs_inuse_bytes;
+	pchp->pchp_alloc_objs = phs->phs_alloc_objs;
+	pchp->pchp_alloc_bytes = phs->phs_alloc_bytes;
+	pchp->pchp_depth = MIN(phs->phs_depth, PFLCTL_HEAPPROF_MAXDEPTH);
+	for (i = 0; i < pchp->pchp_depth; i++)
+		pchp->pchp_pcs[i] = (uintptr_t)phs->phs_pcs[i];
+	return (psc_ctlmsg_sendv(a->fd, a->mh, pchp, NULL));
+}
+
+int
+pfl_ctl_heapprof_sendline(struct pfl_ctl_heapprof_arg *a,
+    const char *line)
+{
+	struct pfl_ctlmsg_heapprof *pchp = a->pchp;
+
+	memset(pchp, 0, sizeof(*pchp));
+	pchp->pchp_type = PFLCTL_HPT_LINE;
+	strlcpy(pchp->pchp_line, line, sizeof(pchp->pchp_line));
+	return (psc_ctlmsg_sendv(a->fd, a->mh, pchp, NULL));
+}
+
+/*
+ * Respond to a "GETHEAPPROF" inquiry with the sampled heap profile in
+ * the order of a pprof legacy heap profile: a header line of totals,
+ * one record per allocation site, then the process memory map.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to be filled in and sent out.
+ */
+int
+pfl_ctlrep_getheapprof(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct pfl_ctl_heapprof_arg a;
+	struct pfl_ctlmsg_heapprof *pchp = m;
+	struct pfl_heapprof_site tot;
+	char *p, buf[BUFSIZ];
+	FILE *fp;
+	int rc;
+
+	pfl_heapprof_gettotal(&tot);
+	if (pfl_heapprof_rate == 0 && tot.phs_alloc_objs == 0)
+		return (psc_ctlsenderr(fd, mh, NULL,
+		    "heap profiler not enabled"));
+
+	memset(pchp, 0, sizeof(*pchp));
+	pchp->pchp_type = PFLCTL_HPT_TOTAL;
+	pchp->pchp_rate = pfl_heapprof_rate;
+	pchp->pchp_inuse_objs = tot.phs_inuse_objs;
+	pchp->pchp_inuse_bytes = tot.phs_inuse_bytes;
+	pchp->pchp_alloc_objs = tot.phs_alloc_objs;
+	pchp->pchp_alloc_bytes = tot.phs_alloc_bytes;
+	rc = psc_ctlmsg_sendv(fd, mh, pchp, NULL);
+	if (!rc)
+		return (rc);
+
+	a.fd = fd;
+	a.mh = mh;
+	a.pchp = pchp;
+	if (!pfl_heapprof_walk(pfl_ctl_heapprof_sendsite, &a))
+		return (0);
+
+	rc = pfl_ctl_heapprof_sendline(&a, "");
+	if (rc)
+		rc = pfl_ctl_heapprof_sendline(&a, "MAPPED_LIBRARIES:");
+	fp = fopen("/proc/self/maps", "r");
+	if (fp == NULL)
+		return (rc);
+	while (rc && fgets(buf, sizeof(buf), fp)) {
+		p = strchr(buf, '\n');
+		if (p)
+			*p = '\0';
+		rc = pfl_ctl_heapprof_sendline(&a, buf);
+	}
+	fclose(fp);
+	return (rc);
+}
+
+/*
+ * Fill in a list cache control message record.
+ * @lc: list cache to report.
+ * @pclc: control message record to fill in.
+ */
+__static void
+psc_ctl_fill_listcache(struct psc_listcache *lc,
+    struct psc_ctlmsg_listcache *pclc)
+{
+	LIST_CACHE_LOCK(lc);
+	strlcpy(pclc->pclc_name, lc->plc_name, sizeof(pclc->pclc_name));
+	pclc->pclc_size = lc->plc_nitems;
+	pclc->pclc_nseen = pfl_opstat_read(lc->plc_nseen);
+	pclc->pclc_flags = lc->plc_flags;
+	pclc->pclc_nw_want = pfl_waitq_nwaiters(&lc->plc_wq_want);
+	pclc->pclc_nw_empty = pfl_waitq_nwaiters(&lc->plc_wq_empty);
+	LIST_CACHE_ULOCK(lc);
+}
+
 /*
  * Respond to a "GETLISTCACHE" inquiry.
  * @fd: client socket descriptor.
@@ -350,18 +595,7 @@ psc_ctlrep_getlistcache(int fd, struct psc_ctlmsghdr *mh, void *m)
 		    name, strlen(name)) == 0) {
 			found = 1;
 
-			LIST_CACHE_LOCK(lc);
-			strlcpy(pclc->pclc_name, lc->plc_name,
-			    sizeof(pclc->pclc_name));
-			pclc->pclc_size = lc->plc_nitems;
-			pclc->pclc_nseen = psc_atomic64_read(
-			    &lc->plc_nseen->opst_lifetime);
-			pclc->pclc_flags = lc->plc_flags;
-			pclc->pclc_nw_want = pfl_waitq_nwaiters(
-			    &lc->plc_wq_want);
-			pclc->pclc_nw_empty = pfl_waitq_nwaiters(
-			    &lc->plc_wq_empty);
-			LIST_CACHE_ULOCK(lc);
+			psc_ctl_fill_listcache(lc, pclc);
 			rc = psc_ctlmsg_sendv(fd, mh, pclc, NULL);
 			if (!rc)
 				break;
@@ -378,6 +612,42 @@ psc_ctlrep_getlistcache(int fd, struct psc_ctlmsghdr *mh, void *m)
 	return (rc);
 }
 
+/*
+ * Fill in a pool control message record.
+ * @m: pool to report.
+ * @pcpl: control message record to fill in.
+ */
+__static void
+psc_ctl_fill_pool(struct psc_poolmgr *m, struct psc_ctlmsg_pool *pcpl)
+{
+	POOL_LOCK(m);
+	strlcpy(pcpl->pcpl_name, m->ppm_name, sizeof(pcpl->pcpl_name));
+	pcpl->pcpl_min = m->ppm_min;
+	pcpl->pcpl_max = m->ppm_max;
+	pcpl->pcpl_total = m->ppm_total;
+	pcpl->pcpl_flags = m->ppm_flags;
+	pcpl->pcpl_thres = m->ppm_thres;
+	pcpl->pcpl_nseen = pfl_opstat_read(m->ppm_nseen);
+	pcpl->pcpl_ngrow = pfl_opstat_read(m->ppm_opst_grows);
+	pcpl->pcpl_nshrink = pfl_opstat_read(m->ppm_opst_shrinks);
+	pcpl->pcpl_nregions = m->ppm_nregions;
+	pcpl->pcpl_regionsz = m->ppm_regionsz;
+	pcpl->pcpl_tlbpages = pfl_pool_tlbpages(m);
+	if (POOL_IS_MLIST(m)) {
+		pcpl->pcpl_free = pfl_mlist_size(&m->ppm_ml);
+		pcpl->pcpl_nw_want = 0;
+		pcpl->pcpl_nw_empty = pfl_multiwaitcond_nwaiters(
+		    &m->ppm_ml.pml_mwcond_empty);
+	} else {
+		pcpl->pcpl_free = lc_nitems(&m->ppm_lc);
+		pcpl->pcpl_nw_want = pfl_waitq_nwaiters(
+		    &m->ppm_lc.plc_wq_want);
+		pcpl->pcpl_nw_empty = pfl_waitq_nwaiters(
+		    &m->ppm_lc.plc_wq_empty);
+	}
+	POOL_ULOCK(m);
+}
+
 /*
  * Send a response to a "GETPOOL" inquiry.
  * @fd: client socket descriptor.
@@ -402,35 +672,7 @@ psc_ctlrep_getpool(int fd, struct psc_ctlmsghdr *mh, void *msg)
 		    strlen(name)) == 0) {
 			found = 1;
 
-			POOL_LOCK(m);
-			strlcpy(pcpl->pcpl_name, m->ppm_name,
-			    sizeof(pcpl->pcpl_name));
-			pcpl->pcpl_min = m->ppm_min;
-			pcpl->pcpl_max = m->ppm_max;
-			pcpl->pcpl_total = m->ppm_total;
-			pcpl->pcpl_flags = m->ppm_flags;
-			pcpl->pcpl_thres = m->ppm_thres;
-			pcpl->pcpl_nseen = psc_atomic64_read(
-			    &m->ppm_nseen->opst_lifetime);
-			pcpl->pcpl_ngrow = psc_atomic64_read(
-			    &m->ppm_opst_grows->opst_lifetime);
-			pcpl->pcpl_nshrink = psc_atomic64_read(
-			    &m->ppm_opst_shrinks->opst_lifetime);
-			if (POOL_IS_MLIST(m)) {
-				pcpl->pcpl_free = pfl_mlist_size(
-				    &m->ppm_ml);
-				pcpl->pcpl_nw_empty =
-				    pfl_multiwaitcond_nwaiters(
-					&m->ppm_ml.pml_mwcond_empty);
-			} else {
-				pcpl->pcpl_free = lc_nitems(&m->ppm_lc);
-				pcpl->pcpl_nw_want = pfl_waitq_nwaiters(
-				    &m->ppm_lc.plc_wq_want);
-				pcpl->pcpl_nw_empty =
-				    pfl_waitq_nwaiters(
-					&m->ppm_lc.plc_wq_empty);
-			}
-			POOL_ULOCK(m);
+			psc_ctl_fill_pool(m, pcpl);
 			rc = psc_ctlmsg_sendv(fd, mh, pcpl, NULL);
 			if (!rc)
 				break;
@@ -1177,6 +1419,139 @@ psc_ctlparam_run(int fd, struct psc_ctlmsghdr *mh,
 	return (rc);
 }
 
+/*
+ * Handle lock contention profiler parameters: lockprof switches the
+ * profiler on or off and lockprof.reset zeroes its counters.
+ * @fd: control connection file descriptor.
+ * @mh: already filled-in control message header.
+ * @pcp: parameter control message.
+ * @levels: parameter fields.
+ * @nlevels: number of fields.
+ */
+int
+pfl_ctlparam_lockprof(int fd, struct psc_ctlmsghdr *mh,
+    struct psc_ctlmsg_param *pcp, char **levels, int nlevels,
+    __unusedx struct psc_ctlparam_node *pcn)
+{
+	int set;
+
+	if (nlevels > 2)
+		return (psc_ctlsenderr(fd, mh, NULL, "invalid field"));
+
+	levels[0] = "lockprof";
+	set = (mh->mh_type == PCMT_SETPARAM);
+
+	if (set && (pcp->pcp_flags & (PCPF_ADD | PCPF_SUB)))
+		return (psc_ctlsenderr(fd, mh, NULL,
+		    "invalid operation"));
+
+	if (nlevels == 2) {
+		if (strcmp(levels[1], "reset"))
+			return (psc_ctlsenderr(fd, mh, NULL,
+			    "invalid field"));
+		if (!set)
+			return (psc_ctlsenderr(fd, mh, NULL,
+			    "lockprof.reset: write-only"));
+		pfl_lockprof_reset();
+		return (psc_ctlmsg_param_send(fd, mh, pcp,
+		    PCTHRNAME_EVERYONE, levels, 2, "1"));
+	}
+
+	if (set) {
+		if (strcmp(pcp->pcp_value, "0") == 0)
+			pfl_lockprof_enable(0);
+		else if (strcmp(pcp->pcp_value, "1") == 0)
+			pfl_lockprof_enable(1);
+		else
+			return (psc_ctlsenderr(fd, mh, NULL,
+			    "invalid lockprof value: %s",
+			    pcp->pcp_value));
+		return (1);
+	}
+	return (psc_ctlmsg_param_send(fd, mh, pcp, PCTHRNAME_EVERYONE,
+	    levels, 1, pfl_lockprof_enabled ? "1" : "0"));
+}
+
+/*
+ * Handle event tracing parameters: trace.<subsys> switches tracing of
+ * a subsystem on or off and trace.dump=<file> writes the buffered
+ * events as Chrome trace JSON.
+ * @fd: control connection file descriptor.
+ * @mh: already filled-in control message header.
+ * @pcp: parameter control message.
+ * @levels: parameter fields.
+ * @nlevels: number of fields.
+ */
+int
+pfl_ctlparam_trace(int fd, struct psc_ctlmsghdr *mh,
+    struct psc_ctlmsg_param *pcp, char **levels, int nlevels,
+    __unusedx struct psc_ctlparam_node *pcn)
+{
+	int rc, set, on = 0, ss, start_ss, end_ss;
+	char buf[32];
+
+	if (nlevels > 2)
+		return (psc_ctlsenderr(fd, mh, NULL, "invalid field"));
+
+	levels[0] = "trace";
+	set = (mh->mh_type == PCMT_SETPARAM);
+
+	if (set && (pcp->pcp_flags & (PCPF_ADD | PCPF_SUB)))
+		return (psc_ctlsenderr(fd, mh, NULL,
+		    "invalid operation"));
+
+	if (nlevels == 2 && strcmp(levels[1], "dump") == 0) {
+		if (!set)
+			return (psc_ctlsenderr(fd, mh, NULL,
+			    "trace.dump: write-only"));
+		rc = pfl_trace_dump_file(pcp->pcp_value);
+		if (rc == -1)
+			return (psc_ctlsenderr(fd, mh, NULL, "%s: %s",
+			    pcp->pcp_value, strerror(errno)));
+		snprintf(buf, sizeof(buf), "%d", rc);
+		return (psc_ctlmsg_param_send(fd, mh, pcp,
+		    PCTHRNAME_EVERYONE, levels, 2, buf));
+	}
+
+	if (set) {
+		if (strcmp(pcp->pcp_value, "0") == 0)
+			on = 0;
+		else if (strcmp(pcp->pcp_value, "1") == 0)
+			on = 1;
+		else
+			return (psc_ctlsenderr(fd, mh, NULL,
+			    "invalid trace value: %s", pcp->pcp_value));
+	}
+
+	if (nlevels == 2) {
+		ss = pfl_subsys_id(levels[1]);
+		if (ss == -1 || ss >= PFL_TRACE_MAXSUBSYS)
+			return (psc_ctlsenderr(fd, mh, NULL,
+			    "invalid trace subsystem: %s", levels[1]));
+		start_ss = ss;
+		end_ss = ss + 1;
+	} else {
+		start_ss = 0;
+		end_ss = MIN(psc_dynarray_len(&pfl_subsystems),
+		    PFL_TRACE_MAXSUBSYS);
+	}
+
+	rc = 1;
+	for (ss = start_ss; ss < end_ss; ss++) {
+		if (set) {
+			pfl_trace_enable(ss, on);
+			continue;
+		}
+		levels[1] = (char *)pfl_subsys_name(ss);
+		rc = psc_ctlmsg_param_send(fd, mh, pcp,
+		    PCTHRNAME_EVERYONE, levels, 2,
+		    PFL_TRACE_ENABLED(ss) ? "1" : "0");
+		if (!rc)
+			break;
+	}
+	return (rc);
+}
+
 /*
  * Handle thread pause state parameter.
  * @fd: control connection file descriptor.
@@ -1356,13 +1731,30 @@ psc_ctlparam_pool_handle(int fd, struct psc_ctlmsghdr *mh,
 				return (0);
 		}
 	}
+	if (nlevels < 3 || strcmp(levels[2], "prio") == 0) {
+		if (nlevels == 3 && set) {
+			if (pcp->pcp_flags & PCPF_ADD)
+				m->ppm_prio += val;
+			else if (pcp->pcp_flags & PCPF_SUB)
+				m->ppm_prio -= val;
+			else
+				m->ppm_prio = val;
+		} else {
+			levels[2] = "prio";
+			snprintf(nbuf, sizeof(nbuf), "%d",
+			    m->ppm_prio);
+			if (!psc_ctlmsg_param_send(fd, mh, pcp,
+			    PCTHRNAME_EVERYONE, levels, 3, nbuf))
+				return (0);
+		}
+	}
 	if (nlevels < 3 || strcmp(levels[2], "grows") == 0) {
 		if (set)
 			return (psc_ctlsenderr(fd, mh, NULL,
 			    "pool.%s.grows: read-only", levels[1]));
 		levels[2] = "grows";
 		snprintf(nbuf, sizeof(nbuf), "%"PRIu64,
-		    psc_atomic64_read(&m->ppm_opst_grows->opst_lifetime));
+		    pfl_opstat_read(m->ppm_opst_grows));
 		if (!psc_ctlmsg_param_send(fd, mh, pcp,
 		    PCTHRNAME_EVERYONE, levels, 3, nbuf))
 			return (0);
@@ -1487,6 +1879,7 @@ psc_ctlparam_pool(int fd, struct psc_ctlmsghdr *mh,
 	    strcmp(levels[2], "max")   != 0 &&
 	    strcmp(levels[2], "thres") != 0 &&
 	    strcmp(levels[2], "free")  != 0 &&
+	    strcmp(levels[2], "prio")  != 0 &&
 	    strcmp(levels[2], "reap")  != 0 &&
 	    strcmp(levels[2], "total") != 0)
 		return (psc_ctlsenderr(fd, mh, NULL,
@@ -2001,12 +2394,11 @@ psc_ctlparam_opstats(int fd, struct psc_ctlmsghdr *mh,
 					    levels[1], pcp->pcp_value);
 					goto out;
 				}
-				opst->opst_last = val;
-				psc_atomic64_set(&opst->opst_lifetime, val);
+				pfl_opstat_set(opst, val);
 			} else {
 				levels[1] = (char *)opst->opst_name;
 				snprintf(buf, sizeof(buf), "%"PRId64,
-				    psc_atomic64_read(&opst->opst_lifetime));
+				    pfl_opstat_read(opst));
 				rc = psc_ctlmsg_param_send(fd, mh, pcp,
 				    PCTHRNAME_EVERYONE, levels, 2, buf);
 			}
@@ -2022,6 +2414,21 @@ psc_ctlparam_opstats(int fd, struct psc_ctlmsghdr *mh,
 	return (rc);
 }
 
+/*
+ * Fill in an opstat control message record.
+ * @opst: opstat to report.
+ * @pcop: control message record to fill in.
+ */
+__static void
+psc_ctl_fill_opstat(struct pfl_opstat *opst,
+    struct psc_ctlmsg_opstat *pcop)
+{
+	pcop->pco_opst = *opst;
+	psc_atomic64_set(&pcop->pco_opst.opst_lifetime,
+	    pfl_opstat_read(opst));
+	strlcpy(pcop->pco_name, opst->opst_name, sizeof(pcop->pco_name));
+}
+
 /*
  * Respond to a "GETOPSTAT" inquiry.
  * @fd: client socket descriptor.
@@ -2056,9 +2463,7 @@ psc_ctlrep_getopstat(int fd, struct psc_ctlmsghdr *mh, void *m)
 		if (all || fnmatch(name, opst->opst_name, 0) == 0) {
 			found = 1;
 
-			pcop->pco_opst = *opst;
-			strlcpy(pcop->pco_name, opst->opst_name,
-			    sizeof(pcop->pco_name));
+			psc_ctl_fill_opstat(opst, pcop);
 			rc = psc_ctlmsg_sendv(fd, mh, pcop, NULL);
 			if (!rc)
 				break;
@@ -2075,56 +2480,427 @@ psc_ctlrep_getopstat(int fd, struct psc_ctlmsghdr *mh, void *m)
 }
 
 /*
- * Respond to a "GETMETER" inquiry.
- * @fd: client socket descriptor.
- * @mh: already filled-in control message header.
- * @m: control message to examine and reuse.
+ * Batched snapshots.  Instead of one message per object, records of
+ * one type are filtered here and packed into large frames, optionally
+ * deflated.  A filter is a list of terms joined by `&', each of the
+ * form field op value, e.g. "name=rpc*&free<10".  String fields accept
+ * `=' and `!=' with fnmatch(3) patterns; numeric fields also accept
+ * `<', `<=', `>' and `>='.
  */
-int
-psc_ctlrep_getmeter(int fd, struct psc_ctlmsghdr *mh, void *m)
-{
-	struct psc_ctlmsg_meter *pcm = m;
-	char name[PSC_METER_NAME_MAX];
-	struct pfl_meter *pm;
-	int rc, found, all;
+static const struct pfl_ctlsnap_field pfl_ctlsnap_listcache_fields[] = {
+	PCSF(psc_ctlmsg_listcache, "name",	PCSFT_STR, pclc_name),
+	PCSF(psc_ctlmsg_listcache, "size",	PCSFT_I64, pclc_size),
+	PCSF(psc_ctlmsg_listcache, "nseen",	PCSFT_I64, pclc_nseen),
+	PCSF(psc_ctlmsg_listcache, "nw_want",	PCSFT_I32, pclc_nw_want),
+	PCSF(psc_ctlmsg_listcache, "nw_empty",	PCSFT_I32, pclc_nw_empty)
+};
 
-	rc = 1;
-	found = 0;
-	snprintf(name, sizeof(name), "%s", pcm->pcm_mtr.pm_name);
-	all = (name[0] == '\0');
-	PLL_LOCK(&pfl_meters);
-	PLL_FOREACH(pm, &pfl_meters)
-		if (all || strncmp(pm->pm_name, name,
-		    strlen(name)) == 0) {
-			found = 1;
+static const struct pfl_ctlsnap_field pfl_ctlsnap_opstat_fields[] = {
+	PCSF(psc_ctlmsg_opstat, "name",		PCSFT_STR, pco_name),
+	PCSF(psc_ctlmsg_opstat, "lifetime",	PCSFT_I64, pco_opst.opst_lifetime),
+	PCSF(psc_ctlmsg_opstat, "intv",		PCSFT_I64, pco_opst.opst_intv),
+	PCSF(psc_ctlmsg_opstat, "avg",		PCSFT_DBL, pco_opst.opst_avg),
+	PCSF(psc_ctlmsg_opstat, "max",		PCSFT_DBL, pco_opst.opst_max)
+};
 
-			pcm->pcm_mtr = *pm; /* XXX atomic */
-			pcm->pcm_mtr.pm_max = *pm->pm_maxp; /* XXX atomic */
-			rc = psc_ctlmsg_sendv(fd, mh, pcm, NULL);
-			if (!rc)
-				break;
+static const struct pfl_ctlsnap_field pfl_ctlsnap_pool_fields[] = {
+	PCSF(psc_ctlmsg_pool, "name",		PCSFT_STR, pcpl_name),
+	PCSF(psc_ctlmsg_pool, "min",		PCSFT_I32, pcpl_min),
+	PCSF(psc_ctlmsg_pool, "max",		PCSFT_I32, pcpl_max),
+	PCSF(psc_ctlmsg_pool, "total",		PCSFT_I32, pcpl_total),
+	PCSF(psc_ctlmsg_pool, "free",		PCSFT_I32, pcpl_free),
+	PCSF(psc_ctlmsg_pool, "nw_want",	PCSFT_I32, pcpl_nw_want),
+	PCSF(psc_ctlmsg_pool, "nw_empty",	PCSFT_I32, pcpl_nw_empty),
+	PCSF(psc_ctlmsg_pool, "ngrow",		PCSFT_I64, pcpl_ngrow),
+	PCSF(psc_ctlmsg_pool, "nshrink",	PCSFT_I64, pcpl_nshrink),
+	PCSF(psc_ctlmsg_pool, "nseen",		PCSFT_I64, pcpl_nseen),
+	PCSF(psc_ctlmsg_pool, "tlbpages",	PCSFT_I64, pcpl_tlbpages)
+};
 
-			/* Terminate on exact match. */
-			if (strcmp(pm->pm_name, name) == 0)
-				break;
+/*
+ * Check a record against the snapshot filter.
+ * @s: snapshot in progress.
+ * @rec: filled-in record.
+ */
+int
+pfl_ctlsnap_match(const struct pfl_ctlsnap *s, const void *rec)
+{
+	const struct pfl_ctlsnap_term *t;
+	const char *p;
+	int32_t i32;
+	int64_t i64;
+	double d;
+	int i, cmp, ok;
+
+	for (i = 0, t = s->pcs_terms; i < s->pcs_nterms; i++, t++) {
+		p = (const char *)rec + t->pcst_field->pcsf_off;
+		switch (t->pcst_field->pcsf_type) {
+		case PCSFT_STR:
+			cmp = fnmatch(t->pcst_str, p, 0) != 0;
+			break;
+		case PCSFT_I32:
+			memcpy(&i32, p, sizeof(i32));
+			cmp = CMP((int64_t)i32, t->pcst_int);
+			break;
+		case PCSFT_I64:
+			memcpy(&i64, p, sizeof(i64));
+			cmp = CMP(i64, t->pcst_int);
+			break;
+		default:
+			memcpy(&d, p, sizeof(d));
+			cmp = CMP(d, t->pcst_dbl);
+			break;
 		}
-	PLL_ULOCK(&pfl_meters);
-	if (rc && !found && !all)
-		rc = psc_ctlsenderr(fd, mh, NULL, "unknown meter: %s", name);
-	return (rc);
+		switch (t->pcst_op) {
+		case PCSOP_EQ:
+			ok = cmp == 0;
+			break;
+		case PCSOP_NE:
+			ok = cmp != 0;
+			break;
+		case PCSOP_LT:
+			ok = cmp < 0;
+			break;
+		case PCSOP_LE:
+			ok = cmp <= 0;
+			break;
+		case PCSOP_GT:
+			ok = cmp > 0;
+			break;
+		default:
+			ok = cmp >= 0;
+			break;
+		}
+		if (!ok)
+			return (0);
+	}
+	return (1);
 }
 
 /*
- * Respond to a "GETMLIST" inquiry.
- * @fd: client socket descriptor.
- * @mh: already filled-in control message header.
- * @m: control message to examine and reuse.
+ * Parse a snapshot filter expression into terms.
+ * @s: snapshot in progress, whose pcs_filter holds the expression.
+ * Returns a static error string on failure.
  */
-int
-psc_ctlrep_getmlist(int fd, struct psc_ctlmsghdr *mh, void *m)
+const char *
+pfl_ctlsnap_parse(struct pfl_ctlsnap *s)
 {
-	struct psc_ctlmsg_mlist *pcml = m;
-	char name[PEXL_NAME_MAX];
+	const struct pfl_ctlsnap_field *f;
+	struct pfl_ctlsnap_term *t;
+	char *p, *term, *val, *endp;
+	size_t len;
+	int i;
+
+	for (p = s->pcs_filter; (term = strsep(&p, "& \t")) != NULL; ) {
+		if (*term == '\0')
+			continue;
+		if (s->pcs_nterms == PFL_CTLSNAP_MAXTERMS)
+			return ("too many terms");
+		t = &s->pcs_terms[s->pcs_nterms++];
+
+		len = strcspn(term, "!<>=");
+		val = term + len;
+		for (i = 0, f = s->pcs_type->pcsy_fields;
+		    i < s->pcs_type->pcsy_nfields; i++, f++)
+			if (strlen(f->pcsf_name) == len &&
+			    strncmp(f->pcsf_name, term, len) == 0)
+				break;
+		if (i == s->pcs_type->pcsy_nfields)
+			return ("unknown field");
+		t->pcst_field = f;
+
+		if (strncmp(val, "!=", 2) == 0) {
+			t->pcst_op = PCSOP_NE;
+			val += 2;
+		} else if (strncmp(val, "<=", 2) == 0) {
+			t->pcst_op = PCSOP_LE;
+			val += 2;
+		} else if (strncmp(val, ">=", 2) == 0) {
+			t->pcst_op = PCSOP_GE;
+			val += 2;
+		} else if (strncmp(val, "==", 2) == 0) {
+			t->pcst_op = PCSOP_EQ;
+			val += 2;
+		} else if (*val == '<') {
+			t->pcst_op = PCSOP_LT;
+			val++;
+		} else if (*val == '>') {
+			t->pcst_op = PCSOP_GT;
+			val++;
+		} else if (*val == '=') {
+			t->pcst_op = PCSOP_EQ;
+			val++;
+		} else
+			return ("missing operator");
+		if (*val == '\0')
+			return ("missing value");
+
+		errno = 0;
+		switch (f->pcsf_type) {
+		case PCSFT_STR:
+			if (t->pcst_op != PCSOP_EQ &&
+			    t->pcst_op != PCSOP_NE)
+				return ("invalid string comparison");
+			t->pcst_str = val;
+			break;
+		case PCSFT_DBL:
+			t->pcst_dbl = strtod(val, &endp);
+			if (*endp != '\0' || errno)
+				return ("invalid number");
+			break;
+		default:
+			t->pcst_int = strtoll(val, &endp, 0);
+			if (*endp != '\0' || errno)
+				return ("invalid number");
+			break;
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Send the pending frame of a snapshot, deflating it if requested and
+ * worthwhile.
+ * @s: snapshot in progress.
+ */
+__static int
+pfl_ctlsnap_flush(struct pfl_ctlsnap *s)
+{
+	struct pfl_ctlmsg_snapshot *f = s->pcs_frame;
+	struct psc_ctlmsghdr mh;
+	int rc;
+
+	if (f->pcsn_nrecs == 0)
+		return (1);
+
+	f->pcsn_len = f->pcsn_rawlen;
+#ifdef HAVE_ZLIB
+	if (s->pcs_zframe) {
+		uLongf zlen;
+
+		zlen = compressBound(PFLCTL_SNAP_FRAMESZ);
+		if (compress2(s->pcs_zframe->pcsn_data, &zlen,
+		    f->pcsn_data, f->pcsn_rawlen, Z_BEST_SPEED) == Z_OK &&
+		    zlen < f->pcsn_rawlen) {
+			memcpy(s->pcs_zframe, f, sizeof(*f));
+			f = s->pcs_zframe;
+			f->pcsn_flags |= PFLCTL_SNAPF_ZLIB;
+			f->pcsn_len = zlen;
+		}
+	}
+#endif
+
+	mh = s->pcs_mh;
+	mh.mh_size = sizeof(*f) + f->pcsn_len;
+	rc = psc_ctlmsg_sendv(s->pcs_fd, &mh, f, NULL);
+
+	s->pcs_frame->pcsn_nrecs = 0;
+	s->pcs_frame->pcsn_rawlen = 0;
+	return (rc);
+}
+
+/*
+ * Append a record to a snapshot if it passes the filter.
+ * @s: snapshot in progress.
+ * @rec: filled-in record.
+ */
+__static int
+pfl_ctlsnap_add(struct pfl_ctlsnap *s, const void *rec)
+{
+	struct pfl_ctlmsg_snapshot *f = s->pcs_frame;
+	size_t recsz = s->pcs_type->pcsy_recsz;
+
+	if (!pfl_ctlsnap_match(s, rec))
+		return (1);
+	if (f->pcsn_rawlen + recsz > PFLCTL_SNAP_FRAMESZ &&
+	    !pfl_ctlsnap_flush(s))
+		return (0);
+	memcpy(f->pcsn_data + f->pcsn_rawlen, rec, recsz);
+	f->pcsn_rawlen += recsz;
+	f->pcsn_nrecs++;
+	return (1);
+}
+
+__static int
+pfl_ctlsnap_walk_listcache(struct pfl_ctlsnap *s)
+{
+	struct psc_ctlmsg_listcache pclc;
+	struct psc_listcache *lc;
+	int rc = 1;
+
+	memset(&pclc, 0, sizeof(pclc));
+	PLL_LOCK(&psc_listcaches);
+	PLL_FOREACH(lc, &psc_listcaches) {
+		psc_ctl_fill_listcache(lc, &pclc);
+		rc = pfl_ctlsnap_add(s, &pclc);
+		if (!rc)
+			break;
+	}
+	PLL_ULOCK(&psc_listcaches);
+	return (rc);
+}
+
+__static int
+pfl_ctlsnap_walk_opstat(struct pfl_ctlsnap *s)
+{
+	struct psc_dynarray all_ops = DYNARRAY_INIT;
+	struct psc_ctlmsg_opstat pcop;
+	struct pfl_opstat *opst;
+	int rc = 1, i;
+
+	psc_dynarray_ensurelen(&all_ops, pfl_opstats_sum);
+
+	spinlock(&pfl_opstats_lock);
+	DYNARRAY_FOREACH(opst, i, &pfl_opstats)
+		psc_dynarray_add(&all_ops, opst);
+	freelock(&pfl_opstats_lock);
+
+	memset(&pcop, 0, sizeof(pcop));
+	DYNARRAY_FOREACH(opst, i, &all_ops) {
+		psc_ctl_fill_opstat(opst, &pcop);
+		rc = pfl_ctlsnap_add(s, &pcop);
+		if (!rc)
+			break;
+	}
+	psc_dynarray_free(&all_ops);
+	return (rc);
+}
+
+__static int
+pfl_ctlsnap_walk_pool(struct pfl_ctlsnap *s)
+{
+	struct psc_ctlmsg_pool pcpl;
+	struct psc_poolmgr *m;
+	int rc = 1;
+
+	memset(&pcpl, 0, sizeof(pcpl));
+	PLL_LOCK(&psc_pools);
+	PLL_FOREACH(m, &psc_pools) {
+		psc_ctl_fill_pool(m, &pcpl);
+		rc = pfl_ctlsnap_add(s, &pcpl);
+		if (!rc)
+			break;
+	}
+	PLL_ULOCK(&psc_pools);
+	return (rc);
+}
+
+static const struct pfl_ctlsnap_type pfl_ctlsnap_types[] = {
+	{ PCMT_GETLISTCACHE, sizeof(struct psc_ctlmsg_listcache),
+	  pfl_ctlsnap_walk_listcache, pfl_ctlsnap_listcache_fields,
+	  nitems(pfl_ctlsnap_listcache_fields) },
+	{ PCMT_GETOPSTATS, sizeof(struct psc_ctlmsg_opstat),
+	  pfl_ctlsnap_walk_opstat, pfl_ctlsnap_opstat_fields,
+	  nitems(pfl_ctlsnap_opstat_fields) },
+	{ PCMT_GETPOOL, sizeof(struct psc_ctlmsg_pool),
+	  pfl_ctlsnap_walk_pool, pfl_ctlsnap_pool_fields,
+	  nitems(pfl_ctlsnap_pool_fields) }
+};
+
+/*
+ * Respond to a "GETSNAPSHOT" inquiry.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to examine.
+ */
+int
+pfl_ctlrep_getsnapshot(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct pfl_ctlmsg_snapshot *pcsn = m;
+	struct pfl_ctlsnap s;
+	const char *errmsg;
+	size_t n;
+	int rc;
+
+	memset(&s, 0, sizeof(s));
+	for (n = 0; n < nitems(pfl_ctlsnap_types); n++)
+		if (pfl_ctlsnap_types[n].pcsy_type == pcsn->pcsn_type)
+			break;
+	if (n == nitems(pfl_ctlsnap_types))
+		return (psc_ctlsenderr(fd, mh, NULL,
+		    "invalid snapshot record type: %d", pcsn->pcsn_type));
+	s.pcs_type = &pfl_ctlsnap_types[n];
+
+	pcsn->pcsn_filter[sizeof(pcsn->pcsn_filter) - 1] = '\0';
+	strlcpy(s.pcs_filter, pcsn->pcsn_filter, sizeof(s.pcs_filter));
+	errmsg = pfl_ctlsnap_parse(&s);
+	if (errmsg)
+		return (psc_ctlsenderr(fd, mh, NULL,
+		    "invalid snapshot filter: %s: %s", pcsn->pcsn_filter,
+		    errmsg));
+
+	s.pcs_fd = fd;
+	s.pcs_mh = *mh;
+	s.pcs_frame = PSCALLOC(sizeof(*s.pcs_frame) +
+	    PFLCTL_SNAP_FRAMESZ);
+	s.pcs_frame->pcsn_type = pcsn->pcsn_type;
+	s.pcs_frame->pcsn_recsz = s.pcs_type->pcsy_recsz;
+#ifdef HAVE_ZLIB
+	if (pcsn->pcsn_flags & PFLCTL_SNAPF_ZLIB)
+		s.pcs_zframe = PSCALLOC(sizeof(*s.pcs_zframe) +
+		    compressBound(PFLCTL_SNAP_FRAMESZ));
+#endif
+
+	rc = s.pcs_type->pcsy_walk(&s);
+	if (rc)
+		rc = pfl_ctlsnap_flush(&s);
+
+	PSCFREE(s.pcs_zframe);
+	PSCFREE(s.pcs_frame);
+	return (rc);
+}
+
+/*
+ * Respond to a "GETMETER" inquiry.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to examine and reuse.
+ */
+int
+psc_ctlrep_getmeter(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct psc_ctlmsg_meter *pcm = m;
+	char name[PSC_METER_NAME_MAX];
+	struct pfl_meter *pm;
+	int rc, found, all;
+
+	rc = 1;
+	found = 0;
+	snprintf(name, sizeof(name), "%s", pcm->pcm_mtr.pm_name);
+	all = (name[0] == '\0');
+	PLL_LOCK(&pfl_meters);
+	PLL_FOREACH(pm, &pfl_meters)
+		if (all || strncmp(pm->pm_name, name,
+		    strlen(name)) == 0) {
+			found = 1;
+
+			pcm->pcm_mtr = *pm; /* XXX atomic */
+			pcm->pcm_mtr.pm_max = *pm->pm_maxp; /* XXX atomic */
+			rc = psc_ctlmsg_sendv(fd, mh, pcm, NULL);
+			if (!rc)
+				break;
+
+			/* Terminate on exact match. */
+			if (strcmp(pm->pm_name, name) == 0)
+				break;
+		}
+	PLL_ULOCK(&pfl_meters);
+	if (rc && !found && !all)
+		rc = psc_ctlsenderr(fd, mh, NULL, "unknown meter: %s", name);
+	return (rc);
+}
+
+/*
+ * Respond to a "GETMLIST" inquiry.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to examine and reuse.
+ */
+int
+psc_ctlrep_getmlist(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct psc_ctlmsg_mlist *pcml = m;
+	char name[PEXL_NAME_MAX];
 	struct pfl_mlist *pml;
 	int rc, found, all;
 
@@ -2143,8 +2919,7 @@ psc_ctlrep_getmlist(int fd, struct psc_ctlmsghdr *mh, void *m)
 			    sizeof(pcml->pcml_name),
 			    "%s", pml->pml_name);
 			pcml->pcml_size = pml->pml_nitems;
-			pcml->pcml_nseen = psc_atomic64_read(
-			    &pml->pml_nseen->opst_lifetime);
+			pcml->pcml_nseen = pfl_opstat_read(pml->pml_nseen);
 			pcml->pcml_nwaiters =
 			    pfl_multiwaitcond_nwaiters(
 				&pml->pml_mwcond_empty);
@@ -2213,34 +2988,127 @@ psc_ctlrep_getodtable(int fd, struct psc_ctlmsghdr *mh, void *m)
 }
 
 /*
- * Respond to a "GETWORKRQ" inquiry.
+ * Describe a single queued work item for a "GETWORKRQ" inquiry.
+ */
+__static void
+pfl_ctlrep_fillworkrq(struct pfl_ctlmsg_workrq *pcw,
+    struct pfl_workrq *wk, const char *thrname)
+{
+	const char *type;
+
+	memset(pcw, 0, sizeof(*pcw));
+	pcw->pcw_addr = (uintptr_t)wk;
+	type = wk->wkrq_type;
+	if (strncmp(type, "struct ", strlen("struct ")) == 0)
+	    	type += strlen("struct ");
+	snprintf(pcw->pcw_type, sizeof(pcw->pcw_type), "%s", type);
+	strlcpy(pcw->pcw_thrname, thrname, sizeof(pcw->pcw_thrname));
+	pcw->pcw_pri = wk->wkrq_pri;
+}
+
+/*
+ * Respond to a "GETWORKRQ" inquiry.  Each worker is reported with its
+ * queue depth and steal counters followed by the items it has queued.
+ * Records are copied out under the queue lock and sent after it is
+ * released so a slow client cannot stall the worker.
  * @fd: client socket descriptor.
  * @mh: already filled-in control message header.
  * @m: control message to examine and reuse.
  */
 int
-pfl_ctlrep_getworkrq(int fd, struct psc_ctlmsghdr *mh, void *m)
+pfl_ctlrep_getworkrq(int fd, struct psc_ctlmsghdr *mh,
+    __unusedx void *m)
 {
-	struct pfl_ctlmsg_workrq *pcw = m;
+	struct pfl_ctlmsg_workrq *pcw, *v = NULL;
+	struct pfl_wk_thread *wkt;
 	struct pfl_workrq *wk;
-	const char *type;
-	int rc = 1;
+	int i, j, n, nv, pri, rc = 1, len = 0;
+
+	n = psc_atomic32_read(&pfl_wkthr_n);
+	for (i = 0; i <= n && rc; i++) {
+		if (i < n) {
+			wkt = pfl_wkthrv[i];
+			spinlock(&wkt->wkt_lock);
+			if (wkt->wkt_nqueued + 1 > len) {
+				len = wkt->wkt_nqueued + 1;
+				freelock(&wkt->wkt_lock);
+				v = PSC_REALLOC(v, len * sizeof(*v));
+				i--;
+				continue;
+			}
 
-	LIST_CACHE_LOCK(&pfl_workq);
-	LIST_CACHE_FOREACH(wk, &pfl_workq) {
-		memset(pcw, 0, sizeof(*pcw));
-		pcw->pcw_addr = (uintptr_t)wk;
-		type = wk->wkrq_type;
-		if (strncmp(type, "struct ", strlen("struct ")) == 0)
-		    	type += strlen("struct ");
-		snprintf(pcw->pcw_type, sizeof(pcw->pcw_type), "%s",
-		    type);
-
-		rc = psc_ctlmsg_sendv(fd, mh, pcw, NULL);
-		if (!rc)
-			break;
+			pcw = &v[0];
+			memset(pcw, 0, sizeof(*pcw));
+			pcw->pcw_addr = (uintptr_t)wkt;
+			strlcpy(pcw->pcw_thrname,
+			    wkt->wkt_thread->pscthr_name,
+			    sizeof(pcw->pcw_thrname));
+			pcw->pcw_flags = PFLCTL_WKRQF_WORKER;
+			pcw->pcw_cpu = wkt->wkt_cpu;
+			pcw->pcw_nqueued = wkt->wkt_nqueued;
+			pcw->pcw_nrun = wkt->wkt_nrun;
+			pcw->pcw_nsteals = wkt->wkt_nsteals;
+			pcw->pcw_nstolen = wkt->wkt_nstolen;
+			nv = 1;
+			for (pri = 0; pri < PFL_WKPRI_MAX; pri++)
+				psclist_for_each_entry(wk,
+				    &wkt->wkt_q[pri], wkrq_lentry)
+					pfl_ctlrep_fillworkrq(&v[nv++],
+					    wk, wkt->wkt_thread->pscthr_name);
+			freelock(&wkt->wkt_lock);
+		} else {
+			/* items queued before any worker started */
+			LIST_CACHE_LOCK(&pfl_workq);
+			if (pfl_workq.plc_nitems > len) {
+				len = pfl_workq.plc_nitems;
+				LIST_CACHE_ULOCK(&pfl_workq);
+				v = PSC_REALLOC(v, len * sizeof(*v));
+				i--;
+				continue;
+			}
+			nv = 0;
+			LIST_CACHE_FOREACH(wk, &pfl_workq)
+				pfl_ctlrep_fillworkrq(&v[nv++], wk, "-");
+			LIST_CACHE_ULOCK(&pfl_workq);
+		}
+
+		for (j = 0; j < nv && rc; j++)
+			rc = psc_ctlmsg_sendv(fd, mh, &v[j], NULL);
+	}
+	PSCFREE(v);
+	return (rc);
+}
+
+/*
+ * Respond to a "GETSLAB" inquiry with statistics for each size class of
+ * the slab allocator.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to be filled in and sent out.
+ */
+int
+pfl_ctlrep_getslab(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct pfl_ctlmsg_slab *pcsl = m;
+	struct pfl_slab_stats pss;
+	int c, rc = 1;
+
+	if (!pfl_slab_enabled)
+		return (psc_ctlsenderr(fd, mh, NULL,
+		    "slab allocator not enabled"));
+
+	for (c = 0; pfl_slab_getstats(c, &pss) && rc; c++) {
+		memset(pcsl, 0, sizeof(*pcsl));
+		pcsl->pcsl_class = c;
+		pcsl->pcsl_nperrun = pss.pss_nperrun;
+		pcsl->pcsl_size = pss.pss_size;
+		pcsl->pcsl_nruns = pss.pss_nruns;
+		pcsl->pcsl_nout = pss.pss_nout;
+		pcsl->pcsl_nrefills = pss.pss_nrefills;
+		pcsl->pcsl_nflushes = pss.pss_nflushes;
+		pcsl->pcsl_nreleased = pss.pss_nreleased;
+		rc = psc_ctlmsg_sendv(fd, mh, pcsl, NULL);
 	}
-	LIST_CACHE_ULOCK(&pfl_workq);
 	return (rc);
 }
 
@@ -2295,98 +3163,524 @@ psc_ctl_applythrop(int fd, struct psc_ctlmsghdr *mh, void *m,
 }
 
 /*
- * Satisfy a client connection.
- * @fd: client socket descriptor.
- * @ct: control operation table.
- * @nops: number of operations in table.
- * @msiz: value-result of buffer size allocated to subsequent message
- *	processing.
- * @pm: value-result buffer for subsequent message processing.
- *
- * Notes: pscthr_yield() is not explicity called throughout this routine,
- * which has implications, advantages, and disadvantages.
- *
- * Implications: we run till we finish the client connection and the next
- * accept() puts us back to sleep, if no intervening system calls which
- * run in the meantime relinquish control to other threads.
- *
- * Advantages: it might be nice to block all threads so processing by
- * other threads doesn't happen while control messages which modify
- * operation are being processed.
- *
- * Disadvantages: if we sleep during processing of client connection,
- * we deny service to new clients.
+ * Control clients are served by a small number of threads multiplexing
+ * non-blocking connections.  Requests are read into a per-connection
+ * buffer as bytes arrive and replies are appended to an output buffer
+ * that is written out as the client drains it.  A client whose replies
+ * pile up is not read from until they drain, and message types marked
+ * with psc_ctlop_setworkq() are run by a worker so a slow one cannot
+ * stall the loop.
  */
-__static int
-psc_ctlthr_service(int fd, const struct psc_ctlop *ct, int nops,
-    size_t *msiz, void *pm)
+
+/* client connections indexed by descriptor, for psc_ctlmsg_sendv() */
+__static psc_spinlock_t		  pfl_ctlconns_lock = SPINLOCK_INIT;
+__static struct pfl_ctl_conn	**pfl_ctlconns;
+__static int			  pfl_ctlconns_len;
+
+/* message types run by a worker, see psc_ctlop_setworkq() */
+__static struct psc_dynarray	  pfl_ctl_workqtypes = DYNARRAY_INIT;
+
+struct pfl_ctl_wk {
+	struct pfl_ctl_conn	*pcw_conn;
+	const struct psc_ctlop	*pcw_op;
+};
+
+__static struct pfl_ctl_conn *
+pfl_ctlconn_lookup(int fd)
 {
-	struct psc_ctlmsghdr mh;
-	ssize_t n;
-	void *m;
+	struct pfl_ctl_conn *pcc = NULL;
+
+	spinlock(&pfl_ctlconns_lock);
+	if (fd >= 0 && fd < pfl_ctlconns_len)
+		pcc = pfl_ctlconns[fd];
+	freelock(&pfl_ctlconns_lock);
+	return (pcc);
+}
+
+__static void
+pfl_ctlconn_setfd(int fd, struct pfl_ctl_conn *pcc)
+{
+	struct pfl_ctl_conn **v, **t;
+	int n;
+
+	for (;;) {
+		spinlock(&pfl_ctlconns_lock);
+		if (fd < pfl_ctlconns_len) {
+			pfl_ctlconns[fd] = pcc;
+			freelock(&pfl_ctlconns_lock);
+			return;
+		}
+		n = pfl_ctlconns_len ? pfl_ctlconns_len * 2 : 64;
+		while (n <= fd)
+			n *= 2;
+		freelock(&pfl_ctlconns_lock);
+
+		v = PSCALLOC(n * sizeof(*v));
+		spinlock(&pfl_ctlconns_lock);
+		if (n > pfl_ctlconns_len) {
+			memcpy(v, pfl_ctlconns,
+			    pfl_ctlconns_len * sizeof(*v));
+			SWAP(v, pfl_ctlconns, t);
+			pfl_ctlconns_len = n;
+		}
+		freelock(&pfl_ctlconns_lock);
+		PSCFREE(v);
+	}
+}
 
-	m = *(void **)pm;
+#ifdef HAVE_EPOLL
 
-	n = recv(fd, &mh, sizeof(mh), MSG_WAITALL | PFL_MSG_NOSIGNAL);
-	if (n == 0)
-		return (EOF);
+__static void
+pfl_ctl_poll_init(struct pfl_ctl_data *pcd)
+{
+	pcd->pcd_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (pcd->pcd_epfd == -1)
+		psc_fatal("epoll_create1");
+}
+
+__static void
+pfl_ctl_poll_arm(struct pfl_ctl_data *pcd, struct pfl_ctl_conn *pcc,
+    int events, int add)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLONESHOT;
+	if (events & POLLIN)
+		ev.events |= EPOLLIN;
+	if (events & POLLOUT)
+		ev.events |= EPOLLOUT;
+	ev.data.ptr = pcc;
+	if (epoll_ctl(pcd->pcd_epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+	    pcc->pcc_fd, &ev) == -1)
+		psc_fatal("epoll_ctl");
+}
+
+__static void
+pfl_ctl_poll_del(struct pfl_ctl_data *pcd, struct pfl_ctl_conn *pcc)
+{
+	if (epoll_ctl(pcd->pcd_epfd, EPOLL_CTL_DEL, pcc->pcc_fd,
+	    NULL) == -1)
+		psclog_warn("epoll_ctl");
+}
+
+/*
+ * Wait for connections to become ready.  Each is reported to only one
+ * thread and stays disarmed until pfl_ctl_poll_arm().
+ */
+__static int
+pfl_ctl_poll_wait(struct pfl_ctl_data *pcd, struct pfl_ctl_conn **v,
+    int max, int msec)
+{
+	struct epoll_event ev[PFL_CTL_NEVENTS];
+	int i, n;
+
+	n = epoll_wait(pcd->pcd_epfd, ev, MIN(max, PFL_CTL_NEVENTS),
+	    msec);
 	if (n == -1) {
-		if (errno == EPIPE || errno == ECONNRESET)
-			return (EOF);
 		if (errno == EINTR)
 			return (0);
-		psc_fatal("recvmsg");
+		psc_fatal("epoll_wait");
 	}
+	for (i = 0; i < n; i++)
+		v[i] = ev[i].data.ptr;
+	return (n);
+}
+
+#else
+
+/*
+ * poll(2) fallback.  One thread polls at a time and claims the ready
+ * connections before letting another in, which provides the same
+ * one-owner guarantee as EPOLLONESHOT.
+ */
+
+/* poll set, rebuilt each round under pcd_pollmutex */
+__static struct pollfd		 *pfl_ctl_pfd;
+__static struct pfl_ctl_conn	**pfl_ctl_pfdconn;
+__static int			  pfl_ctl_npfd;
+
+__static void
+pfl_ctl_poll_init(struct pfl_ctl_data *pcd)
+{
+	pcd->pcd_epfd = -1;
+}
+
+__static void
+pfl_ctl_poll_arm(struct pfl_ctl_data *pcd, struct pfl_ctl_conn *pcc,
+    int events, __unusedx int add)
+{
+	spinlock(&pcd->pcd_lock);
+	pcc->pcc_events = events;
+	pcc->pcc_flags |= PCCF_ARMED;
+	freelock(&pcd->pcd_lock);
+}
+
+__static void
+pfl_ctl_poll_del(__unusedx struct pfl_ctl_data *pcd,
+    __unusedx struct pfl_ctl_conn *pcc)
+{
+}
+
+__static int
+pfl_ctl_poll_wait(struct pfl_ctl_data *pcd, struct pfl_ctl_conn **v,
+    int max, __unusedx int msec)
+{
+	struct pfl_ctl_conn *pcc;
+	int i, n, nready;
+
+	psc_mutex_lock(&pcd->pcd_pollmutex);
+	for (;;) {
+		n = 0;
+		spinlock(&pcd->pcd_lock);
+		psclist_for_each_entry(pcc, &pcd->pcd_conns,
+		    pcc_lentry)
+			if (pcc->pcc_flags & PCCF_ARMED)
+				n++;
+		if (n <= pfl_ctl_npfd)
+			break;
+		freelock(&pcd->pcd_lock);
+
+		pfl_ctl_pfd = PSC_REALLOC(pfl_ctl_pfd,
+		    n * sizeof(*pfl_ctl_pfd));
+		pfl_ctl_pfdconn = PSC_REALLOC(pfl_ctl_pfdconn,
+		    n * sizeof(*pfl_ctl_pfdconn));
+		pfl_ctl_npfd = n;
+	}
+	n = 0;
+	psclist_for_each_entry(pcc, &pcd->pcd_conns, pcc_lentry) {
+		if ((pcc->pcc_flags & PCCF_ARMED) == 0)
+			continue;
+		pfl_ctl_pfd[n].fd = pcc->pcc_fd;
+		pfl_ctl_pfd[n].events = pcc->pcc_events;
+		pfl_ctl_pfd[n].revents = 0;
+		pfl_ctl_pfdconn[n++] = pcc;
+	}
+	freelock(&pcd->pcd_lock);
+
+	/* Connections accepted meanwhile are picked up next round. */
+	nready = poll(pfl_ctl_pfd, n, 100);
+	if (nready == -1 && errno != EINTR)
+		psc_fatal("poll");
+
+	/* Ready connections beyond @max stay armed for the next round. */
+	nready = 0;
+	spinlock(&pcd->pcd_lock);
+	for (i = 0; i < n && nready < max; i++)
+		if (pfl_ctl_pfd[i].revents) {
+			pcc = pfl_ctl_pfdconn[i];
+			pcc->pcc_flags &= ~PCCF_ARMED;
+			v[nready++] = pcc;
+		}
+	freelock(&pcd->pcd_lock);
+	psc_mutex_unlock(&pcd->pcd_pollmutex);
+	return (nready);
+}
+
+#endif
+
+/*
+ * Write out as much pending output as the client will take.
+ * @pcc: connection.
+ */
+__static void
+pfl_ctlconn_flush(struct pfl_ctl_conn *pcc)
+{
+	ssize_t n;
+
+	while (pcc->pcc_ooff < pcc->pcc_olen) {
+		n = send(pcc->pcc_fd, pcc->pcc_obuf + pcc->pcc_ooff,
+		    pcc->pcc_olen - pcc->pcc_ooff, PFL_MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if (errno == EPIPE || errno == ECONNRESET) {
+				OPSTAT_INCR("ctl.drop");
+				pcc->pcc_flags |= PCCF_DEAD;
+				break;
+			}
+			psc_fatal("send");
+		}
+		pcc->pcc_ooff += n;
+	}
+	pcc->pcc_ooff = pcc->pcc_olen = 0;
+}
+
+/*
+ * Append a reply to the output of a connection.  A worker waits here
+ * for a slow client to drain; an event loop thread instead lets the
+ * output grow, up to a limit past which the client is dropped.
+ * @pcc: connection, owned by the calling thread.
+ * @mh: reply header.
+ * @m: reply contents.
+ */
+__static int
+pfl_ctlconn_queue(struct pfl_ctl_conn *pcc,
+    const struct psc_ctlmsghdr *mh, const void *m)
+{
+	struct pollfd pfd;
+	size_t len;
+	int rc;
 
-	if (n != sizeof(mh)) {
-		psclog_notice("short recv on psc_ctlmsghdr; "
-		    "expected=%zd got=%zd", sizeof(mh), n);
+	if (pcc->pcc_flags & PCCF_DEAD)
 		return (0);
+
+	len = sizeof(*mh) + mh->mh_size;
+	if (pcc->pcc_olen + len > pcc->pcc_obufsz) {
+		if (pcc->pcc_ooff) {
+			memmove(pcc->pcc_obuf, pcc->pcc_obuf +
+			    pcc->pcc_ooff, pcc->pcc_olen - pcc->pcc_ooff);
+			pcc->pcc_olen -= pcc->pcc_ooff;
+			pcc->pcc_ooff = 0;
+		}
+		if (pcc->pcc_olen + len > pcc->pcc_obufsz) {
+			pcc->pcc_obufsz = MAX(pcc->pcc_obufsz * 2,
+			    pcc->pcc_olen + len);
+			pcc->pcc_obuf = psc_realloc(pcc->pcc_obuf,
+			    pcc->pcc_obufsz, 0);
+		}
 	}
-	if (mh.mh_size > *msiz) {
-		*msiz = mh.mh_size;
-		m = *(void **)pm = psc_realloc(m, *msiz, 0);
+	memcpy(pcc->pcc_obuf + pcc->pcc_olen, mh, sizeof(*mh));
+	memcpy(pcc->pcc_obuf + pcc->pcc_olen + sizeof(*mh), m,
+	    mh->mh_size);
+	pcc->pcc_olen += len;
+	OPSTAT_INCR("ctl.sent");
+
+	if (pcc->pcc_olen - pcc->pcc_ooff <= PFL_CTL_OBUF_HIWAT)
+		return (1);
+
+	pfl_ctlconn_flush(pcc);
+	if (pcc->pcc_flags & PCCF_WORKQ) {
+		pfd.fd = pcc->pcc_fd;
+		pfd.events = POLLOUT;
+		while ((pcc->pcc_flags & PCCF_DEAD) == 0 &&
+		    pcc->pcc_olen - pcc->pcc_ooff > PFL_CTL_OBUF_HIWAT) {
+			rc = poll(&pfd, 1, PFL_CTL_STALL_MSEC);
+			if (rc == -1 && errno == EINTR)
+				continue;
+			if (rc <= 0) {
+				OPSTAT_INCR("ctl.drop");
+				pcc->pcc_flags |= PCCF_DEAD;
+				break;
+			}
+			pfl_ctlconn_flush(pcc);
+		}
+	} else if (pcc->pcc_olen - pcc->pcc_ooff > PFL_CTL_OBUF_MAX) {
+		OPSTAT_INCR("ctl.drop");
+		pcc->pcc_flags |= PCCF_DEAD;
 	}
+	return ((pcc->pcc_flags & PCCF_DEAD) == 0);
+}
+
+/*
+ * Read from a connection until a whole request is buffered.
+ * @pcc: connection.
+ * Returns 1 when a request is ready, 0 if more input is needed, or -1
+ * on end of input.
+ */
+__static int
+pfl_ctlconn_read(struct pfl_ctl_conn *pcc)
+{
+	struct psc_ctlmsghdr *mh;
+	size_t want;
+	ssize_t n;
 
- again:
-	if (mh.mh_size) {
-		n = recv(fd, m, mh.mh_size, MSG_WAITALL |
-		    PFL_MSG_NOSIGNAL);
+	for (;;) {
+		want = sizeof(*mh);
+		if (pcc->pcc_ilen >= want) {
+			mh = pcc->pcc_ibuf;
+			if (mh->mh_size > PFL_CTL_MSGSZ_MAX) {
+				psclog_notice("oversized psc_ctlmsg; "
+				    "type=%d size=%zu", mh->mh_type,
+				    mh->mh_size);
+				pcc->pcc_flags |= PCCF_DEAD;
+				return (-1);
+			}
+			want += mh->mh_size;
+			if (pcc->pcc_ilen == want)
+				return (1);
+		}
+		if (want > pcc->pcc_ibufsz) {
+			pcc->pcc_ibufsz = want;
+			pcc->pcc_ibuf = psc_realloc(pcc->pcc_ibuf, want, 0);
+		}
+		n = recv(pcc->pcc_fd, (char *)pcc->pcc_ibuf +
+		    pcc->pcc_ilen, want - pcc->pcc_ilen, PFL_MSG_NOSIGNAL);
+		if (n == 0) {
+			if (pcc->pcc_ilen)
+				psclog_notice("short recv on psc_ctlmsg; "
+				    "got=%zu expected=%zu", pcc->pcc_ilen,
+				    want);
+			pcc->pcc_flags |= PCCF_EOF;
+			return (-1);
+		}
 		if (n == -1) {
-			if (errno == EPIPE || errno == ECONNRESET)
-				return (EOF);
 			if (errno == EINTR)
-				goto again;
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (0);
+			if (errno == EPIPE || errno == ECONNRESET) {
+				pcc->pcc_flags |= PCCF_DEAD;
+				return (-1);
+			}
 			psc_fatal("recv");
 		}
-		if ((size_t)n != mh.mh_size) {
-			psclog_warn("short recv on psc_ctlmsg contents; "
-			    "got=%zu; expected=%zu",
-			    n, mh.mh_size);
-			return (EOF);
-		}
+		pcc->pcc_ilen += n;
 	}
-	if (mh.mh_type < 0 ||
-	    mh.mh_type >= nops ||
-	    ct[mh.mh_type].pc_op == NULL) {
-		psc_ctlsenderr(fd, &mh, NULL,
+	/* NOTREACHED */
+	return (-1);
+}
+
+__static void
+pfl_ctlconn_close(struct pfl_ctl_conn *pcc)
+{
+	struct pfl_ctl_data *pcd = pcc->pcc_pcd;
+
+	pfl_ctl_poll_del(pcd, pcc);
+	spinlock(&pcd->pcd_lock);
+	psclist_del(&pcc->pcc_lentry, &pcd->pcd_conns);
+	freelock(&pcd->pcd_lock);
+	pfl_ctlconn_setfd(pcc->pcc_fd, NULL);
+	close(pcc->pcc_fd);
+	PSCFREE(pcc->pcc_ibuf);
+	PSCFREE(pcc->pcc_obuf);
+	PSCFREE(pcc);
+}
+
+/*
+ * Give up ownership of a connection: close it if finished, otherwise
+ * wait for more requests, or for room to write replies into.
+ * @pcc: connection.
+ */
+__static void
+pfl_ctlconn_release(struct pfl_ctl_conn *pcc)
+{
+	int events = 0;
+
+	pfl_ctlconn_flush(pcc);
+	if ((pcc->pcc_flags & PCCF_DEAD) ||
+	    ((pcc->pcc_flags & PCCF_EOF) && pcc->pcc_olen == 0)) {
+		pfl_ctlconn_close(pcc);
+		return;
+	}
+	if ((pcc->pcc_flags & PCCF_EOF) == 0 &&
+	    pcc->pcc_olen - pcc->pcc_ooff <= PFL_CTL_OBUF_HIWAT)
+		events |= POLLIN;
+	if (pcc->pcc_olen)
+		events |= POLLOUT;
+	pfl_ctl_poll_arm(pcc->pcc_pcd, pcc, events, 0);
+}
+
+__static int
+pfl_ctlconn_runwk(void *p)
+{
+	struct pfl_ctl_wk *wk = p;
+	struct pfl_ctl_conn *pcc = wk->pcw_conn;
+	struct pfl_ctl_data *pcd = pcc->pcc_pcd;
+	struct psc_ctlmsghdr *mh = pcc->pcc_ibuf;
+
+	if (!wk->pcw_op->pc_op(pcc->pcc_fd, mh, PSC_AGP(mh,
+	    sizeof(*mh))))
+		pcc->pcc_flags |= PCCF_DEAD;
+	pcc->pcc_flags &= ~PCCF_WORKQ;
+	pfl_ctlconn_release(pcc);
+
+	spinlock(&pcd->pcd_lock);
+	pcd->pcd_refcnt--;
+	pfl_waitq_wakeall(&pcd->pcd_waitq);
+	freelock(&pcd->pcd_lock);
+	return (0);
+}
+
+/*
+ * Execute a buffered request.
+ * @pct: control thread.
+ * @pcc: connection.
+ * Returns 1 if the request was handed to a worker, which then owns the
+ * connection.
+ */
+__static int
+pfl_ctlconn_dispatch(struct psc_ctlthr *pct, struct pfl_ctl_conn *pcc)
+{
+	struct pfl_ctl_data *pcd = pcc->pcc_pcd;
+	struct psc_ctlmsghdr *mh = pcc->pcc_ibuf;
+	const struct psc_ctlop *ct;
+	struct pfl_ctl_wk *wk;
+	int fd = pcc->pcc_fd;
+
+	pcc->pcc_ilen = 0;
+	if (mh->mh_type < 0 ||
+	    mh->mh_type >= pct->pct_nops ||
+	    pct->pct_ct[mh->mh_type].pc_op == NULL) {
+		psc_ctlsenderr(fd, mh, NULL,
 		    "unrecognized psc_ctlmsghdr type; "
-		    "type=%d size=%zu nops=%d", mh.mh_type, mh.mh_size, nops);
+		    "type=%d size=%zu nops=%d", mh->mh_type, mh->mh_size,
+		    pct->pct_nops);
 		return (0);
 	}
-	if (ct[mh.mh_type].pc_siz &&
-	    ct[mh.mh_type].pc_siz != mh.mh_size) {
-		psc_ctlsenderr(fd, &mh, NULL,
+	ct = &pct->pct_ct[mh->mh_type];
+	if (ct->pc_siz && ct->pc_siz != mh->mh_size) {
+		psc_ctlsenderr(fd, mh, NULL,
 		    "invalid ctlmsg size; type=%d, size=%zu, want=%zu",
-		    mh.mh_type, mh.mh_size, ct[mh.mh_type].pc_siz);
+		    mh->mh_type, mh->mh_size, ct->pc_siz);
 		return (0);
 	}
 	OPSTAT_INCR("ctl.recv");
-	if (!ct[mh.mh_type].pc_op(fd, &mh, m))
-		return (EOF);
+
+	if (psc_dynarray_exists(&pfl_ctl_workqtypes,
+	    (void *)(uintptr_t)mh->mh_type) && pfl_workrq_pool &&
+	    psc_atomic32_read(&pfl_wkthr_n)) {
+		wk = pfl_workq_getitem_nb(pfl_ctlconn_runwk,
+		    struct pfl_ctl_wk);
+		if (wk) {
+			/* Replies already queued go out first. */
+			pfl_ctlconn_flush(pcc);
+			pcc->pcc_flags |= PCCF_WORKQ;
+			wk->pcw_conn = pcc;
+			wk->pcw_op = ct;
+
+			spinlock(&pcd->pcd_lock);
+			pcd->pcd_refcnt++;
+			freelock(&pcd->pcd_lock);
+
+			OPSTAT_INCR("ctl.workq");
+			pfl_workq_putitem(wk);
+			return (1);
+		}
+	}
+	if (!ct->pc_op(fd, mh, PSC_AGP(mh, sizeof(*mh))))
+		pcc->pcc_flags |= PCCF_DEAD;
 	return (0);
 }
 
+/*
+ * Serve a connection reported ready: send what the client has room
+ * for, then execute a bounded number of its requests so one busy
+ * client cannot monopolize the thread.
+ * @pct: control thread.
+ * @pcc: connection, now owned by the caller.
+ */
+__static void
+pfl_ctlconn_service(struct psc_ctlthr *pct, struct pfl_ctl_conn *pcc)
+{
+	int i;
+
+	pfl_ctlconn_flush(pcc);
+	for (i = 0; i < PFL_CTL_BATCH; i++) {
+		if (pcc->pcc_flags & (PCCF_EOF | PCCF_DEAD))
+			break;
+		if (pcc->pcc_olen - pcc->pcc_ooff > PFL_CTL_OBUF_HIWAT)
+			break;
+		if (pfl_ctlconn_read(pcc) != 1)
+			break;
+		if (pfl_ctlconn_dispatch(pct, pcc))
+			return;
+	}
+	pfl_ctlconn_release(pcc);
+}
+
 /*
  * Control thread connection acceptor.
  * @thr: thread.
@@ -2394,10 +3688,10 @@ psc_ctlthr_service(int fd, const struct psc_ctlop *ct, int nops,
 void
 psc_ctlacthr_main(struct psc_thread *thr)
 {
+	struct pfl_ctl_conn *pcc, *npcc;
 	struct psc_ctlacthr *pcat;
 	struct pfl_ctl_data *pcd;
-	int i, s, fd;
-	void *p;
+	int s, fd, fl;
 
 	pcat = psc_ctlacthr(thr);
 	pcd = &pcat->pcat_ctldata;
@@ -2417,11 +3711,20 @@ psc_ctlacthr_main(struct psc_thread *thr)
 		}
 		OPSTAT_INCR("ctl.accept");
 
+		fl = fcntl(fd, F_GETFL);
+		if (fl == -1 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) == -1)
+			psc_fatal("fcntl");
+
+		pcc = PSCALLOC(sizeof(*pcc));
+		pcc->pcc_fd = fd;
+		pcc->pcc_pcd = pcd;
+		INIT_PSC_LISTENTRY(&pcc->pcc_lentry);
+		pfl_ctlconn_setfd(fd, pcc);
+
 		spinlock(&pcd->pcd_lock);
-		psc_dynarray_add(&pcd->pcd_clifds,
-		    (void *)(uintptr_t)fd);
-		pfl_waitq_wakeall(&pcd->pcd_waitq);
+		psclist_add(&pcc->pcc_lentry, &pcd->pcd_conns);
 		freelock(&pcd->pcd_lock);
+		pfl_ctl_poll_arm(pcd, pcc, POLLIN, 1);
 	}
 
 	spinlock(&pcd->pcd_lock);
@@ -2429,12 +3732,16 @@ psc_ctlacthr_main(struct psc_thread *thr)
 		pfl_waitq_wait(&pcd->pcd_waitq, &pcd->pcd_lock);
 		spinlock(&pcd->pcd_lock);
 	}
+	freelock(&pcd->pcd_lock);
 
-	DYNARRAY_FOREACH(p, i, &pcd->pcd_clifds)
-		close((int)(long)p);
-	psc_dynarray_free(&pcd->pcd_clifds);
+	psclist_for_each_entry_safe(pcc, npcc, &pcd->pcd_conns,
+	    pcc_lentry)
+		pfl_ctlconn_close(pcc);
+	if (pcd->pcd_epfd != -1)
+		close(pcd->pcd_epfd);
 	pfl_waitq_destroy(&pcd->pcd_waitq);
 	psc_mutex_destroy(&pcd->pcd_mutex);
+	psc_mutex_destroy(&pcd->pcd_pollmutex);
 }
 
 void
@@ -2451,18 +3758,13 @@ pfl_ctl_destroy(struct pfl_ctl_data *pcd)
 void
 psc_ctlthr_mainloop(struct psc_thread *thr)
 {
-	const struct psc_ctlop *ct;
+	struct pfl_ctl_conn *v[PFL_CTL_NEVENTS];
 	struct pfl_ctl_data *pcd;
 	struct psc_ctlthr *pct;
-	size_t bufsiz = 0;
-	void *buf = NULL;
-	uint32_t rnd;
-	int s, nops;
+	int i, n;
 
 	pct = psc_ctlthr(thr);
 	pcd = pct->pct_ctldata;
-	ct = pct->pct_ct;
-	nops = pct->pct_nops;
 	while (pscthr_run(thr)) {
 		spinlock(&pcd->pcd_lock);
 		if (pcd->pcd_dead) {
@@ -2471,27 +3773,14 @@ psc_ctlthr_mainloop(struct psc_thread *thr)
 			freelock(&pcd->pcd_lock);
 			break;
 		}
-		if (psc_dynarray_len(&pcd->pcd_clifds) == 0) {
-			pfl_waitq_wait(&pcd->pcd_waitq, &pcd->pcd_lock);
-			continue;
-		}
-		rnd = psc_random32u(psc_dynarray_len(&pcd->pcd_clifds));
-		s = (int)(long)psc_dynarray_getpos(&pcd->pcd_clifds,
-		    rnd);
-		psc_dynarray_remove(&pcd->pcd_clifds,
-		    (void *)(uintptr_t)s);
 		freelock(&pcd->pcd_lock);
 
-		if (!psc_ctlthr_service(s, ct, nops, &bufsiz, &buf)) {
-			spinlock(&pcd->pcd_lock);
-			psc_dynarray_add(&pcd->pcd_clifds,
-			    (void *)(uintptr_t)s);
-			pfl_waitq_wakeall(&pcd->pcd_waitq);
-			freelock(&pcd->pcd_lock);
-		} else
-			close(s);
+		thr->pscthr_waitq = "ctl-loop";
+		n = pfl_ctl_poll_wait(pcd, v, nitems(v), 1000);
+		thr->pscthr_waitq = NULL;
+		for (i = 0; i < n; i++)
+			pfl_ctlconn_service(pct, v[i]);
 	}
-	PSCFREE(buf);
 }
 
 struct psc_ctlacthr *
@@ -2559,14 +3848,29 @@ psc_ctlthr_spawn_listener(const char *ofn, int acthrtype)
 		psc_fatal("listen");
 
 	pcd->pcd_sock = s;
-	psc_dynarray_init(&pcd->pcd_clifds);
+	INIT_PSCLIST_HEAD(&pcd->pcd_conns);
 	INIT_SPINLOCK(&pcd->pcd_lock);
 	pfl_waitq_init(&pcd->pcd_waitq, "ctl-loop");
 	psc_mutex_init(&pcd->pcd_mutex);
+	psc_mutex_init(&pcd->pcd_pollmutex);
+	pfl_ctl_poll_init(pcd);
 	pscthr_setready(acthr);
 	return (pcat);
 }
 
+/*
+ * Mark a control message type as long-running: its requests are handed
+ * to a worker so they cannot stall the event loop.  Must be called
+ * before psc_ctlthr_main().
+ * @type: PCMT_* or daemon message type.
+ */
+void
+psc_ctlop_setworkq(int type)
+{
+	psc_dynarray_add_ifdne(&pfl_ctl_workqtypes,
+	    (void *)(uintptr_t)type);
+}
+
 /*
  * Main control thread client service loop.
  * @ofn: path to control socket.
@@ -2587,6 +3891,10 @@ psc_ctlthr_main(const char *ofn, const struct psc_ctlop *ct, int nops,
 
 	me = pscthr_get();
 
+	/* default operations slow enough to hold up other clients */
+	psc_ctlop_setworkq(PCMT_GETHEAPPROF);
+	psc_ctlop_setworkq(PCMT_SETPARAM);
+
 	p = strstr(me->pscthr_name, "ctlthr");
 	if (p == NULL)
 		psc_fatalx("'ctlthr' not found in control thread name");
@@ -2596,10 +3904,10 @@ psc_ctlthr_main(const char *ofn, const struct psc_ctlop *ct, int nops,
 	spinlock(&pcd->pcd_lock);
 
 	/*
- 	 * The main thread has already become a control thread. A total
- 	 * of 3 control threads should be enough.
- 	 */
-	for (i = 1; i < 3; i++) {
+	 * The main thread has already become a control thread.  Clients
+	 * are multiplexed, so a couple of threads serve many of them.
+	 */
+	for (i = 1; i < PFL_CTL_NTHR; i++) {
 		thr = pscthr_init(me->pscthr_type, psc_ctlthr_mainloop,
 		    sizeof(struct psc_ctlthr) + extra, "%.*sctlthr%d", 
 		    p - me->pscthr_name, me->pscthr_name, i);
@@ -32,10 +32,13 @@
 #include <sys/un.h>
 
 #include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "pfl/str.h"
 #include "pfl/atomic.h"
+#include "pfl/ctl.h"
 #include "pfl/thread.h"
 
 struct psc_ctlmsghdr;
@@ -62,34 +65,77 @@ struct psc_ctlparam_node;
 	{ psc_ctlrep_getfault,		sizeof(struct psc_ctlmsg_fault) },	\
 	{ NULL /* GETFSRQ */,		0 },					\
 	{ psc_ctlrep_gethashtable,	sizeof(struct psc_ctlmsg_hashtable) },	\
+	{ pfl_ctlrep_getheapprof,	sizeof(struct pfl_ctlmsg_heapprof) },	\
+	{ pfl_ctlrep_gethistogram,	sizeof(struct pfl_ctlmsg_histogram) },	\
 	{ NULL /* GETJOURNAL */,	0 },					\
 	{ psc_ctlrep_getlistcache,	sizeof(struct psc_ctlmsg_listcache) },	\
 	{ NULL /* GETLNETIF */,		0 },					\
+	{ pfl_ctlrep_getlockprof,	sizeof(struct pfl_ctlmsg_lockprof) },	\
 	{ psc_ctlrep_getmeter,		sizeof(struct psc_ctlmsg_meter) },	\
 	{ psc_ctlrep_getmlist,		sizeof(struct psc_ctlmsg_mlist) },	\
 	{ psc_ctlrep_getodtable,	sizeof(struct psc_ctlmsg_odtable) },	\
 	{ psc_ctlrep_getopstat,		sizeof(struct psc_ctlmsg_opstat) },	\
 	{ psc_ctlrep_param,		sizeof(struct psc_ctlmsg_param) },	\
 	{ psc_ctlrep_getpool,		sizeof(struct psc_ctlmsg_pool) },	\
+	{ NULL /* GETRPCOP */,		0 },					\
 	{ NULL /* GETRPCRQ */,		0 },					\
 	{ NULL /* GETRPCSVC */,		0 },					\
+	{ pfl_ctlrep_getslab,		sizeof(struct pfl_ctlmsg_slab) },	\
+	{ pfl_ctlrep_getsnapshot,	sizeof(struct pfl_ctlmsg_snapshot) },	\
 	{ psc_ctlrep_getsubsys,		0 },					\
 	{ psc_ctlrep_getthread,		sizeof(struct psc_ctlmsg_thread) },	\
 	{ pfl_ctlrep_getworkrq,		sizeof(struct pfl_ctlmsg_workrq) },	\
 	{ psc_ctlrep_param,		sizeof(struct psc_ctlmsg_param) }
 
+#define PFL_CTL_NTHR		2		/* event loop threads incl. caller */
+#define PFL_CTL_NEVENTS		32		/* max events per wait */
+#define PFL_CTL_BATCH		8		/* max requests per turn */
+#define PFL_CTL_MSGSZ_MAX	(1024 * 1024)	/* largest request accepted */
+#define PFL_CTL_OBUF_HIWAT	(256 * 1024)	/* stop reading requests */
+#define PFL_CTL_OBUF_MAX	(64 * 1024 * 1024)	/* drop the client */
+#ifndef PFL_CTL_STALL_MSEC
+#define PFL_CTL_STALL_MSEC	30000		/* max worker wait on a client */
+#endif
+
 struct pfl_ctl_data {
 	struct sockaddr_un	 pcd_saun;
 	struct psc_thread	*pcd_acthr;
 	int			 pcd_dead;
 	int			 pcd_refcnt;
 	int			 pcd_sock;
-	struct psc_dynarray	 pcd_clifds;
+	int			 pcd_epfd;
+	struct psclist_head	 pcd_conns;	/* all client connections */
 	psc_spinlock_t		 pcd_lock;
 	struct pfl_waitq	 pcd_waitq;
 	struct pfl_mutex	 pcd_mutex;
+	struct pfl_mutex	 pcd_pollmutex;	/* poll(2) fallback */
+};
+
+/*
+ * A control client connection.  It is owned by exactly one thread at a
+ * time: an event loop thread after a readiness event, or a worker while
+ * a long-running operation executes, so its buffers need no locking.
+ */
+struct pfl_ctl_conn {
+	int			 pcc_fd;
+	int			 pcc_flags;
+	int			 pcc_events;	/* POLLIN/POLLOUT wanted */
+	void			*pcc_ibuf;	/* request header and body */
+	size_t			 pcc_ilen;
+	size_t			 pcc_ibufsz;
+	char			*pcc_obuf;	/* replies pending */
+	size_t			 pcc_ooff;
+	size_t			 pcc_olen;
+	size_t			 pcc_obufsz;
+	struct pfl_ctl_data	*pcc_pcd;
+	struct psclist_head	 pcc_lentry;	/* pcd_conns */
 };
 
+#define PCCF_EOF		(1 << 0)	/* client finished sending */
+#define PCCF_DEAD		(1 << 1)	/* close once released */
+#define PCCF_WORKQ		(1 << 2)	/* owned by a worker */
+#define PCCF_ARMED		(1 << 3)	/* awaiting events */
+
 struct psc_ctlacthr {
 	struct pfl_ctl_data	 pcat_ctldata;
 };
@@ -105,6 +151,63 @@ struct psc_ctlop {
 	size_t	  pc_siz;
 };
 
+/* batched snapshot filtering, see pfl_ctlrep_getsnapshot() */
+#define PFL_CTLSNAP_MAXTERMS	8
+
+enum {
+	PCSFT_STR,
+	PCSFT_I32,
+	PCSFT_I64,
+	PCSFT_DBL
+};
+
+enum {
+	PCSOP_EQ,
+	PCSOP_NE,
+	PCSOP_LT,
+	PCSOP_LE,
+	PCSOP_GT,
+	PCSOP_GE
+};
+
+struct pfl_ctlsnap_field {
+	const char			 *pcsf_name;
+	int				  pcsf_type;	/* PCSFT_* */
+	size_t				  pcsf_off;
+};
+
+struct pfl_ctlsnap_term {
+	const struct pfl_ctlsnap_field	 *pcst_field;
+	int				  pcst_op;	/* PCSOP_* */
+	const char			 *pcst_str;
+	int64_t				  pcst_int;
+	double				  pcst_dbl;
+};
+
+struct pfl_ctlsnap;
+
+struct pfl_ctlsnap_type {
+	int				  pcsy_type;	/* PCMT_* */
+	size_t				  pcsy_recsz;
+	int				(*pcsy_walk)(struct pfl_ctlsnap *);
+	const struct pfl_ctlsnap_field	 *pcsy_fields;
+	int				  pcsy_nfields;
+};
+
+struct pfl_ctlsnap {
+	int				  pcs_fd;
+	struct psc_ctlmsghdr		  pcs_mh;
+	const struct pfl_ctlsnap_type	 *pcs_type;
+	struct pfl_ctlsnap_term		  pcs_terms[PFL_CTLSNAP_MAXTERMS];
+	int				  pcs_nterms;
+	char				  pcs_filter[PFLCTL_SNAP_FILTER_MAX];
+	struct pfl_ctlmsg_snapshot	 *pcs_frame;
+	struct pfl_ctlmsg_snapshot	 *pcs_zframe;	/* deflated copy */
+};
+
+#define PCSF(type, name, ftype, field)					\
+	{ (name), (ftype), offsetof(struct type, field) }
+
 int	psc_ctlsenderr(int, const struct psc_ctlmsghdr *, struct pfl_mutex *, const char *, ...);
 int	psc_ctlmsg_sendv(int, const struct psc_ctlmsghdr *, const void *, struct pfl_mutex *);
 int	psc_ctlmsg_send(int, int, int, size_t, const void *, struct pfl_mutex *);
@@ -112,16 +215,22 @@ int	psc_ctlmsg_send(int, int, int, size_t, const void *, struct pfl_mutex *);
 int	psc_ctlrep_getfault(int, struct psc_ctlmsghdr *, void *);
 int	pfl_ctlrep_getfsrq(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_gethashtable(int, struct psc_ctlmsghdr *, void *);
+int	pfl_ctlrep_getheapprof(int, struct psc_ctlmsghdr *, void *);
+int	pfl_ctlrep_gethistogram(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getjournal(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getlistcache(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getlnetif(int, struct psc_ctlmsghdr *, void *);
+int	pfl_ctlrep_getlockprof(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getmeter(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getmlist(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getodtable(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getopstat(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getpool(int, struct psc_ctlmsghdr *, void *);
+int	psc_ctlrep_getrpcop(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getrpcrq(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getrpcsvc(int, struct psc_ctlmsghdr *, void *);
+int	pfl_ctlrep_getslab(int, struct psc_ctlmsghdr *, void *);
+int	pfl_ctlrep_getsnapshot(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getsubsys(int, struct psc_ctlmsghdr *, void *);
 int	psc_ctlrep_getthread(int, struct psc_ctlmsghdr *, void *);
 int	pfl_ctlrep_getworkrq(int, struct psc_ctlmsghdr *, void *);
@@ -156,6 +265,10 @@ int	psc_ctlparam_pause(int, struct psc_ctlmsghdr *,
 		struct psc_ctlmsg_param *, char **, int, struct psc_ctlparam_node *);
 int	psc_ctlparam_faults(int, struct psc_ctlmsghdr *,
 		struct psc_ctlmsg_param *, char **, int, struct psc_ctlparam_node *);
+int	pfl_ctlparam_lockprof(int, struct psc_ctlmsghdr *,
+		struct psc_ctlmsg_param *, char **, int, struct psc_ctlparam_node *);
+int	pfl_ctlparam_trace(int, struct psc_ctlmsghdr *,
+		struct psc_ctlmsg_param *, char **, int, struct psc_ctlparam_node *);
 
 enum pflctl_paramt {
 	PFLCTL_PARAMT_NONE,
@@ -178,9 +291,14 @@ int	psc_ctlmsg_param_send(int, const struct psc_ctlmsghdr *,
 
 void	pfl_ctl_destroy(struct pfl_ctl_data *);
 void	psc_ctlthr_main(const char *, const struct psc_ctlop *, int, int, int);
+void	psc_ctlop_setworkq(int);
 int	psc_ctl_applythrop(int, struct psc_ctlmsghdr *, void *, const char *,
 		int (*)(int, struct psc_ctlmsghdr *, void *, struct psc_thread *));
 
 void	psc_ctlthr_mainloop(struct psc_thread *);
 
+int	pfl_ctlsnap_match(const struct pfl_ctlsnap *, const void *);
+const char *
+	pfl_ctlsnap_parse(struct pfl_ctlsnap *);
+
 #endif /* _PFL_CTLSVR_H_ */
@@ -48,10 +48,31 @@ psc_dynarray_initf(struct psc_dynarray *pda, int flags)
 {
 	pda->pda_pos = 0;
 	pda->pda_nalloc = 0;
+	pda->pda_ninline = 0;
 	pda->pda_flags = flags;
 	pda->pda_items = NULL;
 }
 
+/*
+ * Initialize a dynamic array declared with PSC_DYNARRAY_SB() so its
+ * first items are stored in the buffer trailing the structure.
+ * @pda: dynamic array to initialize.
+ * @flags: behavioral flags.
+ * @ninline: number of slots in the trailing buffer.
+ */
+void
+_psc_dynarray_initsb(struct psc_dynarray *pda, int flags, int ninline)
+{
+	psc_dynarray_initf(pda, flags);
+	pda->pda_ninline = ninline;
+	pda->pda_items = PSC_DYNARRAY_SBUF(pda);
+	pda->pda_nalloc = ninline;
+	memset(pda->pda_items, 0, ninline * sizeof(*pda->pda_items));
+}
+
+#define DYNARRAY_ISINLINE(pda)						\
+	((pda)->pda_ninline && (pda)->pda_items == PSC_DYNARRAY_SBUF(pda))
+
 int
 psc_dynarray_pos(const struct psc_dynarray *pda)
 {
@@ -69,12 +90,27 @@ _psc_dynarray_resize(struct psc_dynarray *pda, int n)
 	int i, flags;
 	void *p;
 
+	/* statically initialized small-buffer array: start inline */
+	if (pda->pda_items == NULL && pda->pda_ninline &&
+	    n <= pda->pda_ninline) {
+		pda->pda_items = PSC_DYNARRAY_SBUF(pda);
+		pda->pda_nalloc = 0;
+		n = pda->pda_ninline;
+		goto zero;
+	}
+
 	flags = 0;
 	if (pda->pda_flags & PDAF_NOLOG)
 		flags |= PAF_NOLOG;
-	p = psc_realloc(pda->pda_items,
-	    n * sizeof(*pda->pda_items), flags);
+	if (DYNARRAY_ISINLINE(pda)) {
+		p = psc_alloc(n * sizeof(*pda->pda_items), flags);
+		memcpy(p, pda->pda_items,
+		    pda->pda_nalloc * sizeof(*pda->pda_items));
+	} else
+		p = psc_realloc(pda->pda_items,
+		    n * sizeof(*pda->pda_items), flags);
 	pda->pda_items = p;
+ zero:
 	/* Initialize any new slots to zero. */
 	for (i = pda->pda_nalloc; i < n; i++)
 		pda->pda_items[i] = NULL;
@@ -96,8 +132,15 @@ psc_dynarray_ensurelen(struct psc_dynarray *pda, int n)
 	int rc;
 
 	rc = 0;
-	if (n > pda->pda_nalloc)
+	if (n > pda->pda_nalloc) {
+		/*
+		 * Grow geometrically so repeated single-item splices
+		 * or ensurelen(len + 1) calls stay amortized O(1).
+		 */
+		if (pda->pda_nalloc && n < pda->pda_nalloc * 3 / 2)
+			n = pda->pda_nalloc * 3 / 2;
 		rc = _psc_dynarray_resize(pda, n);
+	}
 	return (rc);
 }
 
@@ -192,8 +235,13 @@ psc_dynarray_free(struct psc_dynarray *pda)
 
 	if (pda->pda_flags & PDAF_NOLOG)
 		flags |= PAF_NOLOG;
-	psc_free(pda->pda_items, flags);
-	psc_dynarray_init(pda);
+	if (!DYNARRAY_ISINLINE(pda))
+		psc_free(pda->pda_items, flags);
+	if (pda->pda_ninline)
+		_psc_dynarray_initsb(pda, pda->pda_flags,
+		    pda->pda_ninline);
+	else
+		psc_dynarray_initf(pda, pda->pda_flags);
 }
 
 /*
@@ -235,6 +283,18 @@ psc_dynarray_removepos(struct psc_dynarray *pda, int pos)
 	pda->pda_pos--;
 }
 
+/*
+ * Remove the given position from the dynarray, shifting subsequent
+ * items down to preserve their order.
+ */
+void
+psc_dynarray_removepos_ordered(struct psc_dynarray *pda, int pos)
+{
+	pfl_assert(pos >= 0 && pos < psc_dynarray_len(pda));
+	memmove(pda->pda_items + pos, pda->pda_items + pos + 1,
+	    (--pda->pda_pos - pos) * sizeof(*pda->pda_items));
+}
+
 /*
  * Remove an item from a dynamic array.
  * @pda: dynamic array to remove from.
@@ -330,6 +390,56 @@ psc_dynarray_bsearch(const struct psc_dynarray *pda, const void *item,
 	return (mid);
 }
 
+/*
+ * Insert an item into a sorted dynarray at the position that maintains
+ * sort order.
+ * @pda: sorted dynamic array.
+ * @item: item to insert.
+ * @cmpf: comparison routine.
+ * Returns the position the item was inserted at or -1 on failure.
+ */
+int
+psc_dynarray_add_sorted(struct psc_dynarray *pda, void *item,
+    int (*cmpf)(const void *, const void *))
+{
+	int pos;
+
+	pos = psc_dynarray_bsearch(pda, item, cmpf);
+	if (psc_dynarray_splice(pda, pos, 0, &item, 1))
+		return (-1);
+	return (pos);
+}
+
+/*
+ * Remove an item from a sorted dynarray, preserving sort order.
+ * @pda: sorted dynamic array.
+ * @item: item to remove; matched by identity among items comparing
+ *	equal to it.
+ * @cmpf: comparison routine.
+ * Returns the position the item had or -1 if it was not found.
+ */
+int
+psc_dynarray_remove_sorted(struct psc_dynarray *pda, const void *item,
+    int (*cmpf)(const void *, const void *))
+{
+	int pos, i;
+
+	pos = psc_dynarray_bsearch(pda, item, cmpf);
+	for (i = pos; i < psc_dynarray_len(pda) &&
+	    cmpf(item, pda->pda_items[i]) == 0; i++)
+		if (pda->pda_items[i] == item)
+			goto found;
+	for (i = pos - 1; i >= 0 &&
+	    cmpf(item, pda->pda_items[i]) == 0; i--)
+		if (pda->pda_items[i] == item)
+			goto found;
+	return (-1);
+
+ found:
+	psc_dynarray_removepos_ordered(pda, i);
+	return (i);
+}
+
 /*
  * Duplicate items in one dynarray to another.
  * @pda: dynamic array to copy to.
@@ -372,3 +482,22 @@ psc_dynarray_copy(const struct psc_dynarray *src,
 	dst->pda_pos = psc_dynarray_len(src);
 	return (0);
 }
+
+/*
+ * Backing store management for typed dynarrays; see
+ * PSC_DYNARRAY_TYPED().  Resize @items to hold at least @n elements of
+ * @esz bytes, growing geometrically, or release it when @n is zero.
+ */
+void *
+_psc_dynarray_tresize(void *items, int *nalloc, int n, size_t esz)
+{
+	if (n == 0) {
+		PSCFREE(items);
+		*nalloc = 0;
+		return (NULL);
+	}
+	n = MAX(n, MAX(8, *nalloc * 3 / 2));
+	items = psc_realloc(items, n * esz, 0);
+	*nalloc = n;
+	return (items);
+}
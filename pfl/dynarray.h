@@ -28,17 +28,49 @@
 #ifndef _PFL_DYNARRAY_H_
 #define _PFL_DYNARRAY_H_
 
+#include <stddef.h>
+#include <string.h>
+
 struct psc_dynarray {
 	int			  pda_flags;
 	int			  pda_pos;
 	int			  pda_nalloc;
+	int			  pda_ninline;	/* #slots in trailing buffer */
 	void			**pda_items;
 };
 
 #define PDAF_NOLOG		(1 << 0)	/* do not log allocations */
 
-#define DYNARRAY_INIT		{ 0, 0, 0, NULL }
-#define DYNARRAY_INIT_NOLOG	{ PDAF_NOLOG, 0, 0, NULL }
+#define DYNARRAY_INIT		{ 0, 0, 0, 0, NULL }
+#define DYNARRAY_INIT_NOLOG	{ PDAF_NOLOG, 0, 0, 0, NULL }
+
+/*
+ * Small-buffer dynarrays: declare a dynarray member followed directly
+ * by storage for its first @n items so short arrays never allocate.
+ * Once the array outgrows the buffer it moves to the heap as usual.
+ * The dynarray must not be copied by value while its items are inline.
+ *
+ *	struct foo {
+ *		PSC_DYNARRAY_SB(f_list, 4);
+ *	};
+ *
+ *	psc_dynarray_initsb(&foo->f_list, 4);
+ */
+#define PSC_DYNARRAY_SB(name, n)					\
+	struct psc_dynarray	  name;					\
+	void			 *name ## _sbuf[(n)]
+
+#define DYNARRAY_INIT_SB(n)	{ 0, 0, 0, (n), NULL }
+
+#define PSC_DYNARRAY_SBUF(pda)	((void **)((struct psc_dynarray *)(pda) + 1))
+
+/* PSC_DYNARRAY_SBUF() relies on no padding before the buffer. */
+struct _psc_dynarray_sbcheck {
+	PSC_DYNARRAY_SB(pds, 1);
+};
+typedef char _psc_dynarray_sbcheck_t[offsetof(struct
+    _psc_dynarray_sbcheck, pds_sbuf) == sizeof(struct psc_dynarray) ?
+    1 : -1];
 
 #define _DYNARRAY_FOREACH(initcode, p, n, pda)				\
 	for (initcode; ((n) < psc_dynarray_len(pda) || ((p) = NULL)) &&	\
@@ -100,6 +132,7 @@ struct psc_dynarray {
 	} while (0)
 
 #define psc_dynarray_init(da)		psc_dynarray_initf((da), 0)
+#define psc_dynarray_initsb(da, n)	_psc_dynarray_initsb((da), 0, (n))
 
 #define psc_dynarray_remove(da, p)	psc_dynarray_removeitem((da), (p))
 
@@ -112,8 +145,116 @@ struct psc_dynarray {
 		(da)->pda_pos = (n);					\
 	} while (0)
 
+/*
+ * Typed dynarrays store values of @type contiguously instead of
+ * pointers, for arrays of small records that are mostly iterated.
+ * PSC_DYNARRAY_TYPED(name, type) defines struct name and the inline
+ * accessors name_init(), name_len(), name_getpos(), name_add(),
+ * name_push(), name_ensurelen(), name_removepos(),
+ * name_removepos_ordered(), name_reset() and name_free().
+ */
+#define PSC_DYNARRAY_TYPED(name, type)					\
+	struct name {							\
+		int		  pdt_pos;				\
+		int		  pdt_nalloc;				\
+		type		 *pdt_items;				\
+	};								\
+									\
+	static __inline void						\
+	name ## _init(struct name *da)					\
+	{								\
+		memset(da, 0, sizeof(*da));				\
+	}								\
+									\
+	static __inline int						\
+	name ## _len(const struct name *da)				\
+	{								\
+		return (da->pdt_pos);					\
+	}								\
+									\
+	static __inline type *						\
+	name ## _getpos(const struct name *da, int pos)			\
+	{								\
+		pfl_assert(pos >= 0 && pos < da->pdt_pos);		\
+		return (&da->pdt_items[pos]);				\
+	}								\
+									\
+	static __inline void						\
+	name ## _ensurelen(struct name *da, int n)			\
+	{								\
+		if (n > da->pdt_nalloc)					\
+			da->pdt_items = _psc_dynarray_tresize(		\
+			    da->pdt_items, &da->pdt_nalloc, n,		\
+			    sizeof(type));				\
+	}								\
+									\
+	/* Append a zeroed slot and return it for in-place fill. */	\
+	static __inline type *						\
+	name ## _push(struct name *da)					\
+	{								\
+		type *_p;						\
+									\
+		name ## _ensurelen(da, da->pdt_pos + 1);		\
+		_p = &da->pdt_items[da->pdt_pos++];			\
+		memset(_p, 0, sizeof(*_p));				\
+		return (_p);						\
+	}								\
+									\
+	static __inline void						\
+	name ## _add(struct name *da, type v)				\
+	{								\
+		name ## _ensurelen(da, da->pdt_pos + 1);		\
+		da->pdt_items[da->pdt_pos++] = v;			\
+	}								\
+									\
+	static __inline void						\
+	name ## _removepos(struct name *da, int pos)			\
+	{								\
+		pfl_assert(pos >= 0 && pos < da->pdt_pos);		\
+		if (pos != --da->pdt_pos)				\
+			da->pdt_items[pos] =				\
+			    da->pdt_items[da->pdt_pos];			\
+	}								\
+									\
+	static __inline void						\
+	name ## _removepos_ordered(struct name *da, int pos)		\
+	{								\
+		pfl_assert(pos >= 0 && pos < da->pdt_pos);		\
+		memmove(&da->pdt_items[pos], &da->pdt_items[pos + 1],	\
+		    (--da->pdt_pos - pos) * sizeof(type));		\
+	}								\
+									\
+	static __inline void						\
+	name ## _reset(struct name *da)					\
+	{								\
+		da->pdt_pos = 0;					\
+	}								\
+									\
+	static __inline void						\
+	name ## _free(struct name *da)					\
+	{								\
+		_psc_dynarray_tresize(da->pdt_items,			\
+		    &da->pdt_nalloc, 0, sizeof(type));			\
+		name ## _init(da);					\
+	}								\
+	struct name
+
+#define TDYNARRAY_INIT		{ 0, 0, NULL }
+
+/**
+ * TDYNARRAY_FOREACH - Iterate across values of a typed dynarray.
+ * @p: pointer to the current value.
+ * @n: integer iterator variable.
+ * @da: typed dynamic array.
+ */
+#define TDYNARRAY_FOREACH(p, n, da)					\
+	for ((n) = 0; ((n) < (da)->pdt_pos || ((p) = NULL)) &&		\
+	    (((p) = &(da)->pdt_items[n]) || 1); (n)++)
+
 int	 psc_dynarray_add(struct psc_dynarray *, void *);
 int	 psc_dynarray_add_ifdne(struct psc_dynarray *, void *);
+int	 psc_dynarray_add_sorted(struct psc_dynarray *, void *,
+	    int (*)(const void *, const void *));
 int	 psc_dynarray_bsearch(const struct psc_dynarray *, const void *,
 	    int (*)(const void *, const void *));
 int	 psc_dynarray_concat(struct psc_dynarray *, const struct psc_dynarray *);
@@ -123,13 +264,18 @@ int	 psc_dynarray_finditem(struct psc_dynarray *, const void *);
 void	 psc_dynarray_free(struct psc_dynarray *);
 void	*psc_dynarray_getpos(const struct psc_dynarray *, int);
 void	 psc_dynarray_initf(struct psc_dynarray *, int);
+void	_psc_dynarray_initsb(struct psc_dynarray *, int, int);
 int	 psc_dynarray_removeitem(struct psc_dynarray *, const void *);
 void	 psc_dynarray_removepos(struct psc_dynarray *, int);
+void	 psc_dynarray_removepos_ordered(struct psc_dynarray *, int);
+int	 psc_dynarray_remove_sorted(struct psc_dynarray *, const void *,
+	    int (*)(const void *, const void *));
 void	 psc_dynarray_reset(struct psc_dynarray *);
 void	 psc_dynarray_reverse_subsequence(struct psc_dynarray *, int, int);
 void	 psc_dynarray_setpos(struct psc_dynarray *, int, void *);
 int	 psc_dynarray_splice(struct psc_dynarray *, int, int, const void *, int);
 void	 psc_dynarray_swap(struct psc_dynarray *, int, int);
+void	*_psc_dynarray_tresize(void *, int *, int, size_t);
 
 int	 psc_dynarray_pos(const struct psc_dynarray *);
 
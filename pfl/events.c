@@ -34,6 +34,7 @@
 #include "pfl/rpc.h"
 #include "pfl/rpclog.h"
 #include "pfl/service.h"
+#include "pfl/trace.h"
 #include "pfl/types.h"
 #include "pfl/waitq.h"
 
@@ -186,6 +187,7 @@ pscrpc_request_in_callback(lnet_event_t *ev)
 	req->rq_self = ev->target.nid;
 	req->rq_rqbd = rqbd;
 	req->rq_phase = PSCRPC_RQ_PHASE_NEW;
+	PFL_TRACE_BEGIN(PSS_RPC, "rpc.queued", (uintptr_t)req);
 #ifdef CRAY_XT3
 	//req->rq_uid = ev->uid;
 #endif
@@ -390,6 +392,14 @@ pscrpc_reply_out_callback(lnet_event_t *ev)
 		ev->type == LNET_EVENT_ACK ||
 		ev->type == LNET_EVENT_UNLINK);
 
+	if (ev->unlinked) {
+		struct timeval now;
+
+		do_gettimeofday(&now);
+		pscrpc_svc_oprecord(svc, rs->rs_opc, PSCRPC_OPPH_REPLY,
+		    cfs_timeval_sub(&now, &rs->rs_sendtime, NULL));
+	}
+
 	if (rs->rs_compl)
 		psc_compl_one(rs->rs_compl, 1);
 
@@ -452,6 +462,14 @@ pscrpc_server_bulk_callback(lnet_event_t *ev)
 
 	if (ev->unlinked) {
 		/* This is the last callback no matter what... */
+		struct pscrpc_request *rq = desc->bd_req;
+		struct timeval now;
+
+		PFL_TRACE_END(PSS_RPC, "rpc.bulk", (uintptr_t)desc);
+		do_gettimeofday(&now);
+		pscrpc_svc_oprecord(rq->rq_rqbd->rqbd_service,
+		    rq->rq_reqmsg->opc, PSCRPC_OPPH_BULK,
+		    cfs_timeval_sub(&now, &desc->bd_start, NULL));
 		desc->bd_network_rw = 0;
 		pfl_waitq_wakeall(&desc->bd_waitq);
 	}
@@ -652,6 +670,8 @@ pscrpc_ni_init(int type, int nmsgs)
 	    NULL, "rpcrq");
 	pscrpc_rq_pool = psc_poolmaster_getmgr(&pscrpc_rq_poolmaster);
 
+	pfl_arenas_init();
+
 	pscrpc_conns_init();
 
 	rc = LNetInit(nmsgs);
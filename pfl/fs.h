@@ -25,11 +25,13 @@
 #define _PFL_FS_H_
 
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include <limits.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include "pfl/arena.h"
 #include "pfl/dynarray.h"
 #include "pfl/list.h"
 #include "pfl/multiwait.h"
@@ -40,6 +42,7 @@ struct statvfs;
 struct timespec;
 
 struct psc_thread;
+struct pfl_histogram;
 
 struct pscfs_args;
 struct pscfs_req;
@@ -77,6 +80,25 @@ struct pscfs_dirent {
 #define PFL_DIRENT_SIZE(len)	PFL_DIRENT_ALIGN(			\
 				    PFL_DIRENT_NAME_OFFSET + (len))
 
+/*
+ * Directory entry returned by readdirplus: the dirent is accompanied by
+ * everything a lookup reply would carry so the kernel can instantiate
+ * the dentry and cache its attributes without a round trip per entry.
+ */
+struct pscfs_direntplus {
+	pscfs_fgen_t		pfdp_gen;
+	double			pfdp_entry_timeout;
+	double			pfdp_attr_timeout;
+	struct stat		pfdp_stb;
+	struct pscfs_dirent	pfdp_dirent;		/* must be last */
+};
+
+#define PFL_DIRENTPLUS_NAME_OFFSET					\
+	(offsetof(struct pscfs_direntplus, pfdp_dirent) +		\
+	 PFL_DIRENT_NAME_OFFSET)
+#define PFL_DIRENTPLUS_SIZE(len)	PFL_DIRENT_ALIGN(			\
+				    PFL_DIRENTPLUS_NAME_OFFSET + (len))
+
 /* userland file system fills these in */
 struct pscfs {
 	struct pfl_opstat	*pf_opst_read_err;
@@ -124,6 +146,7 @@ struct pscfs {
 	void	(*pf_handle_getxattr)(struct pscfs_req *, const char *, size_t, pscfs_inum_t);
 	void	(*pf_handle_setxattr)(struct pscfs_req *, const char *, const void *, size_t, pscfs_inum_t);
 	void	(*pf_handle_removexattr)(struct pscfs_req *, const char *, pscfs_inum_t);
+	void	(*pf_handle_readdirplus)(struct pscfs_req *, size_t, off_t, void *);
 };
 
 #define PSCFS_INIT							\
@@ -162,8 +185,14 @@ struct pscfs_req {
 	int				 pfr_refcnt;
 	int				 pfr_rc;
 	const char			*pfr_opname;
+	struct pfl_histogram		*pfr_histo;	// request latency, usec
+	size_t				 pfr_rdsize;	// readdir reply limit
+	int				 pfr_flags;
+	struct pfl_arena		 pfr_arena;	// scratch memory freed with request
 };
 
+#define PFRF_RDPLUS_COMPAT	(1 << 0)	/* readdir emulating readdirplus */
+
 struct pfl_fsthr {
 	struct pscfs_req		*pft_pfr;
 	char				 pft_uprog[128];
@@ -203,6 +232,7 @@ void	pscfs_reply_open(struct pscfs_req *, void *, int, int);
 void	pscfs_reply_opendir(struct pscfs_req *, void *, int, int);
 void	pscfs_reply_read(struct pscfs_req *, struct iovec *, int, int);
 void	pscfs_reply_readdir(struct pscfs_req *, void *, ssize_t, int);
+void	pscfs_reply_readdirplus(struct pscfs_req *, void *, ssize_t, int);
 void	pscfs_reply_readlink(struct pscfs_req *, void *, int);
 void	pscfs_reply_rename(struct pscfs_req *, int);
 void	pscfs_reply_rmdir(struct pscfs_req *, int);
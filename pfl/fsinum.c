@@ -0,0 +1,401 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <sys/param.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "pfl/alloc.h"
+#include "pfl/cdefs.h"
+#include "pfl/fsinum.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/opstats.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+#include "pfl/waitq.h"
+
+/*
+ * A shard with fewer than 1/PFL_FSINUM_LOWAT of its slots free is
+ * scanned by the reclaim thread; one whose synchronous reclaim frees
+ * fewer than that is grown.
+ */
+#define PFL_FSINUM_LOWAT	8
+
+#define FSINUM_ENT(s, slot)						\
+	(&(s)->pfs_chunks[(slot) / PFL_FSINUM_CHUNKSZ]			\
+	    [(slot) % PFL_FSINUM_CHUNKSZ])
+#define FSINUM_SHARD(h)		(&pfl_fsinum_tbl[(h) & (PFL_FSINUM_NSHARDS - 1)])
+#define FSINUM_HOME(s, h)	((uint32_t)((h) >> 32) & (s)->pfs_idxmask)
+#define FSINUM_LOW(s)		((s)->pfs_nfree <				\
+				    (s)->pfs_nslots / PFL_FSINUM_LOWAT)
+
+__static struct pfl_fsinum_shard	*pfl_fsinum_tbl;
+__static uint32_t			 pfl_fsinum_maxslots;
+
+static __inline uint64_t
+pfl_fsinum_hash(uint64_t inum)
+{
+	uint64_t h = inum;
+
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return (h);
+}
+
+/*
+ * Find the index bucket for a pscfs inum, or the empty bucket that
+ * terminates its probe sequence.  The index is never more than half
+ * full so this always terminates.
+ */
+__static uint32_t *
+pfl_fsinum_shard_lookup(struct pfl_fsinum_shard *s, uint64_t inum,
+    uint64_t h)
+{
+	uint32_t i, *b;
+
+	for (i = FSINUM_HOME(s, h);; i = (i + 1) & s->pfs_idxmask) {
+		b = &s->pfs_idx[i];
+		if (*b == 0 || FSINUM_ENT(s, *b - 1)->pfe_pscfs_inum == inum)
+			break;
+	}
+	return (b);
+}
+
+/*
+ * Remove a slot from the shard index and release it to the free list.
+ */
+__static void
+pfl_fsinum_shard_free(struct pfl_fsinum_shard *s, uint32_t slot)
+{
+	struct pfl_fsinum_ent *pfe = FSINUM_ENT(s, slot);
+	uint32_t i, j, k;
+
+	i = pfl_fsinum_shard_lookup(s, pfe->pfe_pscfs_inum,
+	    pfl_fsinum_hash(pfe->pfe_pscfs_inum)) - s->pfs_idx;
+	pfl_assert(s->pfs_idx[i] == slot + 1);
+
+	/* shift back any entries that probed past the vacated bucket */
+	for (j = i;;) {
+		s->pfs_idx[i] = 0;
+		for (;;) {
+			j = (j + 1) & s->pfs_idxmask;
+			if (s->pfs_idx[j] == 0)
+				goto out;
+			k = FSINUM_HOME(s, pfl_fsinum_hash(FSINUM_ENT(s,
+			    s->pfs_idx[j] - 1)->pfe_pscfs_inum));
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+				continue;
+			break;
+		}
+		s->pfs_idx[i] = s->pfs_idx[j];
+		i = j;
+	}
+ out:
+	pfe->pfe_pscfs_inum = 0;
+	pfe->pfe_refcnt = 0;
+	s->pfs_freev[s->pfs_nfree++] = slot;
+}
+
+/*
+ * Release slots the kernel no longer holds references to.
+ * @now: current time.
+ * @force: ignore the timeout given to the kernel.
+ */
+__static uint32_t
+pfl_fsinum_shard_reclaim(struct pfl_fsinum_shard *s, time_t now,
+    int force)
+{
+	struct pfl_fsinum_ent *pfe;
+	uint32_t i, n = 0;
+
+	LOCK_ENSURE(&s->pfs_lock);
+	for (i = 0; i < s->pfs_nslots; i++) {
+		pfe = FSINUM_ENT(s, i);
+		if (pfe->pfe_pscfs_inum && pfe->pfe_refcnt == 0 &&
+		    (force || pfe->pfe_extime <= now)) {
+			pfl_fsinum_shard_free(s, i);
+			n++;
+		}
+	}
+	return (n);
+}
+
+/*
+ * Double the number of slots in a shard, up to the number addressable
+ * with 32-bit FUSE inums.  The shard lock is dropped while memory is
+ * allocated.
+ * Returns zero if the shard is already at its maximum size.
+ */
+__static int
+pfl_fsinum_shard_grow(struct pfl_fsinum_shard *s)
+{
+	struct pfl_fsinum_ent **chunks, **ochunks, *pfe;
+	uint32_t i, j, n, nn, nidx, *idx, *oidx, *freev, *ofreev;
+	int nc, onc;
+
+	n = s->pfs_nslots;
+	if (n >= pfl_fsinum_maxslots)
+		return (0);
+	nn = MIN((uint64_t)n * 2, pfl_fsinum_maxslots);
+	freelock(&s->pfs_lock);
+
+	onc = howmany(n, PFL_FSINUM_CHUNKSZ);
+	nc = howmany(nn, PFL_FSINUM_CHUNKSZ);
+	chunks = PSCALLOC(nc * sizeof(*chunks));
+	for (i = onc; i < (uint32_t)nc; i++)
+		chunks[i] = PSCALLOC(PFL_FSINUM_CHUNKSZ *
+		    sizeof(**chunks));
+	for (nidx = 1; nidx < nn * 2; nidx <<= 1)
+		;
+	idx = PSCALLOC(nidx * sizeof(*idx));
+	freev = PSCALLOC(nn * sizeof(*freev));
+
+	spinlock(&s->pfs_lock);
+	if (s->pfs_nslots != n) {
+		/* another thread grew the shard meanwhile */
+		freelock(&s->pfs_lock);
+		for (i = onc; i < (uint32_t)nc; i++)
+			PSCFREE(chunks[i]);
+		PSCFREE(chunks);
+		PSCFREE(idx);
+		PSCFREE(freev);
+		spinlock(&s->pfs_lock);
+		return (1);
+	}
+
+	memcpy(chunks, s->pfs_chunks, onc * sizeof(*chunks));
+	ochunks = s->pfs_chunks;
+	oidx = s->pfs_idx;
+	ofreev = s->pfs_freev;
+	s->pfs_chunks = chunks;
+	s->pfs_idx = idx;
+	s->pfs_idxmask = nidx - 1;
+	s->pfs_nslots = nn;
+
+	/* hand out the new slots after the ones already free */
+	for (i = 0, j = nn; j > n; )
+		freev[i++] = --j;
+	memcpy(freev + i, ofreev, s->pfs_nfree * sizeof(*freev));
+	s->pfs_freev = freev;
+	s->pfs_nfree += nn - n;
+
+	for (i = 0; i < n; i++) {
+		pfe = FSINUM_ENT(s, i);
+		if (pfe->pfe_pscfs_inum)
+			*pfl_fsinum_shard_lookup(s, pfe->pfe_pscfs_inum,
+			    pfl_fsinum_hash(pfe->pfe_pscfs_inum)) = i + 1;
+	}
+	freelock(&s->pfs_lock);
+
+	OPSTAT_INCR("fs.inum.grow");
+	PSCFREE(ochunks);
+	PSCFREE(oidx);
+	PSCFREE(ofreev);
+
+	spinlock(&s->pfs_lock);
+	return (1);
+}
+
+/*
+ * Initialize the table.
+ * @maxslots: limit on slots per shard, zero for as many as 32-bit FUSE
+ *	inums can address.
+ */
+void
+pfl_fsinum_init(uint32_t maxslots)
+{
+	struct pfl_fsinum_shard *s;
+	uint32_t j;
+	int i;
+
+	if (maxslots == 0 || maxslots > PFL_FSINUM_MAXSLOTS)
+		maxslots = PFL_FSINUM_MAXSLOTS;
+	pfl_fsinum_maxslots = maxslots;
+
+	pfl_fsinum_tbl = PSCALLOC(sizeof(*pfl_fsinum_tbl) *
+	    PFL_FSINUM_NSHARDS);
+	for (i = 0; i < PFL_FSINUM_NSHARDS; i++) {
+		s = &pfl_fsinum_tbl[i];
+		INIT_SPINLOCK(&s->pfs_lock);
+		s->pfs_nslots = MIN(PFL_FSINUM_CHUNKSZ, maxslots);
+		s->pfs_chunks = PSCALLOC(sizeof(*s->pfs_chunks));
+		s->pfs_chunks[0] = PSCALLOC(PFL_FSINUM_CHUNKSZ *
+		    sizeof(*s->pfs_chunks[0]));
+		for (s->pfs_idxmask = 1; s->pfs_idxmask <
+		    s->pfs_nslots * 2; s->pfs_idxmask <<= 1)
+			;
+		s->pfs_idx = PSCALLOC(s->pfs_idxmask *
+		    sizeof(*s->pfs_idx));
+		s->pfs_idxmask--;
+		s->pfs_freev = PSCALLOC(s->pfs_nslots *
+		    sizeof(*s->pfs_freev));
+		for (j = 0; j < s->pfs_nslots; j++)
+			s->pfs_freev[j] = s->pfs_nslots - 1 - j;
+		s->pfs_nfree = s->pfs_nslots;
+	}
+}
+
+/*
+ * Reclaim expired, unreferenced slots in shards running low on free
+ * slots.
+ * @now: current time.
+ * Returns the number of slots released.
+ */
+int
+pfl_fsinum_reclaim(time_t now)
+{
+	struct pfl_fsinum_shard *s;
+	int i, n = 0;
+
+	for (i = 0; i < PFL_FSINUM_NSHARDS; i++) {
+		s = &pfl_fsinum_tbl[i];
+		spinlock(&s->pfs_lock);
+		if (FSINUM_LOW(s))
+			n += pfl_fsinum_shard_reclaim(s, now, 0);
+		freelock(&s->pfs_lock);
+	}
+	if (n)
+		OPSTAT_ADD("fs.inum.reclaim", n);
+	return (n);
+}
+
+void
+pfl_fsinum_reclaimthr_main(struct psc_thread *thr)
+{
+	struct pfl_waitq dummy = PFL_WAITQ_INIT("fsinum");
+	struct timespec ts;
+
+	PFL_GETTIMESPEC(&ts);
+	while (pscthr_run(thr)) {
+		ts.tv_sec++;
+		pfl_waitq_waitabs(&dummy, NULL, &ts);
+		pfl_fsinum_reclaim(time(NULL));
+	}
+}
+
+/*
+ * Convert a 32-bit system inum to a 64-bit pscfs inum.
+ * @nforget: number of kernel lookup references to drop.
+ * Returns zero for an inum not in the table.
+ */
+uint64_t
+pfl_fsinum_fuse2pscfs(uint32_t f_inum, unsigned long nforget)
+{
+	struct pfl_fsinum_shard *s;
+	struct pfl_fsinum_ent *pfe;
+	uint64_t p_inum = 0;
+	uint32_t n, slot;
+
+	if (f_inum == 1)
+		return (1);
+
+	n = f_inum - PFL_FSINUM_BASE;
+	s = &pfl_fsinum_tbl[n % PFL_FSINUM_NSHARDS];
+	slot = n / PFL_FSINUM_NSHARDS;
+
+	spinlock(&s->pfs_lock);
+	if (f_inum >= PFL_FSINUM_BASE && slot < s->pfs_nslots) {
+		pfe = FSINUM_ENT(s, slot);
+		p_inum = pfe->pfe_pscfs_inum;
+		if (nforget) {
+			if (pfe->pfe_refcnt < (int32_t)nforget) {
+				psclog_warnx("inum %x: forget %lu with "
+				    "%d refs", f_inum, nforget,
+				    pfe->pfe_refcnt);
+				pfe->pfe_refcnt = 0;
+			} else
+				pfe->pfe_refcnt -= nforget;
+		}
+	}
+	freelock(&s->pfs_lock);
+
+	if (p_inum == 0)
+		psclog_warnx("inum %x: stale FUSE inum", f_inum);
+	return (p_inum);
+}
+
+/*
+ * Convert a 64-bit pscfs inum to a 32-bit system inum.
+ * @timeo: timeout the kernel is given for this inum.
+ * @ref: whether the kernel takes a lookup reference.
+ * Returns zero if every slot the inum could be given is held by the
+ * kernel.
+ */
+uint32_t
+pfl_fsinum_pscfs2fuse(uint64_t p_inum, double timeo, int ref)
+{
+	struct pfl_fsinum_shard *s;
+	struct pfl_fsinum_ent *pfe;
+	uint32_t nslots, slot, *b;
+	time_t now, extime;
+	uint64_t h;
+
+	if (p_inum == 1)
+		return (1);
+
+	now = time(NULL);
+	h = pfl_fsinum_hash(p_inum);
+	s = FSINUM_SHARD(h);
+
+	spinlock(&s->pfs_lock);
+ retry:
+	b = pfl_fsinum_shard_lookup(s, p_inum, h);
+	if (*b == 0) {
+		if (s->pfs_nfree == 0) {
+			OPSTAT_INCR("fs.inum.reclaim-sync");
+			pfl_fsinum_shard_reclaim(s, now, 1);
+			if ((FSINUM_LOW(s) && pfl_fsinum_shard_grow(s)) ||
+			    s->pfs_nfree)
+				goto retry;
+			nslots = s->pfs_nslots;
+			freelock(&s->pfs_lock);
+
+			OPSTAT_INCR("fs.inum.exhausted");
+			psclog_warnx("FUSE inum table shard full: %u "
+			    "referenced inums", nslots);
+			return (0);
+		}
+		slot = s->pfs_freev[--s->pfs_nfree];
+		pfe = FSINUM_ENT(s, slot);
+		pfe->pfe_pscfs_inum = p_inum;
+		pfe->pfe_refcnt = 0;
+		pfe->pfe_extime = 0;
+		*b = slot + 1;
+	} else
+		slot = *b - 1;
+
+	pfe = FSINUM_ENT(s, slot);
+	if (ref)
+		pfe->pfe_refcnt++;
+	extime = now + (time_t)timeo + 1;
+	if (extime > pfe->pfe_extime)
+		pfe->pfe_extime = extime;
+	freelock(&s->pfs_lock);
+
+	return (PFL_FSINUM_BASE + slot * PFL_FSINUM_NSHARDS +
+	    (s - pfl_fsinum_tbl));
+}
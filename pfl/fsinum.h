@@ -0,0 +1,82 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Translation of 64-bit pscfs inums to the 32-bit inums FUSE uses on
+ * platforms where fuse_ino_t is 32 bits wide.
+ *
+ * A FUSE inum handed to the kernel directly addresses a slot in one of
+ * a fixed number of independently locked shards, so FUSE -> pscfs is a
+ * single array index.  pscfs -> FUSE goes through a per-shard
+ * open-addressed index (linear probing with backward shift deletion,
+ * so no tombstones) keyed by pscfs inum.
+ *
+ * Each slot counts the lookup references held by the kernel, which
+ * are dropped by FORGET.  Unreferenced slots are reclaimed after the
+ * timeout given to the kernel elapses by a background thread, which
+ * only visits shards running low on free slots, or immediately by an
+ * allocating thread that finds its shard full.  A shard that is still
+ * short of free slots afterwards grows.
+ */
+
+#ifndef _PFL_FSINUM_H_
+#define _PFL_FSINUM_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "pfl/lock.h"
+
+struct psc_thread;
+
+#define PFL_FSINUM_NSHARDS	32		/* power of two */
+#define PFL_FSINUM_CHUNKSZ	8192		/* initial slots per shard */
+#define PFL_FSINUM_BASE		2		/* first FUSE inum used */
+
+/* largest number of slots a shard can address with 32-bit FUSE inums */
+#define PFL_FSINUM_MAXSLOTS						\
+	((uint32_t)((UINT32_MAX - PFL_FSINUM_BASE + 1) / PFL_FSINUM_NSHARDS))
+
+struct pfl_fsinum_ent {
+	uint64_t		 pfe_pscfs_inum;	/* 0 if slot is free */
+	int32_t			 pfe_refcnt;		/* kernel lookup refs */
+	time_t			 pfe_extime;		/* when fuse expires it */
+};
+
+struct pfl_fsinum_shard {
+	struct psc_spinlock	 pfs_lock;
+	uint32_t		 pfs_nslots;
+	uint32_t		 pfs_nfree;
+	uint32_t		 pfs_idxmask;		/* index buckets - 1 */
+	uint32_t		*pfs_freev;
+	uint32_t		*pfs_idx;		/* slot + 1, 0 if empty */
+	struct pfl_fsinum_ent	**pfs_chunks;		/* PFL_FSINUM_CHUNKSZ each */
+};
+
+void		pfl_fsinum_init(uint32_t);
+uint64_t	pfl_fsinum_fuse2pscfs(uint32_t, unsigned long);
+uint32_t	pfl_fsinum_pscfs2fuse(uint64_t, double, int);
+int		pfl_fsinum_reclaim(time_t);
+void		pfl_fsinum_reclaimthr_main(struct psc_thread *);
+
+#endif /* _PFL_FSINUM_H_ */
@@ -40,16 +40,18 @@
 #include <fuse_lowlevel.h>
 
 #include "pfl/alloc.h"
+#include "pfl/arena.h"
 #include "pfl/ctl.h"
 #include "pfl/ctlsvr.h"
 #include "pfl/dynarray.h"
 #include "pfl/fs.h"
+#include "pfl/fsinum.h"
 #include "pfl/fsmod.h"
 #include "pfl/lock.h"
 #include "pfl/log.h"
 #include "pfl/pool.h"
-#include "pfl/random.h"
 #include "pfl/sys.h"
+#include "pfl/trace.h"
 #include "pfl/waitq.h"
 #include "pfl/workthr.h"
 
@@ -82,25 +84,14 @@
 
 #ifdef __LP64__
 #  define INUM_FUSE2PSCFS(inum)		(inum)
-#  define INUM_FUSE2PSCFS_DEL(inum)	(inum)
+#  define INUM_FUSE2PSCFS_FORGET(inum, n) (inum)
 #  define INUM_PSCFS2FUSE(inum, tmo)	(inum)
+#  define INUM_PSCFS2FUSE_ATTR(inum, tmo) (inum)
 #else
-#  define INUM_FUSE2PSCFS(inum)		pscfs_inum_fuse2pscfs((inum), 0)
-#  define INUM_FUSE2PSCFS_DEL(inum)	pscfs_inum_fuse2pscfs((inum), 1)
-#  define INUM_PSCFS2FUSE(inum, tmo)	pscfs_inum_pscfs2fuse((inum), (tmo))
-
-struct pscfs_inumcol {
-	pscfs_inum_t		 pfic_pscfs_inum;
-	uint64_t		 pfic_key;		/* fuse inum */
-	psc_atomic32_t		 pfic_refcnt;
-	struct timeval		 pfic_extime;		/* when fuse expires it */
-	struct psc_listentry	 pfic_lentry;		/* pool */
-	struct pfl_hashentry	 pfic_hentry;
-};
-
-static struct psc_poolmaster	 pflfs_inumcol_poolmaster;
-static struct psc_poolmgr	*pflfs_inumcol_pool;
-static struct psc_hashtbl	 pflfs_inumcol_hashtbl;
+#  define INUM_FUSE2PSCFS(inum)		pfl_fsinum_fuse2pscfs((inum), 0)
+#  define INUM_FUSE2PSCFS_FORGET(inum, n) pfl_fsinum_fuse2pscfs((inum), (n))
+#  define INUM_PSCFS2FUSE(inum, tmo)	pfl_fsinum_pscfs2fuse((inum), (tmo), 1)
+#  define INUM_PSCFS2FUSE_ATTR(inum, tmo) pfl_fsinum_pscfs2fuse((inum), (tmo), 0)
 #endif
 
 typedef struct {
@@ -516,25 +507,9 @@ pscfs_main(int nthr, const char *thrname)
 	pflfs_module_add(PFLFS_MOD_POS_LAST, &pscfs_default_ops);
 
 #ifndef __LP64__
-	struct pscfs_inumcol *pfic;
-
-#define INUMCOL_SZ (4096 - 1)
-	psc_poolmaster_init(&pflfs_inumcol_poolmaster, struct
-	    pscfs_inumcol, pfic_lentry, PPMF_AUTO, INUMCOL_SZ,
-	    INUMCOL_SZ / 2, INUMCOL_SZ * 2, NULL,
-	    "inumcol");
-	pflfs_inumcol_pool = psc_poolmaster_getmgr(&pflfs_inumcol_poolmaster);
-	psc_hashtbl_init(&pflfs_inumcol_hashtbl, 0,
-	    struct pscfs_inumcol, pfic_key, pfic_hentry, INUMCOL_SZ * 4,
-	    NULL, "inumcol");
-
-	pfic = psc_pool_get(pflfs_inumcol_pool);
-	memset(pfic, 0, sizeof(*pfic));
-	psc_hashent_init(&pflfs_inumcol_hashtbl, pfic);
-	pfic->pfic_pscfs_inum = 1;
-	pfic->pfic_key = 1;
-	psc_atomic32_set(&pfic->pfic_refcnt, 1);
-	psc_hashtbl_add_item(&pflfs_inumcol_hashtbl, pfic);
+	pfl_fsinum_init(0);
+	pscthr_init(PFL_THRT_FSMGR, pfl_fsinum_reclaimthr_main, 0,
+	    "%sfsinumthr", thrname);
 #endif
 
 	psc_poolmaster_init(&pflfs_req_poolmaster, struct pscfs_req,
@@ -542,6 +517,8 @@ pscfs_main(int nthr, const char *thrname)
 	    "fsrq");
 	pflfs_req_pool = psc_poolmaster_getmgr(&pflfs_req_poolmaster);
 
+	pfl_arenas_init();
+
 	psc_poolmaster_init(&pflfs_filehandle_poolmaster,
 	    struct pflfs_filehandle, pfh_lentry, PPMF_AUTO, 64, 64,
 	    0, NULL, "fh");
@@ -661,129 +638,30 @@ pscfs_getumask(struct pscfs_req *pfr)
 	return (0644);
 }
 
-#if 0
-int
-pscfs_inum_reclaim(struct psc_poolmgr *m, int n)
-{
-	time_t now;
-	int nrel = 0;
-
-	PFL_GETTIMEVAL(&now);
-	/* XXX start at random position */
-	PSC_HASHTBL_FOREACH_BUCKET(t, b) {
-		psc_hashbkt_lock(b);
-		PSC_HASHBKT_FOREACH_ENTRY(t, b, pfic) {
-			if (pfic->pfic_extime &&
-			    timercmp(&now, &pfic->pfic_extime, >) &&
-			    refcnt == 0)
-				evict
-		}
-		psc_hashbkt_unlock(b);
-	}
-}
-#endif
-
 #ifndef __LP64__
-/* convert a 32-bit system inum to a 64-bit pscfs inum */
-pscfs_inum_t
-pscfs_inum_fuse2pscfs(fuse_ino_t f_inum, int del)
-{
-	struct pscfs_inumcol *pfic;
-	struct psc_hashbkt *b;
-	pscfs_inum_t p_inum;
-	uint64_t key;
-
-	key = f_inum;
-	b = psc_hashbkt_get(&pflfs_inumcol_hashtbl, &key);
-	psc_hashbkt_lock(b);
-	pfic = psc_hashtbl_search(&pflfs_inumcol_hashtbl, NULL,
-	    NULL, &key);
-	p_inum = pfic->pfic_pscfs_inum;
-	if (del) {
-		psc_atomic32_dec(&pfic->pfic_refcnt);
-		if (psc_atomic32_read(&pfic->pfic_refcnt) == 0)
-			psc_hashbkt_del_item(&pflfs_inumcol_hashtbl, b,
-			    pfic);
-		else
-			pfic = NULL;
-	}
-	psc_hashbkt_put(&pflfs_inumcol_hashtbl, b);
-
-	if (del && pfic)
-		psc_pool_return(pflfs_inumcol_pool, pfic);
-
-	return (p_inum);
-}
-
-#define COMPUTE_EXPIRE(tv, timeo)					\
-	do {								\
-		struct timeval _tv;					\
-									\
-		PFL_GETTIMEVAL(tv);					\
-		_tv.tv_sec = (int)(timeo);				\
-		_tv.tv_usec = 1000 * ((timeo) - (int)(timeo));		\
-		timeradd((tv), &_tv, (tv));				\
-	} while (0)
-
-/* convert a 64-bit pscfs inum to a 32-bit system inum */
-fuse_ino_t
-pscfs_inum_pscfs2fuse(pscfs_inum_t p_inum, double timeo)
-{
-	struct pscfs_inumcol *pfic, *t;
-	struct psc_hashbkt *b;
-	uint64_t key;
-
-	pfic = psc_pool_get(pflfs_inumcol_pool);
-
-	key = (fuse_ino_t)p_inum;
-	do {
-		b = psc_hashbkt_get(&pflfs_inumcol_hashtbl, &key);
-		psc_hashbkt_lock(b);
-		t = psc_hashtbl_search(&pflfs_inumcol_hashtbl, NULL,
-		    NULL, &key);
-		if (t) {
-			/*
-			 * This faux inum is already in table.  If this
-			 * is for the same real inum, reuse this faux
-			 * inum; otherwise, fallback to a unique random
-			 * value.
-			 */
-			if (t->pfic_pscfs_inum == p_inum) {
-				psc_atomic32_inc(&t->pfic_refcnt);
-				COMPUTE_EXPIRE(&t->pfic_extime, timeo);
-				key = t->pfic_key;
-				t = NULL;
-			} else
-				key = psc_random32();
-		} else {
-			memset(pfic, 0, sizeof(*pfic));
-			psc_hashent_init(&pflfs_inumcol_hashtbl, pfic);
-			pfic->pfic_pscfs_inum = p_inum;
-			pfic->pfic_key = key;
-			COMPUTE_EXPIRE(&pfic->pfic_extime, timeo);
-			psc_atomic32_set(&pfic->pfic_refcnt, 1);
-			psc_hashbkt_add_item(&pflfs_inumcol_hashtbl, b,
-			    pfic);
-			pfic = NULL;
-		}
-		psc_hashbkt_put(&pflfs_inumcol_hashtbl, b);
-	} while (t);
-	if (pfic)
-		psc_pool_return(pflfs_inumcol_pool, pfic);
-	return (key);
+void
+pscfs_fuse_handle_forget(fuse_req_t req, fuse_ino_t inum,
+    unsigned long nlookup)
+{
+	INUM_FUSE2PSCFS_FORGET(inum, nlookup);
+	fuse_reply_none(req);
 }
 #endif
 
 #define GETPFR(pfr, fsreq)						\
 	do {								\
+		static struct pfl_histogram *_phg;			\
 		static struct pfl_opstat *_opst;			\
 		struct psc_thread *_thr;				\
 		struct pfl_fsthr *_pft;					\
 									\
-		if (_opst == NULL)					\
+		if (_opst == NULL) {					\
 			_opst = pfl_opstat_initf(OPSTF_BASE10,		\
 			    "fs.handle.%s", __func__ +			\
 			    strlen("pscfs_fuse_handle_"));		\
+			_phg = pfl_histogram_init("fs.reply-usec.%s",	\
+			    __func__ + strlen("pscfs_fuse_handle_"));	\
+		}							\
 		pfl_opstat_incr(_opst);					\
 									\
 		(pfr) = psc_pool_get(pflfs_req_pool);			\
@@ -795,6 +673,9 @@ pscfs_inum_pscfs2fuse(pscfs_inum_t p_inum, double timeo)
 		(pfr)->pfr_refcnt = 2;					\
 		(pfr)->pfr_opname = __func__ +				\
 		    strlen("pscfs_fuse_handle_");			\
+		(pfr)->pfr_histo = _phg;				\
+		PFL_TRACE_BEGIN(PSS_FS, (pfr)->pfr_opname,		\
+		    (uintptr_t)(pfr));					\
 		PFLOG_PFR(PLL_DEBUG, (pfr), "create");			\
 									\
 		_thr = pscthr_get();					\
@@ -875,6 +756,7 @@ _pfr_decref(const struct pfl_callerinfo *pci, struct pscfs_req *pfr, int rc)
 	}
 	pll_remove(&pflfs_requests, pfr);
 	PFLOG_PFR(PLL_DEBUG, pfr, "destroying");
+	pfl_arena_reset(&pfr->pfr_arena);
 	psc_pool_return(pflfs_req_pool, pfr);
 
 	pflfs_modules_rdunpin();
@@ -1047,6 +929,49 @@ pscfs_fuse_handle_readdir(fuse_req_t req, __unusedx fuse_ino_t inum,
 	FSOP(readdir, pfr, size, off, fusefi_to_pri(fi));
 }
 
+#ifdef HAVE_FUSE_READDIRPLUS
+/*
+ * Determine if any module in the stack is able to supply attributes
+ * along with directory entries.
+ */
+static int
+pscfs_fuse_have_readdirplus(void)
+{
+	struct pscfs *m;
+	int i, rc = 0;
+
+	pflfs_modules_rdpin();
+	DYNARRAY_FOREACH(m, i, &pscfs_modules)
+		if (m->pf_handle_readdirplus) {
+			rc = 1;
+			break;
+		}
+	pflfs_modules_rdunpin();
+	return (rc);
+}
+
+void
+pscfs_fuse_handle_readdirplus(fuse_req_t req, __unusedx fuse_ino_t inum,
+    size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct pscfs_req *pfr;
+
+	GETPFR(pfr, req);
+	pfr->pfr_rdsize = size;
+	if (pscfs_fuse_have_readdirplus()) {
+		FSOP(readdirplus, pfr, size, off, fusefi_to_pri(fi));
+	} else {
+		/*
+		 * No module can fill in attributes so fall back to a
+		 * plain readdir and emit entries without a lookup
+		 * reference; the kernel will LOOKUP them as before.
+		 */
+		pfr->pfr_flags |= PFRF_RDPLUS_COMPAT;
+		FSOP(readdir, pfr, size, off, fusefi_to_pri(fi));
+	}
+}
+#endif
+
 void
 pscfs_fuse_handle_readlink(fuse_req_t req, fuse_ino_t inum)
 {
@@ -1225,8 +1150,13 @@ pscfs_fuse_handle_removexattr(fuse_req_t req, fuse_ino_t ino,
 		uint64_t u0 = r0p->uniqid;				\
 									\
 		fuse_reply_##func((pfr)->pfr_ufsi_req, ## __VA_ARGS__);	\
+		PFL_TRACE_END(PSS_FS, (pfr)->pfr_opname,		\
+		    (uintptr_t)(pfr));					\
 		PFL_GETTIMESPEC(&t0);					\
 		timespecsub(&t0, &(pfr)->pfr_start, &d);		\
+		if ((pfr)->pfr_histo)					\
+			pfl_histogram_record((pfr)->pfr_histo,		\
+			    d.tv_sec * 1000000 + d.tv_nsec / 1000);	\
 		t0.tv_sec = 0;						\
 		t0.tv_nsec = 600000;					\
 		if (timespeccmp(&d, &t0, >))				\
@@ -1277,18 +1207,24 @@ pscfs_reply_create(struct pscfs_req *pfr, pscfs_inum_t inum,
 	else {
 		struct fuse_file_info *fi;
 
-		fi = pfr_to_fusefi(pfr);
-		if (rflags & PSCFS_CREATEF_DIO)
-			fi->direct_io = 1;
-		fusefi_stash_pri(fi, data);
 		e.entry_timeout = entry_timeout;
 		e.ino = INUM_PSCFS2FUSE(inum, entry_timeout);
+		if (e.ino == 0 && inum) {
+			/* out of FUSE inums */
+			PFR_REPLY(err, pfr, ENFILE);
+			return;
+		}
 		if (e.ino) {
 			e.attr_timeout = attr_timeout;
 			memcpy(&e.attr, stb, sizeof(e.attr));
 			e.attr.st_ino = e.ino;
 			e.generation = gen;
 		}
+
+		fi = pfr_to_fusefi(pfr);
+		if (rflags & PSCFS_CREATEF_DIO)
+			fi->direct_io = 1;
+		fusefi_stash_pri(fi, data);
 		PFR_REPLY(create, pfr, &e, fi);
 	}
 }
@@ -1318,7 +1254,7 @@ pscfs_reply_getattr(struct pscfs_req *pfr, struct stat *stb,
 	if (rc)
 		PFR_REPLY(err, pfr, rc);
 	else {
-		stb->st_ino = INUM_PSCFS2FUSE(stb->st_ino,
+		stb->st_ino = INUM_PSCFS2FUSE_ATTR(stb->st_ino,
 		    attr_timeout);
 		PFR_REPLY(attr, pfr, stb, attr_timeout);
 	}
@@ -1409,6 +1345,78 @@ pscfs_reply_read(struct pscfs_req *pfr, struct iovec *iov, int nio,
 	}
 }
 
+#ifdef HAVE_FUSE_READDIRPLUS
+/*
+ * Append one entry in FUSE readdirplus format to a reply buffer.
+ * Returns the number of bytes consumed or zero if the entry does not
+ * fit, in which case the kernel will resume from the offset of the
+ * last entry that did.
+ */
+static size_t
+pscfs_fuse_add_direntplus(struct pscfs_req *pfr, char *buf,
+    size_t bufsize, const struct pscfs_dirent *dirent,
+    struct fuse_entry_param *e, double entry_timeout)
+{
+	char name[NAME_MAX + 1];
+	size_t entsize;
+
+	snprintf(name, sizeof(name), "%.*s", (int)dirent->pfd_namelen,
+	    dirent->pfd_name);
+	entsize = fuse_add_direntry_plus(pfr->pfr_ufsi_req, NULL, 0,
+	    name, NULL, 0);
+	if (entsize > bufsize)
+		return (0);
+
+	/*
+	 * Only allocate a FUSE inum once the entry is known to be sent
+	 * since the kernel takes a lookup reference on each one.
+	 */
+	if (e->ino) {
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			e->ino = INUM_PSCFS2FUSE_ATTR(e->ino,
+			    entry_timeout);
+		else
+			e->ino = INUM_PSCFS2FUSE(e->ino, entry_timeout);
+		e->attr.st_ino = e->ino;
+	} else
+		e->attr.st_ino = INUM_PSCFS2FUSE_ATTR(dirent->pfd_ino,
+		    entry_timeout);
+	return (fuse_add_direntry_plus(pfr->pfr_ufsi_req, buf, bufsize,
+	    name, e, dirent->pfd_off));
+}
+
+/*
+ * Convert a plain readdir buffer into bare readdirplus entries.
+ */
+static void
+pscfs_fuse_reply_readdir_compat(struct pscfs_req *pfr, void *buf,
+    ssize_t len)
+{
+	struct pscfs_dirent *dirent;
+	struct fuse_entry_param e;
+	size_t n, resid;
+	char *rbuf;
+	off_t off;
+	int rc = 0;
+
+	rbuf = PSCALLOC(pfr->pfr_rdsize);
+	resid = pfr->pfr_rdsize;
+	for (dirent = buf, off = 0; off < len;
+	    off += PFL_DIRENT_SIZE(dirent->pfd_namelen),
+	    dirent = PSC_AGP(buf, off)) {
+		memset(&e, 0, sizeof(e));
+		e.attr.st_mode = dirent->pfd_type << 12;
+		n = pscfs_fuse_add_direntplus(pfr, rbuf +
+		    pfr->pfr_rdsize - resid, resid, dirent, &e, 8);
+		if (n == 0)
+			break;
+		resid -= n;
+	}
+	PFR_REPLY(buf, pfr, rbuf, pfr->pfr_rdsize - resid);
+	PSCFREE(rbuf);
+}
+#endif
+
 void
 pscfs_reply_readdir(struct pscfs_req *pfr, void *buf, ssize_t len,
     int rc)
@@ -1418,16 +1426,77 @@ pscfs_reply_readdir(struct pscfs_req *pfr, void *buf, ssize_t len,
 
 	if (rc)
 		PFR_REPLY(err, pfr, rc);
+#ifdef HAVE_FUSE_READDIRPLUS
+	else if (pfr->pfr_flags & PFRF_RDPLUS_COMPAT)
+		pscfs_fuse_reply_readdir_compat(pfr, buf, len);
+#endif
 	else {
 		for (dirent = buf, off = 0; off < len;
 		    off += PFL_DIRENT_SIZE(dirent->pfd_namelen),
 		    dirent = PSC_AGP(buf, off))
-			dirent->pfd_ino = INUM_PSCFS2FUSE(
+			dirent->pfd_ino = INUM_PSCFS2FUSE_ATTR(
 			    dirent->pfd_ino, 8);
 		PFR_REPLY(buf, pfr, buf, len);
 	}
 }
 
+/*
+ * Reply to a readdirplus request.
+ * @buf: packed array of pscfs_direntplus records.
+ * @len: length of @buf.
+ *
+ * Entries are packed into the reply until the size requested by the
+ * kernel is exhausted; anything left over is requested again starting
+ * at the offset of the last entry sent.
+ */
+void
+pscfs_reply_readdirplus(struct pscfs_req *pfr, void *buf, ssize_t len,
+    int rc)
+{
+#ifdef HAVE_FUSE_READDIRPLUS
+	struct pscfs_direntplus *dp;
+	struct fuse_entry_param e;
+	size_t n, resid;
+	int nents = 0;
+	char *rbuf;
+	off_t off;
+
+	if (rc) {
+		PFR_REPLY(err, pfr, rc);
+		return;
+	}
+
+	rbuf = PSCALLOC(pfr->pfr_rdsize);
+	resid = pfr->pfr_rdsize;
+	for (dp = buf, off = 0; off < len;
+	    off += PFL_DIRENTPLUS_SIZE(dp->pfdp_dirent.pfd_namelen),
+	    dp = PSC_AGP(buf, off)) {
+		memset(&e, 0, sizeof(e));
+		e.ino = dp->pfdp_dirent.pfd_ino;
+		e.generation = dp->pfdp_gen;
+		e.entry_timeout = dp->pfdp_entry_timeout;
+		e.attr_timeout = dp->pfdp_attr_timeout;
+		memcpy(&e.attr, &dp->pfdp_stb, sizeof(e.attr));
+		n = pscfs_fuse_add_direntplus(pfr, rbuf +
+		    pfr->pfr_rdsize - resid, resid, &dp->pfdp_dirent, &e,
+		    dp->pfdp_entry_timeout);
+		if (n == 0)
+			break;
+		resid -= n;
+		nents++;
+	}
+	OPSTAT_ADD("fs.readdirplus.ents", nents);
+	PFR_REPLY(buf, pfr, rbuf, pfr->pfr_rdsize - resid);
+	PSCFREE(rbuf);
+#else
+	(void)buf;
+	(void)len;
+	if (rc == 0)
+		rc = ENOTSUP;
+	PFR_REPLY(err, pfr, rc);
+#endif
+}
+
 void
 pscfs_reply_readlink(struct pscfs_req *pfr, void *buf, int rc)
 {
@@ -1456,7 +1525,8 @@ pscfs_reply_setattr(struct pscfs_req *pfr, struct stat *stb,
 	if (rc)
 		PFR_REPLY(err, pfr, rc);
 	else {
-		stb->st_ino = INUM_PSCFS2FUSE(stb->st_ino, attr_timeout);
+		stb->st_ino = INUM_PSCFS2FUSE_ATTR(stb->st_ino,
+		    attr_timeout);
 		PFR_REPLY(attr, pfr, stb, attr_timeout);
 	}
 }
@@ -1547,6 +1617,11 @@ pscfs_fuse_replygen_entry(struct pscfs_req *pfr, pscfs_inum_t inum,
 	} else {
 		e.entry_timeout = entry_timeout;
 		e.ino = INUM_PSCFS2FUSE(inum, entry_timeout);
+		if (e.ino == 0 && inum) {
+			/* out of FUSE inums */
+			PFR_REPLY(err, pfr, ENFILE);
+			return;
+		}
 		if (e.ino) {
 			e.attr_timeout = attr_timeout;
 			memcpy(&e.attr, stb, sizeof(e.attr));
@@ -1562,6 +1637,9 @@ struct fuse_lowlevel_ops pscfs_fuse_ops = {
 	.create		= pscfs_fuse_handle_create,
 	.destroy	= pscfs_fuse_handle_destroy,
 	.flush		= pscfs_fuse_handle_flush,
+#ifndef __LP64__
+	.forget		= pscfs_fuse_handle_forget,
+#endif
 	.fsync		= pscfs_fuse_handle_fsync,
 	.fsyncdir	= pscfs_fuse_handle_fsyncdir,
 	.getattr	= pscfs_fuse_handle_getattr,
@@ -1573,6 +1651,9 @@ struct fuse_lowlevel_ops pscfs_fuse_ops = {
 	.opendir	= pscfs_fuse_handle_opendir,
 	.read		= pscfs_fuse_handle_read,
 	.readdir	= pscfs_fuse_handle_readdir,
+#ifdef HAVE_FUSE_READDIRPLUS
+	.readdirplus	= pscfs_fuse_handle_readdirplus,
+#endif
 	.readlink	= pscfs_fuse_handle_readlink,
 	.release	= pscfs_fuse_handle_release,
 	.releasedir	= pscfs_fuse_handle_releasedir,
@@ -1688,8 +1769,8 @@ pflfs_inval_inode(void *pri, pscfs_inum_t inum)
 	int rc = -ENOTSUP;
 
 #ifdef HAVE_FUSE_NOTIFY_INVAL
-	rc = fuse_lowlevel_notify_inval_entry(pri, INUM_PSCFS2FUSE(inum,
-	    0.0), 0, 0);
+	rc = fuse_lowlevel_notify_inval_entry(pri,
+	    INUM_PSCFS2FUSE_ATTR(inum, 0.0), 0, 0);
 #else
 	(void)pri;
 	(void)inum;
@@ -1705,7 +1786,7 @@ pscfs_notify_inval_entry(void *pri, pscfs_inum_t pinum,
 
 #ifdef HAVE_FUSE_NOTIFY_INVAL
 	rc = fuse_lowlevel_notify_inval_entry(pri,
-	    INUM_PSCFS2FUSE(pinum, 0.0), name, namelen);
+	    INUM_PSCFS2FUSE_ATTR(pinum, 0.0), name, namelen);
 #else
 	(void)pri;
 	(void)pinum;
@@ -2008,5 +2089,6 @@ struct pscfs pscfs_default_ops = {
 	pscfsop_listxattr,
 	pscfsop_getxattr,
 	pscfsop_setxattr,
-	pscfsop_removexattr
+	pscfsop_removexattr,
+	NULL			/* readdirplus */
 };
@@ -37,23 +37,13 @@ _pfl_heap_swap(struct pfl_heap *ph, struct pfl_heap_entry *phe,
 	SWAP(phe->phe_idx, che->phe_idx, tidx);
 }
 
-void
-pfl_heap_add(struct pfl_heap *ph, void *c)
+__static void
+_pfl_heap_siftup(struct pfl_heap *ph, void *c)
 {
 	struct pfl_heap_entry *che, *phe;
-	size_t nalloc;
 	void *p;
 
-	pfl_assert(c);
 	che = PSC_AGP(c, ph->ph_entoff);
-	if (ph->ph_nitems == ph->ph_nalloc) {
-		nalloc = MAX(8, 2 * ph->ph_nalloc);
-		ph->ph_base = psc_realloc(ph->ph_base,
-		    nalloc * sizeof(void *), 0);
-		ph->ph_nalloc = nalloc;
-	}
-	ph->ph_base[che->phe_idx = ph->ph_nitems++] = c;
-	/* bubble up */
 	while (che->phe_idx > 0) {
 		p = ph->ph_base[(che->phe_idx - 1) / 2];
 		if (ph->ph_cmpf(p, c) != 1)
@@ -63,22 +53,14 @@ pfl_heap_add(struct pfl_heap *ph, void *c)
 	}
 }
 
-void
-pfl_heap_remove(struct pfl_heap *ph, void *p)
+__static void
+_pfl_heap_siftdown(struct pfl_heap *ph, void *p)
 {
 	struct pfl_heap_entry *phe, *che;
 	void *c, *minc;
 	int idx, i;
 
-	pfl_assert(ph->ph_nitems > 0);
-
-	pfl_assert(p);
 	phe = PSC_AGP(p, ph->ph_entoff);
-	p = ph->ph_base[idx = phe->phe_idx] =
-	    ph->ph_base[--ph->ph_nitems];
-	phe = PSC_AGP(p, ph->ph_entoff);
-	phe->phe_idx = idx;
-	/* bubble down */
 	for (;;) {
 		for (minc = p, idx = phe->phe_idx * 2 + 1, i = 0;
 		    i < 2 && idx < ph->ph_nitems; idx++, i++) {
@@ -93,6 +75,45 @@ pfl_heap_remove(struct pfl_heap *ph, void *p)
 	}
 }
 
+void
+pfl_heap_add(struct pfl_heap *ph, void *c)
+{
+	struct pfl_heap_entry *che;
+	size_t nalloc;
+
+	pfl_assert(c);
+	che = PSC_AGP(c, ph->ph_entoff);
+	if (ph->ph_nitems == ph->ph_nalloc) {
+		nalloc = MAX(8, 2 * ph->ph_nalloc);
+		ph->ph_base = psc_realloc(ph->ph_base,
+		    nalloc * sizeof(void *), 0);
+		ph->ph_nalloc = nalloc;
+	}
+	ph->ph_base[che->phe_idx = ph->ph_nitems++] = c;
+	_pfl_heap_siftup(ph, c);
+}
+
+void
+pfl_heap_remove(struct pfl_heap *ph, void *p)
+{
+	struct pfl_heap_entry *phe;
+	int idx;
+
+	pfl_assert(ph->ph_nitems > 0);
+
+	pfl_assert(p);
+	phe = PSC_AGP(p, ph->ph_entoff);
+	idx = phe->phe_idx;
+	if (idx == --ph->ph_nitems)
+		return;
+	p = ph->ph_base[idx] = ph->ph_base[ph->ph_nitems];
+	phe = PSC_AGP(p, ph->ph_entoff);
+	phe->phe_idx = idx;
+	/* the replacement may belong above or below */
+	_pfl_heap_siftup(ph, p);
+	_pfl_heap_siftdown(ph, p);
+}
+
 void *
 pfl_heap_peekidx(struct pfl_heap *ph, int idx)
 {
@@ -127,11 +148,14 @@ pfl_heap_shift(struct pfl_heap *ph)
 	return (p);
 }
 
+/*
+ * Restore heap order after an item's key has changed, in place.
+ */
 void
 pfl_heap_reseat(struct pfl_heap *ph, void *p)
 {
-	pfl_heap_remove(ph, p);
-	pfl_heap_add(ph, p);
+	_pfl_heap_siftup(ph, p);
+	_pfl_heap_siftdown(ph, p);
 }
 
 int
@@ -148,3 +172,271 @@ _pfl_heap_init(struct pfl_heap *ph, int entoff,
 	ph->ph_cmpf = cmpf;
 	ph->ph_entoff = entoff;
 }
+
+#define KHEAP_PARENT(i)		(((i) - 1) / PFL_KHEAP_ARITY)
+#define KHEAP_CHILD(i)		((i) * PFL_KHEAP_ARITY + 1)
+
+#define KHEAP_SETIDX(hp, slot, idx)					\
+	(((struct pfl_heap_entry *)PSC_AGP((slot)->phs_item,		\
+	    (hp)->pkh_entoff))->phe_idx = (idx))
+
+#define KHEAP_GETIDX(hp, item)						\
+	(((struct pfl_heap_entry *)PSC_AGP((item),			\
+	    (hp)->pkh_entoff))->phe_idx)
+
+/*
+ * Move the slot at 'idx' toward the root until its parent is no
+ * larger.  Slots are shifted down into the hole rather than swapped.
+ */
+__static int
+_pfl_kheap_siftup(struct pfl_kheap *hp, int idx)
+{
+	struct pfl_kheap_slot s, *base = hp->pkh_base;
+	int pidx;
+
+	s = base[idx];
+	while (idx > 0) {
+		pidx = KHEAP_PARENT(idx);
+		if (base[pidx].phs_key <= s.phs_key)
+			break;
+		base[idx] = base[pidx];
+		KHEAP_SETIDX(hp, &base[idx], idx);
+		idx = pidx;
+	}
+	base[idx] = s;
+	KHEAP_SETIDX(hp, &base[idx], idx);
+	return (idx);
+}
+
+__static int
+_pfl_kheap_siftdown(struct pfl_kheap *hp, int idx)
+{
+	struct pfl_kheap_slot s, *base = hp->pkh_base;
+	int cidx, end, minidx, n = hp->pkh_nitems;
+
+	s = base[idx];
+	for (;;) {
+		cidx = KHEAP_CHILD(idx);
+		if (cidx >= n)
+			break;
+		end = MIN(cidx + PFL_KHEAP_ARITY, n);
+		for (minidx = cidx++; cidx < end; cidx++)
+			if (base[cidx].phs_key < base[minidx].phs_key)
+				minidx = cidx;
+		if (s.phs_key <= base[minidx].phs_key)
+			break;
+		base[idx] = base[minidx];
+		KHEAP_SETIDX(hp, &base[idx], idx);
+		idx = minidx;
+	}
+	base[idx] = s;
+	KHEAP_SETIDX(hp, &base[idx], idx);
+	return (idx);
+}
+
+/*
+ * Number of slots to skip at the start of the allocation at 'mem' so
+ * the first child group, slots 1 .. PFL_KHEAP_ARITY, begins a cache
+ * line; every later group then does too.  Nothing is skipped if the
+ * slot size does not divide the line (e.g. on 32-bit platforms).
+ */
+__static int
+_pfl_kheap_baseoff(const struct pfl_kheap_slot *mem)
+{
+	uintptr_t misalign;
+
+	if (sizeof(*mem) * PFL_KHEAP_ARITY != PFL_KHEAP_LINESZ)
+		return (0);
+	misalign = (uintptr_t)mem % PFL_KHEAP_LINESZ;
+	if (misalign % sizeof(*mem))
+		return (0);
+	return ((2 * PFL_KHEAP_ARITY - 1 - misalign / sizeof(*mem)) %
+	    PFL_KHEAP_ARITY);
+}
+
+__static void
+_pfl_kheap_reserve(struct pfl_kheap *hp, int n)
+{
+	int nalloc, off, ooff;
+
+	if (hp->pkh_nitems + n <= hp->pkh_nalloc)
+		return;
+	nalloc = MAX(8, 2 * hp->pkh_nalloc);
+	if (nalloc < hp->pkh_nitems + n)
+		nalloc = hp->pkh_nitems + n;
+	ooff = hp->pkh_mem ? hp->pkh_base - hp->pkh_mem : 0;
+	hp->pkh_mem = psc_realloc(hp->pkh_mem, (nalloc +
+	    PFL_KHEAP_ARITY - 1) * sizeof(*hp->pkh_mem), 0);
+
+	/* realloc may have moved us to a different line offset */
+	off = _pfl_kheap_baseoff(hp->pkh_mem);
+	if (off != ooff)
+		memmove(hp->pkh_mem + off, hp->pkh_mem + ooff,
+		    hp->pkh_nitems * sizeof(*hp->pkh_mem));
+	hp->pkh_base = hp->pkh_mem + off;
+	hp->pkh_nalloc = nalloc;
+}
+
+void
+pfl_kheap_add(struct pfl_kheap *hp, void *p, uint64_t key)
+{
+	struct pfl_kheap_slot *s;
+	int idx;
+
+	pfl_assert(p);
+	_pfl_kheap_reserve(hp, 1);
+	idx = hp->pkh_nitems++;
+	s = &hp->pkh_base[idx];
+	s->phs_key = key;
+	s->phs_item = p;
+	_pfl_kheap_siftup(hp, idx);
+}
+
+/*
+ * Insert a batch of items.  When the batch is large relative to the
+ * current heap, append everything and rebuild bottom-up (Floyd), which
+ * is O(n) instead of O(n log n) for individual insertions.
+ */
+void
+pfl_kheap_addv(struct pfl_kheap *hp, void **items,
+    const uint64_t *keys, int n)
+{
+	struct pfl_kheap_slot *s;
+	int i, idx;
+
+	if (n <= 0)
+		return;
+	_pfl_kheap_reserve(hp, n);
+	if (n < hp->pkh_nitems) {
+		for (i = 0; i < n; i++)
+			pfl_kheap_add(hp, items[i], keys[i]);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		pfl_assert(items[i]);
+		idx = hp->pkh_nitems++;
+		s = &hp->pkh_base[idx];
+		s->phs_key = keys[i];
+		s->phs_item = items[i];
+		KHEAP_SETIDX(hp, s, idx);
+	}
+	if (hp->pkh_nitems > 1)
+		for (idx = KHEAP_PARENT(hp->pkh_nitems - 1); idx >= 0;
+		    idx--)
+			_pfl_kheap_siftdown(hp, idx);
+}
+
+void
+pfl_kheap_remove(struct pfl_kheap *hp, void *p)
+{
+	int idx;
+
+	pfl_assert(p);
+	pfl_assert(hp->pkh_nitems > 0);
+	idx = KHEAP_GETIDX(hp, p);
+	pfl_assert(idx >= 0 && idx < hp->pkh_nitems &&
+	    hp->pkh_base[idx].phs_item == p);
+	if (idx == --hp->pkh_nitems)
+		return;
+	hp->pkh_base[idx] = hp->pkh_base[hp->pkh_nitems];
+	if (_pfl_kheap_siftup(hp, idx) == idx)
+		_pfl_kheap_siftdown(hp, idx);
+}
+
+/*
+ * Change the key of an item already on the heap (decrease- or
+ * increase-key) and restore heap order in place.
+ */
+void
+pfl_kheap_reseat(struct pfl_kheap *hp, void *p, uint64_t key)
+{
+	uint64_t okey;
+	int idx;
+
+	idx = KHEAP_GETIDX(hp, p);
+	pfl_assert(idx >= 0 && idx < hp->pkh_nitems &&
+	    hp->pkh_base[idx].phs_item == p);
+	okey = hp->pkh_base[idx].phs_key;
+	hp->pkh_base[idx].phs_key = key;
+	if (key < okey)
+		_pfl_kheap_siftup(hp, idx);
+	else if (key > okey)
+		_pfl_kheap_siftdown(hp, idx);
+}
+
+void *
+pfl_kheap_peek(struct pfl_kheap *hp, uint64_t *keyp)
+{
+	if (hp->pkh_nitems == 0)
+		return (NULL);
+	if (keyp)
+		*keyp = hp->pkh_base[0].phs_key;
+	return (hp->pkh_base[0].phs_item);
+}
+
+void *
+pfl_kheap_shift(struct pfl_kheap *hp, uint64_t *keyp)
+{
+	void *p;
+
+	if (hp->pkh_nitems == 0)
+		return (NULL);
+	p = hp->pkh_base[0].phs_item;
+	if (keyp)
+		*keyp = hp->pkh_base[0].phs_key;
+	if (--hp->pkh_nitems) {
+		hp->pkh_base[0] = hp->pkh_base[hp->pkh_nitems];
+		_pfl_kheap_siftdown(hp, 0);
+	}
+	return (p);
+}
+
+/*
+ * Pop every item whose key is at most 'key', up to 'max' of them, into
+ * 'v' in key order.  Returns the number of items popped.  This is the
+ * typical timer wheel drain: all deadlines that have expired by now.
+ */
+int
+pfl_kheap_popuntil(struct pfl_kheap *hp, uint64_t key, void **v,
+    int max)
+{
+	int n;
+
+	for (n = 0; n < max && hp->pkh_nitems &&
+	    hp->pkh_base[0].phs_key <= key; n++)
+		v[n] = pfl_kheap_shift(hp, NULL);
+	return (n);
+}
+
+uint64_t
+pfl_kheap_getkey(struct pfl_kheap *hp, void *p)
+{
+	int idx;
+
+	idx = KHEAP_GETIDX(hp, p);
+	pfl_assert(idx >= 0 && idx < hp->pkh_nitems &&
+	    hp->pkh_base[idx].phs_item == p);
+	return (hp->pkh_base[idx].phs_key);
+}
+
+int
+pfl_kheap_nitems(struct pfl_kheap *hp)
+{
+	return (hp->pkh_nitems);
+}
+
+void
+pfl_kheap_free(struct pfl_kheap *hp)
+{
+	PSCFREE(hp->pkh_mem);
+	hp->pkh_base = NULL;
+	hp->pkh_nitems = 0;
+	hp->pkh_nalloc = 0;
+}
+
+void
+_pfl_kheap_init(struct pfl_kheap *hp, int entoff)
+{
+	memset(hp, 0, sizeof(*hp));
+	hp->pkh_entoff = entoff;
+}
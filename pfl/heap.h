@@ -28,6 +28,8 @@
 #ifndef _PFL_HEAP_H_
 #define _PFL_HEAP_H_
 
+#include <stdint.h>
+
 struct pfl_heap {
 	void	**ph_base;
 	int	(*ph_cmpf)(const void *, const void *);
@@ -46,6 +48,37 @@ struct pfl_heap_entry {
 #define pfl_heap_init(hp, type, memb, cmpf)				\
 	_pfl_heap_init((hp), offsetof(type, memb), cmpf)
 
+/*
+ * Keyed heap: a 4-ary min-heap that stores each item's 64-bit key
+ * inline next to its pointer so sifting never dereferences items.  On
+ * LP64 a slot is 16 bytes, and the slot array is placed so that the
+ * children of every node (4i+1 .. 4i+4) fill exactly one cache line.
+ * Items embed a pfl_heap_entry to track their position, which lets
+ * pfl_kheap_reseat() change a key in O(log n) without a remove and
+ * re-add.
+ */
+#define PFL_KHEAP_ARITY		4
+#define PFL_KHEAP_LINESZ	64
+
+struct pfl_kheap_slot {
+	uint64_t		  phs_key;
+	void			 *phs_item;
+};
+
+struct pfl_kheap {
+	struct pfl_kheap_slot	 *pkh_base;		/* slot 0 */
+	struct pfl_kheap_slot	 *pkh_mem;		/* allocation */
+	int			  pkh_entoff;
+	int			  pkh_nitems;
+	int			  pkh_nalloc;
+};
+
+#define KHEAP_INIT(type, memb)						\
+	{ NULL, NULL, offsetof(type, memb), 0, 0 }
+
+#define pfl_kheap_init(hp, type, memb)					\
+	_pfl_kheap_init((hp), offsetof(type, memb))
+
 void	 pfl_heap_add(struct pfl_heap *, void *);
 void	_pfl_heap_init(struct pfl_heap *, int, int (*)(const void *, const void *));
 int	 pfl_heap_nitems(struct pfl_heap *);
@@ -55,4 +88,16 @@ void	 pfl_heap_remove(struct pfl_heap *, void *);
 void	 pfl_heap_reseat(struct pfl_heap *, void *);
 void	*pfl_heap_shift(struct pfl_heap *);
 
+void	 pfl_kheap_add(struct pfl_kheap *, void *, uint64_t);
+void	 pfl_kheap_addv(struct pfl_kheap *, void **, const uint64_t *, int);
+void	 pfl_kheap_free(struct pfl_kheap *);
+uint64_t pfl_kheap_getkey(struct pfl_kheap *, void *);
+void	_pfl_kheap_init(struct pfl_kheap *, int);
+int	 pfl_kheap_nitems(struct pfl_kheap *);
+void	*pfl_kheap_peek(struct pfl_kheap *, uint64_t *);
+int	 pfl_kheap_popuntil(struct pfl_kheap *, uint64_t, void **, int);
+void	 pfl_kheap_remove(struct pfl_kheap *, void *);
+void	 pfl_kheap_reseat(struct pfl_kheap *, void *, uint64_t);
+void	*pfl_kheap_shift(struct pfl_kheap *, uint64_t *);
+
 #endif /* _PFL_HEAP_H_ */
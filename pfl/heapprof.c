@@ -0,0 +1,301 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Sampling heap profiler.
+ *
+ * Each thread counts down the bytes it allocates and takes a sample
+ * when the count expires, drawing the next interval from an
+ * exponential distribution with mean pfl_heapprof_rate.  This matches
+ * the Poisson sampling that pprof's heap_v2 format assumes when it
+ * scales sampled counts back to estimates of the true totals.
+ *
+ * Sampled allocations are remembered by address so their release can
+ * be charged back to the site.  To keep the release path cheap, a
+ * small counting filter indexed by address hash is consulted first and
+ * the table is only searched when the filter slot is nonzero.
+ *
+ * Internal bookkeeping uses calloc(3)/free(3) directly so that it does
+ * not recurse into the profiler.
+ */
+
+#include <sys/types.h>
+
+#ifdef HAVE_BACKTRACE
+#include <execinfo.h>
+#endif
+#include <err.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pfl/atomic.h"
+#include "pfl/cdefs.h"
+#include "pfl/hashtbl.h"
+#include "pfl/heapprof.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/random.h"
+
+/* frames to skip: _pfl_heapprof_alloc() and _psc_realloc() */
+#define HEAPPROF_SKIP		2
+
+struct pfl_heapprof_sample {
+	void				*phsm_ptr;
+#ifndef __LP64__
+	long				 _phsm_pad;
+#endif
+	struct pfl_hashentry		 phsm_hentry;
+	struct pfl_heapprof_site	*phsm_site;
+	size_t				 phsm_size;
+};
+
+struct pfl_heapprof_key {
+	void		*p;
+#ifndef __LP64__
+	long		 l;
+#endif
+};
+
+struct pfl_heapprof_stack {
+	int		 depth;
+	void		**pcs;
+};
+
+uint64_t			 pfl_heapprof_rate;
+psc_atomic32_t			 pfl_heapprof_filter[PFL_HEAPPROF_NFILTER];
+
+struct psc_hashtbl		 pfl_heapprof_sites;
+struct psc_hashtbl		 pfl_heapprof_samples;
+struct pfl_heapprof_site	 pfl_heapprof_total;
+int				 pfl_heapprof_nsites;
+psc_spinlock_t			 pfl_heapprof_lock = SPINLOCK_INIT_NOLOG;
+
+__threadx int64_t		 pfl_heapprof_countdown;
+__threadx uint64_t		 pfl_heapprof_rngstate;
+
+static int
+pfl_heapprof_site_cmp(const void *a, const void *b)
+{
+	const struct pfl_heapprof_site *phs = b;
+	const struct pfl_heapprof_stack *stk = a;
+
+	return (phs->phs_depth == stk->depth &&
+	    memcmp(phs->phs_pcs, stk->pcs,
+	    stk->depth * sizeof(*stk->pcs)) == 0);
+}
+
+/*
+ * Draw the number of bytes until the next sample.
+ */
+static int64_t
+pfl_heapprof_nextsample(void)
+{
+	uint64_t x, rate;
+	double u;
+
+	if (pfl_heapprof_rngstate == 0)
+		pfl_heapprof_rngstate = psc_random64() | 1;
+
+	/* xorshift64 */
+	x = pfl_heapprof_rngstate;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	pfl_heapprof_rngstate = x;
+
+	rate = pfl_heapprof_rate;
+	u = ((x >> 11) + 1) * (1.0 / (UINT64_C(1) << 53));
+	return (MAX(1, (int64_t)(-log(u) * rate)));
+}
+
+/*
+ * Account an allocation, sampling it if this thread's byte countdown
+ * has expired.
+ * @p: memory returned to the caller.
+ * @sz: size requested by the caller.
+ */
+void
+_pfl_heapprof_alloc(void *p, size_t sz)
+{
+	struct pfl_heapprof_sample *phsm;
+	struct pfl_heapprof_site *phs;
+	struct pfl_heapprof_stack stk;
+	void *pcs[PFL_HEAPPROF_MAXDEPTH + HEAPPROF_SKIP];
+	uint64_t id = 0xcbf29ce484222325;
+	int i, n = 0;
+
+	if (pfl_heapprof_rngstate == 0)
+		pfl_heapprof_countdown = pfl_heapprof_nextsample();
+	pfl_heapprof_countdown -= sz;
+	if (pfl_heapprof_countdown > 0)
+		return;
+	pfl_heapprof_countdown = pfl_heapprof_nextsample();
+
+#ifdef HAVE_BACKTRACE
+	n = backtrace(pcs, nitems(pcs));
+#endif
+	stk.pcs = pcs + HEAPPROF_SKIP;
+	stk.depth = MAX(0, n - HEAPPROF_SKIP);
+	for (i = 0; i < stk.depth; i++) {
+		/* FNV-1a over the return addresses */
+		id ^= (uintptr_t)stk.pcs[i];
+		id *= 0x100000001b3;
+	}
+
+	phsm = calloc(1, sizeof(*phsm));
+	if (phsm == NULL)
+		return;
+	psc_hashent_init(&pfl_heapprof_samples, phsm);
+	phsm->phsm_ptr = p;
+	phsm->phsm_size = sz;
+
+	spinlock(&pfl_heapprof_lock);
+	phs = psc_hashtbl_search_cmp(&pfl_heapprof_sites, &stk, &id);
+	if (phs == NULL) {
+		phs = calloc(1, sizeof(*phs));
+		if (phs == NULL) {
+			freelock(&pfl_heapprof_lock);
+			free(phsm);
+			return;
+		}
+		psc_hashent_init(&pfl_heapprof_sites, phs);
+		phs->phs_id = id;
+		phs->phs_depth = stk.depth;
+		memcpy(phs->phs_pcs, stk.pcs, stk.depth * sizeof(*pcs));
+		psc_hashtbl_add_item(&pfl_heapprof_sites, phs);
+		pfl_heapprof_nsites++;
+	}
+	phsm->phsm_site = phs;
+	phs->phs_alloc_objs++;
+	phs->phs_alloc_bytes += sz;
+	phs->phs_inuse_objs++;
+	phs->phs_inuse_bytes += sz;
+	pfl_heapprof_total.phs_alloc_objs++;
+	pfl_heapprof_total.phs_alloc_bytes += sz;
+	pfl_heapprof_total.phs_inuse_objs++;
+	pfl_heapprof_total.phs_inuse_bytes += sz;
+	psc_hashtbl_add_item(&pfl_heapprof_samples, phsm);
+	psc_atomic32_inc(&pfl_heapprof_filter[
+	    pfl_heapprof_filterslot(p)]);
+	freelock(&pfl_heapprof_lock);
+}
+
+/*
+ * Account the release of memory that may have been sampled.
+ * @p: memory being released.
+ */
+void
+_pfl_heapprof_free(void *p)
+{
+	struct pfl_heapprof_sample *phsm;
+	struct pfl_heapprof_site *phs;
+	struct pfl_heapprof_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.p = p;
+	phsm = psc_hashtbl_searchdel(&pfl_heapprof_samples, &key);
+	if (phsm == NULL)
+		return;
+
+	spinlock(&pfl_heapprof_lock);
+	phs = phsm->phsm_site;
+	phs->phs_inuse_objs--;
+	phs->phs_inuse_bytes -= phsm->phsm_size;
+	pfl_heapprof_total.phs_inuse_objs--;
+	pfl_heapprof_total.phs_inuse_bytes -= phsm->phsm_size;
+	psc_atomic32_dec(&pfl_heapprof_filter[
+	    pfl_heapprof_filterslot(p)]);
+	freelock(&pfl_heapprof_lock);
+	free(phsm);
+}
+
+void
+pfl_heapprof_gettotal(struct pfl_heapprof_site *phs)
+{
+	spinlock(&pfl_heapprof_lock);
+	*phs = pfl_heapprof_total;
+	freelock(&pfl_heapprof_lock);
+}
+
+/*
+ * Invoke a callback on a snapshot of each allocation site.  The
+ * callback runs without any profiler locks held.
+ * @cbf: callback; returning zero stops the walk.
+ * @arg: callback argument.
+ * Returns zero if the walk was stopped by the callback.
+ */
+int
+pfl_heapprof_walk(int (*cbf)(const struct pfl_heapprof_site *, void *),
+    void *arg)
+{
+	struct pfl_heapprof_site *phs, *v;
+	struct psc_hashbkt *b;
+	int i, n = 0, rc = 1;
+
+	spinlock(&pfl_heapprof_lock);
+	v = calloc(MAX(1, pfl_heapprof_nsites), sizeof(*v));
+	if (v == NULL) {
+		freelock(&pfl_heapprof_lock);
+		return (rc);
+	}
+	PSC_HASHTBL_FOREACH_BUCKET(b, &pfl_heapprof_sites)
+		PSC_HASHBKT_FOREACH_ENTRY(&pfl_heapprof_sites, phs, b)
+			v[n++] = *phs;
+	freelock(&pfl_heapprof_lock);
+
+	for (i = 0; i < n && rc; i++)
+		rc = cbf(&v[i], arg);
+	free(v);
+	return (rc);
+}
+
+void
+pfl_heapprof_init(void)
+{
+	char *p, *endp;
+	long long val;
+#ifdef HAVE_BACKTRACE
+	void *pc;
+
+	/* the first backtrace(3) may allocate while loading libgcc */
+	backtrace(&pc, 1);
+#endif
+
+	psc_hashtbl_init(&pfl_heapprof_sites, PHTF_NOMEMGUARD |
+	    PHTF_NOLOG, struct pfl_heapprof_site, phs_id, phs_hentry,
+	    1021, pfl_heapprof_site_cmp, "heapprof-sites");
+	psc_hashtbl_init(&pfl_heapprof_samples, PHTF_NOMEMGUARD |
+	    PHTF_NOLOG, struct pfl_heapprof_sample, phsm_ptr,
+	    phsm_hentry, 4093, NULL, "heapprof-samples");
+
+	p = getenv("PSC_HEAPPROF_RATE");
+	if (p) {
+		val = strtoll(p, &endp, 10);
+		if (val < 0 || endp == p || *endp != '\0')
+			warnx("invalid env PSC_HEAPPROF_RATE: %s", p);
+		else
+			pfl_heapprof_rate = val;
+	}
+}
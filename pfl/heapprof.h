@@ -0,0 +1,86 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Sampling heap profiler.  When enabled, roughly one allocation every
+ * pfl_heapprof_rate bytes passing through psc_alloc() is sampled and
+ * charged, along with its call stack, to an allocation site.  Sites
+ * track allocated and live sample counts for export in the pprof heap
+ * profile format.
+ */
+
+#ifndef _PFL_HEAPPROF_H_
+#define _PFL_HEAPPROF_H_
+
+#include <sys/types.h>
+
+#include <stdint.h>
+
+#include "pfl/atomic.h"
+#include "pfl/hashtbl.h"
+
+#define PFL_HEAPPROF_MAXDEPTH	32		/* max stack frames per site */
+#define PFL_HEAPPROF_FILTERBITS	15
+#define PFL_HEAPPROF_NFILTER	(1 << PFL_HEAPPROF_FILTERBITS)
+
+struct pfl_heapprof_site {
+	uint64_t		 phs_id;	/* hash of call stack */
+	struct pfl_hashentry	 phs_hentry;
+	uint64_t		 phs_alloc_objs;
+	uint64_t		 phs_alloc_bytes;
+	uint64_t		 phs_inuse_objs;
+	uint64_t		 phs_inuse_bytes;
+	int			 phs_depth;
+	void			*phs_pcs[PFL_HEAPPROF_MAXDEPTH];
+};
+
+extern uint64_t			 pfl_heapprof_rate;
+extern psc_atomic32_t		 pfl_heapprof_filter[];
+
+#define pfl_heapprof_filterslot(p)					\
+	((((uintptr_t)(p) >> 4) * UINT64_C(0x9e3779b97f4a7c15)) >>	\
+	 (64 - PFL_HEAPPROF_FILTERBITS))
+
+/* account an allocation; sampling is decided here */
+#define PFL_HEAPPROF_ALLOC(p, sz)					\
+	do {								\
+		if (pfl_heapprof_rate)					\
+			_pfl_heapprof_alloc((p), (sz));			\
+	} while (0)
+
+/* account a release; only pointers that may be samples are looked up */
+#define PFL_HEAPPROF_FREE(p)						\
+	do {								\
+		if (psc_atomic32_read(&pfl_heapprof_filter[		\
+		    pfl_heapprof_filterslot(p)]))			\
+			_pfl_heapprof_free(p);				\
+	} while (0)
+
+void	_pfl_heapprof_alloc(void *, size_t);
+void	_pfl_heapprof_free(void *);
+void	 pfl_heapprof_gettotal(struct pfl_heapprof_site *);
+void	 pfl_heapprof_init(void);
+int	 pfl_heapprof_walk(int (*)(const struct pfl_heapprof_site *,
+	    void *), void *);
+
+#endif /* _PFL_HEAPPROF_H_ */
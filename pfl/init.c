@@ -35,7 +35,9 @@
 #include "pfl/atomic.h"
 #include "pfl/cdefs.h"
 #include "pfl/err.h"
+#include "pfl/heapprof.h"
 #include "pfl/lock.h"
+#include "pfl/lockprof.h"
 #include "pfl/log.h"
 #include "pfl/pfl.h"
 #include "pfl/thread.h"
@@ -177,6 +179,10 @@ pfl_init(void)
 	pfl_subsys_register(PSS_MEM, "mem");
 	pfl_subsys_register(PSS_LNET, "lnet");
 	pfl_subsys_register(PSS_RPC, "rpc");
+	pfl_subsys_register(PSS_JOURNAL, "journal");
+	pfl_subsys_register(PSS_FS, "fs");
+
+	pfl_heapprof_init();
 
 	p = getenv("PSC_DUMPSTACK");
 	if (p && strcmp(p, "0"))
@@ -187,6 +193,10 @@ pfl_init(void)
 	if (p && strcmp(p, "0"))
 		atexit(pfl_dump_stack);
 
+	p = getenv("PSC_LOCKPROF");
+	if (p && strcmp(p, "0"))
+		pfl_lockprof_enable(1);
+
 	p = getenv("PSC_TIMEOUT");
 	if (p) {
 		struct itimerval it;
@@ -40,12 +40,14 @@
 #include "pfl/fcntl.h"
 #include "pfl/journal.h"
 #include "pfl/lock.h"
+#include "pfl/metrics.h"
 #include "pfl/opstats.h"
 #include "pfl/pool.h"
 #include "pfl/str.h"
 #include "pfl/sys.h"
 #include "pfl/thread.h"
 #include "pfl/time.h"
+#include "pfl/trace.h"
 #include "pfl/types.h"
 #include "pfl/waitq.h"
 
@@ -519,6 +521,55 @@ pjournal_logwrite_internal(struct psc_journal *pj,
 	return (0);
 }
 
+/*
+ * OpenMetrics collector for journal state.
+ */
+__static void
+pjournal_metrics(FILE *fp, __unusedx void *arg)
+{
+	static const struct pfl_metrics_field f[] = {
+		{ "pfl_journal_slots_used",	PMFT_GAUGE,   0, NULL },
+		{ "pfl_journal_slots",		PMFT_GAUGE,   1, NULL },
+		{ "pfl_journal_slots_reserved",	PMFT_GAUGE,   2, NULL },
+		{ "pfl_journal_pending_xids",	PMFT_GAUGE,   3, NULL },
+		{ "pfl_journal_distill_xids",	PMFT_GAUGE,   4, NULL },
+		{ "pfl_journal_last_xid",	PMFT_GAUGE,   5, NULL },
+		{ "pfl_journal_commit_txg",	PMFT_GAUGE,   6, NULL },
+		{ "pfl_journal_distill_xid",	PMFT_GAUGE,   7, NULL },
+		{ "pfl_journal_wraparounds",	PMFT_COUNTER, 8, NULL },
+	};
+	struct pfl_metrics_row *rows, *r;
+	struct psc_journal *j;
+	int n;
+
+	/* journals are never removed */
+	n = pll_nitems(&pfl_journals);
+	rows = PSCALLOC(n * sizeof(*rows));
+	r = rows;
+	PLL_LOCK(&pfl_journals);
+	PLL_FOREACH(j, &pfl_journals) {
+		if (r == rows + n)
+			break;
+		PJ_LOCK(j);
+		strlcpy(r->pmr_name, j->pj_name, sizeof(r->pmr_name));
+		r->pmr_vals[0] = j->pj_inuse;
+		r->pmr_vals[1] = j->pj_total;
+		r->pmr_vals[2] = j->pj_resrv;
+		r->pmr_vals[3] = pll_nitems(&j->pj_pendingxids);
+		r->pmr_vals[4] = pll_nitems(&j->pj_distillxids);
+		r->pmr_vals[5] = j->pj_lastxid;
+		r->pmr_vals[6] = j->pj_commit_txg;
+		r->pmr_vals[7] = j->pj_distill_xid;
+		r->pmr_vals[8] = j->pj_wraparound;
+		PJ_ULOCK(j);
+		r++;
+	}
+	PLL_ULOCK(&pfl_journals);
+
+	pfl_metrics_emit(fp, f, nitems(f), "journal", rows, r - rows);
+	PSCFREE(rows);
+}
+
 /*
  * Store a new entry in a journal transaction.
  * @xh: the transaction to receive the log entry.
@@ -531,6 +582,7 @@ pjournal_logwrite(struct psc_journal_xidhndl *xh, int type,
     struct psc_journal_enthdr *pje, int size)
 {
 	static psc_spinlock_t writelock = SPINLOCK_INIT;
+	struct timespec ts[2], wtime;
 	struct psc_journal *pj;
 
 	pj = xh->pjx_pj;
@@ -548,10 +600,17 @@ pjournal_logwrite(struct psc_journal_xidhndl *xh, int type,
 	pje->pje_txg = xh->pjx_txg;
 
 	/* paranoid: make sure that an earlier slot is written first. */
+	PFL_GETTIMESPEC(&ts[0]);
+	PFL_TRACE_BEGIN(PSS_JOURNAL, "jrnl.logwrite", xh->pjx_xid);
 	spinlock(&writelock);
 	pjournal_next_slot(xh);
 	pjournal_logwrite_internal(pj, pje, xh->pjx_slot);
 	freelock(&writelock);
+	PFL_TRACE_END(PSS_JOURNAL, "jrnl.logwrite", xh->pjx_xid);
+	PFL_GETTIMESPEC(&ts[1]);
+	timespecsub(&ts[1], &ts[0], &wtime);
+	pfl_histogram_record(pj->pj_histo_logwrite,
+	    wtime.tv_sec * 1000000 + wtime.tv_nsec / 1000);
 
 	/*
 	 * If this log entry needs further processing, hand it
@@ -773,6 +832,8 @@ pjournal_open(const char *name, const char *fn)
 	    basefn);
 	pj->pj_opst_distills = pfl_opstat_init("jrnl.%s.distills",
 	    basefn);
+	pj->pj_histo_logwrite = pfl_histogram_init(
+	    "jrnl.%s.logwrite-usec", basefn);
 
 	/*
 	 * O_DIRECT may impose alignment restrictions so align the
@@ -839,6 +900,7 @@ pjournal_open(const char *name, const char *fn)
 	psc_dynarray_init(&pj->pj_bufs);
 
 	pll_add(&pfl_journals, pj);
+	pfl_metrics_register("journal", pjournal_metrics, NULL);
 
 	psc_poolmaster_init(&pfl_xidhndl_poolmaster,
 	    struct psc_journal_xidhndl, pjx_lentry, PPMF_AUTO, 4096,
@@ -908,7 +970,9 @@ pjournal_thr_main(struct psc_thread *thr)
 			pll_remove(&pj->pj_distillxids, xh);
 			freelock(&xh->pjx_lock);
 
+			PFL_TRACE_BEGIN(PSS_JOURNAL, "jrnl.distill", 0);
 			pj->pj_distill_handler(pje, 0, pj->pj_npeers, 0);
+			PFL_TRACE_END(PSS_JOURNAL, "jrnl.distill", 0);
 
 			PJ_LOCK(pj);
 			txg = pj->pj_current_txg + 1;
@@ -150,6 +150,7 @@ struct psc_journal {
 	struct pfl_opstat		*pj_opst_reserves;
 	struct pfl_opstat		*pj_opst_commits;
 	struct pfl_opstat		*pj_opst_distills;
+	struct pfl_histogram		*pj_histo_logwrite;	/* usec */
 };
 
 #define PJF_NONE			0
@@ -49,21 +49,28 @@ lc_nitems(struct psc_listcache *plc)
 	return (sz);
 }
 
-void *
-_lc_get(struct psc_listcache *plc, const struct timespec *abstime,
-    int flags)
+/*
+ * Wait for an item to become available in a list cache.
+ * @plc: list cache, locked.
+ * @abstime: optional absolute time to give up at.
+ * @flags: PLCBF_* operational behavior flags.
+ * @locked: whether the caller already held the lock on entry.
+ * Returns zero with the list still locked if an item is available or
+ * nonzero otherwise.  On timeout the list is always released, as the
+ * wait dropped the lock; otherwise it is released only if the caller
+ * had not held it on entry.
+ */
+__static int
+_lc_waitavail(struct psc_listcache *plc, const struct timespec *abstime,
+    int flags, int locked)
 {
-	int locked, rc;
-	void *p;
+	int rc;
 
-	locked = LIST_CACHE_RLOCK(plc);
-//	if (plc->plc_flags & PLCF_DYING)
-//		pfl_assert(flags & PLCF_DYINGOK)
 	while (lc_empty(plc)) {
 		if ((plc->plc_flags & PLCF_DYING) ||
 		    (flags & PLCBF_NOBLOCK)) {
 			LIST_CACHE_URLOCK(plc, locked);
-			return (NULL);
+			return (-1);
 		}
 
 		/* Alert listeners who want to know about exhaustion. */
@@ -79,24 +86,107 @@ _lc_get(struct psc_listcache *plc, const struct timespec *abstime,
 			    LIST_CACHE_GETLOCK(plc), abstime);
 			if (rc) {
 				pfl_assert(rc == ETIMEDOUT);
+
+				/*
+				 * We may have been handed the single
+				 * wakeup right as we timed out, so take
+				 * the item rather than strand it.
+				 */
+				LIST_CACHE_LOCK(plc);
+				if (!lc_empty(plc))
+					break;
+				LIST_CACHE_ULOCK(plc);
 				errno = rc;
-				return (NULL);
+				return (-1);
 			}
 		} else
 			pfl_waitq_wait(&plc->plc_wq_empty,
 			    LIST_CACHE_GETLOCK(plc));
 		LIST_CACHE_LOCK(plc);
 	}
+	return (0);
+}
+
+/*
+ * Pass on wakeups after items have been taken off a list cache.
+ * Producers only signal when the list goes from empty to non-empty,
+ * so a consumer leaving items behind hands the wakeup to the next
+ * waiter.  Waiters for the list to drain are woken when it does.
+ * @plc: list cache, locked.
+ */
+__static void
+_lc_wakeafterget(struct psc_listcache *plc)
+{
+	if (pfl_waitq_nwaiters(&plc->plc_wq_empty) == 0)
+		return;
+	if (plc->plc_nitems)
+		pfl_waitq_wakeone(&plc->plc_wq_empty);
+	else
+		pfl_waitq_wakeall(&plc->plc_wq_empty);
+}
+
+void *
+_lc_get(struct psc_listcache *plc, const struct timespec *abstime,
+    int flags)
+{
+	int locked;
+	void *p;
+
+	locked = LIST_CACHE_RLOCK(plc);
+//	if (plc->plc_flags & PLCF_DYING)
+//		pfl_assert(flags & PLCF_DYINGOK)
+	if (_lc_waitavail(plc, abstime, flags, locked))
+		return (NULL);
 	if (flags & PLCBF_TAIL)
 		p = pll_peektail(&plc->plc_pll);
 	else
 		p = pll_peekhead(&plc->plc_pll);
-	if ((flags & PLCBF_PEEK) == 0)
-		lc_remove(plc, p);
+	if ((flags & PLCBF_PEEK) == 0) {
+		pll_remove(&plc->plc_pll, p);
+		if (plc->plc_st_removes)
+			pfl_opstat_incr(plc->plc_st_removes);
+	}
+	/* A peek leaves the item behind for the next waiter. */
+	_lc_wakeafterget(plc);
 	LIST_CACHE_URLOCK(plc, locked);
 	return (p);
 }
 
+/*
+ * Take up to a number of items from a list cache under a single lock
+ * acquisition.  Blocks, unless PLCBF_NOBLOCK is specified, until at
+ * least one item is available.
+ * @plc: the list cache.
+ * @pv: array to fill with items.
+ * @n: capacity of @pv.
+ * @abstime: optional absolute time to give up waiting at.
+ * @flags: PLCBF_* operational behavior flags.
+ * Returns the number of items taken.
+ */
+int
+_lc_getn(struct psc_listcache *plc, void **pv, int n,
+    const struct timespec *abstime, int flags)
+{
+	int locked, i;
+
+	pfl_assert((flags & PLCBF_PEEK) == 0);
+	locked = LIST_CACHE_RLOCK(plc);
+	if (_lc_waitavail(plc, abstime, flags, locked))
+		return (0);
+	for (i = 0; i < n && plc->plc_nitems; i++) {
+		if (flags & PLCBF_TAIL)
+			pv[i] = pll_peektail(&plc->plc_pll);
+		else
+			pv[i] = pll_peekhead(&plc->plc_pll);
+		pll_remove(&plc->plc_pll, pv[i]);
+	}
+	if (plc->plc_st_removes)
+		pfl_opstat_add(plc->plc_st_removes, i);
+	_lc_wakeafterget(plc);
+	LIST_CACHE_URLOCK(plc, locked);
+	return (i);
+}
+
 /*
  * List wants to go away; notify waiters.
  * @plc: list cache to kill.
@@ -113,6 +203,27 @@ lc_kill(struct psc_listcache *plc)
 	LIST_CACHE_URLOCK(plc, locked);
 }
 
+/*
+ * Wake consumers after items have been added to a list cache.  Only
+ * the transition from empty to non-empty needs a wakeup; consumers
+ * pass it along while items remain (see _lc_wakeafterget()).
+ * @plc: list cache, locked.
+ * @wasempty: whether the list was empty before the items were added.
+ * @n: number of items added.
+ * @flags: PLCBF_* operational behavior flags.
+ */
+__static void
+_lc_wakeafteradd(struct psc_listcache *plc, int wasempty, int n,
+    int flags)
+{
+	if (pfl_waitq_nwaiters(&plc->plc_wq_empty) == 0)
+		return;
+	if ((flags & PLCBF_WAKEALL) || (wasempty && n > 1))
+		pfl_waitq_wakeall(&plc->plc_wq_empty);
+	else if (wasempty)
+		pfl_waitq_wakeone(&plc->plc_wq_empty);
+}
+
 /*
  * Add an item entry to a list cache.
  * @plc: the list cache to add to.
@@ -122,7 +233,7 @@ lc_kill(struct psc_listcache *plc)
 int
 _lc_add(struct psc_listcache *plc, void *p, int flags, void *cmpf)
 {
-	int locked;
+	int locked, wasempty;
 
 	locked = LIST_CACHE_RLOCK(plc);
 
@@ -132,6 +243,7 @@ _lc_add(struct psc_listcache *plc, void *p, int flags, void *cmpf)
 		return (0);
 	}
 
+	wasempty = plc->plc_nitems == 0;
 	if (cmpf && (flags & PLCBF_REVERSE))
 		pll_add_sorted_backwards(&plc->plc_pll, p, cmpf);
 	else if (cmpf)
@@ -148,10 +260,44 @@ _lc_add(struct psc_listcache *plc, void *p, int flags, void *cmpf)
 	 * There is now an item available; wake up waiters who think the
 	 * list is empty.
 	 */
-	if (flags & PLCBF_WAKEALL)
-		pfl_waitq_wakeall(&plc->plc_wq_empty);
-	else
-		pfl_waitq_wakeone(&plc->plc_wq_empty);
+	_lc_wakeafteradd(plc, wasempty, 1, flags);
+	LIST_CACHE_URLOCK(plc, locked);
+	return (1);
+}
+
+/*
+ * Add a number of items to a list cache under a single lock
+ * acquisition.
+ * @plc: the list cache to add to.
+ * @pv: items to add, in order.
+ * @n: number of items.
+ * @flags: PLCBF_* operational behavior flags.
+ * Returns zero if the list is dying and nothing was added.
+ */
+int
+_lc_addv(struct psc_listcache *plc, void **pv, int n, int flags)
+{
+	int locked, wasempty, i;
+
+	locked = LIST_CACHE_RLOCK(plc);
+
+	if (plc->plc_flags & PLCF_DYING) {
+		pfl_assert(flags & PLCBF_DYINGOK);
+		LIST_CACHE_URLOCK(plc, locked);
+		return (0);
+	}
+
+	wasempty = plc->plc_nitems == 0;
+	for (i = 0; i < n; i++)
+		if (flags & PLCBF_TAIL)
+			pll_addtail(&plc->plc_pll, pv[i]);
+		else
+			pll_addhead(&plc->plc_pll, pv[n - i - 1]);
+
+	if (plc->plc_nseen)
+		pfl_opstat_add(plc->plc_nseen, n);
+
+	_lc_wakeafteradd(plc, wasempty, n, flags);
 	LIST_CACHE_URLOCK(plc, locked);
 	return (1);
 }
@@ -136,6 +136,9 @@ struct psc_listcache {
 #define lc_addtail(plc, p)		((void)_lc_add((plc), (p), PLCBF_TAIL, NULL))
 #define lc_add(plc, p)			((void)_lc_add((plc), (p), PLCBF_TAIL, NULL))
 
+#define lc_addv(plc, pv, n)		((void)_lc_addv((plc), (pv), (n), PLCBF_TAIL))
+#define lc_addv_head(plc, pv, n)	((void)_lc_addv((plc), (pv), (n), PLCBF_HEAD))
+
 #define lc_add_sorted(plc, p, f)	_lc_add((plc), (p), 0, (f))
 #define lc_add_sorted_backwards(plc, p, f)				\
 					_lc_add((plc), (p), PLCBF_REVERSE, (f))
@@ -145,6 +148,9 @@ struct psc_listcache {
 #define lc_gettimed(plc, tm)		_lc_get((plc), (tm), PLCBF_HEAD)
 #define lc_getwait(plc)			_lc_get((plc), NULL, PLCBF_HEAD)
 #define lc_getnb(plc)			_lc_get((plc), NULL, PLCBF_HEAD | PLCBF_NOBLOCK)
+#define lc_getn(plc, pv, n)		_lc_getn((plc), (pv), (n), NULL, PLCBF_HEAD)
+#define lc_getn_nb(plc, pv, n)		_lc_getn((plc), (pv), (n), NULL, PLCBF_HEAD | PLCBF_NOBLOCK)
+#define lc_getn_timed(plc, pv, n, tm)	_lc_getn((plc), (pv), (n), (tm), PLCBF_HEAD)
 #define lc_peekheadtimed(plc, tm)	_lc_get((plc), (tm), PLCBF_HEAD | PLCBF_PEEK)
 #define lc_peekheadwait(plc)		_lc_get((plc), NULL, PLCBF_HEAD | PLCBF_PEEK)
 #define lc_peekhead(plc)		_lc_get((plc), NULL, PLCBF_HEAD | PLCBF_NOBLOCK | PLCBF_PEEK)
@@ -190,7 +196,9 @@ struct psc_listcache {
 struct psc_listcache *
 	  lc_lookup(const char *);
 int	 _lc_add(struct psc_listcache *, void *, int, void *);
+int	 _lc_addv(struct psc_listcache *, void **, int, int);
 void	*_lc_get(struct psc_listcache *, const struct timespec *, int);
+int	 _lc_getn(struct psc_listcache *, void **, int, const struct timespec *, int);
 void	 _lc_init(struct psc_listcache *, const char *, ptrdiff_t);
 void	  lc_kill(struct psc_listcache *);
 void	 _lc_move(struct psc_listcache *, void *, int);
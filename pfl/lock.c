@@ -0,0 +1,123 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Spinlock contention path.
+ *
+ * A contended spinlock is first spun on for a bounded, per-lock
+ * adaptive number of iterations (never on a uniprocessor, where the
+ * owner cannot run meanwhile), then the lock is marked as having
+ * waiters and the caller sleeps in the kernel until the owner hands
+ * it back.  Lock values are three-state as in Drepper's "Futexes Are
+ * Tricky": unlocked, locked, and locked with (possible) waiters; only
+ * releasing the latter costs a system call.
+ */
+
+#include <sys/param.h>
+#ifdef HAVE_FUTEX
+#  include <sys/syscall.h>
+
+#  include <linux/futex.h>
+#endif
+
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/atomic.h"
+#include "pfl/lock.h"
+#include "pfl/pfl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define PSL_CPU_RELAX()	__asm__ __volatile__("pause" ::: "memory")
+#else
+#  define PSL_CPU_RELAX()	__sync_synchronize()
+#endif
+
+__static int	psc_spin_ncpu;
+
+/*
+ * Acquire a spinlock that was found locked.  On return the caller owns
+ * the lock and must fill in ownership as for an uncontended acquire.
+ * @psl: the spinlock.
+ */
+void
+_psc_spin_lock_slow(struct psc_spinlock *psl)
+{
+	psc_atomic32_t *v = _SPIN_GETATOM(psl);
+	int i, max = 0;
+
+	if (psc_spin_ncpu == 0)
+		psc_spin_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/*
+	 * Spin up to about twice what it took to get this lock
+	 * recently.  psl_spins is a heuristic and updated racily.
+	 */
+	if (psc_spin_ncpu > 1)
+		max = MIN(PSL_SPIN_MAX, psl->psl_spins * 2 + 10);
+	for (i = 0; i < max; i++) {
+		PSL_CPU_RELAX();
+		if (psc_atomic32_read(v) == PSL_UNLOCKED &&
+		    psc_atomic32_cmpxchg(v, PSL_UNLOCKED, PSL_LOCKED) ==
+		    PSL_UNLOCKED) {
+			psl->psl_spins += (i - psl->psl_spins) / 8;
+			return;
+		}
+	}
+	if (max)
+		psl->psl_spins += (max - psl->psl_spins) / 8;
+
+#ifdef HAVE_FUTEX
+	while (PSC_ATOMIC32_XCHG(v, PSL_CONTENDED) != PSL_UNLOCKED)
+		syscall(SYS_futex, v, FUTEX_WAIT_PRIVATE, PSL_CONTENDED,
+		    NULL, NULL, 0);
+#else
+	{
+		struct timespec ts;
+
+		for (i = 0; psc_atomic32_cmpxchg(v, PSL_UNLOCKED,
+		    PSL_LOCKED) != PSL_UNLOCKED; pscthr_yield(), i++)
+			if (i >= PSL_SLEEP_NTRIES) {
+				ts.tv_sec = 0;
+				ts.tv_nsec = PSL_SLEEP_NSEC;
+				nanosleep(&ts, NULL);
+				i = 0;
+			}
+	}
+#endif
+}
+
+/*
+ * Wake one thread sleeping on a spinlock just released.
+ * @psl: the spinlock.
+ */
+void
+_psc_spin_wake(struct psc_spinlock *psl)
+{
+#ifdef HAVE_FUTEX
+	syscall(SYS_futex, _SPIN_GETATOM(psl), FUTEX_WAKE_PRIVATE, 1,
+	    NULL, NULL, 0);
+#else
+	(void)psl;
+#endif
+}
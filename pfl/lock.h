@@ -22,8 +22,9 @@
  */
 
 /*
- * Spinlock routines: busy wait until another thread is done with a
- * critical section.
+ * Spinlock routines: wait until another thread is done with a critical
+ * section.  Contended acquisitions spin briefly, then sleep in the
+ * kernel where futexes are available (see lock.c).
  *
  * Note: these routines depend on 32-bit atomic operations and may
  * supply higher precision (64-bit) atomic operations on some
@@ -43,6 +44,7 @@
 #include <unistd.h>
 
 #include "pfl/_atomic32.h"
+#include "pfl/lockprof.h"
 #include "pfl/log.h"
 #include "pfl/time.h"
 #include "pfl/types.h"
@@ -56,7 +58,8 @@
 
 enum psc_spinlock_val {
 	PSL_UNLOCKED = 2,
-	PSL_LOCKED = 3
+	PSL_LOCKED = 3,
+	PSL_CONTENDED = 4			/* locked, may have sleepers */
 };
 
 typedef struct psc_spinlock {
@@ -64,16 +67,18 @@ typedef struct psc_spinlock {
 	int16_t			 psl_flags;
 	int16_t			 psl_owner_lineno;
 	const char		*psl_owner_file;
-#ifdef LOCK_TIMING
-	struct timeval		 psl_time;
-#endif
 	pthread_t		 psl_owner;
+	struct pfl_lockprof_site *psl_prof_site;	/* see pfl/lockprof.h */
+	uint64_t		 psl_prof_ts;
+	int32_t			 psl_spins;	/* adaptive spin estimate */
 } psc_spinlock_t;
 
 #define PSLF_NOLOG		(1 << 0)	/* don't psclog locks/unlocks */
 #define PSLF_LOGTMP		(1 << 1)	/* psclog to tmp subsystem */
 
-#define PSL_SLEEP_NTRIES	32
+#define PSL_SPIN_MAX		100		/* max pause loops before sleeping */
+
+#define PSL_SLEEP_NTRIES	32		/* without futexes */
 #define PSL_SLEEP_NSEC		5001
 
 #define _SPIN_GETATOM(psl)	(&(psl)->psl_value)
@@ -89,18 +94,8 @@ typedef struct psc_spinlock {
 #define INIT_SPINLOCK_NOLOG(psl) INIT_SPINLOCK_FLAGS((psl), PSLF_NOLOG)
 #define INIT_SPINLOCK_LOGTMP(psl)INIT_SPINLOCK_FLAGS((psl), PSLF_LOGTMP)
 
-#ifdef LOCK_TIMING
-#  define _SPINLOCK_TIMING_INIT	{ 0, 0 },
-
-#  define _psc_spin_checktime(psl)	_psc_spin_checktime_impl(psl)
-#else
-#  define _SPINLOCK_TIMING_INIT
-
-#  define _psc_spin_checktime(psl)
-#endif
-
 #define SPINLOCK_INITF(f)	{ PSC_ATOMIC32_INIT(PSL_UNLOCKED), (f),	\
-				  0, NULL, _SPINLOCK_TIMING_INIT 0 }
+				  0, NULL, 0, NULL, 0, 0 }
 
 #define SPINLOCK_INIT		SPINLOCK_INITF(0)
 #define SPINLOCK_INIT_NOLOG	SPINLOCK_INITF(PSLF_NOLOG)
@@ -112,7 +107,8 @@ typedef struct psc_spinlock {
 	do {								\
 		enum psc_spinlock_val _val = _SPIN_GETVAL(psl);		\
 									\
-		if (_val != PSL_LOCKED && _val != PSL_UNLOCKED)		\
+		if (_val != PSL_LOCKED && _val != PSL_UNLOCKED &&	\
+		    _val != PSL_CONTENDED)				\
 			psc_fatalx("%s: lock %p has invalid value %#x",	\
 			    (name), (psl), _val);			\
 	} while (0)
@@ -130,28 +126,50 @@ typedef struct psc_spinlock {
 			    (psl), (psl)->psl_owner, pthread_self());	\
 	} while (0)
 
+/*
+ * Record an acquisition with the contention profiler.
+ * @psl: the spinlock, just acquired.
+ * @t0: when waiting for it began, or zero.
+ */
+#define _SPIN_PROF_ACQUIRED(psl, t0)					\
+	do {								\
+		if (PFL_LOCKPROF_ENABLED())				\
+			(psl)->psl_prof_ts = _pfl_lockprof_acquire(	\
+			    __FILE__, __LINE__, PFL_LOCKPROF_SPIN,	\
+			    (t0), &(psl)->psl_prof_site);		\
+	} while (0)
+
+/*
+ * Fill in ownership of a spinlock just acquired.
+ * @t0: when waiting for it began, or zero.
+ */
+#define _SPIN_SETOWNER(pci, psl, t0)					\
+	do {								\
+		pfl_assert((psl)->psl_owner == 0);			\
+		(psl)->psl_owner = pthread_self();			\
+		(psl)->psl_owner_file = __FILE__;			\
+		(psl)->psl_owner_lineno = __LINE__;			\
+		_SPIN_PROF_ACQUIRED((psl), (t0));			\
+		if (((psl)->psl_flags & PSLF_NOLOG) == 0)		\
+			_psclog_pci((pci), PLL_VDEBUG, 0,		\
+			    "lock %p acquired",	(psl));			\
+	} while (0)
+
 #define _SPIN_TEST_AND_SET(pci, name, psl)				\
 	{								\
 		enum psc_spinlock_val _val;				\
 		int _lrc;						\
 									\
-		_val = PSC_ATOMIC32_XCHG(_SPIN_GETATOM(psl),		\
-		    PSL_LOCKED);					\
-		if ((_val) == PSL_LOCKED) {				\
+		_val = psc_atomic32_cmpxchg(_SPIN_GETATOM(psl),		\
+		    PSL_UNLOCKED, PSL_LOCKED);				\
+		if ((_val) == PSL_LOCKED || (_val) == PSL_CONTENDED) {	\
 			if ((psl)->psl_owner == pthread_self())		\
 				_psclog_pci((pci), PLL_FATAL, 0,	\
 				    "%s %p: already locked", (name),	\
 				    (psl));				\
-			/* PFL_GETTIMEVAL(&(psl)->psl_time); */		\
 			_lrc = 0;					\
 		} else if ((_val) == PSL_UNLOCKED) {			\
-			pfl_assert((psl)->psl_owner == 0);		\
-			(psl)->psl_owner = pthread_self();		\
-			(psl)->psl_owner_file = __FILE__;		\
-			(psl)->psl_owner_lineno = __LINE__;		\
-			if (((psl)->psl_flags & PSLF_NOLOG) == 0)	\
-				_psclog_pci((pci), PLL_VDEBUG, 0,	\
-				    "lock %p acquired",	(psl));		\
+			_SPIN_SETOWNER((pci), (psl), 0);		\
 			_lrc = 1;					\
 		} else							\
 			_psclog_pci((pci), PLL_FATAL, 0,		\
@@ -169,22 +187,19 @@ typedef struct psc_spinlock {
 
 /*
  * Block until the caller locks a spinlock for a critical section.
+ * When profiling, the wait is timed from the first failed attempt.
  * @psl: the spinlock.
  */
 #define spinlock_pci(pci, psl)						\
 	do {								\
-		struct timespec _tm;					\
-		int _i;							\
+		uint64_t _t0 = 0;					\
 									\
-		for (_i = 0;						\
-		    !(_SPIN_TEST_AND_SET((pci), "spinlock", (psl)));	\
-		    pscthr_yield(), _i++)				\
-			if (_i >= PSL_SLEEP_NTRIES) {			\
-				_tm.tv_sec  = 0;			\
-				_tm.tv_nsec = PSL_SLEEP_NSEC;		\
-				nanosleep(&_tm, 0);			\
-				_i = 0;					\
-			}						\
+		if (!(_SPIN_TEST_AND_SET((pci), "spinlock", (psl)))) {	\
+			if (PFL_LOCKPROF_ENABLED())			\
+				_t0 = pfl_lockprof_now();		\
+			_psc_spin_lock_slow(psl);			\
+			_SPIN_SETOWNER((pci), (psl), _t0);		\
+		}							\
 	} while (0)
 
 /*
@@ -196,13 +211,19 @@ typedef struct psc_spinlock {
 		int _dolog = 0;						\
 									\
 		_SPIN_ENSURELOCKED("freelock", (psl));			\
-		_psc_spin_checktime(psl);				\
+		if ((psl)->psl_prof_ts) {				\
+			_pfl_lockprof_release((psl)->psl_prof_site,	\
+			    (psl)->psl_prof_ts);			\
+			(psl)->psl_prof_ts = 0;				\
+		}							\
 		(psl)->psl_owner = 0;					\
 		(psl)->psl_owner_file = __FILE__;			\
 		(psl)->psl_owner_lineno = __LINE__;			\
 		if (((psl)->psl_flags & PSLF_NOLOG) == 0)		\
 			_dolog = 1;					\
-		psc_atomic32_set(_SPIN_GETATOM(psl), PSL_UNLOCKED);	\
+		if (PSC_ATOMIC32_XCHG(_SPIN_GETATOM(psl),		\
+		    PSL_UNLOCKED) == PSL_CONTENDED)			\
+			_psc_spin_wake(psl);				\
 		if (_dolog)						\
 			_psclog_pci((pci), PLL_VDEBUG, 0,		\
 			    "lock %p released", (psl));			\
@@ -257,9 +278,8 @@ typedef struct psc_spinlock {
 #define trylock(psl)		trylock_pci(_SPIN_CALLERINFO(psl), (psl))
 #define spinlock(psl)		spinlock_pci(_SPIN_CALLERINFO(psl), (psl))
 
-#ifdef LOCK_TIMING
-static __inline void _psc_spin_checktime_impl(struct psc_spinlock *);
-#endif
+void	_psc_spin_lock_slow(struct psc_spinlock *);
+void	_psc_spin_wake(struct psc_spinlock *);
 
 #ifndef _PFL_ATOMIC_H_
 #  include "pfl/atomic.h"
@@ -287,22 +307,6 @@ static __inline void _psc_spin_checktime_impl(struct psc_spinlock *);
 		ureqlock((lk), _locked);				\
 	} while (0)
 
-#ifdef LOCK_TIMING
-static __inline void
-_psc_spin_checktime_impl(struct psc_spinlock *psl)
-{
-	struct timeval now, diff;
-
-	PFL_GETTIMEVAL(&now);
-	max.tv_sec = 0;
-	max.tv_usec = 500;
-	timersub(&now, &psl->psl_time, &diff);
-	if (timercmp(&diff, &max, >))
-		psclog_errorx("lock %p held long (%luus)",
-		    psl, diff.tv_sec * 1000 * 1000 + diff.tv_usec);
-}
-#endif
-
 static __inline int
 psc_spin_haslock(psc_spinlock_t *psl)
 {
@@ -311,7 +315,7 @@ psc_spin_haslock(psc_spinlock_t *psl)
 	 * This code is thread safe because even if psl_owner changes,
 	 * it won't be set to us.
 	 */
-	return (_SPIN_GETVAL(psl) == PSL_LOCKED &&
+	return (_SPIN_GETVAL(psl) != PSL_UNLOCKED &&
 	    psl->psl_owner == pthread_self());
 }
 
@@ -0,0 +1,281 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Lock contention profiler.
+ *
+ * Sites live in a fixed open-addressed table keyed by the address of
+ * the acquiring file name, the line and the lock type, so recording
+ * never allocates and never takes a lock (which would itself be
+ * profiled).  A slot is claimed by moving its state from empty to
+ * busy, filled in and then published as ready.  Counters are updated
+ * with atomics.  Headers may yield one file name per including source
+ * file; such duplicates are merged when a snapshot is taken.
+ */
+
+#include <sys/param.h>
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pfl/alloc.h"
+#include "pfl/atomic.h"
+#include "pfl/lockprof.h"
+#include "pfl/log.h"
+#include "pfl/time.h"
+
+#define PFL_LOCKPROF_NSITES	4096		/* power of two */
+#define PFL_LOCKPROF_HASHBITS	12
+
+#define PLS_EMPTY		0
+#define PLS_BUSY		1
+#define PLS_READY		2
+
+struct pfl_lockprof_site {
+	psc_atomic32_t		 pls_state;
+	int			 pls_line;
+	int			 pls_type;
+	const char		*pls_file;
+	psc_atomic64_t		 pls_nacq;
+	psc_atomic64_t		 pls_ncontended;
+	psc_atomic64_t		 pls_wait;
+	psc_atomic64_t		 pls_waitmax;
+	psc_atomic64_t		 pls_hold;
+	psc_atomic64_t		 pls_holdmax;
+};
+
+const char *pfl_lockprof_typenames[] = {
+	"spin",
+	"mutex",
+	"rdlock",
+	"wrlock",
+};
+
+volatile int			 pfl_lockprof_enabled;
+
+__static struct pfl_lockprof_site pfl_lockprof_sites[PFL_LOCKPROF_NSITES];
+
+uint64_t
+pfl_lockprof_now(void)
+{
+	struct timespec ts;
+
+	PFL_GETTIMESPEC_MONO(&ts);
+	return (ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec);
+}
+
+/*
+ * Find or create the table slot of an acquisition site.
+ * Returns NULL when the table is full.
+ */
+__static struct pfl_lockprof_site *
+pfl_lockprof_getsite(const char *file, int line, int type)
+{
+	struct pfl_lockprof_site *pls;
+	uint64_t h;
+	int n, st;
+
+	h = ((uintptr_t)file ^ ((uint64_t)line << 2 | type)) *
+	    UINT64_C(0x9e3779b97f4a7c15);
+	h >>= 64 - PFL_LOCKPROF_HASHBITS;
+	for (n = 0; n < PFL_LOCKPROF_NSITES; n++, h++) {
+		pls = &pfl_lockprof_sites[h & (PFL_LOCKPROF_NSITES - 1)];
+		st = psc_atomic32_read(&pls->pls_state);
+		if (st == PLS_EMPTY) {
+			if (psc_atomic32_cmpxchg(&pls->pls_state,
+			    PLS_EMPTY, PLS_BUSY) == PLS_EMPTY) {
+				pls->pls_file = file;
+				pls->pls_line = line;
+				pls->pls_type = type;
+				__sync_synchronize();
+				psc_atomic32_set(&pls->pls_state, PLS_READY);
+				return (pls);
+			}
+			st = psc_atomic32_read(&pls->pls_state);
+		}
+		while (st == PLS_BUSY) {
+			sched_yield();
+			st = psc_atomic32_read(&pls->pls_state);
+		}
+		if (pls->pls_file == file && pls->pls_line == line &&
+		    pls->pls_type == type)
+			return (pls);
+	}
+	return (NULL);
+}
+
+/*
+ * Account an acquisition.
+ * @file: acquiring source file.
+ * @line: acquiring source line.
+ * @type: PFL_LOCKPROF_* lock type.
+ * @t0: when waiting began, or zero if the lock was taken uncontended.
+ * @sitep: value-result site, to be passed on release.
+ * Returns the acquisition time, to be passed on release.
+ */
+uint64_t
+_pfl_lockprof_acquire(const char *file, int line, int type,
+    uint64_t t0, struct pfl_lockprof_site **sitep)
+{
+	struct pfl_lockprof_site *pls;
+	uint64_t now;
+
+	now = pfl_lockprof_now();
+	pls = *sitep = pfl_lockprof_getsite(file, line, type);
+	if (pls == NULL)
+		return (now);
+	psc_atomic64_inc(&pls->pls_nacq);
+	if (t0) {
+		psc_atomic64_inc(&pls->pls_ncontended);
+		psc_atomic64_add(&pls->pls_wait, now - t0);
+		psc_atomic64_setmax(&pls->pls_waitmax, now - t0);
+	}
+	return (now);
+}
+
+/*
+ * Account the hold time of a lock being released.
+ * @pls: site recorded at acquisition.
+ * @ts: acquisition time.
+ */
+void
+_pfl_lockprof_release(struct pfl_lockprof_site *pls, uint64_t ts)
+{
+	uint64_t hold;
+
+	if (pls == NULL)
+		return;
+	hold = pfl_lockprof_now() - ts;
+	psc_atomic64_add(&pls->pls_hold, hold);
+	psc_atomic64_setmax(&pls->pls_holdmax, hold);
+}
+
+void
+pfl_lockprof_enable(int on)
+{
+	pfl_lockprof_enabled = on;
+}
+
+/*
+ * Zero all counters.  Sites stay in place as locks held right now may
+ * still reference them.
+ */
+void
+pfl_lockprof_reset(void)
+{
+	struct pfl_lockprof_site *pls;
+	int i;
+
+	for (i = 0, pls = pfl_lockprof_sites; i < PFL_LOCKPROF_NSITES;
+	    i++, pls++) {
+		if (psc_atomic32_read(&pls->pls_state) != PLS_READY)
+			continue;
+		psc_atomic64_set(&pls->pls_nacq, 0);
+		psc_atomic64_set(&pls->pls_ncontended, 0);
+		psc_atomic64_set(&pls->pls_wait, 0);
+		psc_atomic64_set(&pls->pls_waitmax, 0);
+		psc_atomic64_set(&pls->pls_hold, 0);
+		psc_atomic64_set(&pls->pls_holdmax, 0);
+	}
+}
+
+__static int
+pfl_lockprof_cmpsite(const void *a, const void *b)
+{
+	const struct pfl_lockprof_stat *x = a, *y = b;
+	int rc;
+
+	rc = strcmp(x->pls_file, y->pls_file);
+	if (rc)
+		return (rc);
+	if (x->pls_line != y->pls_line)
+		return (CMP(x->pls_line, y->pls_line));
+	return (CMP(x->pls_type, y->pls_type));
+}
+
+__static int
+pfl_lockprof_cmpwait(const void *a, const void *b)
+{
+	const struct pfl_lockprof_stat *x = a, *y = b;
+
+	if (x->pls_wait != y->pls_wait)
+		return (CMP(y->pls_wait, x->pls_wait));
+	return (CMP(y->pls_ncontended, x->pls_ncontended));
+}
+
+/*
+ * Take a snapshot of all sites that saw an acquisition, most total
+ * wait time first.
+ * @statsp: value-result array, to be freed by the caller.
+ * Returns the number of entries.
+ */
+int
+pfl_lockprof_snapshot(struct pfl_lockprof_stat **statsp)
+{
+	struct pfl_lockprof_stat *st, *p;
+	struct pfl_lockprof_site *pls;
+	int i, n = 0;
+
+	st = PSCALLOC(PFL_LOCKPROF_NSITES * sizeof(*st));
+	for (i = 0, pls = pfl_lockprof_sites; i < PFL_LOCKPROF_NSITES;
+	    i++, pls++) {
+		if (psc_atomic32_read(&pls->pls_state) != PLS_READY ||
+		    psc_atomic64_read(&pls->pls_nacq) == 0)
+			continue;
+		p = &st[n++];
+		p->pls_file = pls->pls_file;
+		p->pls_line = pls->pls_line;
+		p->pls_type = pls->pls_type;
+		p->pls_nacq = psc_atomic64_read(&pls->pls_nacq);
+		p->pls_ncontended = psc_atomic64_read(&pls->pls_ncontended);
+		p->pls_wait = psc_atomic64_read(&pls->pls_wait);
+		p->pls_waitmax = psc_atomic64_read(&pls->pls_waitmax);
+		p->pls_hold = psc_atomic64_read(&pls->pls_hold);
+		p->pls_holdmax = psc_atomic64_read(&pls->pls_holdmax);
+	}
+
+	/* fold sites whose file name string was duplicated */
+	qsort(st, n, sizeof(*st), pfl_lockprof_cmpsite);
+	for (i = 1, p = st; i < n; i++) {
+		if (pfl_lockprof_cmpsite(p, &st[i]) == 0) {
+			p->pls_nacq += st[i].pls_nacq;
+			p->pls_ncontended += st[i].pls_ncontended;
+			p->pls_wait += st[i].pls_wait;
+			p->pls_waitmax = MAX(p->pls_waitmax,
+			    st[i].pls_waitmax);
+			p->pls_hold += st[i].pls_hold;
+			p->pls_holdmax = MAX(p->pls_holdmax,
+			    st[i].pls_holdmax);
+		} else
+			*++p = st[i];
+	}
+	if (n)
+		n = p - st + 1;
+
+	qsort(st, n, sizeof(*st), pfl_lockprof_cmpwait);
+	*statsp = st;
+	return (n);
+}
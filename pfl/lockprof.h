@@ -0,0 +1,76 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Lock contention profiler.  When enabled, spinlocks, pfl_mutex and
+ * pfl_rwlock acquisitions are aggregated per acquisition site (file
+ * and line): how often the lock was taken, how often the caller had
+ * to wait for it, the total and maximum wait, and the total and
+ * maximum time it was then held.  Waits are only timed after an
+ * initial try fails, so uncontended acquisitions read no clock for
+ * them.
+ *
+ * This header is included by pfl/lock.h and so must not depend on
+ * anything that includes it.
+ */
+
+#ifndef _PFL_LOCKPROF_H_
+#define _PFL_LOCKPROF_H_
+
+#include <stdint.h>
+
+struct pfl_lockprof_site;
+
+#define PFL_LOCKPROF_SPIN	0
+#define PFL_LOCKPROF_MUTEX	1
+#define PFL_LOCKPROF_RDLOCK	2
+#define PFL_LOCKPROF_WRLOCK	3
+#define PFL_LOCKPROF_NTYPES	4
+
+#define PFL_LOCKPROF_ENABLED()	__builtin_expect(pfl_lockprof_enabled, 0)
+
+/* aggregated statistics for one site */
+struct pfl_lockprof_stat {
+	const char		*pls_file;
+	int			 pls_line;
+	int			 pls_type;
+	uint64_t		 pls_nacq;
+	uint64_t		 pls_ncontended;
+	uint64_t		 pls_wait;	/* nanoseconds */
+	uint64_t		 pls_waitmax;
+	uint64_t		 pls_hold;
+	uint64_t		 pls_holdmax;
+};
+
+uint64_t _pfl_lockprof_acquire(const char *, int, int, uint64_t,
+	    struct pfl_lockprof_site **);
+void	 _pfl_lockprof_release(struct pfl_lockprof_site *, uint64_t);
+void	 pfl_lockprof_enable(int);
+uint64_t pfl_lockprof_now(void);
+void	 pfl_lockprof_reset(void);
+int	 pfl_lockprof_snapshot(struct pfl_lockprof_stat **);
+
+extern const char	*pfl_lockprof_typenames[];
+extern volatile int	 pfl_lockprof_enabled;
+
+#endif /* _PFL_LOCKPROF_H_ */
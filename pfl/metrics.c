@@ -0,0 +1,689 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * OpenMetrics exporter.  Every object is copied out under its own lock
+ * into plain rows first and only then formatted, so no pfl lock is
+ * held while text is generated or while a (possibly slow) client
+ * drains the socket.
+ */
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/dynarray.h"
+#include "pfl/hashtbl.h"
+#include "pfl/listcache.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/meter.h"
+#include "pfl/metrics.h"
+#include "pfl/mlist.h"
+#include "pfl/net.h"
+#include "pfl/opstats.h"
+#include "pfl/pool.h"
+#include "pfl/str.h"
+#include "pfl/thread.h"
+
+#define QLEN 15	/* listen(2) queue */
+#define SNDTIMEO 5	/* seconds a client may stall a scrape */
+
+struct pfl_metrics_collector {
+	char			 pmc_name[PFL_METRICS_NAME_MAX];
+	pfl_metrics_collector_t	 pmc_cb;
+	void			*pmc_arg;
+};
+
+struct pfl_metricsthr {
+	int			 pmt_sock;
+};
+
+#define pfl_metricsthr(thr)	((struct pfl_metricsthr *)(thr)->pscthr_private)
+
+__static struct psc_spinlock	pfl_metrics_lock = SPINLOCK_INIT;
+__static struct psc_dynarray	pfl_metrics_collectors = DYNARRAY_INIT;
+
+/*
+ * Print a label value, escaping as the text format requires.
+ */
+__static void
+pfl_metrics_prlabel(FILE *fp, const char *s)
+{
+	for (; *s; s++)
+		switch (*s) {
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		default:
+			putc(*s, fp);
+			break;
+		}
+}
+
+/*
+ * Format metric families from copied-out rows.
+ * @fp: output stream.
+ * @f: families, each taking its value from one pmr_vals[] slot.
+ * @nf: number of families.
+ * @label: label name to carry each row's pmr_name.
+ * @rows: rows.
+ * @nrows: number of rows.
+ */
+void
+pfl_metrics_emit(FILE *fp, const struct pfl_metrics_field *f, int nf,
+    const char *label, const struct pfl_metrics_row *rows, int nrows)
+{
+	int i, j;
+
+	if (nrows == 0)
+		return;
+	for (i = 0; i < nf; i++, f++) {
+		fprintf(fp, "# TYPE %s %s\n", f->pmf_name,
+		    f->pmf_type == PMFT_COUNTER ? "counter" : "gauge");
+		if (f->pmf_help)
+			fprintf(fp, "# HELP %s %s\n", f->pmf_name,
+			    f->pmf_help);
+		for (j = 0; j < nrows; j++) {
+			fprintf(fp, "%s%s{%s=\"", f->pmf_name,
+			    f->pmf_type == PMFT_COUNTER ? "_total" : "",
+			    label);
+			pfl_metrics_prlabel(fp, rows[j].pmr_name);
+			fprintf(fp, "\"} %"PRId64"\n",
+			    rows[j].pmr_vals[f->pmf_idx]);
+		}
+	}
+}
+
+/*
+ * Grow a row array for @n objects.  Callers count objects with their
+ * list lock held, and drop it to grow and recount if short, so nothing
+ * is allocated under the lock.
+ */
+__static void
+pfl_metrics_rows_grow(struct pfl_metrics_row **rows, int *nalloc, int n)
+{
+	*nalloc = n + 8;
+	*rows = psc_realloc(*rows, *nalloc * sizeof(**rows), 0);
+}
+
+__static const struct pfl_metrics_field pfl_metrics_opstat_fields[] = {
+	{ "pfl_opstat", PMFT_COUNTER, 0, "pfl operation counter" },
+};
+
+__static const struct pfl_metrics_field pfl_metrics_pool_fields[] = {
+	{ "pfl_pool_items",	PMFT_GAUGE,	0, "items in circulation" },
+	{ "pfl_pool_free",	PMFT_GAUGE,	1, "items on the free list" },
+	{ "pfl_pool_min",	PMFT_GAUGE,	2, NULL },
+	{ "pfl_pool_max",	PMFT_GAUGE,	3, NULL },
+	{ "pfl_pool_gets",	PMFT_COUNTER,	4, NULL },
+	{ "pfl_pool_grows",	PMFT_COUNTER,	5, NULL },
+	{ "pfl_pool_shrinks",	PMFT_COUNTER,	6, NULL },
+};
+
+__static const struct pfl_metrics_field pfl_metrics_listcache_fields[] = {
+	{ "pfl_listcache_items", PMFT_GAUGE,	0, NULL },
+	{ "pfl_listcache_adds",	 PMFT_COUNTER,	1, NULL },
+};
+
+__static const struct pfl_metrics_field pfl_metrics_hashtbl_fields[] = {
+	{ "pfl_hashtable_buckets",	PMFT_GAUGE, 0, NULL },
+	{ "pfl_hashtable_used_buckets",	PMFT_GAUGE, 1, NULL },
+	{ "pfl_hashtable_entries",	PMFT_GAUGE, 2, NULL },
+	{ "pfl_hashtable_max_chain",	PMFT_GAUGE, 3,
+	    "longest bucket chain" },
+};
+
+__static const struct pfl_metrics_field pfl_metrics_meter_fields[] = {
+	{ "pfl_meter_current",	PMFT_GAUGE, 0, NULL },
+	{ "pfl_meter_max",	PMFT_GAUGE, 1, NULL },
+};
+
+/* a histogram copied out under pfl_opstats_lock */
+struct pfl_metrics_histo {
+	char				 pmh_name[PFL_METRICS_NAME_MAX];
+	struct pfl_histogram_snap	 pmh_snap;
+};
+
+__static int
+pfl_metrics_opstats(struct pfl_metrics_row **rowsp)
+{
+	struct pfl_metrics_row *rows = NULL;
+	struct pfl_opstat *opst;
+	int i, n, nalloc = 0;
+
+	for (;;) {
+		spinlock(&pfl_opstats_lock);
+		n = psc_dynarray_len(&pfl_opstats);
+		if (n <= nalloc)
+			break;
+		freelock(&pfl_opstats_lock);
+		pfl_metrics_rows_grow(&rows, &nalloc, n);
+	}
+	DYNARRAY_FOREACH(opst, i, &pfl_opstats) {
+		strlcpy(rows[i].pmr_name, opst->opst_name,
+		    sizeof(rows[i].pmr_name));
+		rows[i].pmr_vals[0] = _pfl_opstat_read(opst);
+	}
+	freelock(&pfl_opstats_lock);
+
+	*rowsp = rows;
+	return (n);
+}
+
+/*
+ * Snapshot every histogram without dropping pfl_opstats_lock, since
+ * pfl_histogram_destroy() frees a histogram as soon as it is unlinked.
+ */
+__static int
+pfl_metrics_histograms(struct pfl_metrics_histo **hv)
+{
+	struct pfl_metrics_histo *h = NULL;
+	struct pfl_histogram *phg;
+	int i, n, nalloc = 0;
+
+	for (;;) {
+		spinlock(&pfl_opstats_lock);
+		n = psc_dynarray_len(&pfl_histograms);
+		if (n <= nalloc)
+			break;
+		freelock(&pfl_opstats_lock);
+		nalloc = n + 8;
+		h = psc_realloc(h, nalloc * sizeof(*h), 0);
+	}
+	DYNARRAY_FOREACH(phg, i, &pfl_histograms) {
+		strlcpy(h[i].pmh_name, phg->phg_name,
+		    sizeof(h[i].pmh_name));
+		_pfl_histogram_snapshot(phg, &h[i].pmh_snap);
+	}
+	freelock(&pfl_opstats_lock);
+
+	*hv = h;
+	return (n);
+}
+
+__static void
+pfl_metrics_emithistograms(FILE *fp, struct pfl_metrics_histo *h,
+    int n)
+{
+	static const double q[] = { .5, .9, .99, .999 };
+	int i, j;
+
+	if (n)
+		fprintf(fp, "# TYPE pfl_histogram summary\n"
+		    "# HELP pfl_histogram pfl latency distribution\n");
+	for (i = 0; i < n; i++, h++) {
+		for (j = 0; j < (int)nitems(q); j++) {
+			fprintf(fp, "pfl_histogram{name=\"");
+			pfl_metrics_prlabel(fp, h->pmh_name);
+			fprintf(fp, "\",quantile=\"%g\"} %"PRIu64"\n", q[j],
+			    pfl_histogram_snap_percentile(&h->pmh_snap,
+			    q[j] * 100));
+		}
+		fprintf(fp, "pfl_histogram_sum{name=\"");
+		pfl_metrics_prlabel(fp, h->pmh_name);
+		fprintf(fp, "\"} %"PRIu64"\n", h->pmh_snap.phs_sum);
+		fprintf(fp, "pfl_histogram_count{name=\"");
+		pfl_metrics_prlabel(fp, h->pmh_name);
+		fprintf(fp, "\"} %"PRIu64"\n", h->pmh_snap.phs_count);
+	}
+}
+
+__static int
+pfl_metrics_pools(struct pfl_metrics_row **rowsp)
+{
+	struct pfl_metrics_row *rows = NULL, *r;
+	struct psc_poolmgr *m;
+	int n, nalloc = 0;
+
+	for (;;) {
+		PLL_LOCK(&psc_pools);
+		n = pll_nitems(&psc_pools);
+		if (n <= nalloc)
+			break;
+		PLL_ULOCK(&psc_pools);
+		pfl_metrics_rows_grow(&rows, &nalloc, n);
+	}
+	r = rows;
+	PLL_FOREACH(m, &psc_pools) {
+		POOL_LOCK(m);
+		strlcpy(r->pmr_name, m->ppm_name, sizeof(r->pmr_name));
+		r->pmr_vals[0] = m->ppm_total;
+		r->pmr_vals[1] = POOL_IS_MLIST(m) ?
+		    pfl_mlist_size(&m->ppm_ml) : lc_nitems(&m->ppm_lc);
+		r->pmr_vals[2] = m->ppm_min;
+		r->pmr_vals[3] = m->ppm_max;
+		r->pmr_vals[4] = pfl_opstat_read(m->ppm_opst_gets);
+		r->pmr_vals[5] = pfl_opstat_read(m->ppm_opst_grows);
+		r->pmr_vals[6] = pfl_opstat_read(m->ppm_opst_shrinks);
+		POOL_ULOCK(m);
+		r++;
+	}
+	PLL_ULOCK(&psc_pools);
+
+	*rowsp = rows;
+	return (n);
+}
+
+__static int
+pfl_metrics_listcaches(struct pfl_metrics_row **rowsp)
+{
+	struct pfl_metrics_row *rows = NULL, *r;
+	struct psc_listcache *lc;
+	int n, nalloc = 0;
+
+	for (;;) {
+		PLL_LOCK(&psc_listcaches);
+		n = pll_nitems(&psc_listcaches);
+		if (n <= nalloc)
+			break;
+		PLL_ULOCK(&psc_listcaches);
+		pfl_metrics_rows_grow(&rows, &nalloc, n);
+	}
+	r = rows;
+	PLL_FOREACH(lc, &psc_listcaches) {
+		LIST_CACHE_LOCK(lc);
+		strlcpy(r->pmr_name, lc->plc_name, sizeof(r->pmr_name));
+		r->pmr_vals[0] = lc->plc_nitems;
+		r->pmr_vals[1] = pfl_opstat_read(lc->plc_nseen);
+		LIST_CACHE_ULOCK(lc);
+		r++;
+	}
+	PLL_ULOCK(&psc_listcaches);
+
+	*rowsp = rows;
+	return (n);
+}
+
+__static int
+pfl_metrics_hashtbls(struct pfl_metrics_row **rowsp)
+{
+	struct pfl_metrics_row *rows = NULL, *r;
+	int n, nalloc = 0, tot, used, nents, maxlen;
+	struct psc_hashtbl *pht;
+
+	for (;;) {
+		PLL_LOCK(&psc_hashtbls);
+		n = pll_nitems(&psc_hashtbls);
+		if (n <= nalloc)
+			break;
+		PLL_ULOCK(&psc_hashtbls);
+		pfl_metrics_rows_grow(&rows, &nalloc, n);
+	}
+	r = rows;
+	PLL_FOREACH(pht, &psc_hashtbls) {
+		strlcpy(r->pmr_name, pht->pht_name, sizeof(r->pmr_name));
+		psc_hashtbl_getstats(pht, &tot, &used, &nents, &maxlen);
+		r->pmr_vals[0] = tot;
+		r->pmr_vals[1] = used;
+		r->pmr_vals[2] = nents;
+		r->pmr_vals[3] = maxlen;
+		r++;
+	}
+	PLL_ULOCK(&psc_hashtbls);
+
+	*rowsp = rows;
+	return (n);
+}
+
+__static int
+pfl_metrics_meters(struct pfl_metrics_row **rowsp)
+{
+	struct pfl_metrics_row *rows = NULL, *r;
+	struct pfl_meter *pm;
+	int n, nalloc = 0;
+
+	for (;;) {
+		PLL_LOCK(&pfl_meters);
+		n = pll_nitems(&pfl_meters);
+		if (n <= nalloc)
+			break;
+		PLL_ULOCK(&pfl_meters);
+		pfl_metrics_rows_grow(&rows, &nalloc, n);
+	}
+	r = rows;
+	PLL_FOREACH(pm, &pfl_meters) {
+		strlcpy(r->pmr_name, pm->pm_name, sizeof(r->pmr_name));
+		r->pmr_vals[0] = pm->pm_cur;
+		r->pmr_vals[1] = *pm->pm_maxp;
+		r++;
+	}
+	PLL_ULOCK(&pfl_meters);
+
+	*rowsp = rows;
+	return (n);
+}
+
+/*
+ * Register a collector for objects outside the library, e.g. journals.
+ * The callback should copy its state out under its own locks and then
+ * format it with pfl_metrics_emit().  Registering a name twice is a
+ * no-op.
+ */
+void
+pfl_metrics_register(const char *name, pfl_metrics_collector_t cb,
+    void *arg)
+{
+	struct pfl_metrics_collector *pmc, *t;
+	int i;
+
+	pmc = PSCALLOC(sizeof(*pmc));
+	strlcpy(pmc->pmc_name, name, sizeof(pmc->pmc_name));
+	pmc->pmc_cb = cb;
+	pmc->pmc_arg = arg;
+
+	spinlock(&pfl_metrics_lock);
+	DYNARRAY_FOREACH(t, i, &pfl_metrics_collectors)
+		if (strcmp(t->pmc_name, name) == 0) {
+			freelock(&pfl_metrics_lock);
+			PSCFREE(pmc);
+			return;
+		}
+	psc_dynarray_add(&pfl_metrics_collectors, pmc);
+	freelock(&pfl_metrics_lock);
+}
+
+/*
+ * Generate a complete exposition.  All built-in families are copied
+ * out back to back before any text is formatted, keeping the skew
+ * between them small; each family is consistent only with itself, as
+ * it is read under its own locks.  Registered collectors run last.
+ * @lenp: value-result length of the returned text.
+ * Returns a buffer to be released with free(3).
+ */
+char *
+pfl_metrics_snapshot(size_t *lenp)
+{
+	struct pfl_metrics_row *opstats, *pools, *lcs, *htbls, *meters;
+	int i, nopstats, nhisto, npools, nlcs, nhtbls, nmeters;
+	struct psc_dynarray collectors = DYNARRAY_INIT;
+	struct pfl_metrics_collector *pmc;
+	struct pfl_metrics_histo *histo;
+	char *buf;
+	FILE *fp;
+
+	nopstats = pfl_metrics_opstats(&opstats);
+	nhisto = pfl_metrics_histograms(&histo);
+	npools = pfl_metrics_pools(&pools);
+	nlcs = pfl_metrics_listcaches(&lcs);
+	nhtbls = pfl_metrics_hashtbls(&htbls);
+	nmeters = pfl_metrics_meters(&meters);
+
+	fp = open_memstream(&buf, lenp);
+	if (fp == NULL)
+		psc_fatal("open_memstream");
+
+	pfl_metrics_emit(fp, pfl_metrics_opstat_fields,
+	    nitems(pfl_metrics_opstat_fields), "name", opstats, nopstats);
+	pfl_metrics_emithistograms(fp, histo, nhisto);
+	pfl_metrics_emit(fp, pfl_metrics_pool_fields,
+	    nitems(pfl_metrics_pool_fields), "pool", pools, npools);
+	pfl_metrics_emit(fp, pfl_metrics_listcache_fields,
+	    nitems(pfl_metrics_listcache_fields), "list", lcs, nlcs);
+	pfl_metrics_emit(fp, pfl_metrics_hashtbl_fields,
+	    nitems(pfl_metrics_hashtbl_fields), "table", htbls, nhtbls);
+	pfl_metrics_emit(fp, pfl_metrics_meter_fields,
+	    nitems(pfl_metrics_meter_fields), "meter", meters, nmeters);
+
+	PSCFREE(opstats);
+	for (i = 0; i < nhisto; i++)
+		pfl_histogram_snap_free(&histo[i].pmh_snap);
+	PSCFREE(histo);
+	PSCFREE(pools);
+	PSCFREE(lcs);
+	PSCFREE(htbls);
+	PSCFREE(meters);
+
+	spinlock(&pfl_metrics_lock);
+	DYNARRAY_FOREACH(pmc, i, &pfl_metrics_collectors)
+		psc_dynarray_add(&collectors, pmc);
+	freelock(&pfl_metrics_lock);
+	DYNARRAY_FOREACH(pmc, i, &collectors)
+		pmc->pmc_cb(fp, pmc->pmc_arg);
+	psc_dynarray_free(&collectors);
+
+	fprintf(fp, "# EOF\n");
+	if (fclose(fp))
+		psc_fatal("fclose");
+	return (buf);
+}
+
+__static int
+pfl_metrics_write(int fd, const char *p, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, p, len, PFL_MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * Answer one client.  HTTP requests (e.g. a Prometheus scrape) get a
+ * minimal HTTP/1.0 response; anything else, including a client that
+ * sends nothing, gets the bare exposition.
+ */
+__static void
+pfl_metrics_serve(int fd)
+{
+	char req[512], hdr[256];
+	struct pollfd pfd;
+	struct timeval tv;
+	int http = 0, rc;
+	size_t len;
+	ssize_t n;
+	char *buf;
+
+	pfl_socket_setnosig(fd);
+
+	/* a client that stops reading is dropped instead of blocking us */
+	tv.tv_sec = SNDTIMEO;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) ==
+	    -1)
+		psclog_warn("setsockopt SO_SNDTIMEO");
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 1000) == 1) {
+		n = recv(fd, req, sizeof(req) - 1, 0);
+		if (n >= 4 && strncmp(req, "GET ", 4) == 0)
+			http = 1;
+	}
+
+	buf = pfl_metrics_snapshot(&len);
+	rc = 0;
+	if (http) {
+		snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+		    "Content-Type: application/openmetrics-text; "
+		    "version=1.0.0; charset=utf-8\r\n"
+		    "Content-Length: %zu\r\n"
+		    "Connection: close\r\n\r\n", len);
+		rc = pfl_metrics_write(fd, hdr, strlen(hdr));
+	}
+	if (rc == 0)
+		rc = pfl_metrics_write(fd, buf, len);
+	free(buf);
+	if (rc) {
+		OPSTAT_INCR("metrics.write-err");
+		return;
+	}
+
+	/* let the client read everything before we close */
+	shutdown(fd, SHUT_WR);
+	while (poll(&pfd, 1, 1000) == 1 &&
+	    recv(fd, req, sizeof(req), 0) > 0)
+		;
+}
+
+void
+pfl_metricsthr_main(struct psc_thread *thr)
+{
+	int s, fd;
+
+	s = pfl_metricsthr(thr)->pmt_sock;
+	while (pscthr_run(thr)) {
+		thr->pscthr_waitq = "accept";
+		fd = accept(s, NULL, NULL);
+		thr->pscthr_waitq = NULL;
+		if (fd == -1) {
+			switch (errno) {
+			case EINTR:
+			case ECONNABORTED:
+				break;
+			case EBADF:
+			case EINVAL:
+			case ENOTSOCK:
+			case EOPNOTSUPP:
+				psc_fatal("accept");
+				break;
+			default:
+				/*
+				 * Out of descriptors or memory; back
+				 * off so the pending connection does
+				 * not spin us.
+				 */
+				psclog_warn("accept");
+				OPSTAT_INCR("metrics.accept-err");
+				sleep(1);
+				break;
+			}
+			continue;
+		}
+		OPSTAT_INCR("metrics.scrape");
+		pfl_metrics_serve(fd);
+		close(fd);
+	}
+	close(s);
+}
+
+/*
+ * Open the listening socket.
+ * @addr: a path (anything containing a slash) for a UNIX socket, or
+ *	[host]:port for TCP; an empty host listens on all addresses.
+ */
+__static int
+pfl_metrics_listen(const char *addr)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[NI_MAXHOST], *port;
+	struct sockaddr_un saun;
+	int s = -1, rc, on = 1;
+
+	if (strchr(addr, '/')) {
+		memset(&saun, 0, sizeof(saun));
+		saun.sun_family = AF_LOCAL;
+		SOCKADDR_SETLEN(&saun);
+		if (strlcpy(saun.sun_path, addr, sizeof(saun.sun_path)) >=
+		    sizeof(saun.sun_path))
+			psc_fatalx("metrics socket path too long: %s",
+			    addr);
+		if (unlink(saun.sun_path) == -1 && errno != ENOENT)
+			psc_fatal("unlink %s", saun.sun_path);
+		s = socket(AF_LOCAL, SOCK_STREAM, PF_UNSPEC);
+		if (s == -1)
+			psc_fatal("socket");
+		if (bind(s, (struct sockaddr *)&saun,
+		    sizeof(saun)) == -1)
+			psc_fatal("bind %s", saun.sun_path);
+	} else {
+		strlcpy(host, addr, sizeof(host));
+		port = strrchr(host, ':');
+		if (port == NULL)
+			psc_fatalx("metrics address %s: no port", addr);
+		*port++ = '\0';
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		rc = getaddrinfo(host[0] ? host : NULL, port, &hints,
+		    &res);
+		if (rc)
+			psc_fatalx("metrics address %s: %s", addr,
+			    gai_strerror(rc));
+		for (ai = res; ai; ai = ai->ai_next) {
+			s = socket(ai->ai_family, ai->ai_socktype,
+			    ai->ai_protocol);
+			if (s == -1)
+				continue;
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on,
+			    sizeof(on));
+			if (bind(s, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			close(s);
+			s = -1;
+		}
+		freeaddrinfo(res);
+		if (s == -1)
+			psc_fatal("bind %s", addr);
+	}
+	if (listen(s, QLEN) == -1)
+		psc_fatal("listen");
+	return (s);
+}
+
+/*
+ * Start the exporter.
+ * @thrtype: application thread type.
+ * @addr: listen address, see pfl_metrics_listen().
+ * @name: thread name.
+ */
+void
+pfl_metricsthr_spawn(int thrtype, const char *addr, const char *name)
+{
+	struct psc_thread *thr;
+	int s;
+
+	s = pfl_metrics_listen(addr);
+	thr = pscthr_init(thrtype, pfl_metricsthr_main,
+	    sizeof(struct pfl_metricsthr), "%s", name);
+	pfl_metricsthr(thr)->pmt_sock = s;
+	pscthr_setready(thr);
+}
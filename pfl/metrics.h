@@ -0,0 +1,66 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * OpenMetrics (Prometheus text format) exporter.  A service thread
+ * answers each connection on a UNIX or TCP socket with a snapshot of
+ * all registered opstats, histograms, pools, list caches, hash tables
+ * and meters, plus whatever registered collectors add.
+ */
+
+#ifndef _PFL_METRICS_H_
+#define _PFL_METRICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PFL_METRICS_NAME_MAX	128
+#define PFL_METRICS_NVALS	10
+
+/* one object's values, copied out under its lock */
+struct pfl_metrics_row {
+	char			 pmr_name[PFL_METRICS_NAME_MAX];
+	int64_t			 pmr_vals[PFL_METRICS_NVALS];
+};
+
+/* describes one metric family taken from pmr_vals[pmf_idx] */
+struct pfl_metrics_field {
+	const char		*pmf_name;
+	int			 pmf_type;	/* PMFT_* */
+	int			 pmf_idx;
+	const char		*pmf_help;
+};
+
+#define PMFT_GAUGE		0
+#define PMFT_COUNTER		1
+
+typedef void (*pfl_metrics_collector_t)(FILE *, void *);
+
+void	 pfl_metrics_emit(FILE *, const struct pfl_metrics_field *, int,
+	    const char *, const struct pfl_metrics_row *, int);
+void	 pfl_metrics_register(const char *, pfl_metrics_collector_t,
+	    void *);
+char	*pfl_metrics_snapshot(size_t *);
+void	 pfl_metricsthr_spawn(int, const char *, const char *);
+
+#endif /* _PFL_METRICS_H_ */
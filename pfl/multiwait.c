@@ -28,9 +28,22 @@
  * XXX since we keep the multiwaits/conds sorted on each others' lists,
  * we shouldnt use a dynarray.  It does make debugging access easier,
  * though.
+ *
+ * Each multiwait sleeps on its own state word (mw_state).  A waking
+ * condition claims a multiwait with a single compare-and-swap, records
+ * itself as the waker and wakes only that thread, so a wakeup neither
+ * locks the multiwaits it is registered in nor makes their owners
+ * race each other for it.  A condition's mwc_wakeable mirrors each
+ * multiwait's mw_condmask entry for it under the condition's own lock
+ * for this reason.
  */
 
 #include <sys/time.h>
+#ifdef HAVE_FUTEX
+#  include <sys/syscall.h>
+
+#  include <linux/futex.h>
+#endif
 
 #include <errno.h>
 #include <pthread.h>
@@ -38,7 +51,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "pfl/atomic.h"
 #include "pfl/bitflag.h"
 #include "pfl/cdefs.h"
 #include "pfl/log.h"
@@ -62,7 +78,10 @@ pfl_multiwaitcond_init(struct pfl_multiwaitcond *mwc, const void *data,
 	va_list ap;
 
 	memset(mwc, 0, sizeof(*mwc));
-	psc_dynarray_init(&mwc->mwc_multiwaits);
+	psc_dynarray_initsb(&mwc->mwc_multiwaits,
+	    nitems(mwc->mwc_multiwaits_sbuf));
+	psc_dynarray_initsb(&mwc->mwc_wakeable,
+	    nitems(mwc->mwc_wakeable_sbuf));
 	psc_mutex_init(&mwc->mwc_mutex);
 	pthread_cond_init(&mwc->mwc_cond, NULL);
 	mwc->mwc_data = data;
@@ -73,47 +92,6 @@ pfl_multiwaitcond_init(struct pfl_multiwaitcond *mwc, const void *data,
 	va_end(ap);
 }
 
-/*
- * Try to lock all multiwaits this condition is a member of.
- * @mwc: a multiwaitcond, which must itself be locked.
- * Returns zero on success, -1 on failure.
- */
-__static int
-pfl_multiwaitcond_trylockallmw(struct pfl_multiwaitcond *mwc)
-{
-	struct pfl_multiwait *mw;
-	int j, k;
-
-	DYNARRAY_FOREACH(mw, j, &mwc->mwc_multiwaits)
-		if (!psc_mutex_trylock(&mw->mw_mutex)) {
-			/*
-			 * Unable to lock them all; release what we did
-			 * lock and give up.
-			 */
-			for (k = 0; k < j; k++) {
-				mw = psc_dynarray_getpos(
-				    &mwc->mwc_multiwaits, k);
-				psc_mutex_unlock(&mw->mw_mutex);
-			}
-			return (-1);
-		}
-	return (0);
-}
-
-/*
- * Unlock all multiwaits this condition is a member of.
- * @mwc: a multiwait condition, which must itself be locked.
- */
-__static void
-pfl_multiwaitcond_unlockallmw(struct pfl_multiwaitcond *mwc)
-{
-	struct pfl_multiwait *mw;
-	int j;
-
-	DYNARRAY_FOREACH(mw, j, &mwc->mwc_multiwaits)
-		psc_mutex_unlock(&mw->mw_mutex);
-}
-
 __static int
 pfl_multiwaitcond_cmp(const void *a, const void *b)
 {
@@ -143,7 +121,7 @@ pfl_multiwaitcond_destroy(struct pfl_multiwaitcond *mwc)
 			pscthr_yield();
 			goto restart;
 		}
-		if (mw->mw_flags & PMWF_CRITSECT &&
+		if (psc_atomic32_read(&mw->mw_state) >= PMWS_CLAIMED &&
 		    mw->mw_waker == mwc)
 			psc_fatalx("waking condition %s wants to go away "
 			    "but may corrupt integrity of multiwait %s",
@@ -153,11 +131,10 @@ pfl_multiwaitcond_destroy(struct pfl_multiwaitcond *mwc)
 
 		DLOG_MULTIWAIT(PLL_DEBUG, mw,
 		    "disassociating cond %s@%p", mwc->mwc_name, mwc);
-		k = psc_dynarray_bsearch(&mwc->mwc_multiwaits, mw,
+		k = psc_dynarray_remove_sorted(&mwc->mwc_multiwaits, mw,
 		    pfl_multiwaitcond_cmp);
-		pfl_assert(psc_dynarray_getpos(&mwc->mwc_multiwaits,
-		    k) == mw);
-		psc_dynarray_splice(&mwc->mwc_multiwaits, k, 1, NULL, 0);
+		pfl_assert(k != -1);
+		psc_dynarray_removepos_ordered(&mwc->mwc_wakeable, k);
 
 		k = psc_dynarray_removeitem(&mw->mw_conds, mwc);
 		pfl_bitstr_copy(&mw->mw_condmask, k, &mw->mw_condmask,
@@ -168,6 +145,7 @@ pfl_multiwaitcond_destroy(struct pfl_multiwaitcond *mwc)
 		psc_mutex_unlock(&mw->mw_mutex);
 	}
 	psc_dynarray_free(&mwc->mwc_multiwaits);
+	psc_dynarray_free(&mwc->mwc_wakeable);
 	/* XXX: ensure no one is waiting on this mutex? */
 	// XXX need refcnt and wait until release before we can destroy it
 	psc_mutex_unlock(&mwc->mwc_mutex);
@@ -200,39 +178,107 @@ pfl_multiwait_iscondwakeable(struct pfl_multiwait *mw,
 }
 
 /*
- * Wakeup multiwaits waiting on a condition.
- * @mwc: a multiwait condition, which must be unlocked on entry
- *	and will be locked on exit.
+ * Sleep until a multiwait's state changes from PMWS_ASLEEP.
+ * @mw: the multiwait, owned by the caller.
+ * @abstime: CLOCK_MONOTONIC deadline or NULL for forever.
+ * Returns ETIMEDOUT if the deadline passed, otherwise zero (possibly
+ * spuriously).
+ */
+__static int
+pfl_multiwait_sleep(struct pfl_multiwait *mw,
+    const struct timespec *abstime)
+{
+	int rc = 0;
+
+#ifdef HAVE_FUTEX
+	if (syscall(SYS_futex, &mw->mw_state, FUTEX_WAIT_BITSET_PRIVATE,
+	    PMWS_ASLEEP, abstime, NULL, FUTEX_BITSET_MATCH_ANY) == -1 &&
+	    errno == ETIMEDOUT)
+		rc = ETIMEDOUT;
+#else
+	uint64_t pts;
+
+	psc_mutex_lock(&mw->mw_mutex);
+	PFL_MUTEX_PROF_SUSPEND(&mw->mw_mutex, pts);
+	if (psc_atomic32_read(&mw->mw_state) == PMWS_ASLEEP) {
+		if (abstime)
+			rc = pthread_cond_timedwait(&mw->mw_cond,
+			    &mw->mw_mutex.pm_mutex, abstime);
+		else
+			rc = pthread_cond_wait(&mw->mw_cond,
+			    &mw->mw_mutex.pm_mutex);
+		if (rc && rc != ETIMEDOUT)
+			psc_fatalx("pthread_cond_wait: %s", strerror(rc));
+	}
+	PFL_MUTEX_PROF_RESUME(&mw->mw_mutex, pts);
+	psc_mutex_unlock(&mw->mw_mutex);
+#endif
+	return (rc);
+}
+
+/*
+ * Try to claim a multiwait for a wakeup and wake its thread.
+ * @mw: the multiwait.
+ * @mwc: the waking condition, which must be locked.
+ * Returns nonzero if @mw was waiting and is now woken by @mwc.
+ */
+__static int
+pfl_multiwait_claim(struct pfl_multiwait *mw,
+    struct pfl_multiwaitcond *mwc)
+{
+	int old;
+
+	old = psc_atomic32_read(&mw->mw_state);
+	if (old != PMWS_ARMED && old != PMWS_ASLEEP)
+		return (0);
+	if (psc_atomic32_cmpxchg(&mw->mw_state, old, PMWS_CLAIMED) !=
+	    old)
+		return (0);
+	mw->mw_waker = mwc;
+	PSC_ATOMIC32_XCHG(&mw->mw_state, PMWS_WOKEN);
+	if (old == PMWS_ASLEEP) {
+#ifdef HAVE_FUTEX
+		syscall(SYS_futex, &mw->mw_state, FUTEX_WAKE_PRIVATE, 1,
+		    NULL, NULL, 0);
+#else
+		psc_mutex_lock(&mw->mw_mutex);
+		pthread_cond_signal(&mw->mw_cond);
+		psc_mutex_unlock(&mw->mw_mutex);
+#endif
+	}
+	return (1);
+}
+
+/*
+ * Wakeup multiwaits waiting on a condition.  Without PMWCF_WAKEALL,
+ * only one multiwait is woken, chosen round-robin among those
+ * currently waiting.
+ * @mwc: a multiwait condition, which must be unlocked.
  */
 void
 pfl_multiwaitcond_wakeup(struct pfl_multiwaitcond *mwc)
 {
 	struct pfl_multiwait *mw;
-	int j, count = 0;
+	int i, j, n;
 
- restart:
 	psc_mutex_lock(&mwc->mwc_mutex);
-	if (pfl_multiwaitcond_trylockallmw(mwc)) {
-		if (count++ == 300000)
-			psclog_errorx("mwcond %s failed to lock his "
-			    "multiwaits after attempting many times; "
-			    "possible deadlock", mwc->mwc_name);
-		psc_mutex_unlock(&mwc->mwc_mutex);
-		pscthr_yield();
-		goto restart;
-	}
-	DYNARRAY_FOREACH(mw, j, &mwc->mwc_multiwaits)
-		if (pfl_multiwait_iscondwakeable(mw, mwc)) {
-			mw->mw_waker = mwc;
-			DLOG_MULTIWAIT(PLL_DEBUG, mw,
-			    "condition %s@%p tentatively woke us",
-			    mwc->mwc_name, mwc);
-			pthread_cond_signal(&mw->mw_cond);
+	n = psc_dynarray_len(&mwc->mwc_multiwaits);
+	for (i = 0; i < n; i++) {
+		j = (mwc->mwc_next + i) % n;
+		if (psc_dynarray_getpos(&mwc->mwc_wakeable, j) == NULL)
+			continue;
+		mw = psc_dynarray_getpos(&mwc->mwc_multiwaits, j);
+		if (!pfl_multiwait_claim(mw, mwc))
+			continue;
+		DLOG_MULTIWAIT(PLL_DEBUG, mw,
+		    "condition %s@%p woke us", mwc->mwc_name, mwc);
+		if ((mwc->mwc_flags & PMWCF_WAKEALL) == 0) {
+			mwc->mwc_next = j + 1;
+			break;
 		}
-	pfl_multiwaitcond_unlockallmw(mwc);
+	}
 	psclog_debug("wake cond %s@%p", mwc->mwc_name, mwc);
 	pthread_cond_broadcast(&mwc->mwc_cond);
-	mwc->mwc_winner = NULL;
 	psc_mutex_unlock(&mwc->mwc_mutex);
 }
 
@@ -249,6 +295,7 @@ pfl_multiwaitcond_waitrel_ts(struct pfl_multiwaitcond *mwc,
     struct pfl_mutex *mutex, const struct timespec *reltime)
 {
 	struct timespec abstime;
+	uint64_t pts;
 	int rc;
 
 	psc_mutex_lock(&mwc->mwc_mutex);
@@ -256,6 +303,7 @@ pfl_multiwaitcond_waitrel_ts(struct pfl_multiwaitcond *mwc,
 		psc_mutex_unlock(mutex);
 
 	psclog_debug("wait cond %s@%p", mwc->mwc_name, mwc);
+	PFL_MUTEX_PROF_SUSPEND(&mwc->mwc_mutex, pts);
 	if (reltime) {
 		PFL_GETTIMESPEC(&abstime);
 		timespecadd(&abstime, reltime, &abstime);
@@ -272,6 +320,7 @@ pfl_multiwaitcond_waitrel_ts(struct pfl_multiwaitcond *mwc,
 			psc_fatalx("pthread_cond_wait: %s",
 			    strerror(rc));
 	}
+	PFL_MUTEX_PROF_RESUME(&mwc->mwc_mutex, pts);
 	psc_mutex_unlock(&mwc->mwc_mutex);
 	return (rc);
 }
@@ -288,6 +337,7 @@ _pfl_multiwait_addcond(struct pfl_multiwait *mw,
 {
 	struct pfl_multiwaitcond *c;
 	int rc = 0, k, j;
+	void *p;
 
 	/* Acquire locks. */
 	for (;;) {
@@ -331,9 +381,15 @@ _pfl_multiwait_addcond(struct pfl_multiwait *mw,
 		psc_fatalx("mw %s already registered multiwaitcond %s",
 		    mw->mw_name, mwc->mwc_name);
 
+	p = (void *)(uintptr_t)active;
 	if (psc_dynarray_splice(&mwc->mwc_multiwaits, k, 0, &mw, 1) ==
+	    -1 || psc_dynarray_splice(&mwc->mwc_wakeable, k, 0, &p, 1) ==
 	    -1) {
 		rc = -1;
+		if (k < psc_dynarray_len(&mwc->mwc_multiwaits) &&
+		    psc_dynarray_getpos(&mwc->mwc_multiwaits, k) == mw)
+			psc_dynarray_removepos_ordered(
+			    &mwc->mwc_multiwaits, k);
 		if (psc_vbitmap_resize(mw->mw_condmask, j - 1) == -1)
 			psc_fatalx("unable to undo bitmask changes");
 		psc_dynarray_removeitem(&mw->mw_conds, mwc);
@@ -356,12 +412,16 @@ _pfl_multiwait_addcond(struct pfl_multiwait *mw,
 void
 pfl_multiwait_init(struct pfl_multiwait *mw, const char *name, ...)
 {
+	pthread_condattr_t attr;
 	va_list ap;
 
 	memset(mw, 0, sizeof(*mw));
 	psc_dynarray_init(&mw->mw_conds);
 	psc_mutex_init(&mw->mw_mutex);
-	pthread_cond_init(&mw->mw_cond, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mw->mw_cond, &attr);
+	pthread_condattr_destroy(&attr);
 	mw->mw_condmask = psc_vbitmap_new(0);
 	if (mw->mw_condmask == NULL)
 		psc_fatal("psc_vbitmap_new");
@@ -398,14 +458,22 @@ void
 pfl_multiwait_setcondwakeable(struct pfl_multiwait *mw,
     const struct pfl_multiwaitcond *mwc, int active)
 {
-	struct pfl_multiwaitcond *c;
-	int j;
+	struct pfl_multiwaitcond *c, *wc = (void *)mwc;
+	int j, k;
 
+	psc_mutex_lock(&wc->mwc_mutex);
 	psc_mutex_lock(&mw->mw_mutex);
 	DYNARRAY_FOREACH(c, j, &mw->mw_conds)
 		if (c == mwc) {
 			psc_vbitmap_setval(mw->mw_condmask, j, active);
+			k = psc_dynarray_bsearch(&wc->mwc_multiwaits, mw,
+			    pfl_multiwaitcond_cmp);
+			pfl_assert(psc_dynarray_getpos(
+			    &wc->mwc_multiwaits, k) == mw);
+			psc_dynarray_setpos(&wc->mwc_wakeable, k,
+			    (void *)(uintptr_t)active);
 			psc_mutex_unlock(&mw->mw_mutex);
+			psc_mutex_unlock(&wc->mwc_mutex);
 			return;
 		}
 	psc_fatalx("couldn't find mwcond %s in multiwait %s",
@@ -416,12 +484,11 @@ int
 pfl_multiwait_rel(struct pfl_multiwait *mw, void *datap, int sec,
     int nsec)
 {
-	struct timespec adj = { sec, nsec };
+	struct timespec ts, *tsp = NULL;
 	struct pfl_multiwaitcond *mwc;
-	int rc, won = 0, j;
 	struct psc_thread *thr;
+	int st, j;
 
-	thr = pscthr_get();
 	/* Sanity checks. */
 	if (psc_dynarray_len(&mw->mw_conds) == 0)
 		psc_fatalx("multiwait %s has no conditions and "
@@ -435,76 +502,59 @@ pfl_multiwait_rel(struct pfl_multiwait *mw, void *datap, int sec,
 		psc_fatalx("multiwait %s has all conditions masked and "
 		    "will never wake up", mw->mw_name);
 
- restart:
-	psc_mutex_lock(&mw->mw_mutex);
+	if (sec || nsec) {
+		struct timespec adj = { sec, nsec };
 
-	/* Check for missed wakeups during a critical section. */
-	if (mw->mw_flags & PMWF_CRITSECT) {
-		mw->mw_flags &= ~PMWF_CRITSECT;
-		if (mw->mw_waker)
-			goto checkwaker;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		timespecadd(&ts, &adj, &ts);
+		tsp = &ts;
 	}
 
+	/*
+	 * Start accepting wakeups unless a critical section already
+	 * did, in which case one may already have arrived.
+	 */
+	psc_atomic32_cmpxchg(&mw->mw_state, PMWS_IDLE, PMWS_ARMED);
+
 	DLOG_MULTIWAIT(PLL_DEBUG, mw, "entering wait; sec=%d nsec=%d",
 	    sec, nsec);
 
-	thr->pscthr_waitq = mwc->mwc_name;
-	if (sec || nsec) {
-		struct timespec ts;
-
-		PFL_GETTIMESPEC(&ts);
-		timespecadd(&ts, &adj, &ts);
-
-		rc = pthread_cond_timedwait(&mw->mw_cond,
-		    &mw->mw_mutex.pm_mutex, &ts);
-		if (rc == ETIMEDOUT) {
-			psc_mutex_unlock(&mw->mw_mutex);
+	thr = pscthr_get_canfail();
+	if (thr)
+		thr->pscthr_waitq = mwc->mwc_name;
+	for (;;) {
+		st = psc_atomic32_read(&mw->mw_state);
+		if (st == PMWS_WOKEN)
+			break;
+		if (st == PMWS_CLAIMED) {
+			/* The waker is about to fill in mw_waker. */
+			pscthr_yield();
+			continue;
+		}
+		if (st == PMWS_ARMED) {
+			psc_atomic32_cmpxchg(&mw->mw_state, PMWS_ARMED,
+			    PMWS_ASLEEP);
+			continue;
+		}
+		pfl_assert(st == PMWS_ASLEEP);
+		if (pfl_multiwait_sleep(mw, tsp) == ETIMEDOUT &&
+		    psc_atomic32_cmpxchg(&mw->mw_state, PMWS_ASLEEP,
+		    PMWS_IDLE) == PMWS_ASLEEP) {
+			if (thr)
+				thr->pscthr_waitq = NULL;
 			return (-ETIMEDOUT);
 		}
-		if (rc)
-			psc_fatalx("pthread_cond_timedwait: %s",
-			    strerror(rc));
-	} else {
-		rc = pthread_cond_wait(&mw->mw_cond,
-		    &mw->mw_mutex.pm_mutex);
-		if (rc)
-			psc_fatalx("pthread_cond_wait: %s",
-			    strerror(rc));
 	}
-	thr->pscthr_waitq = NULL;
+	if (thr)
+		thr->pscthr_waitq = NULL;
 
- checkwaker:
 	mwc = mw->mw_waker;
 	mw->mw_waker = NULL;
-	mw->mw_flags |= PMWF_CRITSECT;
-	psc_mutex_unlock(&mw->mw_mutex);
-
-	psc_mutex_lock(&mwc->mwc_mutex);
-	if (mwc->mwc_flags & PMWCF_WAKEALL) {
-		DLOG_MULTIWAIT(PLL_DEBUG, mw,
-		    "broadcast condition %s@%p woke us out of multiwait",
-		    mwc->mwc_name, mwc);
-		*(void **)datap = (void *)mwc->mwc_data;
-		won = 1;
-	} else if (mwc->mwc_winner == NULL) {
-		DLOG_MULTIWAIT(PLL_DEBUG, mw,
-		    "won multiwait from condition %s@%p",
-		    mwc->mwc_name, mwc);
-		*(void **)datap = (void *)mwc->mwc_data;
-		mwc->mwc_winner = mw;
-		won = 1;
-	}
-
-	psc_mutex_unlock(&mwc->mwc_mutex);
+	psc_atomic32_set(&mw->mw_state, PMWS_IDLE);
 
-	if (!won) {
-		DLOG_MULTIWAIT(PLL_DEBUG, mw,
-		    "did not win, restarting");
-		//pscthr_yield();
-		/* XXX decrement usecs */
-		goto restart;
-	}
-	pfl_multiwait_leavecritsect(mw);
+	DLOG_MULTIWAIT(PLL_DEBUG, mw, "woken by condition %s@%p",
+	    mwc->mwc_name, mwc);
+	*(void **)datap = (void *)mwc->mwc_data;
 	return (0);
 }
 
@@ -533,9 +583,10 @@ pfl_multiwait_reset(struct pfl_multiwait *mw)
 
 		DLOG_MULTIWAIT(PLL_DEBUG, mw,
 		    "disassociating cond %s@%p", mwc->mwc_name, mwc);
-		k = psc_dynarray_bsearch(&mwc->mwc_multiwaits, mw,
+		k = psc_dynarray_remove_sorted(&mwc->mwc_multiwaits, mw,
 		    pfl_multiwaitcond_cmp);
-		psc_dynarray_splice(&mwc->mwc_multiwaits, k, 1, NULL, 0);
+		pfl_assert(k != -1);
+		psc_dynarray_removepos_ordered(&mwc->mwc_wakeable, k);
 
 		psc_mutex_unlock(&mwc->mwc_mutex);
 		/* Remove it so we don't process it twice. */
@@ -544,7 +595,7 @@ pfl_multiwait_reset(struct pfl_multiwait *mw)
 	// XXX mw_conds should already be reset...
 	psc_dynarray_reset(&mw->mw_conds);
 	psc_vbitmap_resize(mw->mw_condmask, 0);
-	mw->mw_flags = 0;
+	psc_atomic32_set(&mw->mw_state, PMWS_IDLE);
 	mw->mw_waker = NULL;
 	psc_mutex_unlock(&mw->mw_mutex);
 }
@@ -575,23 +626,37 @@ pfl_multiwaitcond_nwaiters(struct pfl_multiwaitcond *mwc)
 void
 pfl_multiwait_entercritsect(struct pfl_multiwait *mw)
 {
-	psc_mutex_lock(&mw->mw_mutex);
-	mw->mw_flags |= PMWF_CRITSECT;
-	mw->mw_waker = NULL;
-	psc_mutex_unlock(&mw->mw_mutex);
+	psc_atomic32_cmpxchg(&mw->mw_state, PMWS_IDLE, PMWS_ARMED);
 }
 
 /*
- * Leave a multiwait critical section.
+ * Leave a multiwait critical section without waiting.  A wakeup
+ * claimed meanwhile is passed on to another multiwait so it is not
+ * lost.
  * @mw: the multiwait.
  */
 void
 pfl_multiwait_leavecritsect(struct pfl_multiwait *mw)
 {
-	psc_mutex_lock(&mw->mw_mutex);
-	pfl_assert(mw->mw_flags & PMWF_CRITSECT);
-	mw->mw_flags &= ~PMWF_CRITSECT;
-	psc_mutex_unlock(&mw->mw_mutex);
+	struct pfl_multiwaitcond *mwc;
+	int st;
+
+	for (;;) {
+		st = psc_atomic32_read(&mw->mw_state);
+		pfl_assert(st != PMWS_IDLE && st != PMWS_ASLEEP);
+		if (st == PMWS_ARMED &&
+		    psc_atomic32_cmpxchg(&mw->mw_state, PMWS_ARMED,
+		    PMWS_IDLE) == PMWS_ARMED)
+			return;
+		if (st == PMWS_WOKEN)
+			break;
+		pscthr_yield();
+	}
+	mwc = mw->mw_waker;
+	mw->mw_waker = NULL;
+	psc_atomic32_set(&mw->mw_state, PMWS_IDLE);
+	if ((mwc->mwc_flags & PMWCF_WAKEALL) == 0)
+		pfl_multiwaitcond_wakeup(mwc);
 }
 
 /*
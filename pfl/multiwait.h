@@ -33,17 +33,21 @@
 
 #include <pthread.h>
 
+#include "pfl/atomic.h"
 #include "pfl/dynarray.h"
 #include "pfl/pthrutil.h"
 
 struct pfl_multiwait;
 struct psc_vbitmap;
 
+#define MWC_NINLINE			2	/* inline mwc_multiwaits slots */
+
 struct pfl_multiwaitcond {
 	struct pfl_mutex		 mwc_mutex;
 	pthread_cond_t			 mwc_cond;	/* for single waiters */
-	struct psc_dynarray		 mwc_multiwaits;/* where cond is registered */
-	struct pfl_multiwait		*mwc_winner;	/* which multiwait awoke first */
+	PSC_DYNARRAY_SB(mwc_multiwaits, MWC_NINLINE);	/* where registered */
+	PSC_DYNARRAY_SB(mwc_wakeable, MWC_NINLINE);	/* parallel: mask of above */
+	int				 mwc_next;	/* round-robin wakeup start */
 	const void			*mwc_data;	/* pointer to user data */
 	int				 mwc_flags;
 	char				 mwc_name[48];	/* should be on 8-byte boundary */
@@ -53,7 +57,9 @@ struct pfl_multiwaitcond {
 
 #define MWCOND_INIT(data, name, flags)					\
 	{ PSC_MUTEX_INIT, PTHREAD_COND_INITIALIZER,			\
-	    DYNARRAY_INIT, NULL, (data), (flags), (name) }
+	    DYNARRAY_INIT_SB(MWC_NINLINE), { NULL },			\
+	    DYNARRAY_INIT_SB(MWC_NINLINE), { NULL }, 0, (data),	\
+	    (flags), (name) }
 
 struct pfl_multiwait {
 	/*
@@ -62,15 +68,20 @@ struct pfl_multiwait {
 	 * implicitly (e.g. on wakeups and condition removals).
 	 */
 	struct pfl_mutex		 mw_mutex;
-	pthread_cond_t			 mw_cond;	/* master condition */
+	pthread_cond_t			 mw_cond;	/* sleep w/o futexes */
+	psc_atomic32_t			 mw_state;	/* futex word, PMWS_* */
 	struct pfl_multiwaitcond	*mw_waker;	/* which mwcond woke us */
 	struct psc_dynarray		 mw_conds;	/* registered conditions */
 	struct psc_vbitmap		*mw_condmask;	/* which conds can wake us */
-	int				 mw_flags;
 	char				 mw_name[32];	/* should be 8-byte boundary */
 };
 
-#define PMWF_CRITSECT			(1 << 0)	/* inside critical section */
+/* mw_state values */
+#define PMWS_IDLE			0	/* not accepting wakeups */
+#define PMWS_ARMED			1	/* in critical section */
+#define PMWS_ASLEEP			2	/* sleeping on mw_state */
+#define PMWS_CLAIMED			3	/* waker is filling in mw_waker */
+#define PMWS_WOKEN			4	/* mw_waker is valid */
 
 #define	DLOG_MULTIWAIT(level, mw, fmt, ...)				\
 	psclog((level), "%s@%p " fmt, (mw)->mw_name, (mw), ##__VA_ARGS__)
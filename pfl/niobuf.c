@@ -26,12 +26,14 @@
 #include <inttypes.h>
 
 #include "pfl/alloc.h"
+#include "pfl/arena.h"
 #include "pfl/atomic.h"
 #include "pfl/export.h"
 #include "pfl/log.h"
 #include "pfl/pool.h"
 #include "pfl/rpc.h"
 #include "pfl/rpclog.h"
+#include "pfl/trace.h"
 #include "pfl/waitq.h"
 
 /*
@@ -119,6 +121,8 @@ pscrpc_start_bulk_transfer(struct pscrpc_bulk_desc *desc)
 	pfl_assert(conn);
 
 	desc->bd_success = 0;
+	PFL_TRACE_BEGIN(PSS_RPC, "rpc.bulk", (uintptr_t)desc);
+	do_gettimeofday(&desc->bd_start);
 
 	md.max_size = 0;
 	md.user_ptr = &desc->bd_cbid;
@@ -398,6 +402,8 @@ pscrpc_send_reply(struct pscrpc_request *rq, int may_be_difficult)
 	pfl_assert(rs->rs_cb_id.cbid_arg == rs);
 	pfl_assert(rq->rq_repmsg);
 
+	PFL_TRACE_INSTANT(PSS_RPC, "rpc.reply", (uintptr_t)rq);
+
 #if PAULS_TODO
 	/*
 	 * pscrpc will have to place portions of the export
@@ -434,6 +440,9 @@ pscrpc_send_reply(struct pscrpc_request *rq, int may_be_difficult)
 	atomic_inc(&svc->srv_outstanding_replies);
 	pscrpc_rs_addref(rs);			/* +1 ref for the network */
 
+	rs->rs_opc = rq->rq_reqmsg->opc;
+	do_gettimeofday(&rs->rs_sendtime);
+
 	rc = pscrpc_send_buf(&rs->rs_md_h, rq->rq_repmsg, rq->rq_replen,
 	    rs->rs_difficult ? LNET_ACK_REQ : LNET_NOACK_REQ,
 	    &rs->rs_cb_id, rq->rq_conn,
@@ -738,6 +747,7 @@ _pscrpc_free_req(struct pscrpc_request *rq, __unusedx int locked)
 			    rq->rq_reqlen);
 			rq->rq_reqmsg = NULL;
 		}
+		pfl_arena_reset(&rq->rq_arena);
 		pll_remove(&pscrpc_requests, rq);
 		psc_pool_return(pscrpc_rq_pool, rq);
 	}
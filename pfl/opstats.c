@@ -21,8 +21,11 @@
  * %END_LICENSE%
  */
 
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "pfl/alloc.h"
@@ -35,8 +38,290 @@
 int			pfl_opstats_sum;
 struct psc_spinlock	pfl_opstats_lock = SPINLOCK_INIT;
 struct psc_dynarray	pfl_opstats = DYNARRAY_INIT;
+struct psc_dynarray	pfl_histograms = DYNARRAY_INIT;
 __static char		pfl_opstat_name[128];
 
+/* run of free shard slots */
+struct pfl_opstat_run {
+	int			 por_idx;
+	int			 por_n;
+};
+
+PSC_DYNARRAY_TYPED(pfl_opstat_runs, struct pfl_opstat_run);
+
+/*
+ * Shard bookkeeping, all protected by pfl_opstats_lock: every live
+ * thread's shard, the counter each shard slot folds into, and slots
+ * freed by destroyed opstats and histograms.
+ */
+__static PSCLIST_HEAD(pfl_opstat_shards);
+__static psc_atomic64_t	**pfl_opstat_foldto;
+__static int		pfl_opstat_nidx;
+__static int		pfl_opstat_nfoldto;
+__static struct pfl_opstat_runs pfl_opstat_freeruns = TDYNARRAY_INIT;
+
+__static pthread_key_t	pfl_opstat_shardkey;
+__static pthread_once_t	pfl_opstat_shardonce = PTHREAD_ONCE_INIT;
+
+#ifdef HAVE_TLS
+__threadx struct pfl_opstat_shard *pfl_opstat_myshard;
+#endif
+
+#define OPST_SLOT(s, idx)						\
+	((s)->pos_chunks[(idx) / PFL_OPSTAT_CHUNKSZ] ?			\
+	 &(s)->pos_chunks[(idx) / PFL_OPSTAT_CHUNKSZ]			\
+	    [(idx) % PFL_OPSTAT_CHUNKSZ] : NULL)
+
+/*
+ * Fold an exiting thread's counts into the lifetime totals and
+ * release its shard.
+ */
+__static void
+pfl_opstat_shard_release(void *arg)
+{
+	struct pfl_opstat_shard *s = arg;
+	psc_atomic64_t *v;
+	int64_t *c;
+	int i, j;
+
+	spinlock(&pfl_opstats_lock);
+	for (i = 0; i < PFL_OPSTAT_NCHUNKS; i++) {
+		c = s->pos_chunks[i];
+		if (c == NULL)
+			continue;
+		for (j = 0; j < PFL_OPSTAT_CHUNKSZ; j++) {
+			if (c[j] == 0)
+				continue;
+			v = pfl_opstat_foldto[i * PFL_OPSTAT_CHUNKSZ + j];
+			if (v)
+				psc_atomic64_add(v, c[j]);
+		}
+	}
+	psclist_del(&s->pos_lentry, &pfl_opstat_shards);
+	freelock(&pfl_opstats_lock);
+
+#ifdef HAVE_TLS
+	pfl_opstat_myshard = NULL;
+#endif
+	for (i = 0; i < PFL_OPSTAT_NCHUNKS; i++)
+		free(s->pos_chunks[i]);
+	free(s);
+}
+
+__static void
+pfl_opstat_shard_initkey(void)
+{
+	if (pthread_key_create(&pfl_opstat_shardkey,
+	    pfl_opstat_shard_release))
+		psc_fatalx("pthread_key_create");
+}
+
+/*
+ * Increment slow path: set up this thread's shard and the chunk
+ * holding the opstat's slot.  The system allocator is used directly
+ * since the pfl allocator may itself count opstats.
+ */
+void
+_pfl_opstat_add_slow(int idx, psc_atomic64_t *v, int64_t n)
+{
+	struct pfl_opstat_shard *s;
+	int64_t *c;
+
+	if (idx < 0)
+		goto unsharded;
+
+	pthread_once(&pfl_opstat_shardonce, pfl_opstat_shard_initkey);
+	s = pthread_getspecific(pfl_opstat_shardkey);
+	if (s == NULL) {
+		s = calloc(1, sizeof(*s));
+		if (s == NULL)
+			goto unsharded;
+		INIT_PSC_LISTENTRY(&s->pos_lentry);
+		spinlock(&pfl_opstats_lock);
+		psclist_add(&s->pos_lentry, &pfl_opstat_shards);
+		freelock(&pfl_opstats_lock);
+		pthread_setspecific(pfl_opstat_shardkey, s);
+	}
+#ifdef HAVE_TLS
+	pfl_opstat_myshard = s;
+#endif
+
+	if (s->pos_chunks[idx / PFL_OPSTAT_CHUNKSZ] == NULL) {
+		c = calloc(PFL_OPSTAT_CHUNKSZ, sizeof(*c));
+		if (c == NULL)
+			goto unsharded;
+		spinlock(&pfl_opstats_lock);
+		s->pos_chunks[idx / PFL_OPSTAT_CHUNKSZ] = c;
+		freelock(&pfl_opstats_lock);
+	}
+	*(volatile int64_t *)OPST_SLOT(s, idx) += n;
+	return;
+
+ unsharded:
+	psc_atomic64_add(v, n);
+}
+
+/*
+ * Sum a counter across its folded value and all live shards.
+ * @idx: shard slot or -1.
+ * @fv: folded value.
+ * pfl_opstats_lock must be held.
+ */
+__static int64_t
+pfl_opstat_slot_read(int idx, psc_atomic64_t *fv)
+{
+	struct pfl_opstat_shard *s;
+	int64_t v, *p;
+
+	LOCK_ENSURE(&pfl_opstats_lock);
+	v = psc_atomic64_read(fv);
+	if (idx >= 0)
+		psclist_for_each_entry(s, &pfl_opstat_shards,
+		    pos_lentry) {
+			p = OPST_SLOT(s, idx);
+			if (p)
+				v += *(volatile int64_t *)p;
+		}
+	return (v);
+}
+
+int64_t
+_pfl_opstat_read(struct pfl_opstat *opst)
+{
+	return (pfl_opstat_slot_read(opst->opst_idx,
+	    &opst->opst_lifetime));
+}
+
+int64_t
+pfl_opstat_read(struct pfl_opstat *opst)
+{
+	int64_t v;
+
+	spinlock(&pfl_opstats_lock);
+	v = _pfl_opstat_read(opst);
+	freelock(&pfl_opstats_lock);
+	return (v);
+}
+
+/*
+ * Set an opstat's lifetime value, e.g. to reset it from the control
+ * interface.
+ */
+void
+pfl_opstat_set(struct pfl_opstat *opst, int64_t val)
+{
+	int64_t cur;
+
+	spinlock(&pfl_opstats_lock);
+	cur = _pfl_opstat_read(opst);
+	psc_atomic64_add(&opst->opst_lifetime, val - cur);
+	opst->opst_last = val;
+	freelock(&pfl_opstats_lock);
+}
+
+/*
+ * Raise an opstat's lifetime value to @val if it is lower, e.g. to
+ * track a high-water mark.
+ */
+void
+pfl_opstat_setmax(struct pfl_opstat *opst, int64_t val)
+{
+	int64_t cur;
+
+	spinlock(&pfl_opstats_lock);
+	cur = _pfl_opstat_read(opst);
+	if (val > cur) {
+		psc_atomic64_add(&opst->opst_lifetime, val - cur);
+		opst->opst_last = val;
+	}
+	freelock(&pfl_opstats_lock);
+}
+
+/*
+ * Assign shard slots to a new counter (or run of @n counters), folding
+ * into @fv[].  Slots of destroyed counters are reused first.  Beyond
+ * the shard capacity, counters fall back to atomic updates of their
+ * folded value.
+ */
+__static int
+pfl_opstat_allocidx(psc_atomic64_t *fv, int n)
+{
+	struct pfl_opstat_run *r;
+	int idx = -1, i;
+
+	LOCK_ENSURE(&pfl_opstats_lock);
+	TDYNARRAY_FOREACH(r, i, &pfl_opstat_freeruns)
+		if (r->por_n >= n) {
+			idx = r->por_idx;
+			r->por_idx += n;
+			r->por_n -= n;
+			if (r->por_n == 0)
+				pfl_opstat_runs_removepos(
+				    &pfl_opstat_freeruns, i);
+			break;
+		}
+	if (idx == -1) {
+		if (pfl_opstat_nidx + n >
+		    PFL_OPSTAT_CHUNKSZ * PFL_OPSTAT_NCHUNKS)
+			return (-1);
+		idx = pfl_opstat_nidx;
+		pfl_opstat_nidx += n;
+		if (pfl_opstat_nidx > pfl_opstat_nfoldto) {
+			pfl_opstat_nfoldto = (pfl_opstat_nidx +
+			    PFL_OPSTAT_CHUNKSZ - 1) / PFL_OPSTAT_CHUNKSZ *
+			    PFL_OPSTAT_CHUNKSZ;
+			pfl_opstat_foldto = psc_realloc(
+			    pfl_opstat_foldto, pfl_opstat_nfoldto *
+			    sizeof(*pfl_opstat_foldto), 0);
+		}
+	}
+	for (i = 0; i < n; i++)
+		pfl_opstat_foldto[idx + i] = &fv[i];
+	return (idx);
+}
+
+/*
+ * Release shard slots, scrubbing them in every shard before they are
+ * handed out again.  The run is merged with adjacent free runs so a
+ * later, longer allocation may reuse them.
+ */
+__static void
+pfl_opstat_freeidx(int idx, int n)
+{
+	struct pfl_opstat_shard *s;
+	struct pfl_opstat_run *r;
+	int64_t *p;
+	int i;
+
+	LOCK_ENSURE(&pfl_opstats_lock);
+	for (i = idx; i < idx + n; i++) {
+		psclist_for_each_entry(s, &pfl_opstat_shards,
+		    pos_lentry) {
+			p = OPST_SLOT(s, i);
+			if (p)
+				*(volatile int64_t *)p = 0;
+		}
+		pfl_opstat_foldto[i] = NULL;
+	}
+
+	for (i = 0; i < pfl_opstat_runs_len(&pfl_opstat_freeruns); ) {
+		r = pfl_opstat_runs_getpos(&pfl_opstat_freeruns, i);
+		if (r->por_idx + r->por_n == idx) {
+			idx = r->por_idx;
+			n += r->por_n;
+		} else if (idx + n == r->por_idx)
+			n += r->por_n;
+		else {
+			i++;
+			continue;
+		}
+		pfl_opstat_runs_removepos(&pfl_opstat_freeruns, i);
+	}
+	r = pfl_opstat_runs_push(&pfl_opstat_freeruns);
+	r->por_idx = idx;
+	r->por_n = n;
+}
+
 int
 _pfl_opstat_cmp(const void *a, const void *b)
 {
@@ -74,6 +359,7 @@ pfl_opstat_initf(int flags, const char *namefmt, ...)
 	opst = PSCALLOC(sizeof(*opst) + sz);
 	strlcpy(opst->opst_name, name, 128);
 	opst->opst_flags = flags;
+	opst->opst_idx = pfl_opstat_allocidx(&opst->opst_lifetime, 1);
 	psc_dynarray_splice(&pfl_opstats, pos, 0, &opst, 1);
 	freelock(&pfl_opstats_lock);
 	return (opst);
@@ -87,6 +373,8 @@ pfl_opstat_destroy_pos(int pos)
 	LOCK_ENSURE(&pfl_opstats_lock);
 	opst = psc_dynarray_getpos(&pfl_opstats, pos);
 	psc_dynarray_splice(&pfl_opstats, pos, 1, NULL, 0);
+	if (opst->opst_idx >= 0)
+		pfl_opstat_freeidx(opst->opst_idx, 1);
 	PSCFREE(opst);
 }
 
@@ -103,6 +391,173 @@ pfl_opstat_destroy(struct pfl_opstat *opst)
 	freelock(&pfl_opstats_lock);
 }
 
+int
+_pfl_histogram_cmp(const void *a, const void *b)
+{
+	const struct pfl_histogram *phg = b;
+	const char *name = a;
+
+	return (strcmp(name, phg->phg_name));
+}
+
+/*
+ * Create (or look up) a histogram.
+ * @flags: OPSTF_* flags.
+ * @precision: sub-bucket bits (1-7); relative error is 1/2^precision.
+ * @maxbits: values of 2^maxbits and above share the last bucket.
+ * @namefmt: printf(3)-like name.
+ */
+struct pfl_histogram *
+pfl_histogram_initf(int flags, int precision, int maxbits,
+    const char *namefmt, ...)
+{
+	struct pfl_histogram *phg;
+	int sz, pos, nb;
+	va_list ap;
+	char *name = pfl_opstat_name;
+
+	pfl_assert(precision >= 1 && precision <= 7);
+	pfl_assert(maxbits > precision && maxbits <= 64);
+
+	spinlock(&pfl_opstats_lock);
+
+	va_start(ap, namefmt);
+	sz = vsnprintf(name, 128, namefmt, ap) + 1;
+	va_end(ap);
+
+	pos = psc_dynarray_bsearch(&pfl_histograms, name,
+	    _pfl_histogram_cmp);
+	if (pos < psc_dynarray_len(&pfl_histograms)) {
+		phg = psc_dynarray_getpos(&pfl_histograms, pos);
+		if (strcmp(name, phg->phg_name) == 0) {
+			pfl_assert((flags & OPSTF_EXCL) == 0);
+			freelock(&pfl_opstats_lock);
+			return (phg);
+		}
+	}
+	nb = (maxbits - precision + 1) << precision;
+	phg = PSCALLOC(sizeof(*phg) + sz);
+	strlcpy(phg->phg_name, name, 128);
+	phg->phg_flags = flags;
+	phg->phg_precision = precision;
+	phg->phg_maxbits = maxbits;
+	phg->phg_nbuckets = nb;
+	phg->phg_folded = PSCALLOC((nb + 1) * sizeof(*phg->phg_folded));
+	phg->phg_idx = pfl_opstat_allocidx(phg->phg_folded, nb + 1);
+	psc_dynarray_splice(&pfl_histograms, pos, 0, &phg, 1);
+	freelock(&pfl_opstats_lock);
+	return (phg);
+}
+
+void
+pfl_histogram_destroy(struct pfl_histogram *phg)
+{
+	int pos;
+
+	spinlock(&pfl_opstats_lock);
+	pos = psc_dynarray_bsearch(&pfl_histograms, phg->phg_name,
+	    _pfl_histogram_cmp);
+	pfl_assert(psc_dynarray_getpos(&pfl_histograms, pos) == phg);
+	psc_dynarray_splice(&pfl_histograms, pos, 1, NULL, 0);
+	if (phg->phg_idx >= 0)
+		pfl_opstat_freeidx(phg->phg_idx, phg->phg_nbuckets + 1);
+	freelock(&pfl_opstats_lock);
+	PSCFREE(phg->phg_folded);
+	PSCFREE(phg);
+}
+
+/*
+ * Take a snapshot of a histogram, summing all thread shards.  The
+ * snapshot must be released with pfl_histogram_snap_free().
+ * pfl_opstats_lock must be held.
+ */
+void
+_pfl_histogram_snapshot(struct pfl_histogram *phg,
+    struct pfl_histogram_snap *phs)
+{
+	int i, nb = phg->phg_nbuckets;
+
+	LOCK_ENSURE(&pfl_opstats_lock);
+	phs->phs_precision = phg->phg_precision;
+	phs->phs_maxbits = phg->phg_maxbits;
+	phs->phs_nbuckets = nb;
+	phs->phs_count = 0;
+	phs->phs_buckets = PSCALLOC(nb * sizeof(*phs->phs_buckets));
+	for (i = 0; i < nb; i++) {
+		phs->phs_buckets[i] = pfl_opstat_slot_read(
+		    phg->phg_idx < 0 ? -1 : phg->phg_idx + i,
+		    &phg->phg_folded[i]);
+		phs->phs_count += phs->phs_buckets[i];
+	}
+	phs->phs_sum = pfl_opstat_slot_read(
+	    phg->phg_idx < 0 ? -1 : phg->phg_idx + nb,
+	    &phg->phg_folded[nb]);
+}
+
+void
+pfl_histogram_snapshot(struct pfl_histogram *phg,
+    struct pfl_histogram_snap *phs)
+{
+	spinlock(&pfl_opstats_lock);
+	_pfl_histogram_snapshot(phg, phs);
+	freelock(&pfl_opstats_lock);
+}
+
+void
+pfl_histogram_snap_free(struct pfl_histogram_snap *phs)
+{
+	PSCFREE(phs->phs_buckets);
+}
+
+/*
+ * Accumulate one snapshot into another, e.g. to combine histograms of
+ * several services or daemons.
+ */
+void
+pfl_histogram_snap_merge(struct pfl_histogram_snap *dst,
+    const struct pfl_histogram_snap *src)
+{
+	int i;
+
+	pfl_assert(dst->phs_precision == src->phs_precision);
+	pfl_assert(dst->phs_maxbits == src->phs_maxbits);
+	for (i = 0; i < dst->phs_nbuckets; i++)
+		dst->phs_buckets[i] += src->phs_buckets[i];
+	dst->phs_count += src->phs_count;
+	dst->phs_sum += src->phs_sum;
+}
+
+/*
+ * Find the value at the given percentile.  The result is the highest
+ * value that falls in the same bucket, so it never understates.
+ * @phs: histogram snapshot.
+ * @pct: percentile, in (0, 100].
+ */
+uint64_t
+pfl_histogram_snap_percentile(const struct pfl_histogram_snap *phs,
+    double pct)
+{
+	uint64_t want, n = 0, lo, width;
+	int i, g, p = phs->phs_precision;
+
+	if (phs->phs_count == 0)
+		return (0);
+	want = pct / 100 * phs->phs_count + .5;
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < phs->phs_nbuckets - 1; i++) {
+		n += phs->phs_buckets[i];
+		if (n >= want)
+			break;
+	}
+	g = i >> p;
+	if (g == 0)
+		return (i);
+	width = UINT64_C(1) << (g - 1);
+	lo = ((UINT64_C(1) << p) + (i & ((1 << p) - 1))) << (g - 1);
+	return (lo + width - 1);
+}
+
 __static const char *
 _pfl_opstats_base2_suffix(int64_t *val)
 {
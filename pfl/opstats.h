@@ -26,6 +26,13 @@
  * Every second, each registered opstat is recomputed to measure
  * instantaneous operation rates.  10-second weighted averages are also
  * computed.
+ *
+ * Increments are not made to a shared counter: each thread owns a
+ * private shard of counters, indexed by opst_idx, that only it writes
+ * to, so hot counters never bounce a cache line between CPUs.  Readers
+ * (the timer thread, the control interface) sum opst_lifetime and the
+ * shards of all live threads via pfl_opstat_read().  A thread's shard
+ * is folded into opst_lifetime when it exits.
  */
 
 #ifndef _PFL_OPSTATS_H_
@@ -37,13 +44,15 @@
 
 #include "pfl/atomic.h"
 #include "pfl/bsearch.h"
+#include "pfl/cdefs.h"
 #include "pfl/list.h"
 #include "pfl/lockedlist.h"
 
 struct pfl_opstat {
 	int			 opst_flags;
+	int			 opst_idx;	/* shard slot or -1 */
 
-	psc_atomic64_t		 opst_lifetime;	/* lifetime accumulator */
+	psc_atomic64_t		 opst_lifetime;	/* folded/unsharded total */
 	/*
 	 * Unlike the above lifetime counter, the following four fields
 	 * are maintained by the timer thread. See pfl_opstimerthr_main() 
@@ -60,10 +69,19 @@ struct pfl_opstat {
 #define OPSTF_BASE10		(1 << 0)	/* use base-10 numbering instead of default of base-2 */
 #define OPSTF_EXCL		(1 << 1)	/* like O_EXCL: when creating, opstat must not exist  */
 
-#define pfl_opstat_add(opst, n)	psc_atomic64_add(&(opst)->opst_lifetime, (n))
+#define PFL_OPSTAT_CHUNKSZ	512		/* counters per shard chunk */
+#define PFL_OPSTAT_NCHUNKS	128		/* max #opstats / CHUNKSZ */
+
+/* per-thread counter shard */
+struct pfl_opstat_shard {
+	struct psc_listentry	 pos_lentry;
+	int64_t			*pos_chunks[PFL_OPSTAT_NCHUNKS];
+};
+
+#define pfl_opstat_add(opst, n)	_pfl_opstat_add((opst), (n))
 #define	pfl_opstat_incr(opst)	pfl_opstat_add((opst), 1)
 
-#define pfl_opstat_dec(opst, n)	psc_atomic64_sub(&(opst)->opst_lifetime, (n))
+#define pfl_opstat_dec(opst, n)	_pfl_opstat_add((opst), -(n))
 #define	pfl_opstat_decr(opst)	pfl_opstat_dec((opst), 1)
 
 /*
@@ -114,13 +132,77 @@ struct pfl_opstats_grad {
 				*og_buckets;
 };
 
+/*
+ * Log-linear (HDR-style) histograms for latency distributions.  Values
+ * below 2^precision get a bucket each; above that, every power-of-two
+ * range is split into 2^precision linear sub-buckets, so the bucket
+ * index is found in constant time and any value is reported to within
+ * 1/2^precision of its magnitude.  Values of 2^maxbits and above are
+ * clamped into the last bucket.  Each bucket, plus a running sum, is
+ * an opstat shard slot so recording is per-thread and needs no
+ * atomics.
+ */
+#define PFL_HISTO_PRECISION	3		/* default: 12.5% error */
+#define PFL_HISTO_MAXBITS	40		/* default: values < 2^40 */
+
+struct pfl_histogram {
+	int			 phg_flags;
+	int			 phg_precision;	/* sub-bucket bits */
+	int			 phg_maxbits;	/* value range bits */
+	int			 phg_nbuckets;
+	int			 phg_idx;	/* first shard slot or -1 */
+	psc_atomic64_t		*phg_folded;	/* buckets, then sum */
+	char			 phg_name[0];
+};
+
+/* point-in-time copy of a histogram; snapshots of like geometry merge */
+struct pfl_histogram_snap {
+	int			 phs_precision;
+	int			 phs_maxbits;
+	int			 phs_nbuckets;
+	uint64_t		 phs_count;
+	uint64_t		 phs_sum;
+	uint64_t		*phs_buckets;
+};
+
+#define pfl_histogram_init(name, ...)					\
+	pfl_histogram_initf(0, PFL_HISTO_PRECISION, PFL_HISTO_MAXBITS,	\
+	    (name), ## __VA_ARGS__)
+
+#define	HISTOGRAM_RECORD(name, v)					\
+	do {								\
+		static struct pfl_histogram *_phg;			\
+									\
+		if (_phg == NULL)					\
+			_phg = pfl_histogram_init(name);		\
+		pfl_histogram_record(_phg, (v));			\
+	} while (0)
+
 #define pfl_opstat_init(name, ...)					\
 	pfl_opstat_initf(0, (name), ## __VA_ARGS__)
 
+void	_pfl_opstat_add_slow(int, psc_atomic64_t *, int64_t);
+int64_t	_pfl_opstat_read(struct pfl_opstat *);
 void	pfl_opstat_destroy(struct pfl_opstat *);
 void	pfl_opstat_destroy_pos(int);
 struct pfl_opstat *
 	pfl_opstat_initf(int, const char *, ...);
+int64_t	pfl_opstat_read(struct pfl_opstat *);
+void	pfl_opstat_set(struct pfl_opstat *, int64_t);
+void	pfl_opstat_setmax(struct pfl_opstat *, int64_t);
+
+void	pfl_histogram_destroy(struct pfl_histogram *);
+struct pfl_histogram *
+	pfl_histogram_initf(int, int, int, const char *, ...);
+void	_pfl_histogram_snapshot(struct pfl_histogram *,
+	    struct pfl_histogram_snap *);
+void	pfl_histogram_snapshot(struct pfl_histogram *,
+	    struct pfl_histogram_snap *);
+void	pfl_histogram_snap_free(struct pfl_histogram_snap *);
+void	pfl_histogram_snap_merge(struct pfl_histogram_snap *,
+	    const struct pfl_histogram_snap *);
+uint64_t pfl_histogram_snap_percentile(const struct pfl_histogram_snap *,
+	    double);
 
 void	pfl_opstats_grad_init(struct pfl_opstats_grad *, int, int64_t *,
 	    int, const char *, ...);
@@ -134,10 +216,41 @@ void	pfl_opstats_grad_destroy(struct pfl_opstats_grad *);
 #define pfl_opstats_grad_incr(og, criteria)				\
 	pfl_opstat_incr(pfl_opstats_grad_get((og), (criteria))->ob_opst)
 
+extern struct psc_dynarray	pfl_histograms;
 extern int			pfl_opstats_sum;
 extern struct psc_dynarray	pfl_opstats;
 extern struct psc_spinlock	pfl_opstats_lock;
 
+#ifdef HAVE_TLS
+extern __threadx struct pfl_opstat_shard *pfl_opstat_myshard;
+#endif
+
+/*
+ * Bump an opstat.  The common case is a plain store to this thread's
+ * own shard; setting up the shard or chunk is left to the slow path.
+ */
+static __inline void
+_pfl_opstat_slot_add(int idx, psc_atomic64_t *fv, int64_t n)
+{
+#ifdef HAVE_TLS
+	struct pfl_opstat_shard *s = pfl_opstat_myshard;
+	int64_t *c;
+
+	if (s && idx >= 0 &&
+	    (c = s->pos_chunks[idx / PFL_OPSTAT_CHUNKSZ]) != NULL) {
+		*(volatile int64_t *)&c[idx % PFL_OPSTAT_CHUNKSZ] += n;
+		return;
+	}
+#endif
+	_pfl_opstat_add_slow(idx, fv, n);
+}
+
+static __inline void
+_pfl_opstat_add(struct pfl_opstat *opst, int64_t n)
+{
+	_pfl_opstat_slot_add(opst->opst_idx, &opst->opst_lifetime, n);
+}
+
 static __inline int
 pfl_opstats_grad_cmp(const void *key, const void *item)
 {
@@ -147,4 +260,33 @@ pfl_opstats_grad_cmp(const void *key, const void *item)
 	return (CMP((int64_t)keyval, ob->ob_lower_bound));
 }
 
+static __inline int
+pfl_histogram_bucket(const struct pfl_histogram *phg, uint64_t v)
+{
+	int p = phg->phg_precision, m;
+
+	if (v < (UINT64_C(1) << p))
+		return (v);
+	m = 63 - __builtin_clzll(v);
+	if (m >= phg->phg_maxbits)
+		return (phg->phg_nbuckets - 1);
+	return (((m - p + 1) << p) +
+	    (int)((v >> (m - p)) - (UINT64_C(1) << p)));
+}
+
+/*
+ * Record a value into a histogram.
+ */
+static __inline void
+pfl_histogram_record(struct pfl_histogram *phg, uint64_t v)
+{
+	int b, idx = phg->phg_idx;
+
+	b = pfl_histogram_bucket(phg, v);
+	_pfl_opstat_slot_add(idx < 0 ? -1 : idx + b,
+	    &phg->phg_folded[b], 1);
+	_pfl_opstat_slot_add(idx < 0 ? -1 : idx + phg->phg_nbuckets,
+	    &phg->phg_folded[phg->phg_nbuckets], v);
+}
+
 #endif /* _PFL_OPSTATS_H_ */
@@ -29,8 +29,10 @@
  */
 
 #include <sys/param.h>
+#include <sys/mman.h>
 
 #include <errno.h>
+#include <stdio.h>
 
 #include "pfl/alloc.h"
 #include "pfl/cdefs.h"
@@ -41,9 +43,11 @@
 #include "pfl/lockedlist.h"
 #include "pfl/log.h"
 #include "pfl/mem.h"
+#include "pfl/memnode.h"
 #include "pfl/pool.h"
 #include "pfl/pthrutil.h"
 #include "pfl/str.h"
+#include "pfl/trace.h"
 #include "pfl/waitq.h"
 #include "pfl/workthr.h"
 
@@ -117,10 +121,21 @@
 	} _PFL_RVEND
 #endif
 
+#define PFL_POOL_REGION_HDRSZ(m)					\
+	((m)->ppm_flags & PPMF_ALIGN ? (size_t)psc_pagesize :		\
+	    PSC_ALIGN(sizeof(struct pfl_pool_region), 64))
+
+#define PFL_POOL_REGION_OF(m, p)					\
+	((struct pfl_pool_region *)((uintptr_t)(p) &			\
+	    ~((uintptr_t)(m)->ppm_regionsz - 1)))
+
 __static struct psc_poolset psc_poolset_main = PSC_POOLSET_INIT;
 struct psc_lockedlist psc_pools =
     PLL_INIT(&psc_pools, struct psc_poolmgr, ppm_lentry);
 
+/* whether madvise(2)'d regions may be backed by huge pages */
+__static int pfl_pool_thp = -1;
+
 struct pfl_wkdata_poolreap {
 	struct psc_poolmgr *poolmgr;
 };
@@ -133,7 +148,8 @@ _psc_poolmaster_initv(struct psc_poolmaster *p, size_t entsize,
 {
 	memset(p, 0, sizeof(*p));
 	INIT_SPINLOCK(&p->pms_lock);
-	psc_dynarray_init(&p->pms_poolmgrs);
+	psc_dynarray_initsb(&p->pms_poolmgrs,
+	    nitems(p->pms_poolmgrs_sbuf));
 	psc_dynarray_init(&p->pms_sets);
 	p->pms_reclaimcb = reclaimcb;
 	p->pms_entsize = entsize;
@@ -171,19 +187,23 @@ psc_pool_cmp(const void *a, const void *b)
 }
 
 int
-_psc_poolmaster_initmgr(struct psc_poolmaster *p, struct psc_poolmgr *m)
+_psc_poolmaster_initmgr(struct psc_poolmaster *p, struct psc_poolmgr *m,
+    int memnid)
 {
 	int n, locked;
 	char name[PEXL_NAME_MAX];
 
 	memset(m, 0, sizeof(*m));
 	psc_mutex_init(&m->ppm_reclaim_mutex);
+	INIT_PSCLIST_HEAD(&m->ppm_regions);
+	INIT_PSCLIST_HEAD(&m->ppm_holes);
+	m->ppm_memnid = memnid;
 
 	if (p->pms_flags & PPMF_MLIST) {
 #ifdef HAVE_NUMA
 		_pfl_mlist_init(&m->ppm_ml, PMWCF_WAKEALL,
 		    p->pms_mwcarg, p->pms_offset, "%s:%d", p->pms_name,
-		    psc_memnode_getid());
+		    memnid);
 #else
 		_pfl_mlist_init(&m->ppm_ml, PMWCF_WAKEALL,
 		    p->pms_mwcarg, p->pms_offset, "%s", p->pms_name);
@@ -192,7 +212,7 @@ _psc_poolmaster_initmgr(struct psc_poolmaster *p, struct psc_poolmgr *m)
 
 #ifdef HAVE_NUMA
 		n = snprintf(name, sizeof(m->ppm_name),
-		    "%s:%d", p->pms_name, psc_memnode_getid());
+		    "%s:%d", p->pms_name, memnid);
 #else
 		n = snprintf(name, sizeof(m->ppm_name),
 		    "%s", p->pms_name);
@@ -221,8 +241,29 @@ _psc_poolmaster_initmgr(struct psc_poolmaster *p, struct psc_poolmgr *m)
 	m->ppm_max = p->pms_max;
 	m->ppm_master = p;
 
+#if PFL_DEBUG > 1
+	/* item guard pages cannot be applied inside a huge page */
+	m->ppm_flags &= ~PPMF_REGION;
+#endif
+	if (m->ppm_flags & PPMF_REGION) {
+		if (m->ppm_flags & PPMF_MLIST)
+			psc_fatalx("%s: region backing requires a listcache",
+			    p->pms_name);
+		if (m->ppm_flags & PPMF_ALIGN)
+			m->ppm_stride = PSC_ALIGN(m->ppm_entsize,
+			    psc_pagesize);
+		else
+			m->ppm_stride = PSC_ALIGN(m->ppm_entsize, 16);
+		m->ppm_regionsz = PFL_POOL_REGIONSZ;
+		while (m->ppm_regionsz < PFL_POOL_REGION_HDRSZ(m) +
+		    8 * (size_t)m->ppm_stride)
+			m->ppm_regionsz <<= 1;
+	}
+
 	m->ppm_nseen = pfl_opstat_initf(OPSTF_BASE10,
 	    "pool.%s.seen", m->ppm_name);
+	m->ppm_opst_gets = pfl_opstat_initf(OPSTF_BASE10,
+	    "pool.%s.gets", m->ppm_name);
 	m->ppm_opst_grows = pfl_opstat_initf(OPSTF_BASE10,
 	    "pool.%s.grows", m->ppm_name);
 	m->ppm_opst_shrinks = pfl_opstat_initf(OPSTF_BASE10,
@@ -261,13 +302,256 @@ _psc_poolmaster_getmgr(struct psc_poolmaster *p, int memnid)
 	m = mv[memnid];
 	if (m == NULL) {
 		m = PSCALLOC(sizeof(*m));
-		_psc_poolmaster_initmgr(p, m);
+		_psc_poolmaster_initmgr(p, m, memnid);
 		psc_dynarray_setpos(&p->pms_poolmgrs, memnid, m);
 	}
 	freelock(&p->pms_lock);
 	return (m);
 }
 
+/*
+ * Map a new region for a PPMF_REGION pool.  hugetlbfs is tried first,
+ * falling back to an ordinary anonymous mapping advised for
+ * transparent huge pages.  The mapping is aligned to its own size so
+ * an item's region may be found by masking its address.
+ * @m: the pool manager.
+ */
+__static struct pfl_pool_region *
+pfl_pool_region_map(struct psc_poolmgr *m)
+{
+	struct pfl_pool_region *r = NULL;
+	size_t len = m->ppm_regionsz;
+	char *p, *base, buf[128];
+	int flags = 0;
+	FILE *fp;
+
+	if (pfl_pool_thp == -1) {
+		pfl_pool_thp = 0;
+		fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled",
+		    "r");
+		if (fp) {
+			if (fgets(buf, sizeof(buf), fp) &&
+			    strstr(buf, "[never]") == NULL)
+				pfl_pool_thp = 1;
+			fclose(fp);
+		}
+	}
+
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, 2 * len, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		flags |= PPRF_HUGETLB;
+	else
+#endif
+		p = mmap(NULL, 2 * len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		goto out;
+
+	/* trim the excess on either side */
+	base = (char *)PSC_ALIGN((uintptr_t)p, len);
+	if (base > p)
+		munmap(p, base - p);
+	if (p + 2 * len > base + len)
+		munmap(base + len, p + 2 * len - (base + len));
+
+#ifdef MADV_HUGEPAGE
+	if ((flags & PPRF_HUGETLB) == 0)
+		madvise(base, len, MADV_HUGEPAGE);
+#endif
+#ifdef HAVE_NUMA
+	numa_tonode_memory(base, len, m->ppm_memnid);
+#endif
+	if ((m->ppm_flags & PPMF_PIN) && mlock(base, len) == -1) {
+		psclog_warn("%s: mlock region", m->ppm_name);
+		munmap(base, len);
+		goto out;
+	}
+
+	r = (void *)base;
+	INIT_PSC_LISTENTRY(&r->ppr_lentry);
+	r->ppr_next = base + PFL_POOL_REGION_HDRSZ(m);
+	r->ppr_flags = flags;
+ out:
+	return (r);
+}
+
+/*
+ * Unmap a region along with any destroyed items within it awaiting
+ * reuse.  The caller is responsible for ensuring none of its items
+ * remain in circulation.
+ * @m: the pool manager, locked.
+ * @r: region to release.
+ */
+__static void
+pfl_pool_region_release(struct psc_poolmgr *m,
+    struct pfl_pool_region *r)
+{
+	char *p, *n;
+
+	psclist_for_each_entry2_safe(p, n, &m->ppm_holes,
+	    m->ppm_offset)
+		if (PFL_POOL_REGION_OF(m, p) == r)
+			psclist_del(psclist_entry2(p, m->ppm_offset),
+			    &m->ppm_holes);
+	psclist_del(&r->ppr_lentry, &m->ppm_regions);
+	if (m->ppm_carve == r)
+		m->ppm_carve = NULL;
+	if (r->ppr_flags & PPRF_HUGETLB)
+		m->ppm_nhugetlb--;
+	m->ppm_nregions--;
+	munmap(r, m->ppm_regionsz);
+}
+
+/*
+ * Take an item from an existing region: a hole left by a destroyed
+ * item if there is one, otherwise the next uncarved slot.
+ * @m: the pool manager, locked.
+ */
+__static void *
+pfl_pool_region_getitem(struct psc_poolmgr *m)
+{
+	struct pfl_pool_region *r;
+	char *p;
+
+	p = psc_listhd_first_obj2(&m->ppm_holes, char, m->ppm_offset);
+	if (p) {
+		psclist_del(psclist_entry2(p, m->ppm_offset),
+		    &m->ppm_holes);
+		memset(p, 0, m->ppm_entsize);
+	} else {
+		r = m->ppm_carve;
+		if (r == NULL || r->ppr_next + m->ppm_stride >
+		    (char *)r + m->ppm_regionsz)
+			goto out;
+		p = r->ppr_next;
+		r->ppr_next += m->ppm_stride;
+	}
+	PFL_POOL_REGION_OF(m, p)->ppr_nitems++;
+ out:
+	return (p);
+}
+
+/*
+ * Allocate an item for a PPMF_REGION pool, mapping a new region if
+ * the existing ones are exhausted.
+ * @m: the pool manager.
+ */
+__static void *
+pfl_pool_region_alloc(struct psc_poolmgr *m)
+{
+	struct pfl_pool_region *r;
+	void *p;
+
+	POOL_LOCK(m);
+	p = pfl_pool_region_getitem(m);
+	POOL_ULOCK(m);
+	if (p)
+		goto out;
+
+	r = pfl_pool_region_map(m);
+	if (r == NULL)
+		goto out;
+
+	POOL_LOCK(m);
+	/* another thread may have mapped a region in the meantime */
+	p = pfl_pool_region_getitem(m);
+	if (p) {
+		POOL_ULOCK(m);
+		munmap(r, m->ppm_regionsz);
+		goto out;
+	}
+	psclist_add_tail(&r->ppr_lentry, &m->ppm_regions);
+	if (r->ppr_flags & PPRF_HUGETLB)
+		m->ppm_nhugetlb++;
+	m->ppm_nregions++;
+	m->ppm_carve = r;
+	p = pfl_pool_region_getitem(m);
+	POOL_ULOCK(m);
+ out:
+	return (p);
+}
+
+/*
+ * Destroy an item of a PPMF_REGION pool.  Memory is only given back to
+ * the system a whole region at a time; individual items are kept as
+ * holes for reuse so huge pages are never split.
+ * @m: the pool manager, locked.
+ * @p: item to destroy.
+ */
+__static void
+pfl_pool_region_putitem(struct psc_poolmgr *m, void *p)
+{
+	struct pfl_pool_region *r;
+
+	r = PFL_POOL_REGION_OF(m, p);
+	if (--r->ppr_nitems == 0) {
+		pfl_pool_region_release(m, r);
+		return;
+	}
+	INIT_PSC_LISTENTRY(psclist_entry2(p, m->ppm_offset));
+	psclist_add(psclist_entry2(p, m->ppm_offset), &m->ppm_holes);
+}
+
+/*
+ * Release regions whose items are all sitting on the free list.
+ * @m: the pool manager, locked.
+ * @n: #items desired to shrink by.
+ */
+__static int
+pfl_pool_region_shrink(struct psc_poolmgr *m, int n)
+{
+	struct pfl_pool_region *r, *rn;
+	int nitems, nfreed = 0;
+	char *p, *t;
+
+	psclist_for_each_entry(r, &m->ppm_regions, ppr_lentry)
+		r->ppr_nfree = 0;
+	LIST_CACHE_FOREACH(p, &m->ppm_lc)
+		PFL_POOL_REGION_OF(m, p)->ppr_nfree++;
+
+	psclist_for_each_entry_safe(r, rn, &m->ppm_regions,
+	    ppr_lentry) {
+		if (nfreed >= n)
+			break;
+		nitems = r->ppr_nitems;
+		if (r->ppr_nfree != nitems ||
+		    m->ppm_total - nitems < m->ppm_min)
+			continue;
+		LIST_CACHE_FOREACH_SAFE(p, t, &m->ppm_lc)
+			if (PFL_POOL_REGION_OF(m, p) == r)
+				lc_remove(&m->ppm_lc, p);
+		m->ppm_total -= nitems;
+		pfl_opstat_add(m->ppm_opst_shrinks, nitems);
+		nfreed += nitems;
+		pfl_pool_region_release(m, r);
+	}
+	return (nfreed);
+}
+
+/*
+ * Estimate the number of TLB entries needed to map a pool's items.
+ * @m: the pool manager, locked.
+ */
+int64_t
+pfl_pool_tlbpages(struct psc_poolmgr *m)
+{
+	int64_t npages;
+
+	if ((m->ppm_flags & PPMF_REGION) == 0) {
+		npages = (int64_t)m->ppm_total *
+		    howmany(m->ppm_entsize, psc_pagesize);
+		goto out;
+	}
+	npages = (int64_t)m->ppm_nhugetlb * m->ppm_regionsz /
+	    PFL_POOL_REGIONSZ;
+	npages += (int64_t)(m->ppm_nregions - m->ppm_nhugetlb) *
+	    m->ppm_regionsz / (pfl_pool_thp ? PFL_POOL_REGIONSZ : psc_pagesize);
+ out:
+	return (npages);
+}
+
 void
 pfl_poolmaster_destroy(struct psc_poolmaster *pms)
 {
@@ -275,9 +559,16 @@ pfl_poolmaster_destroy(struct psc_poolmaster *pms)
 	int i;
 
 	spinlock(&pms->pms_lock);
-	DYNARRAY_FOREACH(m, i, &pms->pms_poolmgrs) {
+	DYNARRAY_FOREACH(m, i, &pms->pms_poolmgrs)
 		pll_remove(&psc_pools, m);
+	freelock(&pms->pms_lock);
+
+	/* The reclaim thread may still be working on them. */
+	DYNARRAY_FOREACH(m, i, &pms->pms_poolmgrs)
+		pfl_poolreclaim_wait(m);
 
+	spinlock(&pms->pms_lock);
+	DYNARRAY_FOREACH(m, i, &pms->pms_poolmgrs) {
 		psc_mutex_destroy(&m->ppm_reclaim_mutex);
 
 		if (pms->pms_flags & PPMF_MLIST)
@@ -286,11 +577,17 @@ pfl_poolmaster_destroy(struct psc_poolmaster *pms)
 			pfl_listcache_destroy(&m->ppm_lc);
 
 		pfl_opstat_destroy(m->ppm_nseen);
+		pfl_opstat_destroy(m->ppm_opst_gets);
 		pfl_opstat_destroy(m->ppm_opst_grows);
 		pfl_opstat_destroy(m->ppm_opst_shrinks);
 		pfl_opstat_destroy(m->ppm_opst_returns);
 		pfl_opstat_destroy(m->ppm_opst_preaps);
 		pfl_opstat_destroy(m->ppm_opst_fails);
+
+		while (!psc_listhd_empty(&m->ppm_regions))
+			pfl_pool_region_release(m,
+			    psc_listhd_first_obj(&m->ppm_regions,
+			    struct pfl_pool_region, ppr_lentry));
 		PSCFREE(m);
 	}
 	freelock(&pms->pms_lock);
@@ -312,7 +609,10 @@ _psc_pool_destroy_obj(struct psc_poolmgr *m, void *p)
 	if (m->ppm_flags & PPMF_PIN)
 		flags |= PAF_LOCK;
 	_PSC_POOL_CLEAR_OBJ(m, p);
-	psc_free(p, flags, m->ppm_entsize);
+	if (m->ppm_flags & PPMF_REGION)
+		pfl_pool_region_putitem(m, p);
+	else
+		psc_free(p, flags, m->ppm_entsize);
 }
 
 /*
@@ -340,6 +640,7 @@ psc_pool_try_grow(struct psc_poolmgr *m, int n)
 	}
 	POOL_ULOCK(m);
 
+	PFL_TRACE_BEGIN(PSS_MEM, "pool.grow", (uintptr_t)m);
 	flags = PAF_CANFAIL;
 	if (m->ppm_flags & PPMF_PIN)
 		flags |= PAF_LOCK;
@@ -350,11 +651,15 @@ psc_pool_try_grow(struct psc_poolmgr *m, int n)
  		 * Do not hold any locks because we might call psc_pool_reapmem()
  		 * when memory is low.
  		 */
-		p = psc_alloc(m->ppm_entsize, flags);
+		if (m->ppm_flags & PPMF_REGION)
+			p = pfl_pool_region_alloc(m);
+		else
+			p = psc_alloc(m->ppm_entsize, flags);
 		if (p == NULL) {
 			fprintf(stderr, "ENOMEM: m = %p, name = %s, n = %d\n", 
 				p, m->ppm_master->pms_name, n); 
 			errno = ENOMEM;
+			PFL_TRACE_END(PSS_MEM, "pool.grow", (uintptr_t)m);
 			return (i);
 		}
 		INIT_PSC_LISTENTRY(psclist_entry2(p,
@@ -374,6 +679,7 @@ psc_pool_try_grow(struct psc_poolmgr *m, int n)
 		POOL_ADD_ITEM(m, p);
 		POOL_ULOCK(m);
 	}
+	PFL_TRACE_END(PSS_MEM, "pool.grow", (uintptr_t)m);
 	return (i);
 }
 
@@ -384,7 +690,10 @@ psc_pool_try_shrink(struct psc_poolmgr *m, int n)
 	void *p;
 
 	POOL_LOCK(m);
-	for (i = 0; i < n; i++) {
+	i = 0;
+	if (m->ppm_flags & PPMF_REGION)
+		i = pfl_pool_region_shrink(m, n);
+	for (; i < n; i++) {
 		if (m->ppm_total > m->ppm_min) {
 			p = POOL_TRYGETOBJ(m);
 			if (!p) {
@@ -534,7 +843,9 @@ psc_pool_reap(struct psc_poolmgr *m, int desperate)
 {
 	int reaped;
 
+	PFL_TRACE_BEGIN(PSS_MEM, "pool.reap", (uintptr_t)m);
 	reaped = m->ppm_reclaimcb(m);
+	PFL_TRACE_END(PSS_MEM, "pool.reap", (uintptr_t)m);
 	return (reaped);
 }
 
@@ -681,7 +992,9 @@ _psc_pool_get(struct psc_poolmgr *m, int flags)
  	 * (gdb) p m->ppm_u.ppmu_lc.plc_explist.pexl_pll.pll_nitems
  	 * (gdb) p m->ppm_u.ppmu_lc.plc_explist.pexl_name
  	 */
+	PFL_TRACE_BEGIN(PSS_MEM, "pool.wait", (uintptr_t)m);
 	p = lc_getwait(&m->ppm_lc);
+	PFL_TRACE_END(PSS_MEM, "pool.wait", (uintptr_t)m);
 	psc_atomic32_dec(&m->ppm_nwaiters);
 
  gotitem:
@@ -701,7 +1014,9 @@ _psc_pool_get(struct psc_poolmgr *m, int flags)
 		}
 	}
 	POOL_ULOCK(m);
-	if (p == NULL)
+	if (p)
+		pfl_opstat_incr(m->ppm_opst_gets);
+	else
 		pfl_opstat_incr(m->ppm_opst_fails);
 	return (p);
 }
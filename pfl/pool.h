@@ -47,6 +47,24 @@
 
 struct psc_poolmgr;
 
+#define PFL_POOL_REGIONSZ	(2 * 1024 * 1024)	/* min region size */
+
+/*
+ * Regions back PPMF_REGION pools: large naturally aligned mappings,
+ * advised or allocated as huge pages, from which items are carved.
+ * The region header lives at the start of the mapping.
+ */
+struct pfl_pool_region {
+	struct psc_listentry	  ppr_lentry;
+	char			 *ppr_next;		/* next uncarved item */
+	int			  ppr_nitems;		/* #items in circulation */
+	int			  ppr_nfree;		/* scratch: #items free */
+	int			  ppr_flags;
+};
+
+/* region flags */
+#define PPRF_HUGETLB		(1 << 0)		/* backed by hugetlbfs */
+
 /*
  * Poolsets contain a group of poolmgrs which can reap memory from each
  * other.
@@ -67,7 +85,7 @@ struct psc_poolset {
  */
 struct psc_poolmaster {
 	psc_spinlock_t		  pms_lock;
-	struct psc_dynarray	  pms_poolmgrs;		/* NUMA pools */
+	PSC_DYNARRAY_SB(pms_poolmgrs, 1);		/* NUMA pools */
 	struct psc_dynarray	  pms_sets;		/* poolset memberships */
 
 	/* for initializing memnode poolmgrs */
@@ -105,7 +123,26 @@ struct psc_poolmgr {
 	int			  ppm_entsize;		/* entry size */
 	psc_atomic32_t		  ppm_nwaiters;		/* #thrs waiting for item */
 	struct pfl_mutex	  ppm_reclaim_mutex;	/* exclusive reclamation */
-
+	int			  ppm_memnid;		/* memory node of items */
+
+	/* PPMF_REGION backing */
+	struct psclist_head	  ppm_regions;
+	struct psclist_head	  ppm_holes;		/* destroyed items to reuse */
+	struct pfl_pool_region	 *ppm_carve;		/* region being carved */
+	size_t			  ppm_regionsz;
+	int			  ppm_stride;		/* item spacing in region */
+	int			  ppm_nregions;
+	int			  ppm_nhugetlb;		/* #regions on hugetlbfs */
+
+	/* background reclamation */
+	int			  ppm_prio;		/* higher is reclaimed later */
+	int			  ppm_nidle;		/* #ticks without activity */
+	int			  ppm_grew;		/* grew during last tick */
+	int64_t			  ppm_lastseen;		/* ppm_nseen at last tick */
+	int64_t			  ppm_lastgrows;
+	int			  ppm_reclaimref;	/* held by reclaim thread */
+
+	struct pfl_opstat	 *ppm_opst_gets;
 	struct pfl_opstat	 *ppm_opst_grows;
 	struct pfl_opstat	 *ppm_opst_shrinks;
 	struct pfl_opstat	 *ppm_opst_returns;
@@ -137,6 +174,7 @@ struct psc_poolmgr {
 #define PPMF_NOPREEMPT		(1 << 6)	/* do reactive reaping */
 #define PPMF_PREEMPTQ		(1 << 7)	/* queued for preemptive reaping */
 #define PPMF_IDLEREAP		(1 << 8)	/* idle reaping */
+#define PPMF_REGION		(1 << 9)	/* carve items from huge page regions */
 
 #define POOL_LOCK(m)		PLL_LOCK(&(m)->ppm_pll)
 #define POOL_LOCK_ENSURE(m)	PLL_LOCK_ENSURE(&(m)->ppm_pll)
@@ -234,6 +272,9 @@ int psc_pool_try_shrink(struct psc_poolmgr *, int);
 struct psc_poolmgr *
 	_psc_poolmaster_getmgr(struct psc_poolmaster *, int);
 void	 pfl_poolmaster_destroy(struct psc_poolmaster *);
+int64_t	 pfl_pool_tlbpages(struct psc_poolmgr *);
+void	 pfl_poolreclaim_wait(struct psc_poolmgr *);
+void	 pfl_poolreclaimthr_spawn(int, const char *);
 void	_psc_poolmaster_init(struct psc_poolmaster *, size_t, ptrdiff_t,
 	    int, int, int, int, int (*)(struct psc_poolmgr *),
 	    void *, const char *, ...);
@@ -261,4 +302,9 @@ void	  psc_poolset_init(struct psc_poolset *);
 
 extern struct psc_lockedlist	psc_pools;
 
+extern uint64_t			pfl_poolreclaim_budget;
+extern uint64_t			pfl_poolreclaim_idle;
+extern uint64_t			pfl_poolreclaim_psi_high;
+extern uint64_t			pfl_poolreclaim_psi_low;
+
 #endif /* _PFL_POOL_H_ */
@@ -0,0 +1,270 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Background pool reclamation.  Rather than leaving reaping to the
+ * thread that finds a pool empty, a service thread watches memory
+ * pressure (PSI and RSS against a budget) and pool activity and gives
+ * memory back ahead of demand:
+ *
+ *   - under pressure, free items are released from pools in order of
+ *     ascending ppm_prio, skipping pools that grew during the last
+ *     tick so two pools do not keep reaping each other;
+ *   - PPMF_IDLEREAP pools without activity for pfl_poolreclaim_idle
+ *     seconds are trimmed to their minimum;
+ *   - pools with a reclaim callback that are at their ceiling and
+ *     nearly empty have the callback run so the next get does not.
+ */
+
+#include <sys/param.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/cdefs.h"
+#include "pfl/dynarray.h"
+#include "pfl/log.h"
+#include "pfl/opstats.h"
+#include "pfl/pool.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+#include "pfl/waitq.h"
+
+uint64_t	pfl_poolreclaim_budget;		/* RSS budget in bytes, 0 is none */
+uint64_t	pfl_poolreclaim_idle = 30;	/* seconds before idle reap */
+uint64_t	pfl_poolreclaim_psi_high = 1000;/* some avg10 x 100 to engage */
+uint64_t	pfl_poolreclaim_psi_low = 200;	/* some avg10 x 100 to disengage */
+
+/* pfl_poolmaster_destroy() waits here for the reclaim thread */
+__static struct pfl_waitq pfl_poolreclaim_waitq =
+    PFL_WAITQ_INIT("poolreclaim-ref");
+
+/*
+ * Read the share of time over the last ten seconds some task stalled
+ * on memory, in hundredths of a percent.
+ */
+__static int64_t
+pfl_poolreclaim_getpsi(void)
+{
+	int64_t psi = -1;
+	double avg10;
+	FILE *fp;
+
+	fp = fopen("/proc/pressure/memory", "r");
+	if (fp == NULL)
+		goto out;
+	if (fscanf(fp, "some avg10=%lf", &avg10) == 1)
+		psi = avg10 * 100;
+	fclose(fp);
+ out:
+	return (psi);
+}
+
+__static uint64_t
+pfl_poolreclaim_getrss(void)
+{
+	unsigned long size, resident = 0;
+	FILE *fp;
+
+	fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL)
+		goto out;
+	if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+ out:
+	return ((uint64_t)resident * psc_pagesize);
+}
+
+__static int
+pfl_poolreclaim_cmp(const void *a, const void *b)
+{
+	struct psc_poolmgr * const *pa = a, * const *pb = b;
+
+	return (CMP((*pa)->ppm_prio, (*pb)->ppm_prio));
+}
+
+/*
+ * Drop the reclaim thread's hold on a pool taken while scanning
+ * psc_pools.
+ */
+__static void
+pfl_poolreclaim_rele(struct psc_poolmgr *m)
+{
+	POOL_LOCK(m);
+	if (--m->ppm_reclaimref == 0)
+		pfl_waitq_wakeall(&pfl_poolreclaim_waitq);
+	POOL_ULOCK(m);
+}
+
+/*
+ * Wait until the reclaim thread no longer holds a pool.  The pool must
+ * already be off psc_pools so no new hold can be taken.
+ * @m: pool being destroyed.
+ */
+void
+pfl_poolreclaim_wait(struct psc_poolmgr *m)
+{
+	POOL_LOCK(m);
+	while (m->ppm_reclaimref) {
+		pfl_waitq_wait(&pfl_poolreclaim_waitq,
+		    _PLL_GETLOCK(&m->ppm_pll));
+		POOL_LOCK(m);
+	}
+	POOL_ULOCK(m);
+}
+
+/*
+ * Release up to @want bytes of free items, lowest priority first.
+ * @pools: pool managers in reclamation order.
+ * @want: #bytes desired, or zero to release half of each pool's free
+ *	items.
+ */
+__static void
+pfl_poolreclaim_shrink(struct psc_dynarray *pools, uint64_t want)
+{
+	struct psc_poolmgr *m;
+	int i, n, grew;
+	uint64_t got;
+
+	DYNARRAY_FOREACH(m, i, pools) {
+		POOL_LOCK(m);
+		grew = m->ppm_grew;
+		n = MIN(m->ppm_nfree, m->ppm_total - m->ppm_min);
+		if (want)
+			n = MIN(n, (int)howmany(want, m->ppm_entsize));
+		else
+			n = (n + 1) / 2;
+		POOL_ULOCK(m);
+
+		if (grew || n <= 0)
+			continue;
+		n = psc_pool_try_shrink(m, n);
+		OPSTAT_ADD("poolreclaim.pressure_items", n);
+		if (want) {
+			got = (uint64_t)n * m->ppm_entsize;
+			if (got >= want)
+				break;
+			want -= got;
+		}
+	}
+}
+
+void
+pfl_poolreclaimthr_main(struct psc_thread *thr)
+{
+	struct pfl_waitq dummy = PFL_WAITQ_INIT("poolreclaim");
+	struct psc_dynarray pools = DYNARRAY_INIT;
+	uint64_t rss, lowat, want;
+	int i, n, pressured = 0;
+	struct psc_poolmgr *m;
+	struct timespec ts;
+	int64_t psi, seen, grows;
+
+	PFL_GETTIMESPEC(&ts);
+	while (pscthr_run(thr)) {
+		ts.tv_sec++;
+		pfl_waitq_waitabs(&dummy, NULL, &ts);
+
+		psi = pfl_poolreclaim_getpsi();
+		rss = pfl_poolreclaim_getrss();
+		lowat = pfl_poolreclaim_budget -
+		    pfl_poolreclaim_budget / 10;
+
+		/* engage and disengage at different levels */
+		if (!pressured)
+			pressured = (psi != -1 &&
+			    (uint64_t)psi >= pfl_poolreclaim_psi_high) ||
+			    (pfl_poolreclaim_budget &&
+			     rss > pfl_poolreclaim_budget);
+		else if ((psi == -1 ||
+		    (uint64_t)psi < pfl_poolreclaim_psi_low) &&
+		    (pfl_poolreclaim_budget == 0 || rss < lowat))
+			pressured = 0;
+
+		psc_dynarray_reset(&pools);
+		PLL_LOCK(&psc_pools);
+		PLL_FOREACH(m, &psc_pools) {
+			POOL_LOCK(m);
+			seen = pfl_opstat_read(m->ppm_nseen);
+			grows = pfl_opstat_read(m->ppm_opst_grows);
+			m->ppm_grew = grows != m->ppm_lastgrows;
+			if (seen == m->ppm_lastseen && !m->ppm_grew)
+				m->ppm_nidle++;
+			else
+				m->ppm_nidle = 0;
+			m->ppm_lastseen = seen;
+			m->ppm_lastgrows = grows;
+			m->ppm_reclaimref++;
+			POOL_ULOCK(m);
+			psc_dynarray_add(&pools, m);
+		}
+		PLL_ULOCK(&psc_pools);
+
+		psc_dynarray_sort(&pools, qsort, pfl_poolreclaim_cmp);
+
+		if (pressured) {
+			OPSTAT_INCR("poolreclaim.pressure");
+			want = 0;
+			if (pfl_poolreclaim_budget && rss > lowat)
+				want = rss - lowat;
+			pfl_poolreclaim_shrink(&pools, want);
+		}
+
+		DYNARRAY_FOREACH(m, i, &pools) {
+			POOL_LOCK(m);
+			n = 0;
+			if ((m->ppm_flags & PPMF_IDLEREAP) &&
+			    (uint64_t)m->ppm_nidle >= pfl_poolreclaim_idle)
+				n = MIN(m->ppm_nfree,
+				    m->ppm_total - m->ppm_min);
+			/* nearly empty at the ceiling: reap for the next get */
+			if (m->ppm_reclaimcb && m->ppm_max &&
+			    m->ppm_total >= m->ppm_max &&
+			    m->ppm_nfree < MAX(1, m->ppm_total / 16) &&
+			    (m->ppm_flags & PPMF_PREEMPTQ) == 0) {
+				POOL_ULOCK(m);
+				psc_pool_reap(m, 0);
+				pfl_opstat_incr(m->ppm_opst_preaps);
+				OPSTAT_INCR("poolreclaim.reap");
+			} else
+				POOL_ULOCK(m);
+			if (n > 0) {
+				n = psc_pool_try_shrink(m, n);
+				OPSTAT_ADD("poolreclaim.idle_items", n);
+			}
+		}
+
+		DYNARRAY_FOREACH(m, i, &pools)
+			pfl_poolreclaim_rele(m);
+	}
+	psc_dynarray_free(&pools);
+}
+
+void
+pfl_poolreclaimthr_spawn(int thrtype, const char *name)
+{
+	pscthr_init(thrtype, pfl_poolreclaimthr_main, 0, name);
+}
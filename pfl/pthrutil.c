@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "pfl/lockprof.h"
 #include "pfl/log.h"
 #include "pfl/pthrutil.h"
 #include "pfl/thread.h"
@@ -47,6 +48,47 @@
 			    ##__VA_ARGS__);				\
 	} while (0)
 
+#define PFL_LOCKPROF_FILE(pci)	((pci) ? (pci)->pci_filename : __FILE__)
+#define PFL_LOCKPROF_LINE(pci)	((pci) ? (pci)->pci_lineno : __LINE__)
+
+#define PMUT_PROF_ACQUIRED(pci, mut, t0)				\
+	do {								\
+		if (PFL_LOCKPROF_ENABLED())				\
+			(mut)->pm_prof_ts = _pfl_lockprof_acquire(	\
+			    PFL_LOCKPROF_FILE(pci),			\
+			    PFL_LOCKPROF_LINE(pci), PFL_LOCKPROF_MUTEX,	\
+			    (t0), &(mut)->pm_prof_site);		\
+	} while (0)
+
+#define PMUT_PROF_RELEASE(mut)						\
+	do {								\
+		if ((mut)->pm_prof_ts) {				\
+			_pfl_lockprof_release((mut)->pm_prof_site,	\
+			    (mut)->pm_prof_ts);				\
+			(mut)->pm_prof_ts = 0;				\
+		}							\
+	} while (0)
+
+/*
+ * Lock a mutex for the contention profiler: try first and only time
+ * the wait if that fails.
+ * @t0: value-result start of the wait, left zero if there was none.
+ */
+__static int
+pfl_mutex_lock_prof(struct pfl_mutex *mut, uint64_t *t0)
+{
+	int rc;
+
+	rc = pthread_mutex_trylock(&mut->pm_mutex);
+	if (rc == EBUSY) {
+		if (psc_mutex_haslock(mut))
+			return (EDEADLK);
+		*t0 = pfl_lockprof_now();
+		rc = pthread_mutex_lock(&mut->pm_mutex);
+	}
+	return (rc);
+}
+
 void
 _psc_mutex_init(struct pfl_mutex *mut, int flags)
 {
@@ -88,17 +130,22 @@ psc_mutex_destroy(struct pfl_mutex *mut)
 void
 _psc_mutex_lock(const struct pfl_callerinfo *pci, struct pfl_mutex *mut)
 {
+	uint64_t t0 = 0;
 	int rc;
 
 #if PFL_DEBUG > 1
 	pfl_assert(!pfl_memchk(mut, 0, sizeof(*mut)));
 #endif
 
-	rc = pthread_mutex_lock(&mut->pm_mutex);
+	if (PFL_LOCKPROF_ENABLED())
+		rc = pfl_mutex_lock_prof(mut, &t0);
+	else
+		rc = pthread_mutex_lock(&mut->pm_mutex);
 	if (rc)
 		psc_fatalx("pthread_mutex_lock: %s", strerror(rc));
 	mut->pm_owner = pthread_self();
 	mut->pm_lineno = pci ? pci->pci_lineno : __LINE__;
+	PMUT_PROF_ACQUIRED(pci, mut, t0);
 	PMUT_LOG(mut, "acquired");
 }
 
@@ -108,6 +155,7 @@ _psc_mutex_unlock(const struct pfl_callerinfo *pci,
 {
 	int rc, dolog = 0, loglevel = PLL_VDEBUG;
 
+	PMUT_PROF_RELEASE(mut);
 	mut->pm_owner = 0;
 	mut->pm_lineno = 0;
 	PMUT_LOG(mut, "releasing log=%d level=%d",
@@ -126,13 +174,19 @@ int
 _psc_mutex_reqlock(const struct pfl_callerinfo *pci,
     struct pfl_mutex *mut)
 {
+	uint64_t t0 = 0;
 	int rc;
 
-	rc = pthread_mutex_lock(&mut->pm_mutex);
+	if (PFL_LOCKPROF_ENABLED())
+		rc = pfl_mutex_lock_prof(mut, &t0);
+	else
+		rc = pthread_mutex_lock(&mut->pm_mutex);
 	if (rc == EDEADLK)
 		rc = 1;
 	else if (rc)
 		psc_fatalx("pthread_mutex_lock: %s", strerror(rc));
+	else
+		PMUT_PROF_ACQUIRED(pci, mut, t0);
 	mut->pm_owner = pthread_self();
 	PMUT_LOG(mut, "acquired, req=%d", rc);
 	return (rc);
@@ -156,6 +210,7 @@ _psc_mutex_trylock(const struct pfl_callerinfo *pci,
 	rc = pthread_mutex_trylock(&mut->pm_mutex);
 	if (rc == 0) {
 		mut->pm_owner = pthread_self();
+		PMUT_PROF_ACQUIRED(pci, mut, 0);
 		PMUT_LOG(mut, "acquired");
 		return (1);
 	}
@@ -217,6 +272,8 @@ void
 _pfl_rwlock_rdlock(const struct pfl_callerinfo *pci,
     struct pfl_rwlock *rw)
 {
+	struct pfl_lockprof_site *site;
+	uint64_t t0 = 0;
 	pthread_t p;
 	void *pa;
 	int rc;
@@ -230,7 +287,19 @@ _pfl_rwlock_rdlock(const struct pfl_callerinfo *pci,
 	psc_dynarray_add(&rw->pr_readers, pa);
 	freelock(&rw->pr_lock);
 
-	rc = pthread_rwlock_rdlock(&rw->pr_rwlock);
+	if (PFL_LOCKPROF_ENABLED()) {
+		/* reader hold times are not tracked */
+		rc = pthread_rwlock_tryrdlock(&rw->pr_rwlock);
+		if (rc == EBUSY) {
+			t0 = pfl_lockprof_now();
+			rc = pthread_rwlock_rdlock(&rw->pr_rwlock);
+		}
+		if (rc == 0)
+			_pfl_lockprof_acquire(PFL_LOCKPROF_FILE(pci),
+			    PFL_LOCKPROF_LINE(pci), PFL_LOCKPROF_RDLOCK,
+			    t0, &site);
+	} else
+		rc = pthread_rwlock_rdlock(&rw->pr_rwlock);
 	if (rc)
 		psc_fatalx("pthread_rwlock_rdlock: %s", strerror(rc));
 	psclog_vdebug("rwlock@%p reader lock acquired", rw);
@@ -240,13 +309,26 @@ void
 _pfl_rwlock_wrlock(const struct pfl_callerinfo *pci,
     struct pfl_rwlock *rw)
 {
+	uint64_t t0 = 0;
 	pthread_t p;
 	int rc;
 
 	p = pthread_self();
 	pfl_assert(rw->pr_writer != p);
 
-	rc = pthread_rwlock_wrlock(&rw->pr_rwlock);
+	if (PFL_LOCKPROF_ENABLED()) {
+		rc = pthread_rwlock_trywrlock(&rw->pr_rwlock);
+		if (rc == EBUSY) {
+			t0 = pfl_lockprof_now();
+			rc = pthread_rwlock_wrlock(&rw->pr_rwlock);
+		}
+		if (rc == 0)
+			rw->pr_prof_ts = _pfl_lockprof_acquire(
+			    PFL_LOCKPROF_FILE(pci),
+			    PFL_LOCKPROF_LINE(pci), PFL_LOCKPROF_WRLOCK,
+			    t0, &rw->pr_prof_site);
+	} else
+		rc = pthread_rwlock_wrlock(&rw->pr_rwlock);
 	if (rc)
 		psc_fatalx("pthread_rwlock_wrlock: %s", strerror(rc));
 	rw->pr_writer = p;
@@ -317,6 +399,11 @@ _pfl_rwlock_unlock(const struct pfl_callerinfo *pci,
 	(void)wr;
 	p = pthread_self();
 	if (rw->pr_writer == p) {
+		if (rw->pr_prof_ts) {
+			_pfl_lockprof_release(rw->pr_prof_site,
+			    rw->pr_prof_ts);
+			rw->pr_prof_ts = 0;
+		}
 		rw->pr_writer = 0;
 		wr = 1;
 	} else {
@@ -339,9 +426,12 @@ int
 psc_cond_timedwait(pthread_cond_t *c, struct pfl_mutex *m,
     const struct timespec *tm)
 {
+	uint64_t pts;
 	int rc;
 
+	PFL_MUTEX_PROF_SUSPEND(m, pts);
 	rc = pthread_cond_timedwait(c, &m->pm_mutex, tm);
+	PFL_MUTEX_PROF_RESUME(m, pts);
 	if (rc && rc != ETIMEDOUT)
 		psc_fatalx("pthread_cond_timedwait: %s", strerror(rc));
 	return (rc);
@@ -34,16 +34,16 @@
 /* The last "unable" case happens on FreeBSD 9.0-CURRENT */
  
 #ifdef PTHREAD_MUTEX_ERRORCHECK_INITIALIZER
-# define PSC_MUTEX_INIT			{ PTHREAD_MUTEX_ERRORCHECK_INITIALIZER, 0, 0, 0 }
+# define PSC_MUTEX_INIT			{ PTHREAD_MUTEX_ERRORCHECK_INITIALIZER, 0, 0, 0, NULL, 0 }
 #elif defined(PTHREAD_MUTEX_ERRORCHECK_INITIALIZER_NP)
-# define PSC_MUTEX_INIT			{ PTHREAD_MUTEX_ERRORCHECK_INITIALIZER_NP, 0, 0, 0 }
+# define PSC_MUTEX_INIT			{ PTHREAD_MUTEX_ERRORCHECK_INITIALIZER_NP, 0, 0, 0, NULL, 0 }
 #elif defined(PTHREAD_ERRORCHECK_MUTEX_INITIALIZER)
-# define PSC_MUTEX_INIT			{ PTHREAD_ERRORCHECK_MUTEX_INITIALIZER, 0, 0, 0 }
+# define PSC_MUTEX_INIT			{ PTHREAD_ERRORCHECK_MUTEX_INITIALIZER, 0, 0, 0, NULL, 0 }
 #elif defined(PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP)
-# define PSC_MUTEX_INIT			{ PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP, 0, 0, 0 }
+# define PSC_MUTEX_INIT			{ PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP, 0, 0, 0, NULL, 0 }
 #else
 # warning "unable to find an error checking mutex; beware"
-# define PSC_MUTEX_INIT			{ PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 }
+# define PSC_MUTEX_INIT			{ PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, NULL, 0 }
 #endif
 
 #define psc_mutex_ensure_locked(m)	_psc_mutex_ensure_locked(PFL_CALLERINFO(), (m))
@@ -59,15 +59,37 @@ struct pfl_mutex {
 	pthread_t		pm_owner;
 	int			pm_lineno;
 	int			pm_flags;
+	struct pfl_lockprof_site *pm_prof_site;	/* see pfl/lockprof.h */
+	uint64_t		pm_prof_ts;
 };
 
 #define PMTXF_DEBUG		(1 << 0)
 #define PMTXF_NOLOG		(1 << 1)
 
+/*
+ * Suspend and resume hold time accounting by the contention profiler
+ * around a condition wait, which drops the mutex.
+ */
+#define PFL_MUTEX_PROF_SUSPEND(m, ts)					\
+	do {								\
+		(ts) = (m)->pm_prof_ts;					\
+		if (ts) {						\
+			_pfl_lockprof_release((m)->pm_prof_site, (ts));	\
+			(m)->pm_prof_ts = 0;				\
+		}							\
+	} while (0)
+
+#define PFL_MUTEX_PROF_RESUME(m, ts)					\
+	do {								\
+		if (ts)							\
+			(m)->pm_prof_ts = pfl_lockprof_now();		\
+	} while (0)
+
 #define psc_mutex_init(m)		_psc_mutex_init((m), 0)
 #define psc_mutex_init_debug(m)		_psc_mutex_init((m), PMTXF_DEBUG)
 #define psc_mutex_init_nolog(m)		_psc_mutex_init((m), PMTXF_NOLOG)
 
+int	 psc_cond_timedwait(pthread_cond_t *, struct pfl_mutex *, const struct timespec *);
 void	_psc_mutex_ensure_locked(const struct pfl_callerinfo *, struct pfl_mutex *);
 int	 psc_mutex_haslock(struct pfl_mutex *);
 void	_psc_mutex_init(struct pfl_mutex *, int);
@@ -84,16 +106,18 @@ struct pfl_rwlock {
 	pthread_t		pr_writer;
 	struct psc_dynarray	pr_readers;
 	psc_spinlock_t		pr_lock;
+	struct pfl_lockprof_site *pr_prof_site;	/* writer only */
+	uint64_t		pr_prof_ts;
 };
 
 /* The last "unable" case happens on FreeBSD 9.0-CURRENT */
 
 #ifdef PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
 # define pfl_rwlock_INIT		{ PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP, \
-					  0, DYNARRAY_INIT, SPINLOCK_INIT }
+					  0, DYNARRAY_INIT, SPINLOCK_INIT, NULL, 0 }
 #else
 # warning "unable to find an nonrecursive rw writer; beware"
-# define pfl_rwlock_INIT		{ PTHREAD_RWLOCK_INITIALIZER, 0, DYNARRAY_INIT, SPINLOCK_INIT }
+# define pfl_rwlock_INIT		{ PTHREAD_RWLOCK_INITIALIZER, 0, DYNARRAY_INIT, SPINLOCK_INIT, NULL, 0 }
 #endif
 
 #define pfl_rwlock_rdlock(rw)		_pfl_rwlock_rdlock(PFL_CALLERINFO(), (rw))
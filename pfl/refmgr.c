@@ -21,106 +21,164 @@
  * %END_LICENSE%
  */
 
+
 /*
  * An object reference has the following memory layout:
  *
  *	+-------------------------------------------------------+
  *	| struct pfl_objref					|
  *	+-------------------------------------------------------+
- *	| SPLAY_ENTRY() if PRMF_TREE				|
- *	| struct psc_refmgr * if PRMF_TREE			|
- *	| struct psclist_head (for pool and (LIST|LRU|HASH))	|
- *	| struct psclist_head (if LIST and LRU)			|
- *	| struct psclist_head (if (LIST or LRU) and HASH)	|
- *	+-------------------------------------------------------+
  *	| private object-specific data				|
  *	+-------------------------------------------------------+
  *
+ * Lock ordering: hash bucket, then shard.
+ *
+ * A reference count may only drop to zero while holding the object's
+ * hash bucket lock, except under PRMF_LINGER where zero-reference
+ * objects stay cached.  Since lookups take their reference under the
+ * same lock, an object found in the table is never being destroyed.
+ *
  * XXX need a poolmgr pointer to avoid returning to different poolmgrs.
  */
 
+#include <limits.h>
+#include <math.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 
-#include "pfl/dynarray.h"
+#include "pfl/atomic.h"
 #include "pfl/hashtbl.h"
 #include "pfl/list.h"
-#include "pfl/lockedlist.h"
-#include "pfl/tree.h"
 #include "pfl/lock.h"
 #include "pfl/log.h"
 #include "pfl/pool.h"
 #include "pfl/refmgr.h"
+#include "pfl/waitq.h"
 
-SPLAY_GENERATE(pfl_objref_tree, pfl_objref, pobj_tree_entry, pfl_objref_cmp)
+/* additional pobj_flags, private to this file */
+#define POBJF_RECLAIM		(1 << 2)	/* being evicted by CLOCK */
 
-void
-pfl_refmgr_tryreclaimobj(struct psc_refmgr *prm, struct pfl_objref *pobj,
-    struct psc_dynarray *da)
+__static void
+pfl_refmgr_freeobj(struct psc_refmgr *prm, struct pfl_objref *pobj)
 {
-	struct psc_hashbkt *bkt = NULL;
-	int locked;
+	struct psc_poolmgr *m;
 
-	locked = 0; /* gcc */
+	if (prm->prm_destroyf)
+		prm->prm_destroyf(PSC_OBJREF_GETPRIVATE(prm, pobj));
+	m = psc_poolmaster_getmgr(&prm->prm_pms);
+	psc_pool_return(m, pobj);
+}
 
-	if (prm->prm_flags & PRMF_HASH) {
-		bkt = psc_hashbkt_get(&prm->prm_hashtbl, key);
-		locked = psc_hashbkt_rlock(bkt);
-	}
+/*
+ * Sweep the CLOCK rings, destroying unreferenced objects which have not
+ * been looked up since the hand last passed them.
+ * @prm: reference manager.
+ * @n: #objects desired to be reclaimed.
+ */
+int
+pfl_refmgr_reclaim(struct psc_refmgr *prm, int n)
+{
+	struct pfl_refmgr_shard *prs;
+	struct pfl_objref *pobj;
+	struct psc_hashbkt *b;
+	int i, nscan, nfreed = 0, victim;
+	uint64_t key;
+
+	for (i = 0; i < PFL_REFMGR_NSHARDS && nfreed < n; i++) {
+		prs = &prm->prm_shards[prm->prm_reclaimshard++ &
+		    (PFL_REFMGR_NSHARDS - 1)];
+		spinlock(&prs->prs_lock);
+		for (nscan = 2 * prs->prs_nobjs; nscan > 0 &&
+		    nfreed < n; nscan--) {
+			pobj = psc_listhd_first_obj(&prs->prs_clock,
+			    struct pfl_objref, pobj_lentry);
+			if (pobj == NULL)
+				break;
+			psclist_del(&pobj->pobj_lentry, &prs->prs_clock);
+			if (pobj->pobj_clockref ||
+			    psc_atomic32_read(&pobj->pobj_refcnt) ||
+			    (pobj->pobj_flags & POBJF_BUSY)) {
+				/* second chance */
+				pobj->pobj_clockref = 0;
+				psclist_add_tail(&pobj->pobj_lentry,
+				    &prs->prs_clock);
+				continue;
+			}
+			pobj->pobj_flags &= ~POBJF_ONRING;
+			pobj->pobj_flags |= POBJF_RECLAIM;
+			prs->prs_nobjs--;
+			key = pobj->pobj_key;
+			freelock(&prs->prs_lock);
+
+			/*
+			 * Recheck under the bucket lock as a lookup may
+			 * have raced with us.  If a final decref already
+			 * unhashed the object, it has left the destruction
+			 * to us.
+			 */
+			victim = 1;
+			b = psc_hashbkt_get(&prm->prm_hashtbl, &key);
+			if (pobj->pobj_hashed &&
+			    psc_atomic32_read(&pobj->pobj_refcnt) == 0) {
+				psc_hashbkt_del_item(&prm->prm_hashtbl, b,
+				    pobj);
+				pobj->pobj_hashed = 0;
+			} else if (pobj->pobj_hashed) {
+				victim = 0;
+				spinlock(&prs->prs_lock);
+				pobj->pobj_flags &= ~POBJF_RECLAIM;
+				pobj->pobj_flags |= POBJF_ONRING;
+				psclist_add_tail(&pobj->pobj_lentry,
+				    &prs->prs_clock);
+				prs->prs_nobjs++;
+				freelock(&prs->prs_lock);
+			}
+			psc_hashbkt_put(&prm->prm_hashtbl, b);
 
-	pfl_objref_lock(prm, pobj);
-	if (pobj->pobj_refcnt == 0 &&
-	    pobj->pobj_flags & (POBJF_BUSY | POBJF_DYING) == 0) {
-		pobj->pobj_flags |= POBJF_DYING;
-		if (prm->prm_flags & PRMF_LIST)
-			lc_remove(&prm->prm_list, pobj);
-		if (prm->prm_flags & PRMF_LRU)
-			lc_remove(&prm->prm_lru, pobj);
-		if (prm->prm_flags & PRMF_TREE)
-			PSC_SPLAY_XREMOVE(pfl_objref_tree,
-			    &prm->prm_tree, pobj);
-		if (prm->prm_flags & PRMF_HASH)
-			psc_hashbkt_del_item(&prm->prm_hashtbl, bkt,
-			    prm->prm_objcmpf, key);
-
-		psc_dynarray_add(da, pobj);
+			if (victim) {
+				pfl_refmgr_freeobj(prm, pobj);
+				nfreed++;
+			}
+			spinlock(&prs->prs_lock);
+		}
+		freelock(&prs->prs_lock);
 	}
-	pfl_objref_unlock(prm, pobj);
-
-	if (prm->prm_flags & PRMF_HASH)
-		psc_hashbkt_ureqlock(bkt, locked);
+	return (nfreed);
 }
 
 int
 pfl_refmgr_reclaimcb(struct psc_poolmgr *m)
 {
-	struct psc_dynarray da = DYNARRAY_INIT;
-	struct pfl_objref *pobj;
+	struct psc_refmgr *prm;
 
-	pfl_refmgr_lock_generic(prm);
-	if (prm->prm_flags & PRMF_LRU) {
-		PLC_FOREACH_BACKWARDS(pobj, &prm->prm_lru)
-			pfl_refmgr_tryreclaimobj(prm, pobj, &da);
-	} else if (prm->prm_flags & PRMF_LIST) {
-		PLC_FOREACH(pobj, &prm->prm_list)
-			pfl_refmgr_tryreclaimobj(prm, pobj, &da);
-	} else if (prm->prm_flags & PRMF_TREE) {
-		SPLAY_FOREACH(pfl_objref_tree, &prm->prm_tree, pobj)
-			pfl_refmgr_tryreclaimobj(prm, pobj, &da);
-	} else if (prm->prm_flags & PRMF_HASH) {
-		struct psc_hashbkt *bkt;
-
-		PSC_HASHTBL_FOREACH_BUCKET(bkt, &prm->prm_hashtbl) {
-			psc_hashbkt_lock(bkt);
-			PSC_HASHBKT_FOREACH_ENTRY(&prm->prm_hashtbl,
-			    pobj, bkt)
-				pfl_refmgr_tryreclaimobj(prm, pobj, &da);
-			psc_hashbkt_unlock(bkt);
-		}
-	}
-	pfl_refmgr_unlock_generic(prm);
+	prm = (void *)((char *)m->ppm_master -
+	    offsetof(struct psc_refmgr, prm_pms));
+	return (pfl_refmgr_reclaim(prm, MAX(PFL_REFMGR_RECLAIM_BATCH,
+	    psc_atomic32_read(&m->ppm_nwaiters))));
+}
 
-	psc_dynarray_free(&da);
+/*
+ * Pick a bucket count for about @n objects: a prime not too close to a
+ * power of two, as the hash table prefers.
+ */
+__static int
+pfl_refmgr_nbuckets(int n)
+{
+	double frac;
+	int i;
+
+	for (n = MAX(n, PFL_REFMGR_NBUCKETS) | 1;; n += 2) {
+		frac = log2(n) - (int)log2(n);
+		if (frac < .25 || frac > .75)
+			continue;
+		for (i = 3; i * i <= n; i += 2)
+			if (n % i == 0)
+				break;
+		if (i * i > n)
+			break;
+	}
+	return (n);
 }
 
 void
@@ -128,45 +186,16 @@ pfl_refmgr_init(struct psc_refmgr *prm, int flags, int privsiz, int nobjs,
     int min, int max, int (*initf)(struct psc_poolmgr *, void *),
     void (*destroyf)(void *), const char *namefmt, ...)
 {
-	int off = 0, pool_lentry_avail = 1;
+	struct pfl_refmgr_shard *prs;
 	va_list ap;
+	int i;
 
 	memset(prm, 0, sizeof(*prm));
 	prm->prm_flags = flags;
-
-	off = offsetof(struct pfl_objref, pobj_tree_entry);
-	if (prm->prm_flags & PRMF_TREE) {
-		off += sizeof(SPLAY_ENTRY(pfl_objref));
-
-		prm->prm_refmgrtree_offset = off;
-		off += sizeof(void *);
-	}
-	if (prm->prm_flags & PRMF_LIST) {
-		prm->prm_list_offset = offsetof(struct pfl_objref,
-		    pobj_pool_lentry);
-		pool_lentry_avail = 0;
-	}
-	if (prm->prm_flags & PRMF_LRU) {
-		if (pool_lentry_avail) {
-			prm->prm_lru_offset = offsetof(struct pfl_objref,
-			    pobj_pool_lentry);
-			pool_lentry_avail = 0;
-		} else {
-			prm->prm_lru_offset = off;
-			off += sizeof(struct psclist_head);
-		}
-	}
-	if (prm->prm_flags & PRMF_HASH) {
-		if (pool_lentry_avail) {
-			prm->prm_hash_offset = offsetof(struct pfl_objref,
-			    pobj_pool_lentry);
-			pool_lentry_avail = 0;
-		} else {
-			prm->prm_hash_offset = off;
-			off += sizeof(struct pfl_hashentry);
-		}
-	}
-	prm->prm_private_offset = off;
+	prm->prm_initf = initf;
+	prm->prm_destroyf = destroyf;
+	prm->prm_private_offset = PSC_ALIGN(sizeof(struct pfl_objref),
+	    16);
 
 	flags = 0;
 	if (prm->prm_flags & PRMF_AUTOSIZE)
@@ -177,297 +206,236 @@ pfl_refmgr_init(struct psc_refmgr *prm, int flags, int privsiz, int nobjs,
 		flags |= PPMF_MLIST;
 
 	va_start(ap, namefmt);
-	_psc_poolmaster_initv(&prm->prm_pms, off + privsiz, off, flags,
-	    nobjs, min, max, NULL,
-	    pfl_refmgr_reclaimcb, namefmt, ap);
+	_psc_poolmaster_initv(&prm->prm_pms,
+	    prm->prm_private_offset + privsiz,
+	    offsetof(struct pfl_objref, pobj_lentry), flags, nobjs, min,
+	    max, pfl_refmgr_reclaimcb, NULL, namefmt, ap);
 	va_end(ap);
 
-	if (prm->prm_flags & PRMF_LIST)
-		pll_init(&prm->prm_list, struct pfl_objref,
-		    prm->prm_list_offset);
-	if (prm->prm_flags & PRMF_LRU)
-		pll_init(&prm->prm_lru, struct pfl_objref,
-		    prm->prm_lru_offset);
-	if (prm->prm_flags & PRMF_TREE) {
-		SPLAY_INIT(&prm->prm_tree);
-		INIT_SPINLOCK(&prm->prm_trlock);
-	}
-	if (prm->prm_flags & PRMF_HASH) {
-		flags = 0;
-		if (prm->prm_flags & PRMF_HASHSTR)
-			flags |= PHTF_STR;
-
-		_psc_hashtbl_init(&prm->prm_hashtbl, flags, hashidmemboff,
-		    prm->prm_hash_offset, nbuckets, hashcmpf, "%s",
-		    prm->prm_pms->pms_name);
+	psc_hashtbl_init(&prm->prm_hashtbl, 0, struct pfl_objref,
+	    pobj_key, pobj_hentry, pfl_refmgr_nbuckets(MAX(nobjs, max)),
+	    NULL, "%s", prm->prm_pms.pms_name);
+
+	for (i = 0; i < PFL_REFMGR_NSHARDS; i++) {
+		prs = &prm->prm_shards[i];
+		INIT_SPINLOCK(&prs->prs_lock);
+		INIT_PSCLIST_HEAD(&prs->prs_clock);
+		pfl_waitq_init(&prs->prs_waitq, "refmgr");
 	}
 }
 
 /*
- * pfl_refmgr_lock - Lock a reference manager for a write operation.
+ * Tear down a reference manager.  All objects must have been released.
+ * @prm: reference manager.
  */
 void
-pfl_refmgr_lock_generic(struct psc_refmgr *prm)
+pfl_refmgr_destroy(struct psc_refmgr *prm)
 {
-	struct psc_hashbkt *b;
-
-	if (prm->prm_flags & PRMF_LIST)
-		PLL_LOCK(&prm->prm_list);
-	if (prm->prm_flags & PRMF_LRU)
-		PLL_LOCK(&prm->prm_lru);
-	if (prm->prm_flags & PRMF_TREE)
-		spinlock(&prm->prm_trlock);
-}
-
-void
-pfl_refmgr_lock4obj(struct psc_refmgr *prm, struct pfl_objref *pobj)
-{
-	struct psc_hashbkt *b;
-
-	pfl_refmgr_lock_generic(prm);
-	if (prm->prm_flags & PRMF_HASH) {
-		pfl_assert(key);
-		b = psc_hashbkt_get(&prm->prm_hashtbl, (char *)pobj +
-		    prm->prm_private_off + prm->prm_privhashidmemb_off);
-		psc_hashbkt_lock(b);
+	struct psc_poolmgr *m;
+	int i;
+
+	pfl_refmgr_reclaim(prm, INT_MAX);
+	m = psc_poolmaster_getmgr(&prm->prm_pms);
+	psc_pool_try_shrink(m, psc_pool_gettotal(m));
+	for (i = 0; i < PFL_REFMGR_NSHARDS; i++) {
+		pfl_assert(prm->prm_shards[i].prs_nobjs == 0);
+		pfl_waitq_destroy(&prm->prm_shards[i].prs_waitq);
 	}
+	psc_hashtbl_destroy(&prm->prm_hashtbl);
+	pfl_poolmaster_destroy(&prm->prm_pms);
 }
 
-void
-pfl_refmgr_lock4priv(struct psc_refmgr *prm, void *key)
-{
-	struct psc_hashbkt *b;
-
-	pfl_refmgr_lock_generic(prm);
-	if (prm->prm_flags & PRMF_HASH) {
-		pfl_assert(key);
-		b = psc_hashbkt_get(&prm->prm_hashtbl,
-		    (char *)key + prm->prm_privhashidmemb_off);
-		psc_hashbkt_lock(b);
-	}
-}
-
-void
-pfl_refmgr_unlock_generic(struct psc_refmgr *prm)
-{
-	if (prm->prm_flags & PRMF_TREE)
-		freelock(&prm->prm_trlock);
-	if (prm->prm_flags & PRMF_LRU)
-		PLL_LOCK(&prm->prm_lru);
-	if (prm->prm_flags & PRMF_LIST)
-		PLL_LOCK(&prm->prm_list);
-}
-
-void
-pfl_refmgr_unlock_specific(struct psc_refmgr *prm, void *key)
-{
-	struct psc_hashbkt *b;
-
-	if (prm->prm_flags & PRMF_HASH) {
-		pfl_assert(key);
-		b = psc_hashbkt_get(&prm->prm_hashtbl,
-		    (char *)key + prm->prm_privhashidmemb_off);
-		psc_hashtbl_lockbkt(&prm->prm_hash);
-	}
-	pfl_refmgr_unlock_generic(prm);
-}
-
-void
-pfl_objref_repos_lru(struct psc_refmgr *prm, struct pfl_objref *pobj)
+/*
+ * Wait for the creator of an object to finish setting it up.
+ */
+__static void
+pfl_refmgr_waitbusy(struct psc_refmgr *prm, struct pfl_objref *pobj)
 {
-	int locked;
+	struct pfl_refmgr_shard *prs;
 
-	if ((prm->prm_flags & PRMF_LRU) == 0)
+	if ((pobj->pobj_flags & POBJF_BUSY) == 0)
 		return;
 
-	locked = PLL_RLOCK(&prm->prm_lru);
-	if (pll_first_entry(&prm->prm_lru) != pobj) {
-		pll_remove(&prm->prm_lru, pobj);
-		pll_addhead(&prm->prm_lru, pobj);
+	prs = pfl_refmgr_getshard(prm, pobj->pobj_key);
+	spinlock(&prs->prs_lock);
+	while (pobj->pobj_flags & POBJF_BUSY) {
+		pfl_waitq_wait(&prs->prs_waitq, &prs->prs_lock);
+		spinlock(&prs->prs_lock);
 	}
-	PLL_URLOCK(&prm->prm_lru, locked);
+	freelock(&prs->prs_lock);
 }
 
+/*
+ * Look up an object and take a reference to it.
+ * @prm: reference manager.
+ * @key: object key.
+ */
 void *
-pfl_refmgr_findobj(struct psc_refmgr *prm, int pref, void *key)
+pfl_refmgr_findobj(struct psc_refmgr *prm, uint64_t key)
 {
-	struct pfl_objref q;
-	void *pobj;
-	int locked;
-
-	pfl_assert(pref == PRMF_TREE || pref == PRMF_LIST ||
-	    pref == PRMF_LRU || pref == PRMF_HASH || pref == PRMF_ANY);
-
-	if ((prm->prm_flags & pref) == PRMF_LIST) {
-		locked = PLL_RLOCK(&prm->prm_list);
-		PLL_FOREACH(pobj, &prm->prm_list)
-			if (prm->prm_objcmpf(key,
-			    pfl_objref_getpriv(prm, pobj)) == 0) {
-				pfl_objref_lock(prm, pobj);
-				break;
-			}
-		PLL_URLOCK(&prm->prm_list, locked);
-	} else if ((prm->prm_flags & pref) == PRMF_LRU) {
-		locked = PLL_RLOCK(&prm->prm_lru);
-		PLL_FOREACH(pobj, &prm->prm_)
-			if (prm->prm_objcmpf(key,
-			    pfl_objref_getpriv(prm, pobj)) == 0) {
-				pfl_objref_lock(prm, pobj);
-				break;
-			}
-		/* we must reposition on the LRU before unlocking */
-		if (pobj)
-			pfl_objref_repos_lru(prm, pobj);
-		PLL_URLOCK(&prm->prm_lru, locked);
-	} else if ((prm->prm_flags & pref) == PRMF_TREE) {
-		reqlock(&prm->prm_lock);
-		pobj = SPLAY_FIND(pfl_objref_tree, &prm->prm_tree, key);
-		if (pobj)
-			pfl_objref_lock(prm, pobj);
-		ureqlock(&prm->prm_lock, locked);
-	} else if ((prm->prm_flags & pref) == PRMF_HASH) {
-		bkt = psc_hashtbl_getbucket();
-		locked = psc_hashbkt_reqlock(&prm->prm_hash);
-		pobj = psc_hashbkt_search(&prm->prm_hashtbl, bkt,
-		    prm->prm_objcmpf, NULL,
-		    (char *)key + prm->prm_privhashidmemb_off);
-		if (pobj)
-			pfl_objref_lock(prm, pobj);
-		psc_hashbkt_ureqlock(&prm->prm_hash, locked);
-	}
-	if (pobj == NULL)
-		return (NULL);
-	pfl_objref_repos_lru(prm, pobj);
-	pobj->pobj_refcnt++;
+	struct pfl_objref *pobj;
+	struct psc_hashbkt *b;
+	void *p = NULL;
 
-	/* Wait for someone else to finish processing. */
-	while (pobj->pobj_flags & POBJF_BUSY) {
-		pfl_objref_wait(prm, pobj);
-		pfl_objref_lock(prm, pobj);
+	b = psc_hashbkt_get(&prm->prm_hashtbl, &key);
+	pobj = psc_hashbkt_search(&prm->prm_hashtbl, b, &key);
+	if (pobj) {
+		psc_atomic32_inc(&pobj->pobj_refcnt);
+		pobj->pobj_clockref = 1;
 	}
+	psc_hashbkt_put(&prm->prm_hashtbl, b);
 
-	/* Release immediately if going away. */
-	if (pobj->pobj_flags & POBJF_DYING) {
-		pobj->pobj_refcnt--;
-		pfl_objref_unlock(prm, pobj);
-		return (NULL);
+	if (pobj) {
+		pfl_refmgr_waitbusy(prm, pobj);
+		p = PSC_OBJREF_GETPRIVATE(prm, pobj);
 	}
-	pobj->pobj_flags |= POBJF_BUSY;
-	pfl_objref_unlock(prm, pobj);
-	return (PSC_OBJREF_GETPRIVATE(prm, pobj));
+	return (p);
 }
 
+/*
+ * Look up an object, creating it if it does not exist, and take a
+ * reference to it.  A newly created object is returned marked busy:
+ * other lookups wait until the creator calls pfl_obj_share() or drops
+ * its reference.
+ * @prm: reference manager.
+ * @key: object key.
+ */
 void *
-pfl_refmgr_getobj(struct psc_refmgr *prm, int pref, void *key)
+pfl_refmgr_getobj(struct psc_refmgr *prm, uint64_t key)
 {
-	struct pfl_objref *pobj;
+	struct pfl_refmgr_shard *prs;
+	struct pfl_objref *pobj, *t;
+	struct psc_poolmgr *m;
+	struct psc_hashbkt *b;
 	void *p;
 
-	p = pfl_refmgr_findobj(prm, pref, key);
+	p = pfl_refmgr_findobj(prm, key);
 	if (p)
-		return (p);
+		goto out;
 
-	m = psc_poolmaster_getmgr(prm->prm_pms);
+	m = psc_poolmaster_getmgr(&prm->prm_pms);
 	pobj = psc_pool_get(m);
-
-	/* couldn't find it; lock so we can create it */
-	pfl_refmgr_lock(prm);
-	p = pfl_refmgr_findobj(prm, pref, key);
-	if (p) {
-		pfl_refmgr_unlock(prm);
-		psc_pool_return(prm->prm_pms, pobj);
-		return (p);
+	memset(pobj, 0, m->ppm_entsize);
+#if PFL_DEBUG
+	pobj->pobj_magic = PSC_OBJ_MAGIC;
+#endif
+	pobj->pobj_key = key;
+	psc_atomic32_set(&pobj->pobj_refcnt, 1);
+	pobj->pobj_flags = POBJF_BUSY;
+	INIT_PSC_LISTENTRY(&pobj->pobj_lentry);
+	psc_hashent_init(&prm->prm_hashtbl, pobj);
+	p = PSC_OBJREF_GETPRIVATE(prm, pobj);
+	if (prm->prm_initf && prm->prm_initf(m, p)) {
+		psc_pool_return(m, pobj);
+		p = NULL;
+		goto out;
 	}
 
-	/* OK, it's ours */
-	if (prm->prm_flags & PRMF_LIST)
-		lc_add(&prm->prm_list, pobj);
-	if (prm->prm_flags & PRMF_LRU)
-		lc_add(&prm->prm_list, pobj);
-	if (prm->prm_flags & PRMF_TREE)
-		PSC_SPLAY_XINSERT(pfl_objref_tree,
-		    &prm->prm_tree, pobj);
-	if (prm->prm_flags & PRMF_HASH)
-		psc_hashtbl_add(&prm->prm_hashtbl, pobj);
-	pfl_refmgr_unlock(prm);
-	return (PSC_OBJREF_GETPRIVATE(prm, pobj));
-}
-
-int
-pfl_objref_cmp(const void *a, const void *b)
-{
-	const struct pfl_objref *x = a, *y = b;
-
-	return (CMP(x, y));
+	b = psc_hashbkt_get(&prm->prm_hashtbl, &key);
+	t = psc_hashbkt_search(&prm->prm_hashtbl, b, &key);
+	if (t) {
+		/* lost the race to create it */
+		psc_atomic32_inc(&t->pobj_refcnt);
+		t->pobj_clockref = 1;
+		psc_hashbkt_put(&prm->prm_hashtbl, b);
+
+		pfl_refmgr_freeobj(prm, pobj);
+		pfl_refmgr_waitbusy(prm, t);
+		p = PSC_OBJREF_GETPRIVATE(prm, t);
+		goto out;
+	}
+	psc_hashbkt_add_item(&prm->prm_hashtbl, b, pobj);
+	pobj->pobj_hashed = 1;
+
+	prs = pfl_refmgr_getshard(prm, key);
+	spinlock(&prs->prs_lock);
+	psclist_add_tail(&pobj->pobj_lentry, &prs->prs_clock);
+	pobj->pobj_flags |= POBJF_ONRING;
+	prs->prs_nobjs++;
+	freelock(&prs->prs_lock);
+	psc_hashbkt_put(&prm->prm_hashtbl, b);
+ out:
+	return (p);
 }
 
+/*
+ * Make a newly created object available to other lookups.
+ */
 void
 pfl_obj_share(struct psc_refmgr *prm, void *p)
 {
+	struct pfl_refmgr_shard *prs;
 	struct pfl_objref *pobj;
-	int locked;
 
 	pobj = pfl_obj_getref(prm, p);
-	locked = pfl_objref_reqlock(prm, pobj);
+	prs = pfl_refmgr_getshard(prm, pobj->pobj_key);
+	spinlock(&prs->prs_lock);
 	pobj->pobj_flags &= ~POBJF_BUSY;
-	pfl_objref_ureqlock(prm, pobj, locked);
+	pfl_waitq_wakeall(&prs->prs_waitq);
+	freelock(&prs->prs_lock);
 }
 
+/*
+ * Take an additional reference to an object the caller already holds.
+ */
 void
 pfl_obj_incref(struct psc_refmgr *prm, void *p)
 {
-	struct pfl_objref *pobj, *pp;
-	int locked;
+	struct pfl_objref *pobj;
+	int n;
 
 	pobj = pfl_obj_getref(prm, p);
-	locked = pfl_objref_reqlock(prm, pobj);
-	pobj->pobj_refcnt++;
-	pfl_objref_ureqlock(prm, pobj);
+	n = psc_atomic32_inc_getnew(&pobj->pobj_refcnt);
+	pfl_assert(n > 1);
 }
 
 void
 pfl_obj_decref(struct psc_refmgr *prm, void *p)
 {
-	struct pfl_objref *pobj, *freeobj;
-	void *pp;
-
-	freeobj = NULL;
+	struct pfl_refmgr_shard *prs;
+	struct pfl_objref *pobj;
+	struct psc_hashbkt *b;
+	int n, freeit = 0;
 
 	pobj = pfl_obj_getref(prm, p);
-	pfl_objref_lock(prm, pobj);
-	pobj->pobj_flags &= ~POBJF_BUSY;
-	if (prm->prm_flags & PRMF_LINGER ||
-	    pobj->pobj_refcnt != 1)
-		pobj->pobj_refcnt--;
-	else {
-		pfl_objref_unlock(prm, pobj);
-
-		pfl_refmgr_lock_specific(prm, pobj);
-		pfl_objref_lock(prm, pobj);
-		if (--pobj->pobj_refcnt == 0) {
-			if (prm->prm_flags & PRMF_HASH)
-				psc_hashtbl_del_item(&prm->prm_hashtbl,
-				    prm->prm_objcmpf, key);
-			if (prm->prm_flags & PRMF_TREE)
-				PSC_SPLAY_XREMOVE(pfl_objref_tree,
-				    &prm->prm_tree, pobj);
-			if (prm->prm_flags & PRMF_LRU)
-				lc_remove(&prm->prm_lru, pobj);
-			if (prm->prm_flags & PRMF_LIST)
-				lc_remove(&prm->prm_list, pobj);
-			freeobj = pobj;
-			pobj = NULL;
-		}
-		pfl_refmgr_unlock_specific(prm, pobj);
+	if (pobj->pobj_flags & POBJF_BUSY)
+		pfl_obj_share(prm, p);
 
-		if (freeobj) {
-			/* XXXXXX WRONG, save pointer and store in obj */
-			m = psc_poolmaster_getmgr(&prm->prm_pms);
-			psc_pool_return(m, freeobj);
-		}
+	if (prm->prm_flags & PRMF_LINGER) {
+		n = psc_atomic32_dec_getnew(&pobj->pobj_refcnt);
+		pfl_assert(n >= 0);
+		return;
 	}
-	if (pobj) {
-		pfl_objref_wake(prm, pobj);
-		pfl_objref_unlock(prm, pobj);
+
+	/* fast path: not the last reference */
+	for (;;) {
+		n = psc_atomic32_read(&pobj->pobj_refcnt);
+		pfl_assert(n > 0);
+		if (n == 1)
+			break;
+		if (psc_atomic32_cmpxchg(&pobj->pobj_refcnt, n,
+		    n - 1) == n)
+			return;
+	}
+
+	b = psc_hashbkt_get(&prm->prm_hashtbl, &pobj->pobj_key);
+	if (psc_atomic32_dec_getnew(&pobj->pobj_refcnt) == 0) {
+		psc_hashbkt_del_item(&prm->prm_hashtbl, b, pobj);
+		pobj->pobj_hashed = 0;
+
+		prs = pfl_refmgr_getshard(prm, pobj->pobj_key);
+		spinlock(&prs->prs_lock);
+		if (pobj->pobj_flags & POBJF_ONRING) {
+			psclist_del(&pobj->pobj_lentry, &prs->prs_clock);
+			pobj->pobj_flags &= ~POBJF_ONRING;
+			prs->prs_nobjs--;
+			freeit = 1;
+		}
+		/* else the CLOCK hand has it and will destroy it */
+		freelock(&prs->prs_lock);
 	}
+	psc_hashbkt_put(&prm->prm_hashtbl, b);
+
+	if (freeit)
+		pfl_refmgr_freeobj(prm, pobj);
 }
@@ -21,9 +21,18 @@
  * %END_LICENSE%
  */
 
+
 /*
- * A generic object reference count manager, complete with caching and
- * a variety of lookup methods.
+ * A generic object reference count manager: objects are looked up by
+ * 64-bit key, created on demand from a pool, and kept cached after
+ * their last reference goes away when PRMF_LINGER is set.
+ *
+ * Lookups are striped over the hash table's bucket locks.  Reference
+ * counts are atomic so taking or dropping an additional reference on
+ * an object already held never locks.  Cached objects are reclaimed
+ * by CLOCK (second chance): a hit merely sets a reference bit, so no
+ * list is touched on the lookup path.  The CLOCK rings are sharded by
+ * key, each under its own lock.
  */
 
 /* XXX integrate this directly into pools */
@@ -31,61 +40,52 @@
 #ifndef _PFL_REFMGR_H_
 #define _PFL_REFMGR_H_
 
+#include "pfl/atomic.h"
 #include "pfl/hashtbl.h"
-#include "pfl/lockedlist.h"
+#include "pfl/list.h"
+#include "pfl/lock.h"
 #include "pfl/pool.h"
-#include "pfl/pthrutil.h"
-#include "pfl/tree.h"
+#include "pfl/waitq.h"
 
-SPLAY_HEAD(pfl_objref_tree, pfl_objref);
+#define PFL_REFMGR_NSHARDS		16		/* must be power of two */
+#define PFL_REFMGR_RECLAIM_BATCH	32
+#define PFL_REFMGR_NBUCKETS		3067		/* minimum */
+
+struct pfl_refmgr_shard {
+	psc_spinlock_t			 prs_lock;
+	struct psclist_head		 prs_clock;	/* CLOCK ring, head is hand */
+	struct pfl_waitq		 prs_waitq;	/* waiting on POBJF_BUSY */
+	int				 prs_nobjs;
+} __aligned(64);
 
 struct psc_refmgr {
 	struct psc_poolmaster		 prm_pms;
 	int				 prm_flags;
-
-	/* object access mechanisms */
-	struct psc_lockedlist		 prm_list;
-	struct psc_lockedlist		 prm_lru;
-	struct psc_hashtbl		 prm_hashtbl;
-	struct pfl_refmgr_tree		*prm_tree;
-	psc_spinlock_t			 prm_trlock;
-
-	/* offsets into various object properties */
-	int				 prm_lock_offset;
-	int				 prm_wait_offset;
-	int				 prm_list_offset;
-	int				 prm_lru_offset;
-	int				 prm_hash_offset;
-	int				 prm_tree_offset;
-	int				 prm_refmgrtree_offset;
 	int				 prm_private_offset;
+	int				 prm_reclaimshard;	/* next to sweep */
+	struct psc_hashtbl		 prm_hashtbl;
+	struct pfl_refmgr_shard		 prm_shards[PFL_REFMGR_NSHARDS];
+	int				(*prm_initf)(struct psc_poolmgr *, void *);
+	void				(*prm_destroyf)(void *);
 };
 
 /* prm_flags */
-#define PRMF_LIST			(1 << 0)
-#define PRMF_LRU			(1 << 1)
-#define PRMF_HASH			(1 << 2)
-#define PRMF_TREE			(1 << 3)
-#define PRMF_MULTIWAIT			(1 << 4)
-#define PRMF_AUTOSIZE			(1 << 5)	/* pool is dynamically sized */
-#define PRMF_PIN			(1 << 6)	/* mlock(2) items */
-#define PRMF_HASHSTR			(1 << 7)	/* use strings as hash table keys */
-#define PRMF_LINGER			(1 << 8)	/* don't destroy unref'd objs until out of space */
-#define PRMF_MLIST			(1 << 9)	/* use mlist for pool backend */
-
-/* additional lookup preference flags */
-#define PRMF_ANY			(PRMF_LIST | PRMF_LRU | PRMF_HASH | PRMF_TREE)
+#define PRMF_AUTOSIZE			(1 << 0)	/* pool is dynamically sized */
+#define PRMF_PIN			(1 << 1)	/* mlock(2) items */
+#define PRMF_LINGER			(1 << 2)	/* don't destroy unref'd objs until out of space */
+#define PRMF_MLIST			(1 << 3)	/* use mlist for pool backend */
 
 struct pfl_objref {
 #if PFL_DEBUG
 	uint64_t			 pobj_magic;
 #endif
-	int				 pobj_refcnt;
-	int				 pobj_flags;
-	struct psclist_head		 pobj_pool_lentry;
-
-	/* this is a ghost field; it will only be there if TREE is set in refmgr */
-	SPLAY_ENTRY(pfl_objref)		 pobj_tree_entry;
+	uint64_t			 pobj_key;
+	psc_atomic32_t			 pobj_refcnt;
+	int				 pobj_flags;	/* under shard lock */
+	int				 pobj_hashed;	/* under bucket lock */
+	int				 pobj_clockref;	/* CLOCK reference bit */
+	struct psc_listentry		 pobj_lentry;	/* pool or CLOCK ring */
+	struct pfl_hashentry		 pobj_hentry;
 };
 
 #if PFL_DEBUG
@@ -99,42 +99,27 @@ struct pfl_objref {
 #endif
 
 /* pobj_flags */
-#define POBJF_DYING			(1 << 0)
-#define POBJF_BUSY			(1 << 1)
-
-#define _PSC_OBJCAST(prm, pr, field, type)				\
-	((type *)((prm)->field + (char *)(pr)))
-
-#define PSC_OBJREF_GETLOCK(m, r)	_PSC_OBJCAST(m, r, prm_lock_offset, psc_spinlock_t)
-#define PSC_OBJREF_GETMUTEX(m, r)	_PSC_OBJCAST(m, r, prm_lock_offset, pthread_mutex_t)
-#define PSC_OBJREF_GETWAITQ(m, r)	_PSC_OBJCAST(m, r, prm_wait_offset, struct pfl_waitq)
-#define PSC_OBJREF_GETMWCOND(m, r)	_PSC_OBJCAST(m, r, prm_wait_offset, struct pfl_multiwaitcond)
-#define PSC_OBJREF_GETLISTENTRY(m, r)	_PSC_OBJCAST(m, r, prm_list_offset, struct psclist_head)
-#define PSC_OBJREF_GETLRUENTRY(m, r)	_PSC_OBJCAST(m, r, prm_lru_offset, struct psclist_head)
-#define PSC_OBJREF_GETHASHENTRY(m, r)	_PSC_OBJCAST(m, r, prm_hash_offset, struct psclist_head)
-#define PSC_OBJREF_GETREFMGRTREE(m, r)	_PSC_OBJCAST(m, r, prm_refmgrtree_offset, struct psc_refmgr)
-#define PSC_OBJREF_GETPRIVATE(m, r)	_PSC_OBJCAST(m, r, prm_private_offset, void)
+#define POBJF_BUSY			(1 << 0)	/* being set up by creator */
+#define POBJF_ONRING			(1 << 1)	/* on CLOCK ring */
+
+#define PSC_OBJREF_GETPRIVATE(m, r)					\
+	((void *)((m)->prm_private_offset + (char *)(r)))
+
+#define pfl_refmgr_getshard(prm, key)					\
+	(&(prm)->prm_shards[(key) & (PFL_REFMGR_NSHARDS - 1)])
 
 void	 pfl_refmgr_init(struct psc_refmgr *, int, int, int, int, int,
 	    int (*)(struct psc_poolmgr *, void *), void (*)(void *),
 	    const char *, ...);
+void	 pfl_refmgr_destroy(struct psc_refmgr *);
 
-void	*_pfl_refmgr_findobj(struct psc_refmgr *, int, void *, int);
-void	*pfl_refmgr_getobj(struct psc_refmgr *, int, void *);
-
-#define pfl_refmgr_findremoveobj(prm, pref, key)			\
-	pfl_refmgr_findobj((prm), (pref), (key), 1)
-
-#define pfl_refmgr_findobj(prm, pref, key)				\
-	pfl_refmgr_findobj((prm), (pref), (key), 0)
-
-int	 pfl_objref_cmp(const void *, const void *);
+void	*pfl_refmgr_findobj(struct psc_refmgr *, uint64_t);
+void	*pfl_refmgr_getobj(struct psc_refmgr *, uint64_t);
+int	 pfl_refmgr_reclaim(struct psc_refmgr *, int);
 
-void	 pfl_obj_share(struct psc_refmgr *prm, void *);
-void	 pfl_obj_incref(struct psc_refmgr *prm, void *);
-void	 pfl_obj_decref(struct psc_refmgr *prm, void *);
-
-void	 pfl_obj_dump(const struct psc_refmgr *prm, const void *);
+void	 pfl_obj_share(struct psc_refmgr *, void *);
+void	 pfl_obj_incref(struct psc_refmgr *, void *);
+void	 pfl_obj_decref(struct psc_refmgr *, void *);
 
 static __inline struct pfl_objref *
 pfl_obj_getref(const struct psc_refmgr *prm, void *p)
@@ -147,73 +132,10 @@ pfl_obj_getref(const struct psc_refmgr *prm, void *p)
 	return (pobj);
 }
 
-static __inline void
-pfl_objref_lock(const struct psc_refmgr *prm, struct pfl_objref *pobj)
+static __inline uint64_t
+pfl_obj_getkey(const struct psc_refmgr *prm, void *p)
 {
-	if (prm->prm_flags & PRMF_MULTIWAIT)
-		psc_pthread_mutex_lock(PSC_OBJREF_GETMUTEX(prm, pobj));
-	else
-		spinlock(PSC_OBJREF_GETLOCK(prm, pobj));
+	return (pfl_obj_getref(prm, p)->pobj_key);
 }
 
-static __inline void
-pfl_objref_unlock(const struct psc_refmgr *prm, struct pfl_objref *pobj)
-{
-	if (prm->prm_flags & PRMF_MULTIWAIT)
-		psc_pthread_mutex_unlock(PSC_OBJREF_GETMUTEX(prm, pobj));
-	else
-		freelock(PSC_OBJREF_GETLOCK(prm, pobj));
-}
-
-static __inline int
-pfl_objref_reqlock(const struct psc_refmgr *prm, struct pfl_objref *pobj)
-{
-	if (prm->prm_flags & PRMF_MULTIWAIT)
-		return (psc_pthread_mutex_reqlock(
-		    PSC_OBJREF_GETMUTEX(prm, pobj)));
-	return (reqlock(PSC_OBJREF_GETLOCK(prm, pobj)));
-}
-
-static __inline void
-pfl_objref_ureqlock(const struct psc_refmgr *prm,
-    struct pfl_objref *pobj, int locked)
-{
-	if (prm->prm_flags & PRMF_MULTIWAIT)
-		psc_pthread_mutex_ureqlock(
-		    PSC_OBJREF_GETMUTEX(prm, pobj), locked);
-	else
-		ureqlock(PSC_OBJREF_GETLOCK(prm, pobj), locked);
-}
-
-static __inline void
-pfl_objref_wait(const struct psc_refmgr *prm, struct pfl_objref *pobj)
-{
-	int waslocked;
-
-	waslocked = pfl_objref_reqlock(prm, pobj);
-	if (prm->prm_flags & PRMF_MULTIWAIT)
-		pfl_multiwaitcond_wait(PSC_OBJREF_GETMWCOND(prm, pobj),
-		    PSC_OBJREF_GETMUTEX(prm, pobj));
-	else
-		pfl_waitq_wait(PSC_OBJREF_GETWAITQ(prm, pobj),
-		    PSC_OBJREF_GETLOCK(prm, pobj));
-	if (waslocked)
-		pfl_objref_lock(prm, pobj);
-}
-
-static __inline void
-pfl_objref_wake(const struct psc_refmgr *prm, struct pfl_objref *pobj)
-{
-	int locked;
-
-	locked = pfl_objref_reqlock(prm, pobj);
-	if (prm->prm_flags & PRMF_MULTIWAIT)
-		pfl_multiwaitcond_wakeup(PSC_OBJREF_GETMWCOND(prm, pobj));
-	else
-		pfl_waitq_wakeall(PSC_OBJREF_GETWAITQ(prm, pobj));
-	pfl_objref_ureqlock(prm, pobj, locked);
-}
-
-SPLAY_PROTOTYPE(pfl_objref_tree, pfl_objref, pobj_tree_entry, pfl_objref_cmp);
-
 #endif /* _PFL_REFMGR_H_ */
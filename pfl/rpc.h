@@ -35,6 +35,7 @@
 #include "lnet/api.h"
 #include "lnet/types.h"
 
+#include "pfl/arena.h"
 #include "pfl/atomic.h"
 #include "pfl/completion.h"
 #include "pfl/hashtbl.h"
@@ -44,12 +45,14 @@
 #include "pfl/lockedlist.h"
 #include "pfl/pool.h"
 #include "pfl/rpc_intrfc.h"
+#include "pfl/service.h"
 #include "pfl/thread.h"
 #include "pfl/types.h"
 #include "pfl/waitq.h"
 
 struct psc_dynarray;
 struct psc_ctlop;
+struct pfl_histogram;
 
 #define PSCRPC_MD_OPTIONS		0
 
@@ -280,6 +283,7 @@ struct pscrpc_bulk_desc {
 	int				 bd_nob_transferred;	/* # bytes GOT/PUT	  */
 	uint64_t			 bd_last_xid;		/* track xid for retry	  */
 	uint32_t			 bd_portal;		/* which portal		  */
+	struct timeval			 bd_start;		/* server: transfer start */
 	struct pscrpc_cb_id		 bd_cbid;		/* network callback info  */
 	lnet_handle_md_t		 bd_md_h;		/* associated MD	  */
 	lnet_md_iovec_t			 bd_iov[0];		/* must be last		  */
@@ -371,6 +375,7 @@ struct pscrpc_request {
 	int				(*rq_interpret_reply)(struct pscrpc_request *,
 					    struct pscrpc_async_args *);
 	struct pscrpc_async_args	 rq_async_args;		/* async completion context */
+	struct pfl_arena		 rq_arena;		/* scratch memory freed with request */
 	lnet_handle_md_t		 rq_req_md_h;
 	struct psc_compl		*rq_compl;
 	struct pfl_waitq		*rq_waitq;		/* completion notification for others */
@@ -388,6 +393,33 @@ struct pscrpc_request {
 typedef int (*svc_handler_t)(struct pscrpc_request *);
 
 /* Server side request management */
+#define PSCRPC_SVC_NOPC		128	/* opcodes with latency accounting */
+#define PSCRPC_OPWIN_SECS	60	/* span of "recent" opcode latency */
+#define PSCRPC_OPWIN_NSAMP	7	/* window samples, PSCRPC_OPWIN_SECS / 6 apart */
+
+/* cumulative queue + handle latency of an opcode at some time */
+struct pscrpc_opwin_samp {
+	time_t			 pows_time;
+	uint64_t		 pows_count;
+	uint64_t		 pows_sum;		/* usec */
+};
+
+/*
+ * Per-opcode service latency, broken down by phase (PSCRPC_OPPH_*).
+ * Recording is into per-thread histogram shards; samples of the
+ * running totals, taken at most every PSCRPC_OPWIN_SECS / 6 seconds
+ * as requests are handled, let the last minute be reported apart from
+ * the lifetime of the service.
+ */
+struct pscrpc_svc_opstats {
+	uint32_t		 pso_opc;
+	struct pfl_histogram	*pso_histo[PSCRPC_NOPPH];	/* in usec */
+	psc_spinlock_t		 pso_lock;		/* protects below */
+	time_t			 pso_nextsamp;
+	int			 pso_sampidx;
+	struct pscrpc_opwin_samp pso_samp[PSCRPC_OPWIN_NSAMP];
+};
+
 struct pscrpc_service {
 	int			 srv_max_req_size;	/* max request sz to recv  */
 	int			 srv_max_reply_size;	/* biggest reply to send   */
@@ -424,6 +456,9 @@ struct pscrpc_service {
 
 	struct psc_poolmaster	 srv_poolmaster;
 	struct psc_poolmgr	*srv_pool;
+	struct pfl_histogram	*srv_histo_handle;	/* handler latency, in usec */
+	struct pscrpc_svc_opstats
+				*srv_opstats[PSCRPC_SVC_NOPC];	/* by opcode */
 
 	/*
 	 * All threads sleep on this waitq, signalled when new incoming
@@ -479,6 +514,8 @@ struct pscrpc_reply_state {
 	lnet_handle_md_t		 rs_md_h;
 	struct psc_compl		*rs_compl;
 	struct pscrpc_service		*rs_service;		/* backpointer to my service */
+	struct timeval			 rs_sendtime;		/* for reply latency */
+	uint32_t			 rs_opc;
 	struct pscrpc_msg		 rs_msg;		/* msg struct -- MUST BE LAST MEMBER */
 };
 
@@ -619,6 +656,9 @@ pscrpc_bulk_active(struct pscrpc_bulk_desc *desc)
 /* service.c */
 int	 pscrpc_target_send_reply_msg(struct pscrpc_request *, int, int);
 void	 pscrpc_fail_import(struct pscrpc_import *, uint32_t);
+struct pscrpc_svc_opstats *
+	 pscrpc_svc_getopstats(struct pscrpc_service *, uint32_t);
+void	 pscrpc_svc_oprecord(struct pscrpc_service *, uint32_t, int, long);
 
 void	 pflrpc_register_ctlops(struct psc_ctlop *);
 
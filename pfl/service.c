@@ -25,8 +25,12 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "pfl/alloc.h"
+#include "pfl/arena.h"
 #include "pfl/atomic.h"
 #include "pfl/cdefs.h"
 #include "pfl/ctl.h"
@@ -40,6 +44,7 @@
 #include "pfl/rpclog.h"
 #include "pfl/service.h"
 #include "pfl/str.h"
+#include "pfl/trace.h"
 #include "pfl/waitq.h"
 
 static int test_req_buffer_pressure;
@@ -188,6 +193,7 @@ _pscrpc_server_free_request(struct pscrpc_request *req)
 		pscrpc_put_connection(req->rq_conn);
 	req->rq_conn = NULL;
 
+	pfl_arena_reset(&req->rq_arena);
 	pll_remove(&pscrpc_requests, req);
 	if (req != &rqbd->rqbd_req) {
 		/*
@@ -207,6 +213,12 @@ pscrpc_server_free_request(struct pscrpc_request *req)
 	struct pscrpc_request *nxt;
 	int refcount;
 
+	/*
+	 * The handler is done with the request; release its scratch
+	 * memory now rather than when the request leaves the history.
+	 */
+	pfl_arena_reset(&req->rq_arena);
+
 	SVC_LOCK(svc);
 
 	svc->srv_n_active_reqs--;
@@ -265,6 +277,101 @@ pscrpc_server_free_request(struct pscrpc_request *req)
 	SVC_ULOCK(svc);
 }
 
+static const char *pscrpc_opph_names[] = {
+	"queue",
+	"handle",
+	"reply",
+	"bulk"
+};
+
+/*
+ * Get the latency accounting of an opcode of a service, setting it up
+ * on first use.
+ * @svc: RPC service.
+ * @opc: request opcode.
+ * Returns NULL for opcodes not accounted.
+ */
+struct pscrpc_svc_opstats *
+pscrpc_svc_getopstats(struct pscrpc_service *svc, uint32_t opc)
+{
+	struct pscrpc_svc_opstats *pso;
+	int i;
+
+	if (opc >= PSCRPC_SVC_NOPC)
+		return (NULL);
+	pso = svc->srv_opstats[opc];
+	if (pso)
+		return (pso);
+
+	SVC_LOCK(svc);
+	pso = svc->srv_opstats[opc];
+	if (pso == NULL) {
+		pso = PSCALLOC(sizeof(*pso));
+		pso->pso_opc = opc;
+		INIT_SPINLOCK(&pso->pso_lock);
+		for (i = 0; i < PSCRPC_NOPPH; i++)
+			pso->pso_histo[i] = pfl_histogram_init(
+			    "rpc.%s.op%u.%s-usec", svc->srv_name, opc,
+			    pscrpc_opph_names[i]);
+		svc->srv_opstats[opc] = pso;
+	}
+	SVC_ULOCK(svc);
+	return (pso);
+}
+
+/*
+ * Account time spent in one phase of servicing a request.
+ * @svc: RPC service.
+ * @opc: request opcode.
+ * @phase: PSCRPC_OPPH_* value.
+ * @usec: duration.
+ */
+void
+pscrpc_svc_oprecord(struct pscrpc_service *svc, uint32_t opc,
+    int phase, long usec)
+{
+	struct pscrpc_svc_opstats *pso;
+
+	pso = pscrpc_svc_getopstats(svc, opc);
+	if (pso)
+		pfl_histogram_record(pso->pso_histo[phase],
+		    usec < 0 ? 0 : usec);
+}
+
+/*
+ * Record the running queue + handle latency totals of an opcode if
+ * the last sample is old enough.
+ */
+__static void
+pscrpc_svc_opsample(struct pscrpc_svc_opstats *pso, time_t now)
+{
+	struct pscrpc_opwin_samp *pows;
+	struct pfl_histogram_snap phs;
+
+	if (!trylock(&pso->pso_lock))
+		return;
+	if (now >= pso->pso_nextsamp) {
+		pows = &pso->pso_samp[pso->pso_sampidx];
+		pso->pso_sampidx = (pso->pso_sampidx + 1) %
+		    PSCRPC_OPWIN_NSAMP;
+		pso->pso_nextsamp = now + PSCRPC_OPWIN_SECS /
+		    (PSCRPC_OPWIN_NSAMP - 1);
+
+		pfl_histogram_snapshot(
+		    pso->pso_histo[PSCRPC_OPPH_HANDLE], &phs);
+		pows->pows_time = now;
+		pows->pows_count = phs.phs_count;
+		pows->pows_sum = phs.phs_sum;
+		pfl_histogram_snap_free(&phs);
+
+		pfl_histogram_snapshot(
+		    pso->pso_histo[PSCRPC_OPPH_QUEUE], &phs);
+		pows->pows_sum += phs.phs_sum;
+		pfl_histogram_snap_free(&phs);
+	}
+	freelock(&pso->pso_lock);
+}
+
 static int
 pscrpc_server_handle_request(struct pscrpc_service *svc,
 			     struct psc_thread     *thread)
@@ -302,6 +409,7 @@ pscrpc_server_handle_request(struct pscrpc_service *svc,
 
 	SVC_ULOCK(svc);
 
+	PFL_TRACE_END(PSS_RPC, "rpc.queued", (uintptr_t)request);
 	do_gettimeofday(&work_start);
 	timediff = cfs_timeval_sub(&work_start,
 				   &request->rq_arrival_time, NULL);
@@ -393,7 +501,9 @@ pscrpc_server_handle_request(struct pscrpc_service *svc,
  	 * 07/07/2017: We have already registered the connection into the
  	 * pscrpc_conn_hashtbl hash table before handling the RPC.
  	 */
+	PFL_TRACE_BEGIN(PSS_RPC, "rpc.handle", 0);
 	rc = svc->srv_handler(request);
+	PFL_TRACE_END(PSS_RPC, "rpc.handle", 0);
 
 	request->rq_phase = PSCRPC_RQ_PHASE_COMPLETE;
 
@@ -435,6 +545,24 @@ pscrpc_server_handle_request(struct pscrpc_service *svc,
 	}
 
 	timediff = cfs_timeval_sub(&work_end, &work_start, NULL);
+	pfl_histogram_record(svc->srv_histo_handle, timediff);
+
+	if (request->rq_phase == PSCRPC_RQ_PHASE_COMPLETE) {
+		struct pscrpc_svc_opstats *pso;
+
+		pso = pscrpc_svc_getopstats(svc,
+		    request->rq_reqmsg->opc);
+		if (pso) {
+			pfl_histogram_record(
+			    pso->pso_histo[PSCRPC_OPPH_QUEUE],
+			    cfs_timeval_sub(&work_start,
+			      &request->rq_arrival_time, NULL));
+			pfl_histogram_record(
+			    pso->pso_histo[PSCRPC_OPPH_HANDLE], timediff);
+			if (work_end.tv_sec >= pso->pso_nextsamp)
+				pscrpc_svc_opsample(pso, work_end.tv_sec);
+		}
+	}
 
 	if (timediff / 1000000 > pfl_rpc_timeout)
 		DEBUG_REQ(PLL_ERROR, request, buf,
@@ -796,7 +924,7 @@ pscrpc_unregister_service(struct pscrpc_service *svc)
 	struct pscrpc_request_buffer_desc *rqbd;
 	struct pscrpc_reply_state *rs, *t;
 	struct l_wait_info lwi;
-	int rc;
+	int rc, i;
 
 	LASSERT(psc_listhd_empty(&svc->srv_threads));
 
@@ -914,6 +1042,17 @@ pscrpc_unregister_service(struct pscrpc_service *svc)
 		PSCRPC_OBD_FREE(rs, svc->srv_max_reply_size);
 	}
 
+	for (i = 0; i < PSCRPC_SVC_NOPC; i++) {
+		struct pscrpc_svc_opstats *pso;
+
+		pso = svc->srv_opstats[i];
+		if (pso == NULL)
+			continue;
+		for (rc = 0; rc < PSCRPC_NOPPH; rc++)
+			pfl_histogram_destroy(pso->pso_histo[rc]);
+		PSCFREE(pso);
+	}
+
 	pfl_poolmaster_destroy(&svc->srv_poolmaster);
 	psc_mutex_destroy(&svc->srv_mutex);
 	pfl_waitq_destroy(&svc->srv_waitq);
@@ -994,6 +1133,8 @@ pscrpc_init_svc(int nbufs, int bufsize, int max_req_size,
 	    64, 64, 0, NULL, "rqbd-%s", svc->srv_name);
 	svc->srv_pool = psc_poolmaster_getmgr(
 	    &svc->srv_poolmaster);
+	svc->srv_histo_handle = pfl_histogram_init("rpc.%s.handle-usec",
+	    svc->srv_name);
 
 	/* Now allocate the request buffers */
 	rc = pscrpc_grow_req_bufs(svc);
@@ -1157,6 +1298,130 @@ psc_ctlrep_getrpcsvc(int fd, struct psc_ctlmsghdr *mh, void *m)
 	return (rc);
 }
 
+/*
+ * Fill in the latency breakdown of an opcode for a control inquiry.
+ */
+__static void
+pscrpc_svc_opfill(struct pscrpc_svc_opstats *pso, time_t now,
+    struct psc_ctlmsg_rpcop *pcro)
+{
+	struct pscrpc_opwin_samp *pows, *base = NULL;
+	struct pfl_histogram_snap phs;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < PSCRPC_NOPPH; i++) {
+		pfl_histogram_snapshot(pso->pso_histo[i], &phs);
+		pcro->pcro_count[i] = phs.phs_count;
+		pcro->pcro_mean[i] = phs.phs_count ?
+		    phs.phs_sum / phs.phs_count : 0;
+		pcro->pcro_p99[i] = pfl_histogram_snap_percentile(&phs,
+		    99);
+		if (i == PSCRPC_OPPH_QUEUE || i == PSCRPC_OPPH_HANDLE)
+			sum += phs.phs_sum;
+		pfl_histogram_snap_free(&phs);
+	}
+
+	/*
+	 * Measure from the newest sample at least a window old or,
+	 * failing that, the oldest one.
+	 */
+	spinlock(&pso->pso_lock);
+	for (i = 0; i < PSCRPC_OPWIN_NSAMP; i++) {
+		pows = &pso->pso_samp[i];
+		if (pows->pows_time == 0 ||
+		    pows->pows_time > now - PSCRPC_OPWIN_SECS)
+			continue;
+		if (base == NULL || pows->pows_time > base->pows_time)
+			base = pows;
+	}
+	if (base == NULL)
+		for (i = 0; i < PSCRPC_OPWIN_NSAMP; i++) {
+			pows = &pso->pso_samp[i];
+			if (pows->pows_time &&
+			    (base == NULL ||
+			     pows->pows_time < base->pows_time))
+				base = pows;
+		}
+	if (base) {
+		pcro->pcro_wincount = pcro->pcro_count[
+		    PSCRPC_OPPH_HANDLE] - base->pows_count;
+		pcro->pcro_winmean = pcro->pcro_wincount ?
+		    (sum - base->pows_sum) / pcro->pcro_wincount : 0;
+		pcro->pcro_winsecs = now - base->pows_time;
+	}
+	freelock(&pso->pso_lock);
+
+	pscrpc_svc_opsample(pso, now);
+}
+
+__static int
+pscrpc_svc_opcmp(const void *a, const void *b)
+{
+	const struct psc_ctlmsg_rpcop *x = a, *y = b;
+
+	return (CMP(y->pcro_winmean, x->pcro_winmean));
+}
+
+/*
+ * Respond to a "GETRPCOP" control inquiry with the latency breakdown
+ * of each opcode of each (or the named) RPC service.  If a number of
+ * opcodes is given, only that many of the slowest over the last
+ * minute are sent, slowest first.
+ * @fd: client socket descriptor.
+ * @mh: already filled-in control message header.
+ * @m: control message to be filled in and sent out.
+ */
+int
+psc_ctlrep_getrpcop(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct psc_ctlmsg_rpcop *pcro = m, *rows = NULL, *r;
+	char name[PSCRPC_SVCNAME_MAX];
+	struct pscrpc_svc_opstats *pso;
+	struct pscrpc_service *s;
+	int rc = 1, found = 0, topn, n = 0, i;
+	time_t now;
+
+	strlcpy(name, pcro->pcro_svcname, sizeof(name));
+	topn = pcro->pcro_topn;
+	now = time(NULL);
+
+	spinlock(&pscrpc_all_services_lock);
+	psclist_for_each_entry(s, &pscrpc_all_services, srv_lentry) {
+		if (name[0] && strcmp(name, s->srv_name))
+			continue;
+		found = 1;
+		for (i = 0; i < PSCRPC_SVC_NOPC; i++) {
+			pso = s->srv_opstats[i];
+			if (pso == NULL)
+				continue;
+			rows = PSC_REALLOC(rows, (n + 1) * sizeof(*rows));
+			r = &rows[n++];
+			memset(r, 0, sizeof(*r));
+			strlcpy(r->pcro_svcname, s->srv_name,
+			    sizeof(r->pcro_svcname));
+			r->pcro_opc = pso->pso_opc;
+			pscrpc_svc_opfill(pso, now, r);
+		}
+	}
+	freelock(&pscrpc_all_services_lock);
+
+	if (topn > 0)
+		qsort(rows, n, sizeof(*rows), pscrpc_svc_opcmp);
+	for (i = 0, r = rows; i < n; i++, r++) {
+		if (topn > 0 && (i >= topn || r->pcro_wincount == 0))
+			break;
+		rc = psc_ctlmsg_sendv(fd, mh, r, NULL);
+		if (!rc)
+			break;
+	}
+	if (rc && !found && name[0])
+		rc = psc_ctlsenderr(fd, mh, NULL,
+		    "unknown RPC service: %s", name);
+	PSCFREE(rows);
+	return (rc);
+}
+
 void
 pflrpc_register_ctlops(struct psc_ctlop *ops)
 {
@@ -1166,6 +1431,10 @@ pflrpc_register_ctlops(struct psc_ctlop *ops)
 	op->pc_op = psc_ctlrep_getlnetif;
 	op->pc_siz = sizeof(struct psc_ctlmsg_lnetif);
 
+	op = &ops[PCMT_GETRPCOP];
+	op->pc_op = psc_ctlrep_getrpcop;
+	op->pc_siz = sizeof(struct psc_ctlmsg_rpcop);
+
 	op = &ops[PCMT_GETRPCRQ];
 	op->pc_op = psc_ctlrep_getrpcrq;
 	op->pc_siz = sizeof(struct psc_ctlmsg_rpcrq);
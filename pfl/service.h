@@ -55,6 +55,15 @@ struct pscrpc_svc_handle {
 
 #define PSCRPC_SVCF_COUNT_PEER_QLENS	(1 << 0)
 
+/* phases of request service with per-opcode latency accounting */
+enum {
+	PSCRPC_OPPH_QUEUE,		/* arrival until handler dispatch */
+	PSCRPC_OPPH_HANDLE,		/* handler run time */
+	PSCRPC_OPPH_REPLY,		/* reply send until network is done */
+	PSCRPC_OPPH_BULK,		/* server-initiated bulk transfer */
+	PSCRPC_NOPPH
+};
+
 struct pscrpc_thread {
 	struct pscrpc_svc_handle *prt_svh;
 	struct psclist_head	  prt_lentry;	/* link among thrs in service */
@@ -0,0 +1,261 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pfl/alloc.h"
+#include "pfl/atomic.h"
+#include "pfl/cdefs.h"
+#include "pfl/list.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/shlistcache.h"
+#include "pfl/str.h"
+#include "pfl/sys.h"
+#include "pfl/waitq.h"
+
+/* shard a thread prefers for adding and starts scanning from */
+__threadx int		 pfl_shlc_home = -1;
+psc_atomic32_t		 pfl_shlc_homerotor;
+
+#define SHLC_LENTRY(lc, p)	((struct psc_listentry *)((char *)(p) +	\
+				    (lc)->pshlc_offset))
+#define SHLC_ITEM(lc, e)	((void *)((char *)(e) - (lc)->pshlc_offset))
+
+__static struct pfl_shlistcache_shard *
+shlc_homeshard(struct pfl_shlistcache *lc)
+{
+	if (pfl_shlc_home == -1)
+		pfl_shlc_home = psc_atomic32_inc_getnew(
+		    &pfl_shlc_homerotor) & 0x7fffffff;
+	return (&lc->pshlc_shards[pfl_shlc_home % lc->pshlc_nshards]);
+}
+
+/*
+ * Wake up to a number of sleeping consumers.
+ * @lc: list cache.
+ * @n: maximum number of consumers that could make progress.
+ */
+__static void
+shlc_wake(struct pfl_shlistcache *lc, int n)
+{
+	spinlock(&lc->pshlc_lock);
+	if (lc->pshlc_nwaiters <= n) {
+		if (lc->pshlc_nwaiters)
+			pfl_waitq_wakeall(&lc->pshlc_wq);
+	} else
+		while (n--)
+			pfl_waitq_wakeone(&lc->pshlc_wq);
+	freelock(&lc->pshlc_lock);
+}
+
+/*
+ * Add items to a sharded list cache.  All items go onto the calling
+ * thread's home shard under a single lock acquisition.
+ * @lc: list cache.
+ * @pv: items to add, in order.
+ * @n: number of items.
+ * Returns zero if the list is dying and nothing was added.
+ */
+int
+_shlc_addv(struct pfl_shlistcache *lc, void **pv, int n)
+{
+	struct pfl_shlistcache_shard *s;
+	int32_t old;
+	int i;
+
+	if (lc->pshlc_flags & PSHLCF_DYING)
+		return (0);
+
+	s = shlc_homeshard(lc);
+	spinlock(&s->pshs_lock);
+	for (i = 0; i < n; i++)
+		psclist_add_tail(SHLC_LENTRY(lc, pv[i]), &s->pshs_listhd);
+	s->pshs_nitems += n;
+	freelock(&s->pshs_lock);
+
+	/* Consumers only need a wakeup when we leave the empty state. */
+	old = psc_atomic32_add_getnew(&lc->pshlc_nitems, n) - n;
+	if (old <= 0)
+		shlc_wake(lc, n);
+	return (1);
+}
+
+/*
+ * Take up to @n items from the shards, starting at the home shard.
+ */
+__static int
+shlc_take(struct pfl_shlistcache *lc, void **pv, int n)
+{
+	struct pfl_shlistcache_shard *s, *home;
+	struct psc_listentry *e;
+	int i, got = 0;
+
+	home = shlc_homeshard(lc);
+	for (i = 0; i < lc->pshlc_nshards && got < n; i++) {
+		s = &lc->pshlc_shards[(home - lc->pshlc_shards + i) %
+		    lc->pshlc_nshards];
+		if (s->pshs_nitems == 0)
+			continue;
+		spinlock(&s->pshs_lock);
+		while (got < n &&
+		    (e = psc_listhd_first(&s->pshs_listhd)) !=
+		    &s->pshs_listhd) {
+			psclist_del(e, &s->pshs_listhd);
+			pv[got++] = SHLC_ITEM(lc, e);
+			s->pshs_nitems--;
+		}
+		freelock(&s->pshs_lock);
+	}
+	if (got == 0)
+		return (0);
+
+	/* Pass the wakeup along if items remain for other sleepers. */
+	if (psc_atomic32_sub_getnew(&lc->pshlc_nitems, got) > 0 &&
+	    lc->pshlc_nwaiters)
+		shlc_wake(lc, 1);
+	return (got);
+}
+
+/*
+ * Take up to a number of items from a sharded list cache.  Blocks,
+ * unless PSHLCBF_NOBLOCK is specified, until at least one is available.
+ * @lc: list cache.
+ * @pv: array to fill with items.
+ * @n: capacity of @pv.
+ * @abstime: optional absolute time to give up waiting at.
+ * @flags: PSHLCBF_* behavior flags.
+ * Returns the number of items taken.
+ */
+int
+_shlc_getn(struct pfl_shlistcache *lc, void **pv, int n,
+    const struct timespec *abstime, int flags)
+{
+	int got, rc;
+
+	for (;;) {
+		got = shlc_take(lc, pv, n);
+		if (got)
+			break;
+
+		/* Items are in flight between a shard and the count. */
+		if (shlc_nitems(lc) > 0)
+			continue;
+
+		if ((lc->pshlc_flags & PSHLCF_DYING) ||
+		    (flags & PSHLCBF_NOBLOCK))
+			break;
+
+		spinlock(&lc->pshlc_lock);
+		if (shlc_nitems(lc) > 0 ||
+		    (lc->pshlc_flags & PSHLCF_DYING)) {
+			freelock(&lc->pshlc_lock);
+			continue;
+		}
+		lc->pshlc_nwaiters++;
+		rc = pfl_waitq_waitabs(&lc->pshlc_wq, &lc->pshlc_lock,
+		    abstime);
+		spinlock(&lc->pshlc_lock);
+		lc->pshlc_nwaiters--;
+		freelock(&lc->pshlc_lock);
+		if (rc) {
+			pfl_assert(rc == ETIMEDOUT);
+
+			/*
+			 * A wakeup may have been delivered to us as we
+			 * timed out; take what is there or pass it on.
+			 */
+			got = shlc_take(lc, pv, n);
+			if (got == 0) {
+				if (shlc_nitems(lc) > 0)
+					shlc_wake(lc, 1);
+				errno = rc;
+			}
+			break;
+		}
+	}
+	return (got);
+}
+
+void *
+_shlc_get(struct pfl_shlistcache *lc, const struct timespec *abstime,
+    int flags)
+{
+	void *p;
+
+	if (_shlc_getn(lc, &p, 1, abstime, flags))
+		return (p);
+	return (NULL);
+}
+
+/*
+ * List wants to go away; notify waiters.
+ * @lc: list cache to kill.
+ */
+void
+shlc_kill(struct pfl_shlistcache *lc)
+{
+	spinlock(&lc->pshlc_lock);
+	lc->pshlc_flags |= PSHLCF_DYING;
+	pfl_waitq_wakeall(&lc->pshlc_wq);
+	freelock(&lc->pshlc_lock);
+}
+
+/*
+ * Initialize a sharded list cache.
+ * @lc: list cache.
+ * @name: name for waitq and diagnostics.
+ * @offset: offset of the psc_listentry within items.
+ * @nshards: number of shards or zero for one per processor.
+ */
+void
+_shlc_init(struct pfl_shlistcache *lc, const char *name,
+    ptrdiff_t offset, int nshards)
+{
+	int i;
+
+	if (nshards <= 0)
+		nshards = pfl_getnprocessors();
+
+	memset(lc, 0, sizeof(*lc));
+	lc->pshlc_shards = psc_alloc(nshards *
+	    sizeof(*lc->pshlc_shards), PAF_PAGEALIGN);
+	for (i = 0; i < nshards; i++) {
+		INIT_SPINLOCK(&lc->pshlc_shards[i].pshs_lock);
+		INIT_PSCLIST_HEAD(&lc->pshlc_shards[i].pshs_listhd);
+	}
+	lc->pshlc_nshards = nshards;
+	lc->pshlc_offset = offset;
+	INIT_SPINLOCK(&lc->pshlc_lock);
+	pfl_waitq_init(&lc->pshlc_wq, name);
+	strlcpy(lc->pshlc_name, name, sizeof(lc->pshlc_name));
+}
+
+void
+shlc_destroy(struct pfl_shlistcache *lc)
+{
+	pfl_waitq_destroy(&lc->pshlc_wq);
+	psc_free(lc->pshlc_shards, PAF_PAGEALIGN);
+}
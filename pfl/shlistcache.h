@@ -0,0 +1,104 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Sharded list caches are multi-producer, multi-consumer queues
+ * offering the producer/consumer subset of the list cache API.  Items
+ * are spread across independently locked shards so that unrelated
+ * producers and consumers rarely contend.  Ordering is FIFO within a
+ * shard only.  Consumers sleep only when every shard is empty and are
+ * woken when the cache goes from empty to non-empty.
+ */
+
+#ifndef _PFL_SHLISTCACHE_H_
+#define _PFL_SHLISTCACHE_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#include "pfl/atomic.h"
+#include "pfl/list.h"
+#include "pfl/lock.h"
+#include "pfl/waitq.h"
+
+#define PFL_SHLC_NAME_MAX	32
+
+struct pfl_shlistcache_shard {
+	struct psc_spinlock	 pshs_lock;
+	struct psclist_head	 pshs_listhd;
+	int			 pshs_nitems;
+} __aligned(64);
+
+struct pfl_shlistcache {
+	struct pfl_shlistcache_shard
+				*pshlc_shards;
+	int			 pshlc_nshards;
+	int			 pshlc_flags;
+	ptrdiff_t		 pshlc_offset;	/* of psc_listentry in items */
+	psc_atomic32_t		 pshlc_nitems;
+	psc_atomic32_t		 pshlc_rr;	/* producer shard rotor */
+
+	/* consumer sleep/wakeup */
+	struct psc_spinlock	 pshlc_lock;
+	struct pfl_waitq	 pshlc_wq;
+	int			 pshlc_nwaiters;
+	char			 pshlc_name[PFL_SHLC_NAME_MAX];
+};
+
+/* pshlc_flags */
+#define PSHLCF_DYING		(1 << 0)	/* about to go away */
+
+/* shard list cache behavior flags */
+#define PSHLCBF_NOBLOCK		(1 << 0)	/* return if nothing available */
+
+#define shlc_init(lc, name, type, memb, nshards)			\
+	_shlc_init((lc), (name), offsetof(type, memb), (nshards))
+
+#define shlc_nitems(lc)		psc_atomic32_read(&(lc)->pshlc_nitems)
+#define shlc_empty(lc)		(shlc_nitems(lc) == 0)
+
+#define shlc_add(lc, p)							\
+	do {								\
+		void *_shlc_p = (p);					\
+									\
+		_shlc_addv((lc), &_shlc_p, 1);				\
+	} while (0)
+#define shlc_addv(lc, pv, n)	_shlc_addv((lc), (pv), (n))
+
+#define shlc_getwait(lc)	_shlc_get((lc), NULL, 0)
+#define shlc_gettimed(lc, tm)	_shlc_get((lc), (tm), 0)
+#define shlc_getnb(lc)		_shlc_get((lc), NULL, PSHLCBF_NOBLOCK)
+
+#define shlc_getn(lc, pv, n)	_shlc_getn((lc), (pv), (n), NULL, 0)
+#define shlc_getn_nb(lc, pv, n)	_shlc_getn((lc), (pv), (n), NULL, PSHLCBF_NOBLOCK)
+#define shlc_getn_timed(lc, pv, n, tm)					\
+				_shlc_getn((lc), (pv), (n), (tm), 0)
+
+void	 _shlc_init(struct pfl_shlistcache *, const char *, ptrdiff_t, int);
+void	  shlc_destroy(struct pfl_shlistcache *);
+void	  shlc_kill(struct pfl_shlistcache *);
+int	 _shlc_addv(struct pfl_shlistcache *, void **, int);
+void	*_shlc_get(struct pfl_shlistcache *, const struct timespec *, int);
+int	 _shlc_getn(struct pfl_shlistcache *, void **, int, const struct timespec *, int);
+
+#endif /* _PFL_SHLISTCACHE_H_ */
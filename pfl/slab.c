@@ -0,0 +1,472 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Size-class slab allocator.  See pfl/slab.h for an overview.
+ *
+ * The reserved range is divided into runs of SLAB_RUNSZ bytes.  Each
+ * run is handed to a single size class and its metadata lives in a
+ * parallel array indexed by run number, so freeing an object only
+ * needs its address.  Thread caches hold singly linked lists of free
+ * objects threaded through the objects themselves and exchange them
+ * with the owning class in batches.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pfl/alloc.h"
+#include "pfl/cdefs.h"
+#include "pfl/list.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/slab.h"
+
+#define SLAB_RUNSHIFT		16
+#define SLAB_RUNSZ		((size_t)1 << SLAB_RUNSHIFT)
+#define SLAB_RESERVE		((size_t)32 << 30)	/* virtual space */
+#define SLAB_NRUNS		(SLAB_RESERVE >> SLAB_RUNSHIFT)
+
+#define SLAB_KEEPRUNS		2	/* empty runs a class holds onto */
+#define SLAB_MAXBATCH		64
+
+struct pfl_slab_run {
+	struct psc_listentry	 psr_lentry;	/* on class or free-run list */
+	void			*psr_free;	/* returned objects */
+	int			 psr_nfree;	/* objects available */
+	int			 psr_ncarved;	/* objects ever handed out */
+	int			 psr_class;
+	int			 psr_flags;	/* see below */
+};
+
+/* run flags */
+#define PSRF_PARTIAL		(1 << 0)	/* on class psl_runs list */
+
+struct pfl_slab_class {
+	psc_spinlock_t		 psl_lock;
+	size_t			 psl_size;
+	int			 psl_nperrun;
+	int			 psl_batch;	/* objects moved per refill */
+	int			 psl_nempty;	/* fully free runs held */
+	struct psclist_head	 psl_runs;	/* runs with free objects */
+	struct pfl_slab_stats	 psl_stats;
+} __aligned(64);
+
+struct pfl_slab_tcache {
+	void			*pst_head[PFL_SLAB_NCLASSES];
+	int			 pst_n[PFL_SLAB_NCLASSES];
+};
+
+char			*pfl_slab_base;
+char			*pfl_slab_end;
+int			 pfl_slab_enabled;
+
+struct pfl_slab_class	 pfl_slab_classes[PFL_SLAB_NCLASSES];
+struct pfl_slab_run	*pfl_slab_runs;
+psc_spinlock_t		 pfl_slab_lock = SPINLOCK_INIT_NOLOG;
+size_t			 pfl_slab_nextrun;	/* never-used runs start here */
+struct psclist_head	 pfl_slab_freeruns = PSCLIST_HEAD_INIT(pfl_slab_freeruns);
+
+/* size class lookup for sizes <= 1024 in 16 byte steps */
+unsigned char		 pfl_slab_smallclass[1024 / 16 + 1];
+
+pthread_key_t		 pfl_slab_tckey;
+__threadx struct pfl_slab_tcache *pfl_slab_tc;
+
+#define SLAB_RUNIDX(p)		((size_t)((char *)(p) - pfl_slab_base) >> SLAB_RUNSHIFT)
+#define SLAB_RUNBASE(i)		(pfl_slab_base + ((i) << SLAB_RUNSHIFT))
+
+/* next pointer of a free object */
+#define SLAB_NEXT(p)		(*(void **)(p))
+
+__static int
+pfl_slab_sizeclass(size_t size)
+{
+	int c;
+
+	if (size <= 1024)
+		return (pfl_slab_smallclass[(size + 15) / 16]);
+	for (c = pfl_slab_smallclass[1024 / 16];
+	    pfl_slab_classes[c].psl_size < size; c++)
+		;
+	return (c);
+}
+
+/*
+ * Obtain an unowned run, either a previously released one or one
+ * never used before.
+ */
+__static struct pfl_slab_run *
+pfl_slab_getrun(int c)
+{
+	struct pfl_slab_run *r = NULL;
+
+	spinlock(&pfl_slab_lock);
+	if (!psc_listhd_empty(&pfl_slab_freeruns)) {
+		r = psc_listhd_first_obj(&pfl_slab_freeruns,
+		    struct pfl_slab_run, psr_lentry);
+		psclist_del(&r->psr_lentry, &pfl_slab_freeruns);
+	} else if (pfl_slab_nextrun < SLAB_NRUNS) {
+		r = &pfl_slab_runs[pfl_slab_nextrun++];
+		INIT_PSC_LISTENTRY(&r->psr_lentry);
+	}
+	freelock(&pfl_slab_lock);
+	if (r) {
+		r->psr_free = NULL;
+		r->psr_nfree = pfl_slab_classes[c].psl_nperrun;
+		r->psr_ncarved = 0;
+		r->psr_class = c;
+		r->psr_flags = 0;
+	}
+	return (r);
+}
+
+/*
+ * Give a fully free run back to the OS and make it available to any
+ * size class.
+ */
+__static void
+pfl_slab_putrun(struct pfl_slab_run *r)
+{
+	size_t i = r - pfl_slab_runs;
+
+	madvise(SLAB_RUNBASE(i), SLAB_RUNSZ, MADV_DONTNEED);
+	r->psr_class = -1;
+	spinlock(&pfl_slab_lock);
+	psclist_add_head(&r->psr_lentry, &pfl_slab_freeruns);
+	freelock(&pfl_slab_lock);
+}
+
+/*
+ * Move up to 'n' free objects from a size class into a thread cache.
+ * Returns the number of objects obtained.
+ */
+__static int
+pfl_slab_refill(struct pfl_slab_tcache *tc, int c, int n)
+{
+	struct pfl_slab_class *sl = &pfl_slab_classes[c];
+	struct pfl_slab_run *r;
+	int got = 0;
+	void *p;
+
+	spinlock(&sl->psl_lock);
+	while (got < n) {
+		if (psc_listhd_empty(&sl->psl_runs)) {
+			freelock(&sl->psl_lock);
+			r = pfl_slab_getrun(c);
+			spinlock(&sl->psl_lock);
+			if (r == NULL)
+				break;
+			r->psr_flags |= PSRF_PARTIAL;
+			psclist_add_head(&r->psr_lentry, &sl->psl_runs);
+			sl->psl_stats.pss_nruns++;
+			sl->psl_nempty++;
+		}
+		r = psc_listhd_first_obj(&sl->psl_runs, struct pfl_slab_run,
+		    psr_lentry);
+		if (r->psr_nfree == sl->psl_nperrun)
+			sl->psl_nempty--;
+		for (; got < n && r->psr_nfree; got++, r->psr_nfree--) {
+			if (r->psr_free) {
+				p = r->psr_free;
+				r->psr_free = SLAB_NEXT(p);
+			} else
+				p = SLAB_RUNBASE((size_t)(r - pfl_slab_runs)) +
+				    sl->psl_size * r->psr_ncarved++;
+			SLAB_NEXT(p) = tc->pst_head[c];
+			tc->pst_head[c] = p;
+		}
+		if (r->psr_nfree == 0) {
+			r->psr_flags &= ~PSRF_PARTIAL;
+			psclist_del(&r->psr_lentry, &sl->psl_runs);
+		}
+	}
+	tc->pst_n[c] += got;
+	sl->psl_stats.pss_nout += got;
+	sl->psl_stats.pss_nrefills++;
+	freelock(&sl->psl_lock);
+	return (got);
+}
+
+/*
+ * Return up to 'n' objects from a thread cache to their size class.
+ */
+__static void
+pfl_slab_flush(struct pfl_slab_tcache *tc, int c, int n)
+{
+	struct pfl_slab_class *sl = &pfl_slab_classes[c];
+	struct pfl_slab_run *r;
+	int i;
+	void *p;
+
+	spinlock(&sl->psl_lock);
+	for (i = 0; i < n && tc->pst_head[c]; i++) {
+		p = tc->pst_head[c];
+		tc->pst_head[c] = SLAB_NEXT(p);
+
+		r = &pfl_slab_runs[SLAB_RUNIDX(p)];
+		SLAB_NEXT(p) = r->psr_free;
+		r->psr_free = p;
+		r->psr_nfree++;
+		if ((r->psr_flags & PSRF_PARTIAL) == 0) {
+			r->psr_flags |= PSRF_PARTIAL;
+			psclist_add_head(&r->psr_lentry, &sl->psl_runs);
+		}
+		if (r->psr_nfree == sl->psl_nperrun) {
+			/*
+			 * Keep a few empty runs around at the back of
+			 * the list to absorb churn; release the rest.
+			 */
+			psclist_del(&r->psr_lentry, &sl->psl_runs);
+			if (sl->psl_nempty < SLAB_KEEPRUNS) {
+				sl->psl_nempty++;
+				psclist_add_tail(&r->psr_lentry,
+				    &sl->psl_runs);
+			} else {
+				r->psr_flags &= ~PSRF_PARTIAL;
+				sl->psl_stats.pss_nruns--;
+				sl->psl_stats.pss_nreleased++;
+				freelock(&sl->psl_lock);
+				pfl_slab_putrun(r);
+				spinlock(&sl->psl_lock);
+			}
+		}
+	}
+	tc->pst_n[c] -= i;
+	sl->psl_stats.pss_nout -= i;
+	sl->psl_stats.pss_nflushes++;
+	freelock(&sl->psl_lock);
+}
+
+/*
+ * Thread exit destructor: hand all cached objects back.
+ */
+__static void
+pfl_slab_tcache_destroy(void *arg)
+{
+	struct pfl_slab_tcache *tc = arg;
+	int c;
+
+	for (c = 0; c < PFL_SLAB_NCLASSES; c++)
+		if (tc->pst_n[c])
+			pfl_slab_flush(tc, c, tc->pst_n[c]);
+	pfl_slab_tc = NULL;
+	free(tc);
+}
+
+__static struct pfl_slab_tcache *
+pfl_slab_gettcache(void)
+{
+	struct pfl_slab_tcache *tc;
+
+#ifdef HAVE_TLS
+	tc = pfl_slab_tc;
+#else
+	tc = pthread_getspecific(pfl_slab_tckey);
+#endif
+	if (tc == NULL) {
+		tc = calloc(1, sizeof(*tc));
+		if (tc == NULL)
+			return (NULL);
+		pthread_setspecific(pfl_slab_tckey, tc);
+#ifdef HAVE_TLS
+		pfl_slab_tc = tc;
+#endif
+	}
+	return (tc);
+}
+
+/*
+ * Allocate an object from the slab allocator.
+ * @size: size of object.
+ * @flags: PAF_* flags.
+ *
+ * Returns NULL when the request is not serviceable by the slab
+ * allocator (too large, or no memory left in the reserved range) so
+ * the caller may fall back to malloc(3).  The memory is not zeroed.
+ *
+ * PAF_PAGEALIGN and PAF_LOCK requests are rounded up to a page
+ * multiple so the object is aligned and occupies its own pages, which
+ * allows them to be mlock(2)'d and munlock(2)'d independently.
+ */
+void *
+pfl_slab_alloc(size_t size, int flags)
+{
+	struct pfl_slab_tcache *tc;
+	int c;
+	void *p;
+
+	if (!pfl_slab_enabled)
+		return (NULL);
+	if (flags & (PAF_PAGEALIGN | PAF_LOCK))
+		size = PSC_ALIGN(size, psc_pagesize);
+	if (size == 0)
+		size = 1;
+	if (size > PFL_SLAB_MAXSIZE)
+		return (NULL);
+	c = pfl_slab_sizeclass(size);
+	if ((flags & (PAF_PAGEALIGN | PAF_LOCK)) &&
+	    pfl_slab_classes[c].psl_size % psc_pagesize)
+		return (NULL);
+
+	tc = pfl_slab_gettcache();
+	if (tc == NULL)
+		return (NULL);
+	if (tc->pst_head[c] == NULL &&
+	    pfl_slab_refill(tc, c, pfl_slab_classes[c].psl_batch) == 0)
+		return (NULL);
+	p = tc->pst_head[c];
+	tc->pst_head[c] = SLAB_NEXT(p);
+	tc->pst_n[c]--;
+	return (p);
+}
+
+/*
+ * Release an object back to the slab allocator.
+ * @p: object, for which pfl_slab_owns() must be true.
+ */
+void
+pfl_slab_free(void *p)
+{
+	struct pfl_slab_tcache *tc;
+	int c;
+
+	c = pfl_slab_runs[SLAB_RUNIDX(p)].psr_class;
+	pfl_assert(c >= 0 && c < PFL_SLAB_NCLASSES);
+	tc = pfl_slab_gettcache();
+	if (tc == NULL) {
+		struct pfl_slab_tcache tmp;
+
+		/* no cache; return the object directly */
+		memset(&tmp, 0, sizeof(tmp));
+		SLAB_NEXT(p) = NULL;
+		tmp.pst_head[c] = p;
+		tmp.pst_n[c] = 1;
+		pfl_slab_flush(&tmp, c, 1);
+		return;
+	}
+	SLAB_NEXT(p) = tc->pst_head[c];
+	tc->pst_head[c] = p;
+	if (++tc->pst_n[c] > 2 * pfl_slab_classes[c].psl_batch)
+		pfl_slab_flush(tc, c, pfl_slab_classes[c].psl_batch);
+}
+
+/*
+ * Get the usable size of a slab object.
+ */
+size_t
+pfl_slab_objsize(const void *p)
+{
+	return (pfl_slab_classes[pfl_slab_runs[SLAB_RUNIDX(p)].
+	    psr_class].psl_size);
+}
+
+/*
+ * Take a snapshot of the statistics of a size class.
+ * @c: size class index.
+ * @pss: value-result statistics.
+ * Returns zero if 'c' is not a valid size class.
+ */
+int
+pfl_slab_getstats(int c, struct pfl_slab_stats *pss)
+{
+	struct pfl_slab_class *sl;
+
+	if (!pfl_slab_enabled || c < 0 || c >= PFL_SLAB_NCLASSES)
+		return (0);
+	sl = &pfl_slab_classes[c];
+	spinlock(&sl->psl_lock);
+	*pss = sl->psl_stats;
+	freelock(&sl->psl_lock);
+	return (1);
+}
+
+/*
+ * Reserve address space and set up size classes.  Returns zero on
+ * success or an errno value.
+ */
+int
+pfl_slab_init(void)
+{
+	struct pfl_slab_class *sl;
+	size_t sz, base;
+	int c, i, rc;
+	void *p;
+
+	if (pfl_slab_enabled)
+		return (0);
+
+	/* 16..128 by 16, then four classes per power of two */
+	for (c = 0, sz = 16; sz <= 128; sz += 16)
+		pfl_slab_classes[c++].psl_size = sz;
+	for (base = 128; base < PFL_SLAB_MAXSIZE; base *= 2)
+		for (i = 1; i <= 4; i++)
+			pfl_slab_classes[c++].psl_size = base + i * base / 4;
+	pfl_assert(c == PFL_SLAB_NCLASSES);
+	pfl_assert(pfl_slab_classes[c - 1].psl_size == PFL_SLAB_MAXSIZE);
+
+	for (c = 0; c < PFL_SLAB_NCLASSES; c++) {
+		sl = &pfl_slab_classes[c];
+		INIT_SPINLOCK_NOLOG(&sl->psl_lock);
+		INIT_PSCLIST_HEAD(&sl->psl_runs);
+		sl->psl_nperrun = SLAB_RUNSZ / sl->psl_size;
+		sl->psl_batch = MAX(4, MIN(SLAB_MAXBATCH,
+		    4 * psc_pagesize / (int)sl->psl_size));
+		sl->psl_stats.pss_size = sl->psl_size;
+		sl->psl_stats.pss_nperrun = sl->psl_nperrun;
+	}
+	for (i = 0, c = 0; i < (int)nitems(pfl_slab_smallclass); i++) {
+		while (pfl_slab_classes[c].psl_size < (size_t)i * 16)
+			c++;
+		pfl_slab_smallclass[i] = c;
+	}
+
+	rc = pthread_key_create(&pfl_slab_tckey,
+	    pfl_slab_tcache_destroy);
+	if (rc)
+		return (rc);
+
+	pfl_slab_runs = mmap(NULL, SLAB_NRUNS * sizeof(*pfl_slab_runs),
+	    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS |
+	    MAP_NORESERVE, -1, 0);
+	if (pfl_slab_runs == MAP_FAILED)
+		return (errno);
+	p = mmap(NULL, SLAB_RESERVE, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		rc = errno;
+		munmap(pfl_slab_runs, SLAB_NRUNS * sizeof(*pfl_slab_runs));
+		return (rc);
+	}
+	pfl_slab_base = p;
+	pfl_slab_end = pfl_slab_base + SLAB_RESERVE;
+	pfl_slab_enabled = 1;
+	return (0);
+}
@@ -0,0 +1,74 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Size-class slab allocator backing PSCALLOC() in non-debug builds.
+ *
+ * Objects up to PFL_SLAB_MAXSIZE are carved from fixed-size page runs
+ * inside one reserved virtual address range, so ownership of any
+ * pointer is a range check.  Each thread caches free objects per size
+ * class; runs that become entirely free are returned to the OS with
+ * madvise(2).  Allocation falls back to malloc(3) for larger sizes or
+ * once the reserved range is exhausted.
+ *
+ * The allocator is opt-in: it is enabled by setting PSC_SLAB_ALLOC in
+ * the environment before pfl_init() or by calling pfl_slab_init().
+ */
+
+#ifndef _PFL_SLAB_H_
+#define _PFL_SLAB_H_
+
+#include <sys/types.h>
+
+#include <stdint.h>
+
+#define PFL_SLAB_MAXSIZE	16384
+#define PFL_SLAB_NCLASSES	36
+
+struct pfl_slab_stats {
+	size_t			pss_size;	/* object size of class */
+	int			pss_nperrun;	/* objects per run */
+	uint64_t		pss_nruns;	/* runs owned by class */
+	uint64_t		pss_nout;	/* objs held by threads */
+	uint64_t		pss_nrefills;	/* thread cache refills */
+	uint64_t		pss_nflushes;	/* thread cache flushes */
+	uint64_t		pss_nreleased;	/* runs madvise'd back to OS */
+};
+
+extern char	*pfl_slab_base;
+extern char	*pfl_slab_end;
+extern int	 pfl_slab_enabled;
+
+/*
+ * Determine whether a pointer came from the slab allocator.
+ */
+#define pfl_slab_owns(p)						\
+	((char *)(p) >= pfl_slab_base && (char *)(p) < pfl_slab_end)
+
+void	*pfl_slab_alloc(size_t, int);
+void	 pfl_slab_free(void *);
+int	 pfl_slab_getstats(int, struct pfl_slab_stats *);
+int	 pfl_slab_init(void);
+size_t	 pfl_slab_objsize(const void *);
+
+#endif /* _PFL_SLAB_H_ */
@@ -30,6 +30,7 @@
 #include <err.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <syslog.h>
 
@@ -38,6 +39,7 @@
 #include "pfl/fmtstr.h"
 #include "pfl/log.h"
 #include "pfl/subsys.h"
+#include "pfl/trace.h"
 #include "pfl/thread.h"
 
 struct pfl_subsys {
@@ -145,6 +147,11 @@ pfl_subsys_register(int ssid, const char *name)
 		    "check order", ssid, name, nss);
 	psc_dynarray_add(&pfl_subsystems, ss);
 
+	snprintf(buf, sizeof(buf), "PSC_TRACE_%s", name);
+	p = getenv(buf);
+	if (p && strcmp(p, "0"))
+		pfl_trace_enable(ssid, 1);
+
 	_psc_threads_rebuild_subsys(ss->pss_loglevel);
 }
 
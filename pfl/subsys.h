@@ -38,7 +38,9 @@
 #define PSS_MEM		2
 #define PSS_LNET	3
 #define PSS_RPC		4
-#define _PSS_LAST	5
+#define PSS_JOURNAL	5
+#define PSS_FS		6
+#define _PSS_LAST	7
 
 int		 pfl_subsys_id(const char *);
 const char	*pfl_subsys_name(int);
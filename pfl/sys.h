@@ -31,5 +31,6 @@ int	pflsys_userisgroupmember(uid_t, gid_t, gid_t);
 
 int	pfl_systemf(const char *, ...);
 int	pfl_getfstype(const char *, char *, size_t);
+int	pfl_getnprocessors(void);
 
 #endif /* _PFL_SYS_H_ */
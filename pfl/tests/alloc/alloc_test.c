@@ -25,34 +25,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pfl/alloc.h"
+#include "pfl/atomic.h"
 #include "pfl/cdefs.h"
 #include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/random.h"
+#include "pfl/slab.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+
+#define NSLOTS		1024
+
+psc_atomic32_t		 nrunning;
+int			 niters = 1000000;
+int			 maxsz = 1024;
 
 __dead void
 usage(void)
 {
 	extern const char *__progname;
 
-	fprintf(stderr, "usage: %s\n", __progname);
+	fprintf(stderr, "usage: %s [-b] [-i niters] [-s maxsz] [-t nthr]\n",
+	    __progname);
 	exit(1);
 }
 
-int
-main(int argc, char *argv[])
+void
+basic(void)
 {
 	size_t sz;
 	void *p;
 
-	pfl_init();
-	if (getopt(argc, argv, "") != -1)
-		usage();
-	argc -= optind;
-	if (argc)
-		usage();
-
 	p = PSCALLOC(213);
 	p = psc_realloc(p, 65536, 0);
 	p = psc_realloc(p, 0, 0);
@@ -78,6 +85,121 @@ main(int argc, char *argv[])
 	p = psc_alloc(sz, PAF_LOCK | PAF_PAGEALIGN);
 	memset(p, 0, sz);
 	psc_free(p, PAF_LOCK | PAF_PAGEALIGN, sz);
+}
+
+/*
+ * Churn a per-thread working set of randomly sized objects, replacing
+ * one random slot on each iteration.
+ */
+void
+churn_main(__unusedx struct psc_thread *thr)
+{
+	void *slots[NSLOTS];
+	int i, j;
+
+	memset(slots, 0, sizeof(slots));
+	for (i = 0; i < niters; i++) {
+		j = psc_random32u(NSLOTS);
+		PSCFREE(slots[j]);
+		slots[j] = PSCALLOC(16 + psc_random32u(maxsz - 15));
+		*(char *)slots[j] = i;
+	}
+	for (j = 0; j < NSLOTS; j++)
+		PSCFREE(slots[j]);
+	psc_atomic32_dec(&nrunning);
+}
+
+void
+bench(const char *name, int nthr)
+{
+	struct timespec ts0;
+	double ns;
+	int i;
+
+	psc_atomic32_set(&nrunning, nthr);
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < nthr; i++)
+		pscthr_init(0, churn_main, 0, "churn%d", i);
+	while (psc_atomic32_read(&nrunning))
+		usleep(100);
+	ns = pfl_elapsed_ns(&ts0);
+	printf("%-5s threads %2d size 16-%-5d %8.3f Mops/s\n", name,
+	    nthr, maxsz, (double)nthr * niters / ns * 1e3);
+}
+
+void
+check_slab(void)
+{
+	struct pfl_slab_stats pss;
+	char *p, *q;
+	int c;
+
+	p = PSCALLOC(100);
+	pfl_assert(pfl_slab_owns(p));
+	pfl_assert(pfl_slab_objsize(p) >= 100);
+	for (c = 0; c < 100; c++)
+		pfl_assert(p[c] == 0);
+	memset(p, 'x', 100);
+
+	/* grow within the same size class keeps the object */
+	q = psc_realloc(p, 110, 0);
+	pfl_assert(q == p);
+
+	/* grow past the class copies the contents */
+	q = psc_realloc(p, 4000, 0);
+	pfl_assert(q[0] == 'x' && q[99] == 'x');
+	PSCFREE(q);
+
+	/* oversize requests fall through to the system allocator */
+	p = PSCALLOC(PFL_SLAB_MAXSIZE + 1);
+	pfl_assert(!pfl_slab_owns(p));
+	PSCFREE(p);
+
+	for (c = 0; pfl_slab_getstats(c, &pss); c++)
+		pfl_assert(pss.pss_size <= PFL_SLAB_MAXSIZE);
+	pfl_assert(c == PFL_SLAB_NCLASSES);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, benchmark = 0, nthr = 1, rc;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "bi:s:t:")) != -1)
+		switch (c) {
+		case 'b':
+			benchmark = 1;
+			break;
+		case 'i':
+			niters = atoi(optarg);
+			break;
+		case 's':
+			maxsz = atoi(optarg);
+			break;
+		case 't':
+			nthr = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || maxsz < 16 || nthr < 1)
+		usage();
+
+	basic();
+
+	if (benchmark)
+		bench(pfl_slab_enabled ? "slab" : "libc", nthr);
+
+	rc = pfl_slab_init();
+	if (rc)
+		psc_fatalx("slab init: %s", strerror(rc));
+	basic();
+	check_slab();
+
+	if (benchmark)
+		bench("slab", nthr);
 
 	exit(0);
 }
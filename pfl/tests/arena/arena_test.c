@@ -0,0 +1,212 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Check arena allocation semantics and compare the cost of a request's
+ * worth of short-lived allocations against PSCALLOC/PSCFREE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/arena.h"
+#include "pfl/cdefs.h"
+#include "pfl/log.h"
+#include "pfl/opstats.h"
+#include "pfl/pfl.h"
+#include "pfl/random.h"
+#include "pfl/time.h"
+
+#define NPERREQ		32
+#define NINITTHR	8
+
+extern struct pfl_opstat	*pfl_arena_opst_hwm;
+extern struct pfl_opstat	*pfl_arena_opst_overflow;
+extern struct pfl_opstat	*pfl_arena_opst_oversize;
+
+int			 niters = 100000;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-i niters]\n", __progname);
+	exit(1);
+}
+
+/*
+ * Every subsystem calls pfl_arenas_init() before using arenas, possibly
+ * at the same time; none may return before the pool is ready.
+ */
+void *
+initthr_main(__unusedx void *arg)
+{
+	struct pfl_arena pa;
+
+	pfl_arenas_init();
+	pfl_arena_init(&pa);
+	memset(PFL_ARENA_ALLOC(&pa, 64), 'z', 64);
+	pfl_arena_reset(&pa);
+	return (NULL);
+}
+
+void
+check_init(void)
+{
+	pthread_t thrv[NINITTHR];
+	int i, rc;
+
+	for (i = 0; i < NINITTHR; i++) {
+		rc = pthread_create(&thrv[i], NULL, initthr_main, NULL);
+		if (rc)
+			psc_fatalx("pthread_create: %s", strerror(rc));
+	}
+	for (i = 0; i < NINITTHR; i++)
+		pthread_join(thrv[i], NULL);
+}
+
+void
+check(void)
+{
+	struct pfl_arena_mark m;
+	struct pfl_arena pa;
+	char *p, *q, *big;
+	size_t hwm;
+	int i;
+
+	pfl_arena_init(&pa);
+	pfl_arena_reset(&pa);
+
+	p = PFL_ARENA_ALLOC(&pa, 1);
+	q = PFL_ARENA_ALLOC(&pa, 3);
+	pfl_assert(((uintptr_t)p % PFL_ARENA_ALIGN) == 0);
+	pfl_assert(((uintptr_t)q % PFL_ARENA_ALIGN) == 0);
+	pfl_assert(q == p + PFL_ARENA_ALIGN);
+	pfl_assert(pa.pa_nchunks == 1);
+
+	p = pfl_arena_strdup(&pa, "hello");
+	pfl_assert(strcmp(p, "hello") == 0);
+
+	/* rewinding reuses the same memory */
+	pfl_arena_mark(&pa, &m);
+	p = PFL_ARENA_ALLOC(&pa, 100);
+	memset(p, 'x', 100);
+	pfl_arena_rewind(&pa, &m);
+	q = PFL_ARENA_ALLOC(&pa, 100);
+	pfl_assert(p == q);
+	for (i = 0; i < 100; i++)
+		pfl_assert(q[i] == 0);
+
+	/* spill into further chunks, then rewind across them */
+	pfl_arena_mark(&pa, &m);
+	for (i = 0; i < 4 * PFL_ARENA_CHUNKSZ / 64; i++)
+		PFL_ARENA_ALLOC(&pa, 64);
+	pfl_assert(pa.pa_nchunks > 4);
+	pfl_assert(pfl_opstat_read(pfl_arena_opst_overflow) >= 4);
+	pfl_arena_rewind(&pa, &m);
+	pfl_assert(pa.pa_nchunks == 1);
+	pfl_assert(pa.pa_inuse == m.pam_inuse);
+	pfl_assert(pa.pa_hwm > 4 * PFL_ARENA_CHUNKSZ);
+
+	/* oversize allocations get their own chunk */
+	big = PFL_ARENA_ALLOC(&pa, 3 * PFL_ARENA_CHUNKSZ);
+	memset(big, 'y', 3 * PFL_ARENA_CHUNKSZ);
+	pfl_assert(pa.pa_cur->pac_flags & PACF_OVERSIZE);
+	pfl_assert(pfl_opstat_read(pfl_arena_opst_oversize) == 1);
+	p = PFL_ARENA_ALLOC(&pa, 16);
+	pfl_assert(!(pa.pa_cur->pac_flags & PACF_OVERSIZE));
+
+	hwm = pa.pa_hwm;
+	pfl_arena_reset(&pa);
+	pfl_assert(pfl_opstat_read(pfl_arena_opst_hwm) >= (int64_t)hwm);
+	pfl_assert(pa.pa_cur == NULL);
+	pfl_assert(pa.pa_inuse == 0);
+	pfl_assert(pa.pa_nchunks == 0);
+}
+
+void
+bench(void)
+{
+	struct timespec ts0;
+	void *ptrs[NPERREQ];
+	size_t sz[NPERREQ];
+	struct pfl_arena pa;
+	double ns;
+	int i, j;
+
+	for (j = 0; j < NPERREQ; j++)
+		sz[j] = 16 + psc_random32u(240);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < niters; i++) {
+		for (j = 0; j < NPERREQ; j++)
+			ptrs[j] = PSCALLOC(sz[j]);
+		for (j = 0; j < NPERREQ; j++)
+			PSCFREE(ptrs[j]);
+	}
+	ns = pfl_elapsed_ns(&ts0);
+	printf("%-8s %8.1f ns/req (%d allocs)\n", "malloc", ns / niters,
+	    NPERREQ);
+
+	pfl_arena_init(&pa);
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < niters; i++) {
+		for (j = 0; j < NPERREQ; j++)
+			ptrs[j] = PFL_ARENA_ALLOC(&pa, sz[j]);
+		pfl_arena_reset(&pa);
+	}
+	ns = pfl_elapsed_ns(&ts0);
+	printf("%-8s %8.1f ns/req (%d allocs)\n", "arena", ns / niters,
+	    NPERREQ);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "i:")) != -1)
+		switch (c) {
+		case 'i':
+			niters = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || niters < 0)
+		usage();
+
+	check_init();
+	check();
+	bench();
+	return (0);
+}
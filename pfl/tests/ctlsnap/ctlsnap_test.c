@@ -0,0 +1,184 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Check parsing and evaluation of batched snapshot filters.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfl/cdefs.h"
+#include "pfl/ctlsvr.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/str.h"
+
+struct rec {
+	char		r_name[32];
+	int32_t		r_i32;
+	int64_t		r_i64;
+	double		r_dbl;
+};
+
+const struct pfl_ctlsnap_field rec_fields[] = {
+	PCSF(rec, "name",	PCSFT_STR, r_name),
+	PCSF(rec, "i32",	PCSFT_I32, r_i32),
+	PCSF(rec, "i64",	PCSFT_I64, r_i64),
+	PCSF(rec, "dbl",	PCSFT_DBL, r_dbl)
+};
+
+const struct pfl_ctlsnap_type rec_type = {
+	0, sizeof(struct rec), NULL, rec_fields, nitems(rec_fields)
+};
+
+struct rec r = { "rpc.send", -5, INT64_C(1) << 40, 2.5 };
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s\n", __progname);
+	exit(1);
+}
+
+const char *
+parse(struct pfl_ctlsnap *s, const char *expr)
+{
+	memset(s, 0, sizeof(*s));
+	s->pcs_type = &rec_type;
+	strlcpy(s->pcs_filter, expr, sizeof(s->pcs_filter));
+	return (pfl_ctlsnap_parse(s));
+}
+
+int
+match(const char *expr)
+{
+	struct pfl_ctlsnap s;
+	const char *errmsg;
+
+	errmsg = parse(&s, expr);
+	if (errmsg)
+		psc_fatalx("%s: %s", expr, errmsg);
+	return (pfl_ctlsnap_match(&s, &r));
+}
+
+void
+check_error(const char *expr, const char *want)
+{
+	struct pfl_ctlsnap s;
+	const char *errmsg;
+
+	errmsg = parse(&s, expr);
+	if (errmsg == NULL || strcmp(errmsg, want))
+		psc_fatalx("%s: got %s, want %s", expr,
+		    errmsg ? errmsg : "success", want);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char buf[PFLCTL_SNAP_FILTER_MAX];
+	int i;
+
+	pfl_init();
+	if (getopt(argc, argv, "") != -1)
+		usage();
+
+	/* no terms matches everything; empty terms are skipped */
+	pfl_assert(match(""));
+	pfl_assert(match("&& &"));
+
+	/* strings: equality and fnmatch(3) patterns */
+	pfl_assert(match("name=rpc.send"));
+	pfl_assert(match("name==rpc.send"));
+	pfl_assert(match("name=rpc*"));
+	pfl_assert(match("name=*.?end"));
+	pfl_assert(match("name=rpc.[rs]end"));
+	pfl_assert(!match("name=rpc"));
+	pfl_assert(!match("name=RPC*"));
+	pfl_assert(!match("name!=rpc*"));
+	pfl_assert(match("name!=net*"));
+
+	/* every operator on each numeric type */
+	pfl_assert(match("i32=-5"));
+	pfl_assert(!match("i32!=-5"));
+	pfl_assert(match("i32<0"));
+	pfl_assert(!match("i32<-5"));
+	pfl_assert(match("i32<=-5"));
+	pfl_assert(match("i32>-6"));
+	pfl_assert(!match("i32>-5"));
+	pfl_assert(match("i32>=-5"));
+	pfl_assert(!match("i32>=0"));
+
+	pfl_assert(match("i64=1099511627776"));
+	pfl_assert(match("i64==0x10000000000"));
+	pfl_assert(!match("i64>0x10000000000"));
+	pfl_assert(match("i64>=0x10000000000"));
+	pfl_assert(match("i64>2147483647"));
+	pfl_assert(!match("i64<=0"));
+
+	pfl_assert(match("dbl=2.5"));
+	pfl_assert(!match("dbl!=2.5"));
+	pfl_assert(!match("dbl<2.5"));
+	pfl_assert(match("dbl<=2.5"));
+	pfl_assert(match("dbl>2.4"));
+	pfl_assert(!match("dbl>=2.6"));
+	pfl_assert(match("dbl<1e3"));
+
+	/* terms are ANDed, separated by `&' or white space */
+	pfl_assert(match("name=rpc*&i32<0&dbl>2"));
+	pfl_assert(match("name=rpc* i32<0\tdbl>2"));
+	pfl_assert(!match("name=rpc*&i32<0&dbl>3"));
+
+	/* malformed filters */
+	check_error("nosuch=1", "unknown field");
+	check_error("nam=rpc", "unknown field");
+	check_error("names=rpc", "unknown field");
+	check_error("=1", "unknown field");
+	check_error("name", "missing operator");
+	check_error("i32", "missing operator");
+	check_error("i32=", "missing value");
+	check_error("name!=", "missing value");
+	check_error("name<rpc", "invalid string comparison");
+	check_error("name>=rpc", "invalid string comparison");
+	check_error("i32=12x", "invalid number");
+	check_error("i32=<1", "invalid number");
+	check_error("i64=99999999999999999999", "invalid number");
+	check_error("dbl=abc", "invalid number");
+	check_error("dbl=1e999", "invalid number");
+
+	/* term limit */
+	buf[0] = '\0';
+	for (i = 0; i < PFL_CTLSNAP_MAXTERMS; i++)
+		strlcat(buf, "&i32<0", sizeof(buf));
+	pfl_assert(match(buf));
+	strlcat(buf, "&i32<0", sizeof(buf));
+	check_error(buf, "too many terms");
+
+	return (0);
+}
@@ -0,0 +1,421 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Drive the control server over its socket: many clients at once,
+ * requests split across writes, a client that stops reading, and a
+ * request handed to a worker.  The ctlsvr-poll test builds this against
+ * the poll(2) fallback instead of epoll.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/ctl.h"
+#include "pfl/ctlsvr.h"
+#include "pfl/log.h"
+#include "pfl/opstats.h"
+#include "pfl/pfl.h"
+#include "pfl/thread.h"
+#include "pfl/workthr.h"
+
+#define NCLIENTS	128
+#define BULKSZ		(64 * 1024)
+
+enum {
+	TMT_ECHO = NPCMT,		/* reply with the request */
+	TMT_BULK,			/* reply with tb_n messages */
+	TMT_BULKWK,			/* TMT_BULK, run on a worker */
+	TMT_SLOW			/* sleep, then report the thread */
+};
+
+struct test_bulk {
+	int32_t			 tb_n;
+	int32_t			 tb_sz;
+};
+
+char		 sockfn[PATH_MAX];
+char		 bulkbuf[BULKSZ];
+volatile int	 lastecho = -1;
+
+int
+test_echo(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	lastecho = mh->mh_id;
+	return (psc_ctlmsg_sendv(fd, mh, m, NULL));
+}
+
+int
+test_bulk(int fd, struct psc_ctlmsghdr *mh, void *m)
+{
+	struct test_bulk *tb = m;
+	struct psc_ctlmsghdr rmh;
+	int i;
+
+	rmh = *mh;
+	rmh.mh_size = tb->tb_sz;
+	for (i = 0; i < tb->tb_n; i++)
+		if (!psc_ctlmsg_sendv(fd, &rmh, bulkbuf, NULL))
+			return (0);
+	return (1);
+}
+
+int
+test_slow(int fd, struct psc_ctlmsghdr *mh, __unusedx void *m)
+{
+	int32_t onworker;
+
+	usleep(500000);
+	onworker = pscthr_get()->pscthr_type == PFL_THRT_WORKER;
+	mh->mh_size = sizeof(onworker);
+	return (psc_ctlmsg_sendv(fd, mh, &onworker, NULL));
+}
+
+struct psc_ctlop ops[] = {
+	PSC_CTLDEFOPS,
+	{ test_echo,	0 },
+	{ test_bulk,	sizeof(struct test_bulk) },
+	{ test_bulk,	sizeof(struct test_bulk) },
+	{ test_slow,	0 }
+};
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s\n", __progname);
+	exit(1);
+}
+
+int64_t
+opstat(const char *name)
+{
+	return (pfl_opstat_read(pfl_opstat_init("%s", name)));
+}
+
+int
+cli_connect(void)
+{
+	struct sockaddr_un saun;
+	int s;
+
+	memset(&saun, 0, sizeof(saun));
+	saun.sun_family = AF_LOCAL;
+	strlcpy(saun.sun_path, sockfn, sizeof(saun.sun_path));
+	s = socket(AF_LOCAL, SOCK_STREAM, PF_UNSPEC);
+	if (s == -1)
+		psc_fatal("socket");
+	if (connect(s, (struct sockaddr *)&saun, sizeof(saun)) == -1)
+		psc_fatal("connect %s", sockfn);
+	return (s);
+}
+
+void
+cli_write(int s, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(s, p, len);
+		if (n == -1)
+			psc_fatal("write");
+		p += n;
+		len -= n;
+	}
+}
+
+/*
+ * Read exactly @len bytes.  Returns 0, or -1 if the server closed the
+ * connection first.
+ */
+int
+cli_readn(int s, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(s, p, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno == ECONNRESET)
+			return (-1);
+		if (n == -1)
+			psc_fatal("read");
+		if (n == 0)
+			return (-1);
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+void
+cli_send(int s, int type, int id, const void *m, size_t len)
+{
+	struct psc_ctlmsghdr mh;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.mh_type = type;
+	mh.mh_id = id;
+	mh.mh_size = len;
+	cli_write(s, &mh, sizeof(mh));
+	cli_write(s, m, len);
+}
+
+/*
+ * Receive one reply into @buf.  Returns its body length, or -1 if the
+ * server closed the connection.
+ */
+ssize_t
+cli_recv(int s, struct psc_ctlmsghdr *mh, void *buf, size_t bufsz)
+{
+	if (cli_readn(s, mh, sizeof(*mh)))
+		return (-1);
+	pfl_assert(mh->mh_size <= bufsz);
+	if (cli_readn(s, buf, mh->mh_size))
+		return (-1);
+	return (mh->mh_size);
+}
+
+void
+check_echo(int s, int id, const char *want)
+{
+	struct psc_ctlmsghdr mh;
+	char buf[BUFSIZ];
+
+	pfl_assert(cli_recv(s, &mh, buf, sizeof(buf)) ==
+	    (ssize_t)strlen(want) + 1);
+	pfl_assert(mh.mh_type == TMT_ECHO);
+	pfl_assert(mh.mh_id == id);
+	pfl_assert(strcmp(buf, want) == 0);
+}
+
+void
+echo(int s, int id, const char *str)
+{
+	cli_send(s, TMT_ECHO, id, str, strlen(str) + 1);
+	check_echo(s, id, str);
+}
+
+/*
+ * Every client sends before any reads, so the server has all of them
+ * open and pending at once.
+ */
+void
+check_clients(void)
+{
+	char buf[32];
+	int i, s[NCLIENTS];
+
+	for (i = 0; i < NCLIENTS; i++)
+		s[i] = cli_connect();
+	for (i = 0; i < NCLIENTS; i++) {
+		snprintf(buf, sizeof(buf), "client %d", i);
+		cli_send(s[i], TMT_ECHO, i, buf, strlen(buf) + 1);
+	}
+	for (i = NCLIENTS - 1; i >= 0; i--) {
+		snprintf(buf, sizeof(buf), "client %d", i);
+		check_echo(s[i], i, buf);
+		close(s[i]);
+	}
+}
+
+/*
+ * A request arriving in pieces is only executed once complete, and
+ * several requests arriving in one write are all executed.
+ */
+void
+check_split(void)
+{
+	static const char str[] = "split across writes";
+	char buf[2 * (sizeof(struct psc_ctlmsghdr) + sizeof(str))];
+	struct psc_ctlmsghdr *mh = (void *)buf;
+	size_t len, cuts[] = { 1, 7, sizeof(*mh) + 3 };
+	size_t off = 0;
+	int i, s;
+
+	s = cli_connect();
+	memset(mh, 0, sizeof(*mh));
+	mh->mh_type = TMT_ECHO;
+	mh->mh_id = 7;
+	mh->mh_size = sizeof(str);
+	memcpy(mh + 1, str, sizeof(str));
+	len = sizeof(*mh) + sizeof(str);
+
+	lastecho = -1;
+	for (i = 0; i < (int)nitems(cuts); i++) {
+		cli_write(s, buf + off, cuts[i] - off);
+		off = cuts[i];
+		usleep(50000);
+		pfl_assert(lastecho == -1);
+	}
+	cli_write(s, buf + off, len - off);
+	check_echo(s, 7, str);
+
+	memcpy(buf + len, buf, len);
+	mh = (void *)(buf + len);
+	mh->mh_id = 8;
+	cli_write(s, buf, 2 * len);
+	check_echo(s, 7, str);
+	check_echo(s, 8, str);
+	close(s);
+}
+
+/*
+ * A client with more replies pending than PFL_CTL_OBUF_HIWAT is not
+ * read from until it drains them, while other clients are still
+ * served.
+ */
+void
+check_backpressure(void)
+{
+	struct test_bulk tb = { 16, BULKSZ };
+	struct psc_ctlmsghdr mh;
+	int i, s, other;
+
+	s = cli_connect();
+	other = cli_connect();
+
+	lastecho = -1;
+	cli_send(s, TMT_BULK, 1, &tb, sizeof(tb));
+	cli_send(s, TMT_ECHO, 2, "after bulk", sizeof("after bulk"));
+	usleep(200000);
+	echo(other, 3, "other");
+	pfl_assert(lastecho == 3);
+
+	for (i = 0; i < tb.tb_n; i++) {
+		pfl_assert(cli_recv(s, &mh, bulkbuf, sizeof(bulkbuf)) ==
+		    BULKSZ);
+		pfl_assert(mh.mh_id == 1);
+	}
+	check_echo(s, 2, "after bulk");
+	close(s);
+	close(other);
+}
+
+/*
+ * A worker waiting on a client that never reads gives up after
+ * PFL_CTL_STALL_MSEC and drops it; the event loop keeps serving others
+ * meanwhile.
+ */
+void
+check_stall(void)
+{
+	struct test_bulk tb = { 64, BULKSZ };
+	struct psc_ctlmsghdr mh;
+	int64_t ndrop;
+	int n = 0, s, other;
+
+	ndrop = opstat("ctl.drop");
+	s = cli_connect();
+	other = cli_connect();
+
+	cli_send(s, TMT_BULKWK, 1, &tb, sizeof(tb));
+	usleep(200000);
+	echo(other, 2, "during stall");
+	usleep(PFL_CTL_STALL_MSEC * 2000);
+
+	while (cli_recv(s, &mh, bulkbuf, sizeof(bulkbuf)) != -1)
+		n++;
+	pfl_assert(n < tb.tb_n);
+	pfl_assert(opstat("ctl.drop") > ndrop);
+
+	echo(other, 3, "after stall");
+	close(s);
+	close(other);
+}
+
+/*
+ * A type marked with psc_ctlop_setworkq() runs on a worker, so a quick
+ * request from another client is answered while it is still running.
+ */
+void
+check_workq(void)
+{
+	struct psc_ctlmsghdr mh;
+	int32_t onworker;
+	int64_t nworkq;
+	struct pollfd pfd;
+	int s, other;
+
+	nworkq = opstat("ctl.workq");
+	s = cli_connect();
+	other = cli_connect();
+
+	cli_send(s, TMT_SLOW, 1, NULL, 0);
+	usleep(100000);
+	echo(other, 2, "while slow");
+
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	pfl_assert(poll(&pfd, 1, 0) == 0);
+
+	pfl_assert(cli_recv(s, &mh, &onworker, sizeof(onworker)) ==
+	    sizeof(onworker));
+	pfl_assert(mh.mh_id == 1);
+	pfl_assert(onworker);
+	pfl_assert(opstat("ctl.workq") == nworkq + 1);
+	close(s);
+	close(other);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pfl_init();
+	if (getopt(argc, argv, "") != -1)
+		usage();
+
+	snprintf(sockfn, sizeof(sockfn), "/tmp/ctlsvr_test.%d.sock",
+	    (int)getpid());
+
+	/* hand-off never blocks for a work item, so preallocate some */
+	pfl_workq_init(64, 16, 16);
+	pfl_wkthr_spawn(PFL_THRT_WORKER, 2, 0, "wkthr%d");
+
+	pscthr_init(PFL_THRT_CTL, NULL, sizeof(struct psc_ctlthr),
+	    "ctlthr0");
+	psc_ctlop_setworkq(TMT_BULKWK);
+	psc_ctlop_setworkq(TMT_SLOW);
+	psc_ctlthr_main(sockfn, ops, nitems(ops), 0, PFL_THRT_CTLAC);
+
+	check_clients();
+	check_split();
+	check_backpressure();
+	check_stall();
+	check_workq();
+
+	unlink(sockfn);
+	return (0);
+}
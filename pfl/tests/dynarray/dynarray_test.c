@@ -22,6 +22,7 @@
  */
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -110,6 +111,113 @@ pcmp(const void *a, const void *b)
 	return (CMP(*x, *y));
 }
 
+struct sbtest {
+	int			 sb_pad;
+	PSC_DYNARRAY_SB(sb_da, 2);
+	void			*sb_canary;
+};
+
+struct val {
+	int			 v_a;
+	int			 v_b;
+};
+
+PSC_DYNARRAY_TYPED(valarray, struct val);
+
+void
+check_sbuf(void)
+{
+	struct sbtest sb, ssb = { 0, DYNARRAY_INIT_SB(2), { NULL },
+	    PTR_c };
+
+	/* statically initialized: the first add lands inline */
+	psc_dynarray_add(&ssb.sb_da, PTR_1); CHECK(&ssb.sb_da, PTR_1, NULL);
+	pfl_assert(psc_dynarray_get(&ssb.sb_da) == ssb.sb_da_sbuf);
+	psc_dynarray_free(&ssb.sb_da);
+	pfl_assert(ssb.sb_canary == PTR_c);
+
+	sb.sb_canary = PTR_c;
+	psc_dynarray_initsb(&sb.sb_da, nitems(sb.sb_da_sbuf));
+	psc_dynarray_add(&sb.sb_da, PTR_1);
+	psc_dynarray_add(&sb.sb_da, PTR_2); CHECK(&sb.sb_da, PTR_1, PTR_2, NULL);
+	pfl_assert(psc_dynarray_get(&sb.sb_da) == sb.sb_da_sbuf);
+	pfl_assert(sb.sb_canary == PTR_c);
+
+	/* spill to the heap */
+	psc_dynarray_add(&sb.sb_da, PTR_3); CHECK(&sb.sb_da, PTR_1, PTR_2, PTR_3, NULL);
+	pfl_assert(psc_dynarray_get(&sb.sb_da) != sb.sb_da_sbuf);
+	pfl_assert(sb.sb_canary == PTR_c);
+
+	/* free returns to the inline buffer */
+	psc_dynarray_free(&sb.sb_da);
+	psc_dynarray_add(&sb.sb_da, PTR_4); CHECK(&sb.sb_da, PTR_4, NULL);
+	pfl_assert(psc_dynarray_get(&sb.sb_da) == sb.sb_da_sbuf);
+	psc_dynarray_free(&sb.sb_da);
+
+	/* flags survive a free */
+	_psc_dynarray_initsb(&sb.sb_da, PDAF_NOLOG, nitems(sb.sb_da_sbuf));
+	psc_dynarray_add(&sb.sb_da, PTR_1);
+	psc_dynarray_add(&sb.sb_da, PTR_2);
+	psc_dynarray_add(&sb.sb_da, PTR_3);
+	psc_dynarray_free(&sb.sb_da);
+	pfl_assert(sb.sb_da.pda_flags == PDAF_NOLOG);
+	pfl_assert(psc_dynarray_get(&sb.sb_da) == sb.sb_da_sbuf);
+	psc_dynarray_free(&sb.sb_da);
+}
+
+void
+check_sorted(void)
+{
+	struct psc_dynarray da = DYNARRAY_INIT;
+
+	pfl_assert(psc_dynarray_add_sorted(&da, PTR_3, cmp) == 0);
+	pfl_assert(psc_dynarray_add_sorted(&da, PTR_1, cmp) == 0);
+	pfl_assert(psc_dynarray_add_sorted(&da, PTR_4, cmp) == 2);
+	pfl_assert(psc_dynarray_add_sorted(&da, PTR_2, cmp) == 1);
+	psc_dynarray_add_sorted(&da, PTR_a, cmp);
+	CHECK(&da, PTR_1, PTR_2, PTR_3, PTR_4, PTR_a, NULL);
+
+	pfl_assert(psc_dynarray_remove_sorted(&da, PTR_3, cmp) == 2);
+	CHECK(&da, PTR_1, PTR_2, PTR_4, PTR_a, NULL);
+	pfl_assert(psc_dynarray_remove_sorted(&da, PTR_3, cmp) == -1);
+	pfl_assert(psc_dynarray_remove_sorted(&da, PTR_a, cmp) == 3);
+	pfl_assert(psc_dynarray_remove_sorted(&da, PTR_1, cmp) == 0);
+	CHECK(&da, PTR_2, PTR_4, NULL);
+
+	psc_dynarray_removepos_ordered(&da, 0); CHECK(&da, PTR_4, NULL);
+	psc_dynarray_free(&da);
+}
+
+void
+check_typed(void)
+{
+	struct valarray va = TDYNARRAY_INIT;
+	struct val v, *vp;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		v.v_a = i;
+		v.v_b = -i;
+		valarray_add(&va, v);
+	}
+	vp = valarray_push(&va);
+	pfl_assert(vp->v_a == 0 && vp->v_b == 0);
+	vp->v_a = 100;
+	pfl_assert(valarray_len(&va) == 101);
+
+	TDYNARRAY_FOREACH(vp, i, &va)
+		pfl_assert(vp->v_a == i);
+	pfl_assert(vp == NULL);
+
+	valarray_removepos_ordered(&va, 0);
+	pfl_assert(valarray_getpos(&va, 0)->v_a == 1);
+	valarray_removepos(&va, 0);
+	pfl_assert(valarray_getpos(&va, 0)->v_a == 100);
+	pfl_assert(valarray_len(&va) == 99);
+	valarray_free(&va);
+	pfl_assert(valarray_len(&va) == 0);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -224,6 +332,11 @@ main(int argc, char *argv[])
 			pfl_assert(psc_dynarray_getpos(&da, j) ==
 			    (void *)(uintptr_t)j);
 	}
+	psc_dynarray_free(&da);
+
+	check_sbuf();
+	check_sorted();
+	check_typed();
 
 	exit(0);
 }
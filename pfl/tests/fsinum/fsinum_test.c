@@ -0,0 +1,130 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Exercise the 32-bit FUSE inum table, which is only used by the FUSE
+ * layer on platforms with a 32-bit fuse_ino_t.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/fsinum.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+
+#define MAXSLOTS	(PFL_FSINUM_CHUNKSZ * 2)
+#define NINUMS		(PFL_FSINUM_NSHARDS * MAXSLOTS)
+
+#define SHARD(f)	(((f) - PFL_FSINUM_BASE) % PFL_FSINUM_NSHARDS)
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s\n", __progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, n, nshard[PFL_FSINUM_NSHARDS], maxshard;
+	uint32_t *fv, f;
+	time_t later;
+
+	pfl_init();
+	if (getopt(argc, argv, "") != -1)
+		usage();
+
+	pfl_fsinum_init(MAXSLOTS);
+	fv = PSCALLOC(NINUMS * sizeof(*fv));
+	later = time(NULL) + 100;
+
+	/* round trip, stable while referenced */
+	for (i = 0; i < 1000; i++) {
+		fv[i] = pfl_fsinum_pscfs2fuse(100 + i, 0, 1);
+		pfl_assert(fv[i] >= PFL_FSINUM_BASE);
+		pfl_assert(pfl_fsinum_fuse2pscfs(fv[i], 0) ==
+		    (uint64_t)100 + i);
+	}
+	for (i = 0; i < 1000; i++)
+		pfl_assert(pfl_fsinum_pscfs2fuse(100 + i, 0, 1) == fv[i]);
+	pfl_assert(pfl_fsinum_pscfs2fuse(1, 0, 1) == 1);
+	pfl_assert(pfl_fsinum_fuse2pscfs(1, 0) == 1);
+
+	/* shards under no pressure are left alone */
+	for (i = 0; i < 1000; i++)
+		pfl_fsinum_fuse2pscfs(fv[i], 2);
+	pfl_assert(pfl_fsinum_reclaim(later) == 0);
+	pfl_assert(pfl_fsinum_fuse2pscfs(fv[0], 0) == 100);
+
+	/*
+	 * Fill the table with referenced inums until a shard at its
+	 * maximum size has nothing left to reclaim.
+	 */
+	for (i = 0; i < NINUMS; i++) {
+		fv[i] = pfl_fsinum_pscfs2fuse(1000000 + i, 0, 1);
+		if (fv[i] == 0)
+			break;
+	}
+	pfl_assert(i < NINUMS);
+	n = i;
+	pfl_assert(n > PFL_FSINUM_NSHARDS * PFL_FSINUM_CHUNKSZ);
+
+	for (i = 0; i < PFL_FSINUM_NSHARDS; i++)
+		nshard[i] = 0;
+	for (i = 0; i < n; i++)
+		nshard[SHARD(fv[i])]++;
+	for (i = maxshard = 0; i < PFL_FSINUM_NSHARDS; i++) {
+		pfl_assert(nshard[i] <= MAXSLOTS);
+		if (nshard[i] > nshard[maxshard])
+			maxshard = i;
+	}
+	pfl_assert(nshard[maxshard] == MAXSLOTS);
+	pfl_assert(pfl_fsinum_pscfs2fuse(1000000 + n, 0, 1) == 0);
+
+	/* dropping one reference in the full shard makes room */
+	for (i = 0; SHARD(fv[i]) != (uint32_t)maxshard; i++)
+		;
+	pfl_assert(pfl_fsinum_fuse2pscfs(fv[i], 1) ==
+	    (uint64_t)1000000 + i);
+	f = pfl_fsinum_pscfs2fuse(1000000 + n, 0, 1);
+	pfl_assert(f == fv[i]);
+	pfl_assert(pfl_fsinum_fuse2pscfs(f, 0) == (uint64_t)1000000 + n);
+
+	/* shards low on free slots are reclaimed once forgotten */
+	for (i = 0; i < n; i++)
+		if (fv[i] != f)
+			pfl_fsinum_fuse2pscfs(fv[i], 1);
+	pfl_assert(pfl_fsinum_reclaim(later) > 0);
+	pfl_assert(pfl_fsinum_fuse2pscfs(f, 0) == (uint64_t)1000000 + n);
+
+	PSCFREE(fv);
+	return (0);
+}
@@ -21,14 +21,33 @@
  * %END_LICENSE%
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pfl/alloc.h"
 #include "pfl/heap.h"
+#include "pfl/log.h"
 #include "pfl/pfl.h"
 #include "pfl/random.h"
+#include "pfl/time.h"
+
+struct k {
+	uint64_t key;
+	struct pfl_heap_entry entry;
+};
+
+int
+kcmp(const void *a, const void *b)
+{
+	const struct k *x = a, *y = b;
+
+	return (CMP(x->key, y->key));
+}
+
+int verbose;
 
 struct a {
 	int val;
@@ -81,26 +100,222 @@ add(int v)
 	pfl_heap_add(&hp, p);
 }
 
+void
+kcheck(struct pfl_kheap *kh)
+{
+	struct pfl_kheap_slot *s;
+	int i, j;
+
+	/* each node's children share one cache line where slots allow */
+	if (sizeof(*s) * PFL_KHEAP_ARITY == PFL_KHEAP_LINESZ &&
+	    kh->pkh_nitems > 1)
+		pfl_assert((uintptr_t)&kh->pkh_base[1] %
+		    PFL_KHEAP_LINESZ == 0);
+
+	for (i = 0; i < kh->pkh_nitems; i++) {
+		s = &kh->pkh_base[i];
+		pfl_assert(((struct k *)s->phs_item)->entry.phe_idx == i);
+		for (j = i * PFL_KHEAP_ARITY + 1;
+		    j <= i * PFL_KHEAP_ARITY + PFL_KHEAP_ARITY &&
+		    j < kh->pkh_nitems; j++)
+			pfl_assert(s->phs_key <= kh->pkh_base[j].phs_key);
+	}
+}
+
+void
+check_kheap(void)
+{
+	struct pfl_kheap kh = KHEAP_INIT(struct k, entry);
+	uint64_t key, last, keys[4000];
+	struct k *p, *items;
+	void *v[4000];
+	int i, n;
+
+	items = PSCALLOC(4000 * sizeof(*items));
+
+	/* individual inserts, removes from the middle, and reseats */
+	for (i = 0; i < 1000; i++) {
+		items[i].key = psc_random32u(1000);
+		pfl_kheap_add(&kh, &items[i], items[i].key);
+	}
+	kcheck(&kh);
+	for (i = 0; i < 1000; i += 7)
+		pfl_kheap_remove(&kh, &items[i]);
+	kcheck(&kh);
+	for (i = 1; i < 1000; i += 3) {
+		if (i % 7 == 0)
+			continue;
+		items[i].key = psc_random32u(1000);
+		pfl_kheap_reseat(&kh, &items[i], items[i].key);
+		pfl_assert(pfl_kheap_getkey(&kh, &items[i]) ==
+		    items[i].key);
+	}
+	kcheck(&kh);
+	for (last = 0, n = 0; (p = pfl_kheap_shift(&kh, &key)); n++) {
+		pfl_assert(p->key == key);
+		pfl_assert(key >= last);
+		last = key;
+	}
+	pfl_assert(n == 1000 - 143);
+
+	/* bulk build followed by a drain of expired keys */
+	for (i = 0; i < 4000; i++) {
+		items[i].key = keys[i] = psc_random32u(100000);
+		v[i] = &items[i];
+	}
+	pfl_kheap_addv(&kh, v, keys, 4000);
+	kcheck(&kh);
+	pfl_kheap_addv(&kh, v, keys, 0);
+	for (n = 0, i = 0; i < 4000; i++)
+		if (keys[i] <= 50000)
+			n++;
+	pfl_assert(pfl_kheap_popuntil(&kh, 50000, v, 4000) == n);
+	for (i = 1; i < n; i++)
+		pfl_assert(((struct k *)v[i - 1])->key <=
+		    ((struct k *)v[i])->key);
+	pfl_assert(pfl_kheap_peek(&kh, &key));
+	pfl_assert(key > 50000);
+	pfl_assert(pfl_kheap_nitems(&kh) == 4000 - n);
+	kcheck(&kh);
+
+	pfl_kheap_free(&kh);
+	PSCFREE(items);
+}
+
+/*
+ * Timer-style workload: a fixed population whose deadlines are pushed
+ * back repeatedly, with the earliest expiring one re-armed each round.
+ */
+void
+bench(int nitems, int nops)
+{
+	struct pfl_heap ph = HEAP_INIT(struct k, entry, kcmp);
+	struct pfl_kheap kh = KHEAP_INIT(struct k, entry);
+	uint64_t t_heap, t_kheap, t_build, t_bbuild, *keys;
+	struct timespec ts0;
+	struct k *items, *p;
+	void **v;
+	int i;
+
+	items = PSCALLOC(nitems * sizeof(*items));
+	keys = PSCALLOC(nitems * sizeof(*keys));
+	v = PSCALLOC(nitems * sizeof(*v));
+	for (i = 0; i < nitems; i++) {
+		items[i].key = keys[i] = psc_random32u(1 << 30);
+		v[i] = &items[i];
+	}
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < nitems; i++)
+		pfl_heap_add(&ph, &items[i]);
+	t_build = pfl_elapsed_ns(&ts0);
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < nops; i++) {
+		p = &items[psc_random32u(nitems)];
+		p->key += psc_random32u(1 << 20);
+		pfl_heap_reseat(&ph, p);
+		p = pfl_heap_peek(&ph);
+		p->key += 1 << 20;
+		pfl_heap_reseat(&ph, p);
+	}
+	t_heap = pfl_elapsed_ns(&ts0);
+	while (pfl_heap_shift(&ph))
+		;
+
+	for (i = 0; i < nitems; i++)
+		items[i].key = keys[i];
+	PFL_GETTIMESPEC_MONO(&ts0);
+	pfl_kheap_addv(&kh, v, keys, nitems);
+	t_bbuild = pfl_elapsed_ns(&ts0);
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < nops; i++) {
+		p = &items[psc_random32u(nitems)];
+		p->key += psc_random32u(1 << 20);
+		pfl_kheap_reseat(&kh, p, p->key);
+		p = pfl_kheap_peek(&kh, NULL);
+		p->key += 1 << 20;
+		pfl_kheap_reseat(&kh, p, p->key);
+	}
+	t_kheap = pfl_elapsed_ns(&ts0);
+	pfl_assert(pfl_kheap_popuntil(&kh, UINT64_MAX, v, nitems) ==
+	    nitems);
+
+	printf("%d items: build heap %.1fms kheap %.1fms; "
+	    "%d reseat rounds: heap %.1fns/op kheap %.1fns/op\n",
+	    nitems, t_build / 1e6, t_bbuild / 1e6, nops,
+	    (double)t_heap / nops, (double)t_kheap / nops);
+
+	pfl_kheap_free(&kh);
+	PSCFREE(ph.ph_base);
+	PSCFREE(items);
+	PSCFREE(keys);
+	PSCFREE(v);
+}
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-bv] [-n nitems] [-o nops]\n",
+	    __progname);
+	exit(1);
+}
+
 int
-main(__unusedx int argc, __unusedx char *argv[])
+main(int argc, char *argv[])
 {
+	int c, i, last, dobench = 0, nitems = 100000, nops = 1000000;
 	struct a *p;
-	int i, last;
 
 	pfl_init();
+	while ((c = getopt(argc, argv, "bn:o:v")) != -1)
+		switch (c) {
+		case 'b':
+			dobench = 1;
+			break;
+		case 'n':
+			nitems = atoi(optarg);
+			break;
+		case 'o':
+			nops = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || nitems <= 0 || nops <= 0)
+		usage();
 
 	pfl_assert(sizeof(struct a) == 8);
+	pfl_assert(sizeof(struct pfl_kheap_slot) == 16);
 
-	for (i = 0; i < 1000; i++) 
+	for (i = 0; i < 1000; i++)
 		add(psc_random32u(100));
 
+	/* remove from the middle; the filler may need to move up */
+	for (i = 0; i < 200; i++) {
+		p = pfl_heap_peekidx(&hp, psc_random32u(hp.ph_nitems));
+		pfl_heap_remove(&hp, p);
+		PSCFREE(p);
+	}
+
 	last = -1;
 	while ((p = pfl_heap_shift(&hp))) {
-		printf("%d\n", p->val);
+		if (verbose)
+			printf("%d\n", p->val);
 		pfl_assert(p->val >= last);
 		last = p->val;
 		PSCFREE(p);
 	}
 
+	check_kheap();
+
+	if (dobench)
+		bench(nitems, nops);
+
 	exit(0);
 }
@@ -0,0 +1,172 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Check that the sampling heap profiler attributes allocations to the
+ * right sites with roughly unbiased estimates, and measure its cost on
+ * the allocation path.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/cdefs.h"
+#include "pfl/heapprof.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/time.h"
+
+#define NOBJS		20000
+
+void			*objs[NOBJS];
+int			 niters = 200000;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-i niters]\n", __progname);
+	exit(1);
+}
+
+__attribute__((noinline)) void *
+alloc_small(void)
+{
+	return (PSCALLOC(64));
+}
+
+__attribute__((noinline)) void *
+alloc_large(void)
+{
+	return (PSCALLOC(4096));
+}
+
+struct summary {
+	uint64_t	inuse_bytes;
+	uint64_t	alloc_bytes;
+	int		nsites;
+};
+
+int
+sum_site(const struct pfl_heapprof_site *phs, void *arg)
+{
+	struct summary *s = arg;
+
+	s->inuse_bytes += phs->phs_inuse_bytes;
+	s->alloc_bytes += phs->phs_alloc_bytes;
+	s->nsites++;
+	return (1);
+}
+
+void
+check(void)
+{
+	struct pfl_heapprof_site tot;
+	struct summary s;
+	uint64_t est;
+	int i;
+
+	pfl_heapprof_rate = 16384;
+
+	/* 20000 * 64 = 1.25MB live small, 80MB allocated then freed large */
+	for (i = 0; i < NOBJS; i++)
+		objs[i] = alloc_small();
+	for (i = 0; i < NOBJS; i++) {
+		void *p;
+
+		p = alloc_large();
+		PSCFREE(p);
+	}
+	pfl_heapprof_rate = 0;
+
+	memset(&s, 0, sizeof(s));
+	pfl_heapprof_walk(sum_site, &s);
+	pfl_heapprof_gettotal(&tot);
+	pfl_assert(s.inuse_bytes == tot.phs_inuse_bytes);
+	pfl_assert(s.alloc_bytes == tot.phs_alloc_bytes);
+	pfl_assert(s.nsites >= 2);
+
+	/* only the small objects should remain live */
+	pfl_assert(tot.phs_inuse_bytes % 64 == 0);
+	est = tot.phs_inuse_objs * 16384;
+	printf("live estimate %"PRIu64" bytes (actual %d)\n",
+	    est, NOBJS * 64);
+	pfl_assert(est > NOBJS * 64 / 2 && est < NOBJS * 64 * 2);
+
+	for (i = 0; i < NOBJS; i++)
+		PSCFREE(objs[i]);
+	pfl_heapprof_gettotal(&tot);
+	pfl_assert(tot.phs_inuse_objs == 0);
+	pfl_assert(tot.phs_inuse_bytes == 0);
+}
+
+double
+bench(uint64_t rate)
+{
+	struct timespec ts0;
+	void *p;
+	int i;
+
+	pfl_heapprof_rate = rate;
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < niters; i++) {
+		p = PSCALLOC(16 + (i & 1023));
+		PSCFREE(p);
+	}
+	pfl_heapprof_rate = 0;
+	return ((double)pfl_elapsed_ns(&ts0) / niters);
+}
+
+int
+main(int argc, char *argv[])
+{
+	double base, prof;
+	int c;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "i:")) != -1)
+		switch (c) {
+		case 'i':
+			niters = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || niters < 1)
+		usage();
+
+	check();
+
+	base = bench(0);
+	prof = bench(512 * 1024);
+	printf("alloc+free %.1f ns off, %.1f ns at 512KB rate (%+.1f%%)\n",
+	    base, prof, (prof - base) / base * 100);
+	return (0);
+}
@@ -0,0 +1,214 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Producer/consumer throughput of list caches and sharded list caches,
+ * with single item and batched operations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/atomic.h"
+#include "pfl/cdefs.h"
+#include "pfl/listcache.h"
+#include "pfl/pfl.h"
+#include "pfl/shlistcache.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+
+#define MAXBATCH	64
+
+struct item {
+	struct psc_listentry	 lentry;
+	int			 v;
+};
+
+struct thrarg {
+	int			 start;
+	int			 n;
+};
+
+#define thrarg(thr)	((struct thrarg *)(thr)->pscthr_private)
+
+struct psc_listcache	 lc;
+struct pfl_shlistcache	 shlc;
+struct item		*items;
+psc_atomic32_t		 nconsumed;
+psc_atomic32_t		 nrunning;
+int			*seen;
+int			 sharded;
+int			 batch = 1;
+int			 total = 200000;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-b batch] [-n nitems] [-t maxthr]\n",
+	    __progname);
+	exit(1);
+}
+
+void
+producer_main(struct psc_thread *thr)
+{
+	struct thrarg *ta = thrarg(thr);
+	void *pv[MAXBATCH];
+	int i, j;
+
+	for (i = 0; i < ta->n; i += j) {
+		for (j = 0; j < batch && i + j < ta->n; j++)
+			pv[j] = &items[ta->start + i + j];
+		if (sharded)
+			shlc_addv(&shlc, pv, j);
+		else if (j == 1)
+			lc_add(&lc, pv[0]);
+		else
+			lc_addv(&lc, pv, j);
+	}
+	psc_atomic32_dec(&nrunning);
+}
+
+void
+consumer_main(__unusedx struct psc_thread *thr)
+{
+	void *pv[MAXBATCH];
+	struct item *it;
+	int i, n;
+
+	for (;;) {
+		if (sharded)
+			n = shlc_getn(&shlc, pv, batch);
+		else if (batch == 1) {
+			pv[0] = lc_getwait(&lc);
+			n = pv[0] ? 1 : 0;
+		} else
+			n = lc_getn(&lc, pv, batch);
+		if (n == 0)
+			break;
+		for (i = 0; i < n; i++) {
+			it = pv[i];
+			seen[it->v]++;
+		}
+		psc_atomic32_add(&nconsumed, n);
+	}
+	psc_atomic32_dec(&nrunning);
+}
+
+void
+run(int nthr)
+{
+	struct timespec ts0, ts;
+	struct psc_thread *thr;
+	int i, per;
+	double s;
+
+	if (sharded)
+		shlc_init(&shlc, "shlc", struct item, lentry, 0);
+	else
+		lc_init(&lc, "lc", struct item, lentry);
+	for (i = 0; i < total; i++) {
+		INIT_PSC_LISTENTRY(&items[i].lentry);
+		items[i].v = i;
+		seen[i] = 0;
+	}
+	psc_atomic32_set(&nconsumed, 0);
+	psc_atomic32_set(&nrunning, 2 * nthr);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < nthr; i++)
+		pscthr_init(0, consumer_main, 0, "cons%d", i);
+	per = total / nthr;
+	for (i = 0; i < nthr; i++) {
+		thr = pscthr_init(0, producer_main, sizeof(struct thrarg),
+		    "prod%d", i);
+		thrarg(thr)->start = i * per;
+		thrarg(thr)->n = i == nthr - 1 ? total - i * per : per;
+		pscthr_setready(thr);
+	}
+	while (psc_atomic32_read(&nconsumed) < total)
+		usleep(100);
+	PFL_GETTIMESPEC_MONO(&ts);
+
+	if (sharded)
+		shlc_kill(&shlc);
+	else
+		lc_kill(&lc);
+	while (psc_atomic32_read(&nrunning))
+		usleep(100);
+
+	for (i = 0; i < total; i++)
+		if (seen[i] != 1)
+			psc_fatalx("item %d consumed %d times", i, seen[i]);
+
+	timespecsub(&ts, &ts0, &ts);
+	s = ts.tv_sec + ts.tv_nsec * 1e-9;
+	printf("%-10s batch %2d %2d:%-2d %12.0f items/s\n",
+	    sharded ? "sharded" : "listcache", batch, nthr, nthr,
+	    total / s);
+
+	if (sharded)
+		shlc_destroy(&shlc);
+	else
+		pfl_listcache_destroy(&lc);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, nthr, maxthr = 32;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "b:n:t:")) != -1)
+		switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'n':
+			total = atoi(optarg);
+			break;
+		case 't':
+			maxthr = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || batch < 1 || batch > MAXBATCH || total < maxthr)
+		usage();
+
+	items = PSCALLOC(total * sizeof(*items));
+	seen = PSCALLOC(total * sizeof(*seen));
+
+	for (sharded = 0; sharded < 2; sharded++)
+		for (nthr = 1; nthr <= maxthr; nthr *= 2)
+			run(nthr);
+
+	PSCFREE(seen);
+	PSCFREE(items);
+	return (0);
+}
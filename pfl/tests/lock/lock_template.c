@@ -26,6 +26,9 @@
 
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +47,15 @@
 #define STARTWATCH(t) PFL_GETTIMEVAL(&(t)[0])
 #define STOPWATCH(t)  PFL_GETTIMEVAL(&(t)[1])
 
+#define BENCH_NOPS	20000		/* lock acquisitions per bench run */
+#define BENCH_WORK	200		/* loop iterations outside the lock */
+
+struct bench_lock {
+	const char	 *bl_name;
+	void		(*bl_acquire)(void);
+	void		(*bl_release)(void);
+};
+
 TEST_LOCK_TYPE	 lock = TEST_LOCK_INITIALIZER;
 atomic_t	 idx = ATOMIC_INIT(0);
 atomic_t	 nworkers = ATOMIC_INIT(0);
@@ -51,12 +63,22 @@ int		 nthrs = 32;
 int		 nruns = 4000;
 int		*buf;
 
+/* handoff benchmark state, protected by the lock under test */
+struct bench_lock *bench_cur;
+volatile int	 bench_go;
+int		 bench_nops;
+uint64_t	 bench_lastrel;
+pthread_t	 bench_lastowner;
+uint64_t	 bench_handoff;
+uint64_t	 bench_nhandoffs;
+
 __dead void
 usage(void)
 {
 	extern const char *__progname;
 
-	fprintf(stderr, "usage: %s [-n nruns] [-t nthr]\n", __progname);
+	fprintf(stderr, "usage: %s [-b] [-n nruns] [-t nthr]\n",
+	    __progname);
 	exit(1);
 }
 
@@ -75,15 +97,112 @@ thr_main(__unusedx struct psc_thread *thr)
 	atomic_dec(&nworkers);
 }
 
+void
+test_acquire(void)
+{
+	TEST_LOCK_ACQUIRE(&lock);
+}
+
+void
+test_release(void)
+{
+	TEST_LOCK_RELEASE(&lock);
+}
+
+struct bench_lock bench_locks[] = {
+	{ "current",	test_acquire,	test_release },
+#ifdef TEST_LOCK_BENCH_EXTRA
+	TEST_LOCK_BENCH_EXTRA
+#endif
+};
+
+uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	PFL_GETTIMESPEC_MONO(&ts);
+	return (ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec);
+}
+
+void
+bench_main(__unusedx struct psc_thread *thr)
+{
+	pthread_t self = pthread_self();
+	volatile int k;
+	uint64_t now;
+	int i;
+
+	while (!bench_go)
+		sched_yield();
+	for (i = 0; i < bench_nops; i++) {
+		bench_cur->bl_acquire();
+		now = bench_now();
+		if (bench_lastrel &&
+		    !pthread_equal(bench_lastowner, self)) {
+			bench_handoff += now - bench_lastrel;
+			bench_nhandoffs++;
+		}
+		bench_lastowner = self;
+		bench_lastrel = bench_now();
+		bench_cur->bl_release();
+
+		for (k = 0; k < BENCH_WORK; k++)
+			;
+	}
+	atomic_dec(&nworkers);
+}
+
+/*
+ * Measure lock handoff latency: the time from a release to the next
+ * acquisition by a different thread.
+ */
+void
+bench(void)
+{
+	uint64_t start, elapsed;
+	int n, i;
+	size_t l;
+
+	printf("%-14s %4s %12s %12s\n", "lock", "thrs", "handoff-ns",
+	    "ops/s");
+	for (l = 0; l < nitems(bench_locks); l++)
+		for (n = 2; n <= 64; n *= 2) {
+			bench_cur = &bench_locks[l];
+			bench_go = 0;
+			bench_nops = BENCH_NOPS / n;
+			bench_lastrel = 0;
+			bench_handoff = 0;
+			bench_nhandoffs = 0;
+
+			atomic_set(&nworkers, n);
+			for (i = 0; i < n; i++)
+				pscthr_init(0, bench_main, 0, "bench%d", i);
+			start = bench_now();
+			bench_go = 1;
+			while (atomic_read(&nworkers))
+				usleep(1000);
+			elapsed = bench_now() - start;
+
+			printf("%-14s %4d %12.0f %12.0f\n",
+			    bench_cur->bl_name, n, bench_nhandoffs ?
+			    (double)bench_handoff / bench_nhandoffs : 0.,
+			    bench_nops * n * 1e9 / elapsed);
+		}
+}
+
 int
 main(int argc, char *argv[])
 {
-	int slen, oldidx, c, i, *j;
+	int slen, oldidx, c, i, *j, dobench = 0;
 	struct timeval tv[2], res;
 
 	pfl_init();
-	while (((c = getopt(argc, argv, "n:t:")) != -1))
+	while (((c = getopt(argc, argv, "bn:t:")) != -1))
 		switch (c) {
+		case 'b':
+			dobench = 1;
+			break;
 		case 't':
 			nthrs = atoi(optarg);
 			break;
@@ -97,6 +216,11 @@ main(int argc, char *argv[])
 	if (argc)
 		usage();
 
+	if (dobench) {
+		bench();
+		exit(0);
+	}
+
 	buf = PSCALLOC(nruns * sizeof(*buf));
 
 	atomic_set(&nworkers, nthrs);
@@ -26,5 +26,39 @@
 #define TEST_LOCK_INITIALIZER	SPINLOCK_INIT
 #define TEST_LOCK_ACQUIRE(lk)	spinlock(lk)
 #define TEST_LOCK_RELEASE(lk)	freelock(lk)
+#define TEST_LOCK_BENCH_EXTRA	{ "sleep-backoff", legacy_acquire, legacy_release },
+
+#include <time.h>
+
+#include "pfl/atomic.h"
+#include "pfl/lock.h"
+
+/*
+ * The spinlock slow path before futexes, for comparison: yield between
+ * attempts and nap every PSL_SLEEP_NTRIES.
+ */
+psc_atomic32_t legacy_lock = PSC_ATOMIC32_INIT(PSL_UNLOCKED);
+
+void
+legacy_acquire(void)
+{
+	struct timespec ts;
+	int i;
+
+	for (i = 0; PSC_ATOMIC32_XCHG(&legacy_lock, PSL_LOCKED) ==
+	    PSL_LOCKED; sched_yield(), i++)
+		if (i >= PSL_SLEEP_NTRIES) {
+			ts.tv_sec = 0;
+			ts.tv_nsec = PSL_SLEEP_NSEC;
+			nanosleep(&ts, NULL);
+			i = 0;
+		}
+}
+
+void
+legacy_release(void)
+{
+	psc_atomic32_set(&legacy_lock, PSL_UNLOCKED);
+}
 
 #include "lock_template.c"
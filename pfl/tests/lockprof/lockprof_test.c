@@ -0,0 +1,265 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <pthread.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/lock.h"
+#include "pfl/lockprof.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/pthrutil.h"
+#include "pfl/str.h"
+#include "pfl/time.h"
+
+#define HOLD_USEC	20000
+
+/* remember the line of a lock call so its site can be found */
+#define AT(i, stmt)	do { lines[i] = __LINE__; stmt; } while (0)
+
+enum {
+	L_SPINHOLD,
+	L_SPINWAIT,
+	L_MUTHOLD,
+	L_MUTWAIT,
+	L_WRHOLD,
+	L_RDWAIT,
+	L_COND,
+	NLINES
+};
+
+int			 lines[NLINES];
+int			 niters = 1000000;
+volatile int		 started;
+
+psc_spinlock_t		 sl = SPINLOCK_INIT;
+struct pfl_mutex	 mut = PSC_MUTEX_INIT;
+struct pfl_rwlock	 rw;
+pthread_cond_t		 cond = PTHREAD_COND_INITIALIZER;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-b] [-n niters]\n", __progname);
+	exit(1);
+}
+
+void *
+spin_waiter(__unusedx void *arg)
+{
+	started = 1;
+	AT(L_SPINWAIT, spinlock(&sl));
+	freelock(&sl);
+	return (NULL);
+}
+
+void *
+mutex_waiter(__unusedx void *arg)
+{
+	started = 1;
+	AT(L_MUTWAIT, psc_mutex_lock(&mut));
+	psc_mutex_unlock(&mut);
+	return (NULL);
+}
+
+void *
+rd_waiter(__unusedx void *arg)
+{
+	started = 1;
+	AT(L_RDWAIT, pfl_rwlock_rdlock(&rw));
+	pfl_rwlock_unlock(&rw);
+	return (NULL);
+}
+
+/* hold a lock while another thread tries to take it */
+void
+contend(void *(*waiter)(void *))
+{
+	pthread_t pt;
+
+	started = 0;
+	if (pthread_create(&pt, NULL, waiter, NULL))
+		psc_fatal("pthread_create");
+	while (!started)
+		usleep(100);
+	usleep(HOLD_USEC);
+}
+
+const struct pfl_lockprof_stat *
+find(const struct pfl_lockprof_stat *st, int n, int line, int type)
+{
+	int i;
+
+	for (i = 0; i < n; i++, st++)
+		if (st->pls_line == line && st->pls_type == type &&
+		    strcmp(pfl_basename(st->pls_file),
+		    "lockprof_test.c") == 0)
+			return (st);
+	return (NULL);
+}
+
+void
+check(void)
+{
+	const struct pfl_lockprof_stat *p;
+	struct pfl_lockprof_stat *st;
+	struct timespec ts;
+	int i, n;
+
+	pfl_rwlock_init(&rw);
+
+	/* nothing is recorded while disabled */
+	spinlock(&sl);
+	freelock(&sl);
+	psc_mutex_lock(&mut);
+	psc_mutex_unlock(&mut);
+	n = pfl_lockprof_snapshot(&st);
+	pfl_assert(n == 0);
+	PSCFREE(st);
+
+	pfl_lockprof_enable(1);
+
+	AT(L_SPINHOLD, spinlock(&sl));
+	contend(spin_waiter);
+	freelock(&sl);
+
+	AT(L_MUTHOLD, psc_mutex_lock(&mut));
+	contend(mutex_waiter);
+	psc_mutex_unlock(&mut);
+
+	AT(L_WRHOLD, pfl_rwlock_wrlock(&rw));
+	contend(rd_waiter);
+	pfl_rwlock_unlock(&rw);
+
+	/* a condition wait drops the mutex and is not hold time */
+	AT(L_COND, psc_mutex_lock(&mut));
+	PFL_GETTIMESPEC(&ts);
+	ts.tv_nsec += HOLD_USEC * 2 * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	psc_cond_timedwait(&cond, &mut, &ts);
+	psc_mutex_unlock(&mut);
+
+	/* let the waiters finish */
+	usleep(HOLD_USEC);
+
+	n = pfl_lockprof_snapshot(&st);
+	for (i = 1; i < n; i++)
+		pfl_assert(st[i - 1].pls_wait >= st[i].pls_wait);
+
+	p = find(st, n, lines[L_SPINHOLD], PFL_LOCKPROF_SPIN);
+	pfl_assert(p && p->pls_nacq == 1 && p->pls_ncontended == 0);
+	pfl_assert(p->pls_hold >= HOLD_USEC * 1000);
+	pfl_assert(p->pls_holdmax == p->pls_hold);
+	p = find(st, n, lines[L_SPINWAIT], PFL_LOCKPROF_SPIN);
+	pfl_assert(p && p->pls_nacq == 1 && p->pls_ncontended == 1);
+	pfl_assert(p->pls_wait >= HOLD_USEC * 1000);
+	pfl_assert(p->pls_waitmax == p->pls_wait);
+
+	p = find(st, n, lines[L_MUTHOLD], PFL_LOCKPROF_MUTEX);
+	pfl_assert(p && p->pls_nacq == 1 && p->pls_ncontended == 0);
+	pfl_assert(p->pls_hold >= HOLD_USEC * 1000);
+	p = find(st, n, lines[L_MUTWAIT], PFL_LOCKPROF_MUTEX);
+	pfl_assert(p && p->pls_nacq == 1 && p->pls_ncontended == 1);
+	pfl_assert(p->pls_wait >= HOLD_USEC * 1000);
+
+	p = find(st, n, lines[L_WRHOLD], PFL_LOCKPROF_WRLOCK);
+	pfl_assert(p && p->pls_nacq == 1);
+	pfl_assert(p->pls_hold >= HOLD_USEC * 1000);
+	p = find(st, n, lines[L_RDWAIT], PFL_LOCKPROF_RDLOCK);
+	pfl_assert(p && p->pls_nacq == 1 && p->pls_ncontended == 1);
+	pfl_assert(p->pls_wait >= HOLD_USEC * 1000);
+
+	p = find(st, n, lines[L_COND], PFL_LOCKPROF_MUTEX);
+	pfl_assert(p && p->pls_nacq == 1);
+	pfl_assert(p->pls_hold < HOLD_USEC * 1000);
+	PSCFREE(st);
+
+	/* reset keeps sites but drops them from snapshots */
+	pfl_lockprof_enable(0);
+	pfl_lockprof_reset();
+	n = pfl_lockprof_snapshot(&st);
+	pfl_assert(n == 0);
+	PSCFREE(st);
+}
+
+double
+bench(void)
+{
+	struct timespec ts0, ts1;
+	int i;
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < niters; i++) {
+		spinlock(&sl);
+		freelock(&sl);
+	}
+	PFL_GETTIMESPEC_MONO(&ts1);
+	timespecsub(&ts1, &ts0, &ts1);
+	return ((ts1.tv_sec * 1e9 + ts1.tv_nsec) / niters);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, dobench = 0;
+	double off, on;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "bn:")) != -1)
+		switch (c) {
+		case 'b':
+			dobench = 1;
+			break;
+		case 'n':
+			niters = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc)
+		usage();
+
+	check();
+
+	if (dobench) {
+		off = bench();
+		pfl_lockprof_enable(1);
+		on = bench();
+		pfl_lockprof_enable(0);
+		printf("ns per uncontended spinlock+freelock: "
+		    "disabled %.2f, enabled %.2f\n", off, on);
+	}
+	exit(0);
+}
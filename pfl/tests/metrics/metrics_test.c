@@ -0,0 +1,159 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfl/cdefs.h"
+#include "pfl/log.h"
+#include "pfl/meter.h"
+#include "pfl/metrics.h"
+#include "pfl/opstats.h"
+#include "pfl/pfl.h"
+#include "pfl/pool.h"
+#include "pfl/str.h"
+#include "pfl/thread.h"
+
+struct widget {
+	struct psc_listentry	wi_lentry;
+};
+
+struct pfl_meter	mtr;
+struct psc_poolmaster	widget_poolmaster;
+
+void
+collect(FILE *fp, void *arg)
+{
+	static const struct pfl_metrics_field f[] = {
+		{ "test_widgets", PMFT_GAUGE, 0, "widgets" },
+	};
+	struct pfl_metrics_row r;
+
+	memset(&r, 0, sizeof(r));
+	strlcpy(r.pmr_name, "w", sizeof(r.pmr_name));
+	r.pmr_vals[0] = *(int *)arg;
+	pfl_metrics_emit(fp, f, nitems(f), "widget", &r, 1);
+}
+
+/*
+ * Read everything the exporter sends on one connection.
+ */
+char *
+scrape(const char *path, const char *req)
+{
+	struct sockaddr_un saun;
+	size_t len = 0;
+	char *buf;
+	ssize_t n;
+	int s;
+
+	s = socket(AF_LOCAL, SOCK_STREAM, 0);
+	if (s == -1)
+		psc_fatal("socket");
+	memset(&saun, 0, sizeof(saun));
+	saun.sun_family = AF_LOCAL;
+	strlcpy(saun.sun_path, path, sizeof(saun.sun_path));
+	if (connect(s, (struct sockaddr *)&saun, sizeof(saun)) == -1)
+		psc_fatal("connect %s", path);
+	if (req && write(s, req, strlen(req)) == -1)
+		psc_fatal("write");
+	buf = malloc(1);
+	for (;;) {
+		buf = realloc(buf, len + 4096 + 1);
+		n = read(s, buf + len, 4096);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	buf[len] = '\0';
+	close(s);
+	return (buf);
+}
+
+int
+main(void)
+{
+	struct pfl_histogram *phg;
+	struct psc_poolmgr *pool;
+	struct pfl_opstat *opst;
+	char path[64], *buf;
+	void *wv[3];
+	int i, nwidgets = 42;
+	size_t len;
+
+	pfl_init();
+
+	opst = pfl_opstat_init("test.q\"uote");
+	pfl_opstat_add(opst, 17);
+	phg = pfl_histogram_init("test.lat");
+	pfl_histogram_record(phg, 100);
+	pfl_meter_init(&mtr, 10, "test.mtr");
+	mtr.pm_cur = 3;
+	pfl_metrics_register("test", collect, &nwidgets);
+	pfl_metrics_register("test", collect, NULL);
+
+	psc_poolmaster_init(&widget_poolmaster, struct widget,
+	    wi_lentry, PPMF_AUTO, 0, 0, 0, NULL, "widget");
+	pool = psc_poolmaster_getmgr(&widget_poolmaster);
+	for (i = 0; i < 3; i++)
+		wv[i] = psc_pool_get(pool);
+	for (i = 0; i < 3; i++)
+		psc_pool_return(pool, wv[i]);
+
+	buf = pfl_metrics_snapshot(&len);
+	pfl_assert(strlen(buf) == len);
+	pfl_assert(strstr(buf, "# TYPE pfl_opstat counter\n"));
+	pfl_assert(strstr(buf, "pfl_opstat_total{name=\"test.q\\\"uote\"} 17\n"));
+	pfl_assert(strstr(buf, "pfl_histogram{name=\"test.lat\",quantile=\"0.5\"} 103\n"));
+	pfl_assert(strstr(buf, "pfl_histogram_count{name=\"test.lat\"} 1\n"));
+	pfl_assert(strstr(buf, "pfl_pool_gets_total{pool=\"widget\"} 3\n"));
+	pfl_assert(strstr(buf, "pfl_meter_current{meter=\"test.mtr\"} 3\n"));
+	pfl_assert(strstr(buf, "pfl_meter_max{meter=\"test.mtr\"} 10\n"));
+	pfl_assert(strstr(buf, "# HELP test_widgets widgets\n"
+	    "test_widgets{widget=\"w\"} 42\n"));
+	pfl_assert(strcmp(buf + len - 6, "# EOF\n") == 0);
+	free(buf);
+
+	snprintf(path, sizeof(path), "/tmp/metrics_test.%d.sock",
+	    (int)getpid());
+	pfl_metricsthr_spawn(0, path, "metricsthr");
+
+	buf = scrape(path, "GET /metrics HTTP/1.0\r\n\r\n");
+	pfl_assert(strncmp(buf, "HTTP/1.0 200 OK\r\n", 17) == 0);
+	pfl_assert(strstr(buf, "\r\n\r\n# TYPE"));
+	pfl_assert(strstr(buf, "pfl_opstat_total{name=\"metrics.scrape\"} "));
+	pfl_assert(strcmp(buf + strlen(buf) - 6, "# EOF\n") == 0);
+	free(buf);
+
+	buf = scrape(path, "\n");
+	pfl_assert(strncmp(buf, "# TYPE", 6) == 0);
+	free(buf);
+
+	unlink(path);
+	exit(0);
+}
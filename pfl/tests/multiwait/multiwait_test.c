@@ -26,17 +26,21 @@
  */
 
 #include <err.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "pfl/atomic.h"
 #include "pfl/cdefs.h"
 #include "pfl/pfl.h"
 #include "pfl/log.h"
 #include "pfl/multiwait.h"
+#include "pfl/time.h"
 
 struct thr {
 	pthread_t			t_pthread;
@@ -48,6 +52,13 @@ struct pfl_multiwaitcond mastermlc;
 int nthreads = 32;
 int iterations = 1000;
 
+/* benchmark state */
+struct pfl_multiwait	 ackml;
+struct pfl_multiwaitcond ackmlc;
+psc_atomic64_t		 nwoken;
+pthread_barrier_t	 startbar;
+volatile int		 done;
+
 void *
 thr_main(void *arg)
 {
@@ -62,12 +73,148 @@ thr_main(void *arg)
 	return (NULL);
 }
 
+uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec);
+}
+
+/*
+ * Latency: wake a thread through one of its conditions and wait for it
+ * to acknowledge, so each iteration is one wakeup each way.
+ */
+void *
+bench_pong(void *arg)
+{
+	struct thr *t = arg;
+	void *p;
+	int rc;
+
+	/* Rearm before acknowledging so the next wakeup is not missed. */
+	while (!done) {
+		rc = pfl_multiwait_msecs(&t->t_ml, &p, 100);
+		pfl_multiwait_entercritsect(&t->t_ml);
+		if (rc == 0)
+			pfl_multiwaitcond_wakeup(&ackmlc);
+	}
+	pfl_multiwait_leavecritsect(&t->t_ml);
+	return (NULL);
+}
+
+void *
+bench_waiter(void *arg)
+{
+	struct thr *t = arg;
+	void *p;
+
+	pthread_barrier_wait(&startbar);
+	while (!done)
+		if (pfl_multiwait_msecs(&t->t_ml, &p, 100) == 0)
+			psc_atomic64_inc(&nwoken);
+	return (NULL);
+}
+
+/*
+ * Count the waiters currently able to take a wakeup.
+ */
+int
+nparked(struct thr *threads)
+{
+	int j, n = 0, state;
+
+	for (j = 0; j < nthreads; j++) {
+		state = psc_atomic32_read(&threads[j].t_ml.mw_state);
+		if (state == PMWS_ARMED || state == PMWS_ASLEEP)
+			n++;
+	}
+	return (n);
+}
+
+void
+bench(struct thr *threads)
+{
+	uint64_t t0, dt, deadline;
+	struct thr *t;
+	int64_t n;
+	int j, rc;
+	void *p;
+
+	pfl_multiwait_init(&ackml, "ack");
+	pfl_multiwaitcond_init(&ackmlc, NULL, 0, "ack");
+	pfl_multiwait_addcond(&ackml, &ackmlc);
+
+	t = &threads[0];
+	pfl_multiwait_entercritsect(&ackml);
+	pfl_multiwait_entercritsect(&t->t_ml);
+	j = pthread_create(&t->t_pthread, NULL, bench_pong, t);
+	if (j)
+		errx(1, "pthread_create: %s", strerror(j));
+	t0 = now_ns();
+	for (j = 0; j < iterations; j++) {
+		pfl_multiwaitcond_wakeup(j % 2 ? &t->t_mlc : &mastermlc);
+		if (pfl_multiwait(&ackml, &p))
+			psc_fatalx("ack wait");
+		pfl_multiwait_entercritsect(&ackml);
+	}
+	dt = now_ns() - t0;
+	pfl_multiwait_leavecritsect(&ackml);
+	done = 1;
+	pthread_join(t->t_pthread, NULL);
+	printf("round trip latency: %"PRIu64" ns\n", dt / iterations);
+
+	/*
+	 * Throughput: every thread waits on the shared condition, each
+	 * wakeup of which goes to exactly one of them.
+	 */
+	done = 0;
+	rc = pthread_barrier_init(&startbar, NULL, nthreads + 1);
+	if (rc)
+		errx(1, "pthread_barrier_init: %s", strerror(rc));
+	for (j = 0, t = threads; j < nthreads; j++, t++) {
+		rc = pthread_create(&t->t_pthread, NULL, bench_waiter,
+		    t);
+		if (rc)
+			errx(1, "pthread_create: %s", strerror(rc));
+	}
+
+	/*
+	 * A wakeup with nobody waiting is dropped, so wait for every
+	 * waiter to park before timing and only fire while one is.
+	 */
+	pthread_barrier_wait(&startbar);
+	while (nparked(threads) < nthreads)
+		sched_yield();
+	t0 = now_ns();
+	for (j = 0; j < iterations; j++) {
+		while (nparked(threads) == 0)
+			sched_yield();
+		pfl_multiwaitcond_wakeup(&mastermlc);
+	}
+	deadline = t0 + UINT64_C(10000000000);
+	while (psc_atomic64_read(&nwoken) < iterations &&
+	    now_ns() < deadline)
+		sched_yield();
+	dt = now_ns() - t0;
+	done = 1;
+	for (j = 0, t = threads; j < nthreads; j++, t++)
+		pthread_join(t->t_pthread, NULL);
+	pthread_barrier_destroy(&startbar);
+	n = psc_atomic64_read(&nwoken);
+	printf("%d threads: %"PRId64" of %d delivered, "
+	    "%"PRIu64" ns per delivered wakeup\n",
+	    nthreads, n, iterations, n ? dt / n : 0);
+}
+
 __dead void
 usage(void)
 {
 	extern const char *__progname;
 
-	fprintf(stderr, "%s [-i iterations] [-n nthreads]\n", __progname);
+	fprintf(stderr, "%s [-b] [-i iterations] [-n nthreads]\n",
+	    __progname);
 	exit(1);
 }
 
@@ -75,12 +222,15 @@ int
 main(int argc, char *argv[])
 {
 	struct thr *t, *threads;
-	int rc, c, j;
+	int rc, c, j, bflag = 0;
 	long l;
 
 	pfl_init();
-	while ((c = getopt(argc, argv, "i:n:")) != -1)
+	while ((c = getopt(argc, argv, "bi:n:")) != -1)
 		switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
 		case 'i':
 			l = strtol(optarg, NULL, 10);
 			if (l < 0 || l > INT_MAX)
@@ -116,12 +266,21 @@ main(int argc, char *argv[])
 		if (rc)
 			psc_fatal("addcond");
 
+		if (bflag)
+			continue;
 		rc = pthread_create(&t->t_pthread, NULL, thr_main, t);
 		if (rc)
 			errx(1, "pthread_create: %s", strerror(rc));
 		sched_yield();
 	}
 
+	if (bflag) {
+		if (nthreads == 0)
+			errx(1, "benchmark needs at least one thread");
+		bench(threads);
+		exit(0);
+	}
+
 	for (j = 0; j < iterations; j++) {
 		pfl_multiwaitcond_wakeup(&mastermlc);
 		usleep(100);
@@ -0,0 +1,248 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/atomic.h"
+#include "pfl/log.h"
+#include "pfl/opstats.h"
+#include "pfl/pfl.h"
+#include "pfl/time.h"
+
+#define NTHR_MAX	64
+
+struct pfl_opstat	*opst;
+psc_atomic64_t		 shared = PSC_ATOMIC64_INIT(0);
+pthread_barrier_t	 barrier;
+int			 niters = 1000000;
+int			 use_atomic;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-b] [-n niters] [-t maxthr]\n",
+	    __progname);
+	exit(1);
+}
+
+void *
+incr_main(__unusedx void *arg)
+{
+	int i;
+
+	pthread_barrier_wait(&barrier);
+	if (use_atomic)
+		for (i = 0; i < niters; i++)
+			psc_atomic64_inc(&shared);
+	else
+		for (i = 0; i < niters; i++)
+			pfl_opstat_incr(opst);
+	return (NULL);
+}
+
+/*
+ * Run nthr threads each bumping a counter niters times.  Returns the
+ * aggregate rate in increments per second.
+ */
+double
+run(int nthr)
+{
+	pthread_t pt[NTHR_MAX];
+	struct timespec ts0;
+	uint64_t ns;
+	int i;
+
+	pthread_barrier_init(&barrier, NULL, nthr + 1);
+	for (i = 0; i < nthr; i++)
+		if (pthread_create(&pt[i], NULL, incr_main, NULL))
+			psc_fatal("pthread_create");
+	PFL_GETTIMESPEC_MONO(&ts0);
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < nthr; i++)
+		pthread_join(pt[i], NULL);
+	ns = pfl_elapsed_ns(&ts0);
+	pthread_barrier_destroy(&barrier);
+	return (1e9 * nthr * niters / ns);
+}
+
+void
+check(void)
+{
+	struct pfl_opstat *a, *b;
+	int64_t v;
+
+	/* exited threads' shards are folded into the lifetime value */
+	opst = pfl_opstat_init("test.check");
+	niters = 10000;
+	run(4);
+	pfl_assert(pfl_opstat_read(opst) == 40000);
+
+	/* this thread's shard is live and counted on read */
+	pfl_opstat_add(opst, 5);
+	pfl_opstat_decr(opst);
+	pfl_assert(pfl_opstat_read(opst) == 40004);
+
+	pfl_opstat_set(opst, 7);
+	pfl_assert(pfl_opstat_read(opst) == 7);
+	pfl_opstat_incr(opst);
+	pfl_assert(pfl_opstat_read(opst) == 8);
+
+	/* the OPSTAT_* macros feed the same counter */
+	OPSTAT_INCR("test.check");
+	OPSTAT_ADD("test.check", 2);
+	OPSTAT_SUB("test.check", 1);
+	pfl_assert(pfl_opstat_read(opst) == 10);
+
+	/* a reused shard slot must not inherit old counts */
+	a = pfl_opstat_init("test.reuse.a");
+	pfl_opstat_add(a, 100);
+	v = a->opst_idx;
+	pfl_opstat_destroy(a);
+	b = pfl_opstat_init("test.reuse.b");
+	pfl_assert(b->opst_idx == v);
+	pfl_assert(pfl_opstat_read(b) == 0);
+	pfl_opstat_incr(b);
+	pfl_assert(pfl_opstat_read(b) == 1);
+	pfl_opstat_destroy(b);
+}
+
+void *
+record_main(void *arg)
+{
+	struct pfl_histogram *phg = arg;
+	uint64_t v;
+
+	for (v = 1; v <= 1000; v++)
+		pfl_histogram_record(phg, v);
+	return (NULL);
+}
+
+void
+check_histogram(void)
+{
+	struct pfl_histogram_snap s0, s1;
+	struct pfl_histogram *phg;
+	pthread_t pt[4];
+	uint64_t v, p;
+	int i, idx;
+
+	phg = pfl_histogram_init("test.histo");
+
+	/* small values are exact; larger ones within 1/2^precision */
+	for (v = 0; v < 8; v++)
+		pfl_assert(pfl_histogram_bucket(phg, v) == (int)v);
+	for (v = 8; v < 100000; v += 7)
+		pfl_assert(pfl_histogram_bucket(phg, v) <
+		    pfl_histogram_bucket(phg, v + (v >> 3) + 1));
+	pfl_assert(pfl_histogram_bucket(phg, UINT64_MAX) ==
+	    phg->phg_nbuckets - 1);
+
+	/* recordings from exited threads and this thread are summed */
+	for (i = 0; i < 4; i++)
+		if (pthread_create(&pt[i], NULL, record_main, phg))
+			psc_fatal("pthread_create");
+	for (i = 0; i < 4; i++)
+		pthread_join(pt[i], NULL);
+	record_main(phg);
+
+	pfl_histogram_snapshot(phg, &s0);
+	pfl_assert(s0.phs_count == 5000);
+	pfl_assert(s0.phs_sum == 5 * 500500);
+	for (i = 1; i <= 100; i++) {
+		p = pfl_histogram_snap_percentile(&s0, i);
+		pfl_assert(p >= (uint64_t)i * 10);
+		pfl_assert(p <= (uint64_t)i * 10 + (i * 10 >> 3));
+	}
+
+	pfl_histogram_snapshot(phg, &s1);
+	pfl_histogram_snap_merge(&s1, &s0);
+	pfl_assert(s1.phs_count == 10000);
+	pfl_assert(pfl_histogram_snap_percentile(&s1, 50) ==
+	    pfl_histogram_snap_percentile(&s0, 50));
+	pfl_histogram_snap_free(&s0);
+	pfl_histogram_snap_free(&s1);
+
+	/* freed histogram slots are reused rather than new ones taken */
+	idx = phg->phg_idx;
+	pfl_histogram_destroy(phg);
+	phg = pfl_histogram_init("test.histo");
+	pfl_assert(phg->phg_idx <= idx);
+	pfl_histogram_snapshot(phg, &s0);
+	pfl_assert(s0.phs_count == 0 && s0.phs_sum == 0);
+	pfl_assert(pfl_histogram_snap_percentile(&s0, 99) == 0);
+	pfl_histogram_snap_free(&s0);
+	pfl_histogram_destroy(phg);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, i, bench = 0, maxthr = 4, total = 0;
+	double rs, ra;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "bn:t:")) != -1)
+		switch (c) {
+		case 'b':
+			bench = 1;
+			maxthr = NTHR_MAX;
+			break;
+		case 'n':
+			niters = atoi(optarg);
+			break;
+		case 't':
+			maxthr = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || maxthr < 1 || maxthr > NTHR_MAX)
+		usage();
+
+	check();
+	check_histogram();
+
+	if (!bench)
+		niters = 100000;
+	opst = pfl_opstat_init("test.bench");
+	printf("%8s %16s %16s\n", "threads", "sharded incr/s",
+	    "atomic incr/s");
+	for (i = 1; i <= maxthr; i *= 2) {
+		use_atomic = 0;
+		rs = run(i);
+		total += i;
+		use_atomic = 1;
+		ra = run(i);
+		printf("%8d %16.0f %16.0f\n", i, rs, ra);
+	}
+	pfl_assert(pfl_opstat_read(opst) == (int64_t)niters * total);
+	exit(0);
+}
@@ -0,0 +1,220 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+
+/*
+ * Check that PPMF_REGION pools carve items from aligned regions and give
+ * memory back a whole region at a time, and compare get/return cost
+ * against an ordinary pool.  Also exercise background reclamation.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/cdefs.h"
+#include "pfl/list.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/pool.h"
+#include "pfl/random.h"
+#include "pfl/time.h"
+
+struct item {
+	struct psc_listentry	it_lentry;
+	char			it_buf[1000];
+};
+
+struct psc_poolmaster	 region_poolmaster;
+struct psc_poolmaster	 plain_poolmaster;
+struct psc_poolmaster	 idle_poolmaster;
+struct psc_poolmaster	 busy_poolmaster;
+struct psc_poolmaster	 churn_poolmaster;
+int			 nitems = 10000;
+int			 niters = 200000;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-i niters] [-n nitems]\n",
+	    __progname);
+	exit(1);
+}
+
+void
+check(struct psc_poolmgr *m)
+{
+	struct item **v, *it;
+	int i, n;
+
+	v = PSCALLOC(nitems * sizeof(*v));
+
+	pfl_assert(psc_pool_try_grow(m, nitems) == nitems);
+	pfl_assert(m->ppm_total == nitems);
+	pfl_assert(m->ppm_nregions == (int)howmany(nitems,
+	    (m->ppm_regionsz - 64) / m->ppm_stride));
+	printf("%d items in %d regions of %zu bytes, %d on hugetlbfs, "
+	    "~%"PRId64" TLB entries\n", nitems, m->ppm_nregions,
+	    m->ppm_regionsz, m->ppm_nhugetlb, pfl_pool_tlbpages(m));
+
+	for (i = 0; i < nitems; i++) {
+		v[i] = it = psc_pool_get(m);
+		pfl_assert(((uintptr_t)it & 15) == 0);
+		memset(it->it_buf, i, sizeof(it->it_buf));
+	}
+	for (i = 0; i < nitems; i++) {
+		pfl_assert(v[i]->it_buf[0] == (char)i);
+		pfl_assert(v[i]->it_buf[sizeof(it->it_buf) - 1] ==
+		    (char)i);
+	}
+
+	/* hold one item so its region cannot be released */
+	for (i = 1; i < nitems; i++)
+		psc_pool_return(m, v[i]);
+	n = psc_pool_try_shrink(m, nitems - 1);
+	pfl_assert(n == nitems - 1);
+	pfl_assert(m->ppm_total == 1);
+	pfl_assert(m->ppm_nregions == 1);
+
+	/* destroyed items are reused before new regions are mapped */
+	pfl_assert(psc_pool_try_grow(m, 10) == 10);
+	pfl_assert(m->ppm_nregions == 1);
+
+	psc_pool_return(m, v[0]);
+	n = psc_pool_try_shrink(m, 11);
+	pfl_assert(n == 11);
+	pfl_assert(m->ppm_total == 0);
+	pfl_assert(m->ppm_nregions == 0);
+	pfl_assert(psc_listhd_empty(&m->ppm_holes));
+
+	PSCFREE(v);
+}
+
+/*
+ * Check that the reclaim thread trims idle pools to their minimum and
+ * releases free items while over the RSS budget.
+ */
+void
+check_reclaim(void)
+{
+	struct psc_poolmgr *idle, *busy, *churn;
+	int i;
+
+	psc_poolmaster_init(&idle_poolmaster, struct item, it_lentry,
+	    PPMF_IDLEREAP, 0, 10, 0, NULL, "idle");
+	psc_poolmaster_init(&busy_poolmaster, struct item, it_lentry,
+	    0, 0, 0, 0, NULL, "busy");
+	idle = psc_poolmaster_getmgr(&idle_poolmaster);
+	busy = psc_poolmaster_getmgr(&busy_poolmaster);
+	psc_pool_try_grow(idle, 1000);
+	psc_pool_try_grow(busy, 1000);
+
+	pfl_poolreclaim_idle = 1;
+	pfl_poolreclaimthr_spawn(0, "poolreclaimthr");
+	for (i = 0; i < 50 && psc_pool_gettotal(idle) > 10; i++)
+		usleep(100000);
+	pfl_assert(psc_pool_gettotal(idle) == 10);
+
+	/* busy pools are left alone until memory is tight */
+	pfl_assert(psc_pool_gettotal(busy) == 1000);
+	pfl_poolreclaim_budget = 1;
+	for (i = 0; i < 50 && psc_pool_gettotal(busy) == 1000; i++)
+		usleep(100000);
+	pfl_assert(psc_pool_gettotal(busy) < 1000);
+
+	/* pools may be destroyed while the reclaim thread holds them */
+	for (i = 0; i < 30; i++) {
+		psc_poolmaster_init(&churn_poolmaster, struct item,
+		    it_lentry, PPMF_IDLEREAP, 0, 0, 0, NULL, "churn");
+		churn = psc_poolmaster_getmgr(&churn_poolmaster);
+		psc_pool_try_grow(churn, 100);
+		usleep(70000);
+		psc_pool_try_shrink(churn, psc_pool_gettotal(churn));
+		pfl_poolmaster_destroy(&churn_poolmaster);
+	}
+	pfl_poolreclaim_budget = 0;
+}
+
+void
+bench(const char *name, struct psc_poolmgr *m)
+{
+	struct timespec ts0;
+	struct item **v;
+	double ns;
+	int i, j;
+
+	v = PSCALLOC(nitems * sizeof(*v));
+	psc_pool_try_grow(m, nitems);
+	for (i = 0; i < nitems; i++) {
+		v[i] = psc_pool_get(m);
+		v[i]->it_buf[0] = 1;
+	}
+
+	/* touch items at random to expose TLB misses */
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = j = 0; i < niters; i++)
+		j += v[psc_random32u(nitems)]->it_buf[0];
+	ns = pfl_elapsed_ns(&ts0);
+	pfl_assert(j == niters);
+	printf("%-8s %8.1f ns/touch, %"PRId64" TLB entries\n", name,
+	    ns / niters, pfl_pool_tlbpages(m));
+
+	for (i = 0; i < nitems; i++)
+		psc_pool_return(m, v[i]);
+	PSCFREE(v);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "i:n:")) != -1)
+		switch (c) {
+		case 'i':
+			niters = atoi(optarg);
+			break;
+		case 'n':
+			nitems = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || niters < 0 || nitems < 2)
+		usage();
+
+	psc_poolmaster_init(&region_poolmaster, struct item, it_lentry,
+	    PPMF_REGION, 0, 0, 0, NULL, "region");
+	psc_poolmaster_init(&plain_poolmaster, struct item, it_lentry,
+	    0, 0, 0, 0, NULL, "plain");
+
+	check(psc_poolmaster_getmgr(&region_poolmaster));
+	bench("plain", psc_poolmaster_getmgr(&plain_poolmaster));
+	bench("region", psc_poolmaster_getmgr(&region_poolmaster));
+	check_reclaim();
+	return (0);
+}
@@ -21,27 +21,44 @@
  * %END_LICENSE%
  */
 
+
+/*
+ * Check refmgr lookup, caching and CLOCK reclamation semantics and
+ * measure multi-threaded lookup and reference throughput.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pfl/atomic.h"
 #include "pfl/cdefs.h"
+#include "pfl/pfl.h"
+#include "pfl/random.h"
 #include "pfl/refmgr.h"
-
-struct psc_refmgr	 refmgr;
-psc_atomic32_t		 c = PSC_ATOMIC32_INIT(0);
+#include "pfl/thread.h"
+#include "pfl/time.h"
 
 struct obj {
 	int	obj_val;
 };
 
+struct psc_refmgr	 refmgr;
+psc_atomic32_t		 ncreated = PSC_ATOMIC32_INIT(0);
+psc_atomic32_t		 ndestroyed = PSC_ATOMIC32_INIT(0);
+psc_atomic32_t		 nrunning;
+int			 niters = 200000;
+int			 nkeys = 1024;
+int			 nthr = 4;
+
 __dead void
 usage(void)
 {
 	extern const char *__progname;
 
-	fprintf(stderr, "usage: %s\n", __progname);
+	fprintf(stderr, "usage: %s [-i niters] [-k nkeys] [-t nthr]\n",
+	    __progname);
 	exit(1);
 }
 
@@ -50,32 +67,139 @@ init_obj(__unusedx struct psc_poolmgr *m, void *p)
 {
 	struct obj *o = p;
 
-	o->obj_val = psc_atomic32_inc_getnew(&c);
-	printf("created obj %d\n", o->obj_val);
+	o->obj_val = psc_atomic32_inc_getnew(&ncreated);
 	return (0);
 }
 
 void
-destroy_obj(void *p)
+destroy_obj(__unusedx void *p)
 {
-	struct obj *o = p;
+	psc_atomic32_inc(&ndestroyed);
+}
+
+void
+check(void)
+{
+	struct psc_refmgr prm;
+	struct obj *o, *p;
+	int i, n;
+
+	/*
+	 * Cached objects are found again until the CLOCK hand passes.
+	 * Size the pool up front so it is not reclaimed to make room.
+	 */
+	pfl_refmgr_init(&prm, PRMF_LINGER | PRMF_AUTOSIZE, sizeof(*o),
+	    128, 0, 0, init_obj, destroy_obj, "check-linger");
+	pfl_assert(pfl_refmgr_findobj(&prm, 1) == NULL);
+	o = pfl_refmgr_getobj(&prm, 1);
+	pfl_assert(psc_atomic32_read(&ncreated) == 1);
+	pfl_assert(pfl_obj_getkey(&prm, o) == 1);
+	pfl_obj_share(&prm, o);
+	p = pfl_refmgr_findobj(&prm, 1);
+	pfl_assert(p == o);
+	pfl_obj_incref(&prm, p);
+	pfl_obj_decref(&prm, p);
+	pfl_obj_decref(&prm, p);
+	pfl_obj_decref(&prm, o);
+	pfl_assert(psc_atomic32_read(&ndestroyed) == 0);
+	pfl_assert(pfl_refmgr_findobj(&prm, 1) == o);
+	pfl_obj_decref(&prm, o);
+
+	for (i = 2; i < 102; i++)
+		pfl_obj_decref(&prm, pfl_refmgr_getobj(&prm, i));
+	pfl_assert(psc_atomic32_read(&ncreated) == 101);
 
-	printf("destroy obj %d\n", o->obj_val);
+	/* held objects survive the sweep */
+	o = pfl_refmgr_findobj(&prm, 50);
+	n = pfl_refmgr_reclaim(&prm, 1000);
+	pfl_assert(n == 100);
+	pfl_assert(pfl_refmgr_findobj(&prm, 2) == NULL);
+	pfl_obj_decref(&prm, o);
+	n = pfl_refmgr_reclaim(&prm, 1000);
+	pfl_assert(n == 1);
+	pfl_assert(psc_atomic32_read(&ndestroyed) == 101);
+	pfl_refmgr_destroy(&prm);
+
+	/* without LINGER, the last reference destroys */
+	pfl_refmgr_init(&prm, PRMF_AUTOSIZE, sizeof(*o), 0, 0, 0,
+	    init_obj, destroy_obj, "check-nolinger");
+	o = pfl_refmgr_getobj(&prm, 7);
+	pfl_obj_share(&prm, o);
+	pfl_obj_incref(&prm, o);
+	pfl_obj_decref(&prm, o);
+	pfl_assert(pfl_refmgr_findobj(&prm, 7) == o);
+	pfl_obj_decref(&prm, o);
+	pfl_obj_decref(&prm, o);
+	pfl_assert(psc_atomic32_read(&ndestroyed) == 102);
+	pfl_assert(pfl_refmgr_findobj(&prm, 7) == NULL);
+	pfl_refmgr_destroy(&prm);
+}
+
+void
+lookup_main(__unusedx struct psc_thread *thr)
+{
+	struct obj *o;
+	int i;
+
+	for (i = 0; i < niters; i++) {
+		o = pfl_refmgr_getobj(&refmgr, psc_random32u(nkeys));
+		pfl_assert(o->obj_val > 0);
+		pfl_obj_incref(&refmgr, o);
+		pfl_obj_decref(&refmgr, o);
+		pfl_obj_decref(&refmgr, o);
+	}
+	psc_atomic32_dec(&nrunning);
+}
+
+void
+bench(int n)
+{
+	struct timespec ts0;
+	double ns;
+	int i;
+
+	psc_atomic32_set(&nrunning, n);
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < n; i++)
+		pscthr_init(0, lookup_main, 0, "lookup%d", i);
+	while (psc_atomic32_read(&nrunning))
+		usleep(100);
+	ns = pfl_elapsed_ns(&ts0);
+	printf("threads %2d keys %6d %8.3f Mlookups/s\n", n, nkeys,
+	    (double)n * niters / ns * 1e3);
 }
 
 int
 main(int argc, char *argv[])
 {
-	struct obj *o;
+	int c;
 
 	pfl_init();
-	if (getopt(argc, argv, "") != -1)
-		usage();
+	while ((c = getopt(argc, argv, "i:k:t:")) != -1)
+		switch (c) {
+		case 'i':
+			niters = atoi(optarg);
+			break;
+		case 'k':
+			nkeys = atoi(optarg);
+			break;
+		case 't':
+			nthr = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
 	argc -= optind;
-	if (argc)
+	if (argc || niters < 0 || nkeys < 1 || nthr < 1)
 		usage();
 
-	psc_refmgr_init(&refmgr, PRMF_LIST, sizeof(*o),
-	    128, 64, 256, init_obj, destroy_obj, "test");
+	check();
+
+	pfl_refmgr_init(&refmgr, PRMF_LINGER | PRMF_AUTOSIZE,
+	    sizeof(struct obj), nkeys, 0, 0, init_obj, destroy_obj,
+	    "bench");
+	bench(1);
+	if (nthr > 1)
+		bench(nthr);
 	exit(0);
 }
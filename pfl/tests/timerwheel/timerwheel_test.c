@@ -0,0 +1,222 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Benchmark the timer wheel: cost of arming, canceling and re-arming a
+ * large number of timers and the jitter with which they fire.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/atomic.h"
+#include "pfl/cdefs.h"
+#include "pfl/pfl.h"
+#include "pfl/random.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+#include "pfl/timerwheel.h"
+#include "pfl/workthr.h"
+
+struct bt {
+	struct pfl_timer	tm;
+	struct timespec		due;
+};
+
+#define NBUCKETS 6
+
+const int	 buckets_ms[NBUCKETS] = { 1, 2, 5, 10, 50, -1 };
+psc_atomic64_t	 hist[NBUCKETS];
+psc_atomic64_t	 jitter_sum;
+psc_atomic64_t	 jitter_max;
+psc_atomic64_t	 nearly;
+psc_atomic64_t	 nfired;
+
+int		 ntimers = 1000 * 1000;
+int		 nworkers = 4;
+int		 mindelay = 500;
+int		 spread = 1000;
+int		 tmflags;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-ci] [-d mindelay-ms] [-n ntimers] "
+	    "[-s spread-ms] [-w nworkers]\n", __progname);
+	exit(1);
+}
+
+void
+fire(void *arg)
+{
+	struct bt *b = arg;
+	struct timespec ts;
+	int64_t us, old;
+	int i;
+
+	PFL_GETTIMESPEC_MONO(&ts);
+	if (timespeccmp(&ts, &b->due, <)) {
+		psc_atomic64_inc(&nearly);
+		us = 0;
+	} else {
+		timespecsub(&ts, &b->due, &ts);
+		us = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+	psc_atomic64_add(&jitter_sum, us);
+	do {
+		old = psc_atomic64_read(&jitter_max);
+		if (us <= old)
+			break;
+	} while (psc_atomic64_cmpxchg(&jitter_max, old, us) != old);
+	for (i = 0; i < NBUCKETS - 1; i++)
+		if (us < buckets_ms[i] * 1000)
+			break;
+	psc_atomic64_inc(&hist[i]);
+	psc_atomic64_inc(&nfired);
+}
+
+void
+armall(struct bt *v, int *delays)
+{
+	struct timespec ts;
+	int i;
+
+	for (i = 0; i < ntimers; i++) {
+		PFL_GETTIMESPEC_MONO(&ts);
+		v[i].due.tv_sec = ts.tv_sec + delays[i] / 1000;
+		v[i].due.tv_nsec = ts.tv_nsec + delays[i] % 1000 *
+		    1000000;
+		if (v[i].due.tv_nsec >= 1000000000) {
+			v[i].due.tv_sec++;
+			v[i].due.tv_nsec -= 1000000000;
+		}
+		pfl_timer_arm(&v[i].tm, delays[i]);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct timespec ts0;
+	int c, i, *delays;
+	struct bt *v;
+	double ns;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "cd:in:s:w:")) != -1)
+		switch (c) {
+		case 'c':
+			tmflags |= PFL_TIMERF_COARSE;
+			break;
+		case 'd':
+			mindelay = atoi(optarg);
+			break;
+		case 'i':
+			tmflags |= PFL_TIMERF_INLINE;
+			break;
+		case 'n':
+			ntimers = atoi(optarg);
+			break;
+		case 's':
+			spread = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || ntimers <= 0 || spread <= 0)
+		usage();
+
+	pfl_workq_init(sizeof(void *) * 2, 1024, 0);
+	pfl_wkthr_spawn(PFL_THRT_WORKER, nworkers, 0, "wkthr%d");
+	pfl_timerwheel_spawn(PFL_THRT_TWHEEL, "twheelthr");
+
+	v = PSCALLOC(ntimers * sizeof(*v));
+	delays = PSCALLOC(ntimers * sizeof(*delays));
+	for (i = 0; i < ntimers; i++) {
+		pfl_timer_init(&v[i].tm, fire, &v[i], tmflags);
+		delays[i] = mindelay + psc_random32u(spread);
+	}
+
+	/*
+	 * Measure arm/cancel cost with the wheel fully populated.  The
+	 * delays are pushed out so nothing fires during this phase.
+	 */
+	for (i = 0; i < ntimers; i++)
+		delays[i] += 3600 * 1000;
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	armall(v, delays);
+	ns = pfl_elapsed_ns(&ts0);
+	printf("arm     %9d timers %8.1f ns/op\n", ntimers, ns / ntimers);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < ntimers; i++)
+		pfl_timer_arm(&v[i].tm, delays[ntimers - i - 1]);
+	ns = pfl_elapsed_ns(&ts0);
+	printf("re-arm  %9d timers %8.1f ns/op\n", ntimers, ns / ntimers);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < ntimers; i++)
+		if (!pfl_timer_cancel(&v[i].tm))
+			psc_fatalx("timer %d was not armed", i);
+	ns = pfl_elapsed_ns(&ts0);
+	printf("cancel  %9d timers %8.1f ns/op\n", ntimers, ns / ntimers);
+
+	/* Now let them all fire and measure the jitter. */
+	for (i = 0; i < ntimers; i++)
+		delays[i] -= 3600 * 1000;
+	armall(v, delays);
+
+	while (psc_atomic64_read(&nfired) < ntimers)
+		usleep(10000);
+
+	printf("fired   %9"PRId64" timers, %"PRId64" early\n",
+	    psc_atomic64_read(&nfired), psc_atomic64_read(&nearly));
+	printf("jitter  avg %.1f us max %"PRId64" us\n",
+	    psc_atomic64_read(&jitter_sum) / (double)ntimers,
+	    psc_atomic64_read(&jitter_max));
+	for (i = 0; i < NBUCKETS; i++) {
+		if (buckets_ms[i] == -1)
+			printf("  >=%3d ms", buckets_ms[i - 1]);
+		else
+			printf("  < %3d ms", buckets_ms[i]);
+		printf(" %9"PRId64"\n", psc_atomic64_read(&hist[i]));
+	}
+	if (psc_atomic64_read(&nearly))
+		psc_fatalx("timers fired before their deadline");
+	if (psc_atomic64_read(&nfired) != ntimers)
+		psc_fatalx("timers fired more than once");
+
+	PSCFREE(delays);
+	PSCFREE(v);
+	return (0);
+}
@@ -0,0 +1,189 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/subsys.h"
+#include "pfl/time.h"
+#include "pfl/trace.h"
+
+#define NTHR	4
+#define NITERS	1000			/* must fit in a ring */
+
+int	niters = 1000000;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-b] [-n niters]\n", __progname);
+	exit(1);
+}
+
+/* count occurrences of a substring */
+int
+count(const char *buf, const char *s)
+{
+	const char *p;
+	int n = 0;
+
+	for (p = buf; (p = strstr(p, s)) != NULL; p += strlen(s))
+		n++;
+	return (n);
+}
+
+char *
+dump(int *nevents)
+{
+	size_t len;
+	char *buf;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	*nevents = pfl_trace_dump(fp);
+	fclose(fp);
+	return (buf);
+}
+
+void *
+thr_main(void *arg)
+{
+	int i, id = (int)(uintptr_t)arg;
+
+	for (i = 0; i < NITERS; i++) {
+		PFL_TRACE_BEGIN(PSS_TMP, "work", 0);
+		PFL_TRACE_INSTANT(PSS_TMP, "tick", 0);
+		PFL_TRACE_END(PSS_TMP, "work", 0);
+	}
+	/* hand off: begun here, ended by the main thread */
+	PFL_TRACE_BEGIN(PSS_TMP, "handoff", id + 1);
+	PFL_TRACE_INSTANT(PSS_MEM, "disabled", 0);
+	return (NULL);
+}
+
+void
+check(void)
+{
+	pthread_t pt[NTHR];
+	char *buf;
+	int i, n;
+
+	pfl_trace_enable(PSS_TMP, 1);
+	for (i = 0; i < NTHR; i++)
+		if (pthread_create(&pt[i], NULL, thr_main,
+		    (void *)(uintptr_t)i))
+			psc_fatal("pthread_create");
+	for (i = 0; i < NTHR; i++)
+		pthread_join(pt[i], NULL);
+	for (i = 0; i < NTHR; i++)
+		PFL_TRACE_END(PSS_TMP, "handoff", i + 1);
+
+	/* rings of exited threads are kept */
+	buf = dump(&n);
+	pfl_assert(n == NTHR * (NITERS * 3 + 2));
+	pfl_assert(count(buf, "\"ph\":\"B\"") == NTHR * NITERS);
+	pfl_assert(count(buf, "\"ph\":\"E\"") == NTHR * NITERS);
+	pfl_assert(count(buf, "\"ph\":\"i\"") == NTHR * NITERS);
+	pfl_assert(count(buf, "\"ph\":\"b\"") == NTHR);
+	pfl_assert(count(buf, "\"ph\":\"e\"") == NTHR);
+	pfl_assert(count(buf, "\"id\":\"0x1\"") == 2);
+	pfl_assert(count(buf, "\"name\":\"thread_name\"") == NTHR + 1);
+	pfl_assert(count(buf, "disabled") == 0);
+	pfl_assert(strncmp(buf, "{\"displayTimeUnit\"", 18) == 0);
+	pfl_assert(strcmp(buf + strlen(buf) - 4, "\n]}\n") == 0);
+	free(buf);
+
+	/* the ring keeps only the newest events */
+	pfl_trace_reset();
+	for (i = 0; i < PFL_TRACE_NEVENTS + 100; i++)
+		PFL_TRACE_INSTANT(PSS_TMP, i < 100 ? "old" : "new", 0);
+	buf = dump(&n);
+	pfl_assert(n == PFL_TRACE_NEVENTS);
+	pfl_assert(count(buf, "\"old\"") == 0);
+	free(buf);
+
+	pfl_trace_reset();
+	pfl_trace_enable(PSS_TMP, 0);
+	PFL_TRACE_INSTANT(PSS_TMP, "off", 0);
+	buf = dump(&n);
+	pfl_assert(n == 0);
+	free(buf);
+}
+
+double
+bench(void)
+{
+	struct timespec ts0, ts1;
+	int i;
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < niters; i++)
+		PFL_TRACE_INSTANT(PSS_TMP, "bench", i);
+	PFL_GETTIMESPEC_MONO(&ts1);
+	timespecsub(&ts1, &ts0, &ts1);
+	return ((ts1.tv_sec * 1e9 + ts1.tv_nsec) / niters);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, dobench = 0;
+	double off, on;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "bn:")) != -1)
+		switch (c) {
+		case 'b':
+			dobench = 1;
+			break;
+		case 'n':
+			niters = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc)
+		usage();
+
+	check();
+
+	if (dobench) {
+		off = bench();
+		pfl_trace_enable(PSS_TMP, 1);
+		on = bench();
+		pfl_trace_enable(PSS_TMP, 0);
+		printf("ns per trace point: disabled %.2f, enabled %.2f\n",
+		    off, on);
+	}
+	exit(0);
+}
@@ -24,12 +24,15 @@
 #include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pfl/alloc.h"
 #include "pfl/cdefs.h"
 #include "pfl/log.h"
 #include "pfl/pfl.h"
+#include "pfl/random.h"
+#include "pfl/time.h"
 #include "pfl/vbitmap.h"
 
 #define ENSURE(vb, fmt, ...)						\
@@ -80,12 +83,123 @@
 
 #define NELEM 524288	/* # of 2MB blocks in 1TG. */
 
+/*
+ * Time the common operations on a large bitmap.
+ * @nbits: size of bitmap.
+ */
+void
+bench(size_t nbits)
+{
+	struct psc_vbitmap *vb;
+	struct timespec ts0;
+	size_t i, elem, n;
+	int nslots;
+
+	vb = psc_vbitmap_new(nbits);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < nbits; i++)
+		psc_vbitmap_next(vb, &elem);
+	printf("%-24s %10.2f ns/op\n", "next (fill)",
+	    (double)pfl_elapsed_ns(&ts0) / nbits);
+
+	/* One free bit placed randomly forces a search of the map. */
+	n = 1000;
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < n; i++) {
+		psc_vbitmap_unset(vb, psc_random64() % nbits);
+		psc_vbitmap_next(vb, &elem);
+	}
+	printf("%-24s %10.2f ns/op\n", "next (single hole)",
+	    (double)pfl_elapsed_ns(&ts0) / n);
+
+	n = 100;
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < n; i++)
+		pfl_assert(psc_vbitmap_nfree(vb) == 0);
+	printf("%-24s %10.2f ns/op\n", "nfree",
+	    (double)pfl_elapsed_ns(&ts0) / n);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < n; i++)
+		pfl_assert(psc_vbitmap_isfull(vb));
+	printf("%-24s %10.2f ns/op\n", "israngeset (full map)",
+	    (double)pfl_elapsed_ns(&ts0) / n);
+
+	for (i = 0; i < nbits; i += 4096)
+		psc_vbitmap_unsetrange(vb, i, MIN(100, nbits - i));
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < n; i++)
+		pfl_assert(psc_vbitmap_lcr(vb) == (int)MIN(100, nbits));
+	printf("%-24s %10.2f ns/op\n", "lcr",
+	    (double)pfl_elapsed_ns(&ts0) / n);
+
+	n = nbits / 4096;
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < n; i++) {
+		nslots = 64;
+		pfl_assert(psc_vbitmap_getncontig(vb, &nslots) == 64);
+	}
+	printf("%-24s %10.2f ns/op\n", "getncontig",
+	    (double)pfl_elapsed_ns(&ts0) / MAX(n, 1));
+
+	psc_vbitmap_free(vb);
+}
+
+/*
+ * Check psc_vbitmap_lcr() and psc_vbitmap_getncontig() against
+ * a plain bit-by-bit scan.
+ */
+void
+check_runs(size_t nbits)
+{
+	struct psc_vbitmap *vb;
+	size_t i, s, r, bs, bl;
+	int nslots, want, rc;
+
+	vb = psc_vbitmap_new(nbits);
+	for (i = 0; i < nbits; i++)
+		if (psc_random32u(4) == 0)
+			psc_vbitmap_set(vb, i);
+
+	for (r = s = i = 0; i <= nbits; i++)
+		if (i == nbits || psc_vbitmap_get(vb, i)) {
+			r = MAX(r, i - s);
+			s = i + 1;
+		}
+	pfl_assert(psc_vbitmap_lcr(vb) == (int)r);
+
+	want = 5;
+	for (bs = bl = s = i = 0; i <= nbits; i++)
+		if (i == nbits || psc_vbitmap_get(vb, i)) {
+			if (i - s >= (size_t)want) {
+				bs = s;
+				bl = want;
+				break;
+			}
+			if (i - s > bl) {
+				bs = s;
+				bl = i - s;
+			}
+			s = i + 1;
+		}
+	nslots = want;
+	rc = psc_vbitmap_getncontig(vb, &nslots);
+	pfl_assert(rc == (int)bl);
+	if (bl) {
+		pfl_assert(nslots == (int)bs);
+		pfl_assert(pfl_vbitmap_israngeset(vb, 1, bs, bl));
+	}
+	psc_vbitmap_free(vb);
+}
+
 __dead void
 usage(void)
 {
 	extern const char *__progname;
 
-	fprintf(stderr, "usage: %s\n", __progname);
+	fprintf(stderr, "usage: %s [-b nbits]\n", __progname);
 	exit(1);
 }
 
@@ -93,12 +207,15 @@ int
 main(int argc, char *argv[])
 {
 	struct psc_vbitmap *vb, vba = VBITMAP_INIT_AUTO;
-	size_t elem, j, cap, len, off;
+	size_t elem, j, cap, len, off, nbench = 0;
 	int i, c, u, t;
 
 	pfl_init();
-	while ((c = getopt(argc, argv, "")) != -1)
+	while ((c = getopt(argc, argv, "b:")) != -1)
 		switch (c) {
+		case 'b':
+			nbench = strtoul(optarg, NULL, 10);
+			break;
 		default:
 			usage();
 		}
@@ -107,6 +224,11 @@ main(int argc, char *argv[])
 	if (argc)
 		usage();
 
+	if (nbench) {
+		bench(nbench);
+		exit(0);
+	}
+
 	for (i = 0; i < 79; i++)
 		if (psc_vbitmap_next(&vba, &j) != 1)
 			psc_fatalx("psc_vbitmap_next failed with auto");
@@ -295,5 +417,19 @@ main(int argc, char *argv[])
 	pfl_assert(pfl_vbitmap_isempty(vb));
 	psc_vbitmap_free(vb);
 
+	for (cap = 1; cap < 300; cap += 7)
+		check_runs(cap);
+
+	vb = psc_vbitmap_new(130);
+	psc_vbitmap_setall(vb);
+	pfl_assert(psc_vbitmap_nfree(vb) == 0);
+	psc_vbitmap_unset(vb, 3);
+	psc_vbitmap_unset(vb, 129);
+	pfl_assert(psc_vbitmap_resize(vb, 100) == 0);
+	pfl_assert(psc_vbitmap_resize(vb, 200) == 0);
+	pfl_assert(psc_vbitmap_nfree(vb) == 101);
+	pfl_assert(psc_vbitmap_next(vb, &elem) == 1 && elem == 3);
+	psc_vbitmap_free(vb);
+
 	exit(0);
 }
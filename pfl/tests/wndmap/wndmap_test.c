@@ -0,0 +1,191 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Check window map semantics and benchmark allocation/clear churn with
+ * a sliding (FIFO) and a random clear pattern, optionally with
+ * concurrent lock-free pfl_wndmap_isset() readers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/atomic.h"
+#include "pfl/cdefs.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/random.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+#include "pfl/wndmap.h"
+
+struct pfl_wndmap	 wm;
+psc_atomic64_t		 nreads;
+psc_atomic32_t		 nrunning;
+volatile int		 done;
+size_t			*ring;
+int			 window = 100000;
+int			 niters = 2000000;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-i niters] [-r nreaders] [-w window]\n",
+	    __progname);
+	exit(1);
+}
+
+void
+reader_main(__unusedx struct psc_thread *thr)
+{
+	size_t base;
+	int64_t n = 0;
+
+	while (!done) {
+		base = wm.pwm_min;
+		pfl_wndmap_isset(&wm, base + psc_random32u(2 * window));
+		n++;
+	}
+	psc_atomic64_add(&nreads, n);
+	psc_atomic32_dec(&nrunning);
+}
+
+void
+check(void)
+{
+	size_t pos;
+	int i;
+
+	pfl_wndmap_init(&wm, 100);
+	for (i = 0; i < 5000; i++) {
+		pos = pfl_wndmap_getnext(&wm);
+		if (pos != (size_t)i + 100)
+			psc_fatalx("getnext: got %zu want %d", pos, i + 100);
+	}
+	pfl_assert(pfl_wndmap_isset(&wm, 100));
+	pfl_assert(pfl_wndmap_isset(&wm, 5099));
+	pfl_assert(!pfl_wndmap_isset(&wm, 5100));
+	pfl_assert(!pfl_wndmap_isset(&wm, 99));
+
+	/* holes are refilled lowest first */
+	pfl_wndmap_clearpos(&wm, 3000);
+	pfl_wndmap_clearpos(&wm, 2000);
+	pfl_assert(!pfl_wndmap_isset(&wm, 2000));
+	pfl_assert(pfl_wndmap_getnext(&wm) == 2000);
+	pfl_assert(pfl_wndmap_getnext(&wm) == 3000);
+	pfl_assert(pfl_wndmap_getnext(&wm) == 5100);
+
+	/* clearing the bottom of the window slides it forward */
+	for (pos = 100; pos < 100 + 2 * PFL_WNDMAP_BLKBITS; pos++)
+		pfl_wndmap_clearpos(&wm, pos);
+	pfl_assert(wm.pwm_min == 100 + 2 * PFL_WNDMAP_BLKBITS);
+	pfl_assert(!pfl_wndmap_isset(&wm, 100));
+	pfl_assert(pfl_wndmap_isset(&wm, 100 + 2 * PFL_WNDMAP_BLKBITS));
+	pfl_assert(pfl_wndmap_getnext(&wm) == 5101);
+	pfl_wndmap_free(&wm);
+}
+
+void
+churn(int nreaders, int random)
+{
+	struct timespec ts0;
+	size_t pos;
+	double ns;
+	int i, j;
+
+	pfl_wndmap_init(&wm, 0);
+	for (i = 0; i < window; i++)
+		ring[i] = pfl_wndmap_getnext(&wm);
+
+	done = 0;
+	psc_atomic64_set(&nreads, 0);
+	psc_atomic32_set(&nrunning, nreaders);
+	for (i = 0; i < nreaders; i++)
+		pscthr_init(0, reader_main, 0, "reader%d", i);
+
+	PFL_GETTIMESPEC_MONO(&ts0);
+	for (i = 0; i < niters; i++) {
+		j = random ? (int)psc_random32u(window) : i % window;
+		pfl_wndmap_clearpos(&wm, ring[j]);
+		ring[j] = pos = pfl_wndmap_getnext(&wm);
+		if (i % 1024 == 0)
+			pfl_assert(pfl_wndmap_isset(&wm, pos));
+	}
+	ns = pfl_elapsed_ns(&ts0);
+	done = 1;
+	while (psc_atomic32_read(&nrunning))
+		usleep(100);
+
+	printf("%-7s window %8d readers %2d %8.1f ns/op", random ?
+	    "random" : "sliding", window, nreaders, ns / niters);
+	if (nreaders)
+		printf(" %8.1f Mreads/s",
+		    psc_atomic64_read(&nreads) / ns * 1e3);
+	printf("\n");
+
+	for (i = 0; i < window; i++)
+		pfl_assert(pfl_wndmap_isset(&wm, ring[i]));
+	pfl_wndmap_free(&wm);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, nreaders = 0;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "i:r:w:")) != -1)
+		switch (c) {
+		case 'i':
+			niters = atoi(optarg);
+			break;
+		case 'r':
+			nreaders = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || window < 1 || niters < 0)
+		usage();
+
+	check();
+
+	ring = PSCALLOC(window * sizeof(*ring));
+	churn(0, 0);
+	churn(0, 1);
+	if (nreaders) {
+		churn(nreaders, 0);
+		churn(nreaders, 1);
+	}
+	PSCFREE(ring);
+	return (0);
+}
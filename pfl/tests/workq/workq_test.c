@@ -0,0 +1,234 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Exercise the work queue scheduler: every item runs exactly once,
+ * priority classes are served in order, and items queued behind a busy
+ * worker are stolen by the others without relying on a polling loop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pfl/alloc.h"
+#include "pfl/atomic.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/thread.h"
+#include "pfl/workthr.h"
+
+#define NPRI		5		/* items per priority class */
+#define NSTEAL		64
+#define NITEMS		100000
+#define TIMEOUT		10		/* seconds */
+
+struct titem {
+	int			 ti_id;
+};
+
+psc_atomic32_t	 ndone;
+psc_atomic32_t	 blocked;
+volatile int	 release;
+
+int		 order[PFL_WKPRI_MAX * NPRI];
+psc_atomic32_t	 norder;
+
+struct psc_thread *ranby[NSTEAL];
+struct psc_thread *stealer_thr;
+
+psc_atomic32_t	*seen;
+
+__dead void
+usage(void)
+{
+	extern const char *__progname;
+
+	fprintf(stderr, "usage: %s [-n nworkers]\n", __progname);
+	exit(1);
+}
+
+void
+waitdone(int n, const char *what)
+{
+	time_t deadline;
+
+	deadline = time(NULL) + TIMEOUT;
+	while (psc_atomic32_read(&ndone) < n) {
+		if (time(NULL) > deadline)
+			psc_fatalx("%s: %d of %d items run", what,
+			    psc_atomic32_read(&ndone), n);
+		usleep(100);
+	}
+}
+
+int
+blocker_cb(__unusedx void *p)
+{
+	psc_atomic32_set(&blocked, 1);
+	while (!release)
+		usleep(100);
+	return (0);
+}
+
+int
+order_cb(void *p)
+{
+	struct titem *ti = p;
+
+	order[psc_atomic32_inc_getnew(&norder) - 1] = ti->ti_id;
+	psc_atomic32_inc(&ndone);
+	return (0);
+}
+
+int
+stolen_cb(void *p)
+{
+	struct titem *ti = p;
+
+	ranby[ti->ti_id] = pscthr_get();
+	usleep(200);
+	psc_atomic32_inc(&ndone);
+	return (0);
+}
+
+/*
+ * Queue items onto this worker's own deques, then stay busy until the
+ * other workers have run all of them.
+ */
+int
+stealer_cb(__unusedx void *p)
+{
+	struct titem *ti;
+	time_t deadline;
+	int i;
+
+	stealer_thr = pscthr_get();
+	for (i = 0; i < NSTEAL; i++) {
+		ti = pfl_workq_getitem(stolen_cb, struct titem);
+		ti->ti_id = i;
+		pfl_workq_putitem(ti);
+	}
+	deadline = time(NULL) + TIMEOUT;
+	while (psc_atomic32_read(&ndone) < NSTEAL) {
+		if (time(NULL) > deadline)
+			psc_fatalx("items queued on a busy worker were "
+			    "not stolen: %d of %d run",
+			    psc_atomic32_read(&ndone), NSTEAL);
+		usleep(100);
+	}
+	return (0);
+}
+
+int
+count_cb(void *p)
+{
+	struct titem *ti = p;
+
+	psc_atomic32_inc(&seen[ti->ti_id]);
+	psc_atomic32_inc(&ndone);
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c, i, j, pri, nworkers = 4;
+	uint64_t nsteals, nstolen;
+	struct titem *ti;
+
+	pfl_init();
+	while ((c = getopt(argc, argv, "n:")) != -1)
+		switch (c) {
+		case 'n':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	if (argc || nworkers < 2)
+		usage();
+
+	pfl_workq_init(sizeof(struct titem), 1024, 0);
+
+	/*
+	 * Priority order: with the only worker busy, queue items of
+	 * every class interleaved and check they run most urgent class
+	 * first, FIFO within a class.
+	 */
+	pfl_wkthr_spawn(PFL_THRT_WORKER, 1, 0, "wkthr%d");
+	pfl_workq_putitem(pfl_workq_getitem(blocker_cb, struct titem));
+	while (!psc_atomic32_read(&blocked))
+		usleep(100);
+	for (i = 0; i < NPRI; i++)
+		for (pri = PFL_WKPRI_MAX - 1; pri >= 0; pri--) {
+			ti = pfl_workq_getitem(order_cb, struct titem);
+			ti->ti_id = pri * NPRI + i;
+			pfl_workq_putitem_pri(ti, pri);
+		}
+	release = 1;
+	waitdone(PFL_WKPRI_MAX * NPRI, "priority");
+	for (pri = j = 0; pri < PFL_WKPRI_MAX; pri++)
+		for (i = 0; i < NPRI; i++, j++)
+			pfl_assert(order[j] == pri * NPRI + i);
+
+	/*
+	 * Stealing: a worker queues items to itself and stays busy, so
+	 * they can only run if idle workers are woken to take them.
+	 */
+	pfl_wkthr_spawn(PFL_THRT_WORKER, nworkers - 1, 0, "wkthrx%d");
+	psc_atomic32_set(&ndone, 0);
+	pfl_workq_putitem(pfl_workq_getitem(stealer_cb, struct titem));
+	waitdone(NSTEAL, "steal");
+	for (i = 0; i < NSTEAL; i++) {
+		pfl_assert(ranby[i]);
+		pfl_assert(ranby[i] != stealer_thr);
+	}
+	/* let the stealer finish before sampling the counters */
+	sleep(1);
+	nsteals = nstolen = 0;
+	for (i = 0; i < psc_atomic32_read(&pfl_wkthr_n); i++) {
+		nsteals += pfl_wkthrv[i]->wkt_nsteals;
+		nstolen += pfl_wkthrv[i]->wkt_nstolen;
+	}
+	pfl_assert(nsteals >= NSTEAL);
+	pfl_assert(nsteals == nstolen);
+
+	/* enqueue: many items from outside the pool each run once */
+	seen = PSCALLOC(NITEMS * sizeof(*seen));
+	psc_atomic32_set(&ndone, 0);
+	for (i = 0; i < NITEMS; i++) {
+		ti = pfl_workq_getitem(count_cb, struct titem);
+		ti->ti_id = i;
+		pfl_workq_putitem(ti);
+	}
+	waitdone(NITEMS, "enqueue");
+	for (i = 0; i < NITEMS; i++)
+		pfl_assert(psc_atomic32_read(&seen[i]) == 1);
+
+	pfl_wkthr_killall();
+	PSCFREE(seen);
+	return (0);
+}
@@ -84,7 +84,7 @@ _pscthr_destroy(void *arg)
 	if (thr->pscthr_uniqid) {
 		psc_vbitmap_unset(&psc_uniqthridmap,
 		    thr->pscthr_uniqid - 1);
-		if (thr->pscthr_uniqid - 1 <
+		if ((size_t)thr->pscthr_uniqid - 1 <
 		    psc_vbitmap_getnextpos(&psc_uniqthridmap))
 			psc_vbitmap_setnextpos(&psc_uniqthridmap,
 			    thr->pscthr_uniqid - 1);
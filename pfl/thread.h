@@ -63,6 +63,7 @@ struct psc_thread_init {
 #define PTF_DEAD		(1 << 3)			/* thread will terminate now */
 #define PTF_INIT		(1 << 4)			/* thread being inited now */
 #define PTF_RPC_SVC_THREAD	(1 << 5)			/* thread is an RPC servicer */
+#define PTF_WORKER		(1 << 6)			/* thread services the shared work queue */
 
 #define PSCTHR_MKCAST(label, name, type)				\
 static inline struct name *						\
@@ -89,6 +90,7 @@ enum {
 	PFL_THRT_NBRPC,			/* non-blocking RPC reply handler */
 	PFL_THRT_OPSTIMER,		/* opstats updater */
 	PFL_THRT_USKLNDPL,		/* userland socket lustre net dev poll thr */
+	PFL_THRT_TWHEEL,		/* timer wheel */
 	PFL_THRT_WORKER,		/* generic worker */
 	_PFL_NTHRT,
 };
@@ -129,4 +129,6 @@ struct pfl_timespec {
 		(ts)->tv_nsec = _ts.tv_nsec;				\
 	} while (0)
 
+uint64_t	pfl_elapsed_ns(const struct timespec *);
+
 #endif /* _PFL_TIME_H_ */
@@ -68,7 +68,7 @@ pfl_opstimerthr_main(struct psc_thread *thr)
 		DYNARRAY_FOREACH(opst, i, &pfl_opstats) {
 
 			/* update last second rate */
-			curr = psc_atomic64_read(&opst->opst_lifetime);
+			curr = _pfl_opstat_read(opst);
 			len = curr - opst->opst_last;
 			if (len < 0)
 				len = -len;
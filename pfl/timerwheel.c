@@ -0,0 +1,361 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "pfl/cdefs.h"
+#include "pfl/list.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/pool.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+#include "pfl/timerwheel.h"
+#include "pfl/waitq.h"
+#include "pfl/workthr.h"
+
+#define PFL_TWHEEL_BATCH	64	/* expired timers dispatched per unlock */
+
+struct pfl_timerwheel	 pfl_timerwheel;
+
+/* deferred timer callback queued onto the shared work queue */
+struct pfl_timer_wk {
+	void			(*ptwk_cbf)(void *);
+	void			 *ptwk_arg;
+};
+
+/*
+ * Return the nanoseconds elapsed on the monotonic clock since @ts0.
+ */
+uint64_t
+pfl_elapsed_ns(const struct timespec *ts0)
+{
+	struct timespec ts;
+
+	PFL_GETTIMESPEC_MONO(&ts);
+	timespecsub(&ts, ts0, &ts);
+	return (ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec);
+}
+
+/*
+ * Return the current tick, relative to when the wheel was started.
+ */
+uint64_t
+pfl_timerwheel_gettick(void)
+{
+	struct pfl_timerwheel *tw = &pfl_timerwheel;
+
+	return (pfl_elapsed_ns(&tw->ptw_base) /
+	    (PFL_TWHEEL_TICK_MS * UINT64_C(1000000)));
+}
+
+/*
+ * Hash a timer into the slot for its expiry.
+ * @tw: wheel, locked.
+ * @tm: timer, not on the wheel.
+ */
+__static void
+pfl_timerwheel_insert(struct pfl_timerwheel *tw, struct pfl_timer *tm)
+{
+	uint64_t expire, delta;
+	int lvl, idx;
+
+	if (tm->ptm_expire < tw->ptw_now)
+		tm->ptm_expire = tw->ptw_now;
+	expire = tm->ptm_expire;
+	delta = expire - tw->ptw_now;
+
+	for (lvl = 0; lvl < PFL_TWHEEL_LEVELS - 1; lvl++)
+		if (delta < 1ULL << (PFL_TWHEEL_SLOTBITS * (lvl + 1)))
+			break;
+	if (lvl == PFL_TWHEEL_LEVELS - 1 &&
+	    delta >> (PFL_TWHEEL_SLOTBITS * PFL_TWHEEL_LEVELS))
+		/* Beyond the wheel's span; park and recascade later. */
+		expire = tw->ptw_now + (1ULL << (PFL_TWHEEL_SLOTBITS *
+		    PFL_TWHEEL_LEVELS)) - 1;
+
+	idx = (expire >> (PFL_TWHEEL_SLOTBITS * lvl)) &
+	    PFL_TWHEEL_SLOTMASK;
+	psclist_add_tail(&tm->ptm_lentry, &tw->ptw_slots[lvl][idx]);
+	if (lvl == 0)
+		tw->ptw_slotmap[idx / 64] |= 1ULL << (idx % 64);
+}
+
+/*
+ * Redistribute the timers of the slot at a coarser level reached by
+ * the wheel into finer levels.
+ * @tw: wheel, locked.
+ * @lvl: level to cascade.
+ * Returns the slot index cascaded.
+ */
+__static int
+pfl_timerwheel_cascade(struct pfl_timerwheel *tw, int lvl)
+{
+	struct psclist_head *hd;
+	struct pfl_timer *tm;
+	int idx;
+
+	idx = (tw->ptw_now >> (PFL_TWHEEL_SLOTBITS * lvl)) &
+	    PFL_TWHEEL_SLOTMASK;
+	hd = &tw->ptw_slots[lvl][idx];
+	while ((tm = psc_listhd_first_obj(hd, struct pfl_timer,
+	    ptm_lentry)) != NULL) {
+		psclist_del(&tm->ptm_lentry, hd);
+		pfl_timerwheel_insert(tw, tm);
+		tw->ptw_ncascaded++;
+	}
+	return (idx);
+}
+
+__static int
+pfl_timer_runwk(void *p)
+{
+	struct pfl_timer_wk *wk = p;
+
+	wk->ptwk_cbf(wk->ptwk_arg);
+	return (0);
+}
+
+/*
+ * Hand an expired timer callback to a worker, or run it here if it
+ * asked to be run inline or no work item is available.
+ */
+__static void
+pfl_timer_dispatch(void (*cbf)(void *), void *arg, int flags)
+{
+	struct pfl_timer_wk *wk;
+
+	if ((flags & PFL_TIMERF_INLINE) == 0 && pfl_workrq_pool) {
+		wk = pfl_workq_getitem_nb(pfl_timer_runwk,
+		    struct pfl_timer_wk);
+		if (wk) {
+			wk->ptwk_cbf = cbf;
+			wk->ptwk_arg = arg;
+			pfl_workq_putitem(wk);
+			return;
+		}
+	}
+	cbf(arg);
+}
+
+/*
+ * Process all ticks up to and including the given one.  The wheel
+ * lock is dropped while expired callbacks are dispatched.
+ * @tw: wheel, locked.
+ * @upto: last tick to process.
+ */
+__static void
+pfl_timerwheel_advance(struct pfl_timerwheel *tw, uint64_t upto)
+{
+	struct {
+		void	(*cbf)(void *);
+		void	 *arg;
+		int	  flags;
+	} fired[PFL_TWHEEL_BATCH];
+	struct psclist_head *hd;
+	struct pfl_timer *tm;
+	int i, n, idx, lvl;
+
+	LOCK_ENSURE(&tw->ptw_lock);
+	while (tw->ptw_now <= upto) {
+		idx = tw->ptw_now & PFL_TWHEEL_SLOTMASK;
+		if (idx == 0)
+			for (lvl = 1; lvl < PFL_TWHEEL_LEVELS; lvl++)
+				if (pfl_timerwheel_cascade(tw, lvl))
+					break;
+
+		hd = &tw->ptw_slots[0][idx];
+		n = 0;
+		while (n < PFL_TWHEEL_BATCH &&
+		    (tm = psc_listhd_first_obj(hd, struct pfl_timer,
+		    ptm_lentry)) != NULL) {
+			psclist_del(&tm->ptm_lentry, hd);
+			tm->ptm_flags &= ~PFL_TIMERF_ARMED;
+			fired[n].cbf = tm->ptm_cbf;
+			fired[n].arg = tm->ptm_arg;
+			fired[n].flags = tm->ptm_flags;
+			n++;
+		}
+		if (psc_listhd_empty(hd)) {
+			tw->ptw_slotmap[idx / 64] &= ~(1ULL << (idx % 64));
+			tw->ptw_now++;
+		}
+		if (n == 0)
+			continue;
+
+		tw->ptw_narmed -= n;
+		tw->ptw_nfired += n;
+		freelock(&tw->ptw_lock);
+		for (i = 0; i < n; i++)
+			pfl_timer_dispatch(fired[i].cbf, fired[i].arg,
+			    fired[i].flags);
+		spinlock(&tw->ptw_lock);
+	}
+}
+
+/*
+ * Determine the tick at which the wheel next needs attention: the next
+ * occupied slot of the finest level or the next cascade, whichever
+ * comes first.
+ * @tw: wheel, locked.
+ */
+__static uint64_t
+pfl_timerwheel_nextwake(struct pfl_timerwheel *tw)
+{
+	uint64_t bits;
+	int idx, w;
+
+	idx = tw->ptw_now & PFL_TWHEEL_SLOTMASK;
+	if (tw->ptw_narmed == 0)
+		return (tw->ptw_now + 1000 / PFL_TWHEEL_TICK_MS);
+	if (idx == 0)
+		/* cascade due */
+		return (tw->ptw_now);
+	for (w = idx / 64; w < PFL_TWHEEL_NSLOTS / 64; w++) {
+		bits = tw->ptw_slotmap[w];
+		if (w == idx / 64)
+			bits &= ~0ULL << (idx % 64);
+		if (bits)
+			return (tw->ptw_now - idx + w * 64 +
+			    ffsll(bits) - 1);
+	}
+	return (tw->ptw_now - idx + PFL_TWHEEL_NSLOTS);
+}
+
+/*
+ * Arm a timer to fire after the given number of milliseconds.  If the
+ * timer is already armed, it is moved.
+ * @tm: timer.
+ * @ms: delay.
+ */
+void
+pfl_timer_arm(struct pfl_timer *tm, int ms)
+{
+	struct pfl_timerwheel *tw = &pfl_timerwheel;
+	uint64_t expire, gran, delta;
+	int lvl, wake = 0;
+
+	/* The current tick is partially elapsed: round up past it. */
+	expire = pfl_timerwheel_gettick() + 1 +
+	    (MAX(ms, 0) + PFL_TWHEEL_TICK_MS - 1) / PFL_TWHEEL_TICK_MS;
+
+	spinlock(&tw->ptw_lock);
+	if (tm->ptm_flags & PFL_TIMERF_ARMED)
+		psclist_del(&tm->ptm_lentry, psc_lentry_hd(
+		    &tm->ptm_lentry));
+	else
+		tw->ptw_narmed++;
+
+	if (tm->ptm_flags & PFL_TIMERF_COARSE) {
+		/*
+		 * Round up to the granularity of the level the timer
+		 * lands in so it fires straight from the cascade.
+		 */
+		delta = expire > tw->ptw_now ? expire - tw->ptw_now : 0;
+		for (lvl = 0; lvl < PFL_TWHEEL_LEVELS - 1; lvl++)
+			if (delta < 1ULL << (PFL_TWHEEL_SLOTBITS *
+			    (lvl + 1)))
+				break;
+		gran = 1ULL << (PFL_TWHEEL_SLOTBITS * lvl);
+		expire = (expire + gran - 1) & ~(gran - 1);
+	}
+	tm->ptm_expire = expire;
+	tm->ptm_flags |= PFL_TIMERF_ARMED;
+	pfl_timerwheel_insert(tw, tm);
+	if (tm->ptm_expire < tw->ptw_wakeat)
+		wake = 1;
+	freelock(&tw->ptw_lock);
+
+	if (wake)
+		pfl_waitq_wakeone(&tw->ptw_wq);
+}
+
+/*
+ * Disarm a timer.
+ * @tm: timer.
+ * Returns nonzero if the timer was pending and will not fire; zero if
+ * it was not armed or its callback has already been dispatched.
+ */
+int
+pfl_timer_cancel(struct pfl_timer *tm)
+{
+	struct pfl_timerwheel *tw = &pfl_timerwheel;
+	int rc = 0;
+
+	spinlock(&tw->ptw_lock);
+	if (tm->ptm_flags & PFL_TIMERF_ARMED) {
+		psclist_del(&tm->ptm_lentry, psc_lentry_hd(
+		    &tm->ptm_lentry));
+		tm->ptm_flags &= ~PFL_TIMERF_ARMED;
+		tw->ptw_narmed--;
+		rc = 1;
+	}
+	freelock(&tw->ptw_lock);
+	return (rc);
+}
+
+void
+pfl_timerwheel_main(struct psc_thread *thr)
+{
+	struct pfl_timerwheel *tw = &pfl_timerwheel;
+	uint64_t now, wakeat;
+	long ns;
+
+	while (pscthr_run(thr)) {
+		spinlock(&tw->ptw_lock);
+		tw->ptw_wakeat = 0;
+		now = pfl_timerwheel_gettick();
+		pfl_timerwheel_advance(tw, now);
+
+		wakeat = pfl_timerwheel_nextwake(tw);
+		tw->ptw_wakeat = wakeat;
+
+		/* Sleep until the start of the wake tick. */
+		ns = (long)(wakeat * PFL_TWHEEL_TICK_MS) * 1000000 -
+		    (long)pfl_elapsed_ns(&tw->ptw_base);
+		if (ns <= 0) {
+			freelock(&tw->ptw_lock);
+			continue;
+		}
+		pfl_waitq_waitrel(&tw->ptw_wq, &tw->ptw_lock,
+		    ns / 1000000000, ns % 1000000000);
+	}
+}
+
+void
+pfl_timerwheel_spawn(int thrtype, const char *name)
+{
+	struct pfl_timerwheel *tw = &pfl_timerwheel;
+	int lvl, idx;
+
+	INIT_SPINLOCK(&tw->ptw_lock);
+	pfl_waitq_init(&tw->ptw_wq, "timerwheel");
+	for (lvl = 0; lvl < PFL_TWHEEL_LEVELS; lvl++)
+		for (idx = 0; idx < PFL_TWHEEL_NSLOTS; idx++)
+			INIT_PSCLIST_HEAD(&tw->ptw_slots[lvl][idx]);
+	PFL_GETTIMESPEC_MONO(&tw->ptw_base);
+	pscthr_init(thrtype, pfl_timerwheel_main, 0, name);
+}
@@ -0,0 +1,96 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Hierarchical timer wheel.  Timers are hashed into one of several
+ * levels of slots by distance to expiry; arm, cancel and re-arm are
+ * constant time.  Slots of coarser levels are cascaded into finer
+ * levels as the wheel turns.  Expired timers are delivered onto the
+ * shared work queue (see pfl/workthr.h).
+ */
+
+#ifndef _PFL_TIMERWHEEL_H_
+#define _PFL_TIMERWHEEL_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "pfl/list.h"
+#include "pfl/lock.h"
+#include "pfl/waitq.h"
+
+struct psc_thread;
+
+#define PFL_TWHEEL_LEVELS	4
+#define PFL_TWHEEL_SLOTBITS	8
+#define PFL_TWHEEL_NSLOTS	(1 << PFL_TWHEEL_SLOTBITS)
+#define PFL_TWHEEL_SLOTMASK	(PFL_TWHEEL_NSLOTS - 1)
+
+#define PFL_TWHEEL_TICK_MS	1	/* granularity of finest level */
+
+struct pfl_timer {
+	struct psc_listentry	  ptm_lentry;
+	uint64_t		  ptm_expire;	/* in ticks */
+	void			(*ptm_cbf)(void *);
+	void			 *ptm_arg;
+	int			  ptm_flags;
+};
+
+/* timer flags */
+#define PFL_TIMERF_ARMED	(1 << 0)	/* on the wheel */
+#define PFL_TIMERF_COARSE	(1 << 1)	/* may fire late, by up to one slot of its level */
+#define PFL_TIMERF_INLINE	(1 << 2)	/* run callback on the wheel thread */
+
+struct pfl_timerwheel {
+	struct psc_spinlock	  ptw_lock;
+	struct pfl_waitq	  ptw_wq;
+	uint64_t		  ptw_now;	/* next tick to process */
+	uint64_t		  ptw_wakeat;	/* tick wheel thread sleeps until */
+	struct timespec		  ptw_base;	/* time of tick zero */
+	int			  ptw_narmed;
+	uint64_t		  ptw_nfired;
+	uint64_t		  ptw_ncascaded;
+	uint64_t		  ptw_slotmap[PFL_TWHEEL_NSLOTS / 64];	/* level 0 occupancy */
+	struct psclist_head	  ptw_slots[PFL_TWHEEL_LEVELS][PFL_TWHEEL_NSLOTS];
+};
+
+#define pfl_timer_init(tm, cbf, arg, flags)				\
+	do {								\
+		INIT_PSC_LISTENTRY(&(tm)->ptm_lentry);			\
+		(tm)->ptm_cbf = (cbf);					\
+		(tm)->ptm_arg = (arg);					\
+		(tm)->ptm_flags = (flags) & ~PFL_TIMERF_ARMED;		\
+	} while (0)
+
+#define pfl_timer_armed(tm)	((tm)->ptm_flags & PFL_TIMERF_ARMED)
+
+void	pfl_timer_arm(struct pfl_timer *, int);
+int	pfl_timer_cancel(struct pfl_timer *);
+
+void	pfl_timerwheel_spawn(int, const char *);
+uint64_t
+	pfl_timerwheel_gettick(void);
+
+extern struct pfl_timerwheel pfl_timerwheel;
+
+#endif /* _PFL_TIMERWHEEL_H_ */
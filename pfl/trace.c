@@ -0,0 +1,426 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Per-thread binary event tracing with Chrome trace JSON export.
+ *
+ * Each ring has a single writer, its thread, which invalidates a slot,
+ * fills it in, stamps it with its sequence number and then advances
+ * ptr_head.  A reader copies the window below the head it saw and keeps
+ * only events whose stamp matched before and after the copy, so events
+ * the writer overwrote meanwhile are dropped and no lock is ever taken
+ * on the recording side.  On x86 timestamps are TSC ticks (invariant
+ * on any CPU we run on), scaled to wall time at dump against
+ * CLOCK_MONOTONIC.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pfl/dynarray.h"
+#include "pfl/list.h"
+#include "pfl/lock.h"
+#include "pfl/log.h"
+#include "pfl/pfl.h"
+#include "pfl/str.h"
+#include "pfl/subsys.h"
+#include "pfl/thread.h"
+#include "pfl/time.h"
+#include "pfl/trace.h"
+
+#define PFL_TRACE_MAXDEAD	32	/* rings of exited threads to keep */
+
+#define PFL_TRACE_BARRIER()	__sync_synchronize()
+
+struct pfl_trace_event {
+	volatile uint64_t	 pte_seq;
+	uint64_t		 pte_ts;
+	const char		*pte_name;
+	uint64_t		 pte_id;
+	int16_t			 pte_subsys;
+	int16_t			 pte_phase;
+};
+
+struct pfl_trace_ring {
+	struct psc_listentry	 ptr_lentry;
+	char			 ptr_thrname[PSC_THRNAME_MAX];
+	pid_t			 ptr_tid;
+	int			 ptr_dead;
+	uint64_t		 ptr_start;	/* reader: events before were reset */
+	volatile uint64_t	 ptr_head;	/* writer: next event */
+	struct pfl_trace_event	 ptr_events[PFL_TRACE_NEVENTS];
+};
+
+volatile uint64_t		 pfl_trace_mask;
+
+__static struct psc_spinlock	 pfl_trace_lock = SPINLOCK_INIT;
+__static PSCLIST_HEAD(pfl_trace_rings);
+__static int			 pfl_trace_ndead;
+__static uint64_t		 pfl_trace_clk0;
+__static uint64_t		 pfl_trace_ns0;
+
+__static pthread_key_t		 pfl_trace_key;
+__static pthread_once_t		 pfl_trace_once = PTHREAD_ONCE_INIT;
+
+#ifdef HAVE_TLS
+__static __threadx struct pfl_trace_ring *pfl_trace_myring;
+#endif
+
+__static uint64_t
+pfl_trace_monons(void)
+{
+	struct timespec ts;
+
+	PFL_GETTIMESPEC_MONO(&ts);
+	return (ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec);
+}
+
+static __inline uint64_t
+pfl_trace_clock(void)
+{
+	uint64_t v;
+
+#if defined(__x86_64__) || defined(__i386__)
+	v = __builtin_ia32_rdtsc();
+#else
+	v = pfl_trace_monons();
+#endif
+	return (v);
+}
+
+/*
+ * Retire an exiting thread's ring.  It is kept for dumping, but only
+ * the most recent PFL_TRACE_MAXDEAD of them.
+ */
+__static void
+pfl_trace_ring_release(void *arg)
+{
+	struct pfl_trace_ring *r = arg, *t, *old = NULL;
+
+#ifdef HAVE_TLS
+	pfl_trace_myring = NULL;
+#endif
+	spinlock(&pfl_trace_lock);
+	r->ptr_dead = 1;
+	if (++pfl_trace_ndead > PFL_TRACE_MAXDEAD) {
+		psclist_for_each_entry(t, &pfl_trace_rings, ptr_lentry)
+			if (t->ptr_dead) {
+				old = t;
+				break;
+			}
+		psclist_del(&old->ptr_lentry, &pfl_trace_rings);
+		pfl_trace_ndead--;
+	}
+	freelock(&pfl_trace_lock);
+	free(old);
+}
+
+__static void
+pfl_trace_initkey(void)
+{
+	if (pthread_key_create(&pfl_trace_key, pfl_trace_ring_release))
+		psc_fatalx("pthread_key_create");
+}
+
+/*
+ * Set up the calling thread's ring.  The system allocator is used
+ * directly since pool and memory paths are themselves traced.
+ */
+__static struct pfl_trace_ring *
+pfl_trace_getring(void)
+{
+	struct pfl_trace_ring *r;
+	struct psc_thread *thr;
+
+	pthread_once(&pfl_trace_once, pfl_trace_initkey);
+	r = pthread_getspecific(pfl_trace_key);
+	if (r)
+		goto out;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		goto out;
+	INIT_PSC_LISTENTRY(&r->ptr_lentry);
+	thr = pscthr_get_canfail();
+	if (thr) {
+		strlcpy(r->ptr_thrname, thr->pscthr_name,
+		    sizeof(r->ptr_thrname));
+		r->ptr_tid = thr->pscthr_thrid;
+	} else {
+		r->ptr_tid = pfl_getsysthrid();
+		snprintf(r->ptr_thrname, sizeof(r->ptr_thrname),
+		    "thr%d", r->ptr_tid);
+	}
+	pthread_setspecific(pfl_trace_key, r);
+
+	spinlock(&pfl_trace_lock);
+	psclist_add_tail(&r->ptr_lentry, &pfl_trace_rings);
+	freelock(&pfl_trace_lock);
+
+ out:
+#ifdef HAVE_TLS
+	pfl_trace_myring = r;
+#endif
+	return (r);
+}
+
+/*
+ * Record an event; called by the PFL_TRACE_*() trace points once the
+ * subsystem is known to be enabled.
+ */
+void
+_pfl_trace(int ss, int phase, const char *name, uint64_t id)
+{
+	struct pfl_trace_event *e;
+	struct pfl_trace_ring *r;
+	uint64_t h;
+
+#ifdef HAVE_TLS
+	r = pfl_trace_myring;
+	if (r == NULL)
+#endif
+		r = pfl_trace_getring();
+	if (r == NULL)
+		return;
+
+	h = r->ptr_head;
+	e = &r->ptr_events[h & (PFL_TRACE_NEVENTS - 1)];
+	e->pte_seq = UINT64_MAX;
+	PFL_TRACE_BARRIER();
+	e->pte_ts = pfl_trace_clock();
+	e->pte_name = name;
+	e->pte_id = id;
+	e->pte_subsys = ss;
+	e->pte_phase = phase;
+	PFL_TRACE_BARRIER();
+	e->pte_seq = h;
+	r->ptr_head = h + 1;
+}
+
+/*
+ * Switch tracing of a subsystem on or off.
+ * @ss: subsystem ID or PSS_ALL.
+ * @on: boolean.
+ */
+int
+pfl_trace_enable(int ss, int on)
+{
+	uint64_t bits;
+
+	if (ss == PSS_ALL)
+		bits = ~UINT64_C(0);
+	else if (ss < 0 || ss >= PFL_TRACE_MAXSUBSYS)
+		return (-1);
+	else
+		bits = UINT64_C(1) << ss;
+
+	spinlock(&pfl_trace_lock);
+	if (pfl_trace_clk0 == 0) {
+		pfl_trace_clk0 = pfl_trace_clock();
+		pfl_trace_ns0 = pfl_trace_monons();
+	}
+	if (on)
+		pfl_trace_mask |= bits;
+	else
+		pfl_trace_mask &= ~bits;
+	freelock(&pfl_trace_lock);
+	return (0);
+}
+
+/*
+ * Discard all recorded events.
+ */
+void
+pfl_trace_reset(void)
+{
+	struct pfl_trace_ring *r, *next;
+	struct psc_dynarray dead = DYNARRAY_INIT;
+	int i;
+
+	spinlock(&pfl_trace_lock);
+	psclist_for_each_entry_safe(r, next, &pfl_trace_rings,
+	    ptr_lentry) {
+		if (r->ptr_dead) {
+			psclist_del(&r->ptr_lentry, &pfl_trace_rings);
+			psc_dynarray_add(&dead, r);
+		} else
+			r->ptr_start = r->ptr_head;
+	}
+	pfl_trace_ndead = 0;
+	freelock(&pfl_trace_lock);
+
+	DYNARRAY_FOREACH(r, i, &dead)
+		free(r);
+	psc_dynarray_free(&dead);
+}
+
+__static void
+pfl_trace_prstr(FILE *fp, const char *s)
+{
+	putc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putc('\\', fp);
+		if ((unsigned char)*s >= ' ')
+			putc(*s, fp);
+	}
+	putc('"', fp);
+}
+
+/*
+ * Copy a ring's valid window into @dst.  Returns the number of events.
+ * pfl_trace_lock must be held so the ring stays put.
+ */
+__static int
+pfl_trace_ring_copy(struct pfl_trace_ring *r,
+    struct pfl_trace_event *dst)
+{
+	struct pfl_trace_event *e;
+	uint64_t h, lo, i;
+	int n = 0;
+
+	h = r->ptr_head;
+	PFL_TRACE_BARRIER();
+	lo = h > PFL_TRACE_NEVENTS ? h - PFL_TRACE_NEVENTS : 0;
+	if (lo < r->ptr_start)
+		lo = r->ptr_start;
+	for (i = lo; i < h; i++) {
+		e = &r->ptr_events[i & (PFL_TRACE_NEVENTS - 1)];
+		if (e->pte_seq != i)
+			continue;
+		PFL_TRACE_BARRIER();
+		dst[n] = *e;
+		PFL_TRACE_BARRIER();
+		/* drop it if the writer lapped us during the copy */
+		if (e->pte_seq == i)
+			n++;
+	}
+	return (n);
+}
+
+/*
+ * Write all buffered events as Chrome trace event JSON.
+ * Returns the number of events written.
+ */
+int
+pfl_trace_dump(FILE *fp)
+{
+	struct pfl_trace_event *e, *evs = NULL;
+	struct pfl_trace_ring *r, *found;
+	char thrname[PSC_THRNAME_MAX];
+	int nrings, j, n, total = 0;
+	uint64_t clk1, ns1;
+	double scale;
+	pid_t pid, tid;
+	const char *ph;
+
+	pid = getpid();
+	clk1 = pfl_trace_clock();
+	ns1 = pfl_trace_monons();
+	scale = 1e-3;
+	if (clk1 > pfl_trace_clk0 && pfl_trace_clk0)
+		scale = (double)(ns1 - pfl_trace_ns0) /
+		    (clk1 - pfl_trace_clk0) * 1e-3;
+
+	evs = malloc(PFL_TRACE_NEVENTS * sizeof(*evs));
+	if (evs == NULL)
+		return (-1);
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (nrings = 0; ; nrings++) {
+		/* locate the next ring; the list may change in between */
+		spinlock(&pfl_trace_lock);
+		j = 0;
+		found = NULL;
+		psclist_for_each_entry(r, &pfl_trace_rings, ptr_lentry)
+			if (j++ == nrings) {
+				found = r;
+				break;
+			}
+		if (found == NULL) {
+			freelock(&pfl_trace_lock);
+			break;
+		}
+		n = pfl_trace_ring_copy(found, evs);
+		strlcpy(thrname, found->ptr_thrname, sizeof(thrname));
+		tid = found->ptr_tid;
+		freelock(&pfl_trace_lock);
+
+		fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\","
+		    "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+		    nrings ? ",\n" : "", (int)pid, (int)tid);
+		pfl_trace_prstr(fp, thrname);
+		fprintf(fp, "}}");
+
+		for (j = 0, e = evs; j < n; j++, e++) {
+			switch (e->pte_phase) {
+			case PFL_TRACE_PH_BEGIN:
+				ph = e->pte_id ? "b" : "B";
+				break;
+			case PFL_TRACE_PH_END:
+				ph = e->pte_id ? "e" : "E";
+				break;
+			default:
+				ph = e->pte_id ? "n" : "i";
+				break;
+			}
+			fprintf(fp, ",\n{\"name\":");
+			pfl_trace_prstr(fp, e->pte_name);
+			fprintf(fp, ",\"cat\":");
+			pfl_trace_prstr(fp, pfl_subsys_name(e->pte_subsys));
+			fprintf(fp, ",\"ph\":\"%s\",\"ts\":%.3f,"
+			    "\"pid\":%d,\"tid\":%d", ph,
+			    (int64_t)(e->pte_ts - pfl_trace_clk0) * scale,
+			    (int)pid, (int)tid);
+			if (e->pte_id)
+				fprintf(fp, ",\"id\":\"0x%"PRIx64"\"",
+				    e->pte_id);
+			else if (e->pte_phase == PFL_TRACE_PH_INSTANT)
+				fprintf(fp, ",\"s\":\"t\"");
+			fprintf(fp, "}");
+		}
+		total += n;
+	}
+	fprintf(fp, "\n]}\n");
+	free(evs);
+	return (total);
+}
+
+int
+pfl_trace_dump_file(const char *fn)
+{
+	FILE *fp;
+	int n;
+
+	fp = fopen(fn, "w");
+	if (fp == NULL)
+		return (-1);
+	n = pfl_trace_dump(fp);
+	if (fclose(fp))
+		n = -1;
+	return (n);
+}
@@ -0,0 +1,75 @@
+/*
+ * %ISC_START_LICENSE%
+ * ---------------------------------------------------------------------
+ * Copyright 2018, Pittsburgh Supercomputing Center
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the
+ * above copyright notice and this permission notice appear in all
+ * copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ * --------------------------------------------------------------------
+ * %END_LICENSE%
+ */
+
+/*
+ * Binary event tracing.  Trace points record timestamped begin, end
+ * and instant events into a ring buffer private to the calling thread,
+ * so recording takes no locks and no atomics.  Tracing is switched on
+ * per subsystem (PSS_*) at run time; a disabled trace point costs one
+ * load and one predicted branch.  Rings are dumped in Chrome trace
+ * event JSON, which chrome://tracing and Perfetto load directly.
+ *
+ * Event names are stored by pointer and must be string constants (or
+ * otherwise live for the life of the process).  A nonzero id makes the
+ * event asynchronous: begin and end with the same name and id are
+ * paired even when they happen on different threads, e.g. an RPC
+ * received on one thread and handled on another.
+ */
+
+#ifndef _PFL_TRACE_H_
+#define _PFL_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pfl/subsys.h"
+
+#define PFL_TRACE_NEVENTS	4096		/* per thread, power of two */
+#define PFL_TRACE_MAXSUBSYS	64		/* bits in pfl_trace_mask */
+
+#define PFL_TRACE_PH_BEGIN	0
+#define PFL_TRACE_PH_END	1
+#define PFL_TRACE_PH_INSTANT	2
+
+#define PFL_TRACE_ENABLED(ss)						\
+	__builtin_expect(pfl_trace_mask & (UINT64_C(1) << (ss)), 0)
+
+#define _PFL_TRACE(ss, ph, name, id)					\
+	do {								\
+		if (PFL_TRACE_ENABLED(ss))				\
+			_pfl_trace((ss), (ph), (name), (id));		\
+	} while (0)
+
+#define PFL_TRACE_BEGIN(ss, name, id)	_PFL_TRACE((ss), PFL_TRACE_PH_BEGIN, (name), (id))
+#define PFL_TRACE_END(ss, name, id)	_PFL_TRACE((ss), PFL_TRACE_PH_END, (name), (id))
+#define PFL_TRACE_INSTANT(ss, name, id)	_PFL_TRACE((ss), PFL_TRACE_PH_INSTANT, (name), (id))
+
+void	_pfl_trace(int, int, const char *, uint64_t);
+int	 pfl_trace_dump(FILE *);
+int	 pfl_trace_dump_file(const char *);
+int	 pfl_trace_enable(int, int);
+void	 pfl_trace_reset(void);
+
+extern volatile uint64_t	pfl_trace_mask;
+
+#endif /* _PFL_TRACE_H_ */
@@ -24,6 +24,8 @@
 #include "pfl/cdefs.h"
 #include "pfl/ctl.h"
 #include "pfl/ctlsvr.h"
+#include "pfl/heapprof.h"
+#include "pfl/pool.h"
 #include "pfl/service.h"
 
 #include "lnrtd.h"
@@ -38,13 +40,30 @@ lrctlthr_main(void)
 	//pflrpc_register_ctlops(lrctlops);
 
 //	psc_ctlparam_register("faults", psc_ctlparam_faults);
+	psc_ctlparam_register_var("heapprof.rate",
+	    PFLCTL_PARAMT_UINT64, PFLCTL_PARAMF_RDWR,
+	    &pfl_heapprof_rate);
+	psc_ctlparam_register("lockprof", pfl_ctlparam_lockprof);
 	psc_ctlparam_register("log.file", psc_ctlparam_log_file);
 	psc_ctlparam_register("log.format", psc_ctlparam_log_format);
 	psc_ctlparam_register("log.level", psc_ctlparam_log_level);
 	psc_ctlparam_register("pause", psc_ctlparam_pause);
 	psc_ctlparam_register("pool", psc_ctlparam_pool);
+	psc_ctlparam_register_var("poolreclaim.budget",
+	    PFLCTL_PARAMT_UINT64, PFLCTL_PARAMF_RDWR,
+	    &pfl_poolreclaim_budget);
+	psc_ctlparam_register_var("poolreclaim.idle",
+	    PFLCTL_PARAMT_UINT64, PFLCTL_PARAMF_RDWR,
+	    &pfl_poolreclaim_idle);
+	psc_ctlparam_register_var("poolreclaim.psi_high",
+	    PFLCTL_PARAMT_UINT64, PFLCTL_PARAMF_RDWR,
+	    &pfl_poolreclaim_psi_high);
+	psc_ctlparam_register_var("poolreclaim.psi_low",
+	    PFLCTL_PARAMT_UINT64, PFLCTL_PARAMF_RDWR,
+	    &pfl_poolreclaim_psi_low);
 	psc_ctlparam_register("rlim", psc_ctlparam_rlim);
 	psc_ctlparam_register("run", psc_ctlparam_run);
+	psc_ctlparam_register("trace", pfl_ctlparam_trace);
 
 	psc_ctlthr_main(ctlsockfn, lrctlops, nitems(lrctlops), 0,
 	    LRTHRT_CTLAC);
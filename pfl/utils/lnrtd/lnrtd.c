@@ -31,6 +31,7 @@
 #include "pfl/ctlsvr.h"
 #include "pfl/lock.h"
 #include "pfl/log.h"
+#include "pfl/pool.h"
 
 #include "lnet/lnet.h"
 
@@ -88,6 +89,7 @@ main(int argc, char *argv[])
 
 	pscthr_init(LRTHRT_CTL, NULL,
 	    sizeof(struct psc_ctlthr), "lrctlthr");
+	pfl_poolreclaimthr_spawn(LRTHRT_POOLRECLAIM, "lrpoolreclaimthr");
 
 	rc = LNetInit(2048);
 	if (rc)
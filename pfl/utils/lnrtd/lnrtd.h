@@ -32,6 +32,7 @@ enum {
 	LRTHRT_EQPOLL,
 	LRTHRT_LNETAC,
 	LRTHRT_OPSTIMER,
+	LRTHRT_POOLRECLAIM,
 	LRTHRT_USKLNDPL
 };
 
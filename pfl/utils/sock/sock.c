@@ -116,12 +116,12 @@ displaythr_main(__unusedx struct psc_thread *thr)
 
 		pfl_fmt_human(ratebuf, rdst->opst_intv);
 		printf("%7s\t", ratebuf);
-		pfl_fmt_human(ratebuf, psc_atomic64_read(&rdst->opst_lifetime));
+		pfl_fmt_human(ratebuf, pfl_opstat_read(rdst));
 		printf("%7s\t\t|\t", ratebuf);
 
 		pfl_fmt_human(ratebuf, wrst->opst_intv);
 		printf("%7s\t", ratebuf);
-		pfl_fmt_human(ratebuf, psc_atomic64_read(&wrst->opst_lifetime));
+		pfl_fmt_human(ratebuf, pfl_opstat_read(wrst));
 		printf("%7s\n", ratebuf);
 
 		if (n > 30)
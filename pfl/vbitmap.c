@@ -22,8 +22,13 @@
  */
 
 /*
- * Variable-sized bitmaps.  Internally, bitmaps are arrays
- * of chars that are realloc(3)'d to different lengths.
+ * Variable-sized bitmaps.  Internally, bitmaps are arrays of 64-bit
+ * words that are realloc(3)'d to different lengths.
+ *
+ * Bits past the end of the bitmap in the last word are always kept
+ * zero.  A summary layer (vb_summary) holds one bit per word, set when
+ * the word has a free bit, so psc_vbitmap_next() on a mostly full map
+ * skips 4096 bits per summary word examined instead of walking bytes.
  *
  * This API is not thread-safe!
  */
@@ -32,22 +37,157 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 
 #include "pfl/alloc.h"
-#include "pfl/bitflag.h"
 #include "pfl/cdefs.h"
 #include "pfl/log.h"
 #include "pfl/vbitmap.h"
 
-#define VB_CLEAR_UNALLOC(vb)						\
-	do {								\
-		if ((vb)->vb_lastsize && (vb)->vb_lastsize != NBBY)	\
-			*(vb)->vb_end &= ~(0xff << (vb)->vb_lastsize);	\
-	} while (0)
+#define VB_NBITS		PFL_VBITMAP_WORDBITS
+#define VB_ALLONES		(~(uint64_t)0)
+
+#define VB_POPCNT(w)		__builtin_popcountll(w)
+#define VB_CTZ(w)		__builtin_ctzll(w)
+
+#define VB_NWORDS(nbits)	howmany((nbits), VB_NBITS)
+
+/*
+ * Allocation sizes of the word and summary arrays.  These never drop
+ * to zero so psc_realloc() is never asked to shrink to nothing.
+ */
+#define VB_WORDSZ(nw)		(MAX((nw), 1) * sizeof(uint64_t))
+#define VB_SUMSZ(nw)		(MAX(VB_NWORDS(nw), 1) * sizeof(uint64_t))
+
+/* Mask of bits at and above bit offset 'n' of a word. */
+#define VB_MASK_FROM(n)		(VB_ALLONES << (n))
+
+/* Mask of bits below bit offset 'n' of a word; n may be VB_NBITS. */
+#define VB_MASK_BELOW(n)	((n) >= VB_NBITS ? VB_ALLONES :		\
+				    ((uint64_t)1 << (n)) - 1)
+
+/*
+ * Mask of the bits of word 'w' that fall inside the bitmap.
+ */
+static __inline uint64_t
+vb_validmask(const struct psc_vbitmap *vb, size_t w)
+{
+	if (w == vb->vb_nwords - 1 && vb->vb_nbits % VB_NBITS)
+		return (VB_MASK_BELOW(vb->vb_nbits % VB_NBITS));
+	return (VB_ALLONES);
+}
+
+/*
+ * Recompute the summary bit for word 'w'.
+ */
+static __inline void
+vb_sumupdate(struct psc_vbitmap *vb, size_t w)
+{
+	uint64_t bit = (uint64_t)1 << (w % VB_NBITS);
+
+	if ((vb->vb_words[w] | ~vb_validmask(vb, w)) == VB_ALLONES)
+		vb->vb_summary[w / VB_NBITS] &= ~bit;
+	else
+		vb->vb_summary[w / VB_NBITS] |= bit;
+}
+
+/*
+ * Rebuild the entire summary layer from the bitmap words.
+ */
+static void
+vb_sumrebuild(struct psc_vbitmap *vb)
+{
+	size_t w;
+
+	memset(vb->vb_summary, 0, VB_SUMSZ(vb->vb_nwords));
+	for (w = 0; w < vb->vb_nwords; w++)
+		vb_sumupdate(vb, w);
+}
+
+/*
+ * Find the first word at or after 'w' with a free bit.
+ * Returns vb_nwords if there is none.
+ */
+static size_t
+vb_findnonfull(const struct psc_vbitmap *vb, size_t w)
+{
+	size_t sw, nsw;
+	uint64_t s;
+
+	if (w >= vb->vb_nwords)
+		return (vb->vb_nwords);
+	nsw = VB_NWORDS(vb->vb_nwords);
+	sw = w / VB_NBITS;
+	s = vb->vb_summary[sw] & VB_MASK_FROM(w % VB_NBITS);
+	while (s == 0) {
+		if (++sw >= nsw)
+			return (vb->vb_nwords);
+		s = vb->vb_summary[sw];
+	}
+	return (sw * VB_NBITS + VB_CTZ(s));
+}
+
+/*
+ * Find the first unset bit at or after 'pos'.
+ * Returns vb_nbits if there is none.
+ */
+static size_t
+vb_nextzero(const struct psc_vbitmap *vb, size_t pos)
+{
+	size_t w;
+	uint64_t v;
+
+	if (pos >= vb->vb_nbits)
+		return (vb->vb_nbits);
+	w = pos / VB_NBITS;
+	v = ~vb->vb_words[w] & vb_validmask(vb, w) &
+	    VB_MASK_FROM(pos % VB_NBITS);
+	if (v == 0) {
+		w = vb_findnonfull(vb, w + 1);
+		if (w >= vb->vb_nwords)
+			return (vb->vb_nbits);
+		v = ~vb->vb_words[w] & vb_validmask(vb, w);
+	}
+	return (w * VB_NBITS + VB_CTZ(v));
+}
+
+/*
+ * Find the first set bit at or after 'pos'.
+ * Returns vb_nbits if there is none.
+ */
+static size_t
+vb_nextone(const struct psc_vbitmap *vb, size_t pos)
+{
+	size_t w;
+	uint64_t v;
+
+	if (pos >= vb->vb_nbits)
+		return (vb->vb_nbits);
+	w = pos / VB_NBITS;
+	v = vb->vb_words[w] & VB_MASK_FROM(pos % VB_NBITS);
+	while (v == 0) {
+		if (++w >= vb->vb_nwords)
+			return (vb->vb_nbits);
+		v = vb->vb_words[w];
+	}
+	return (MIN(w * VB_NBITS + VB_CTZ(v), vb->vb_nbits));
+}
+
+/*
+ * Get the Nth byte of the legacy byte-array representation.
+ */
+#define VB_BYTE(vb, n)		psc_vbitmap_getbyte((vb), (n))
+
+/*
+ * Number of bytes in the legacy byte-array representation and the
+ * number of valid bits in its last byte.
+ */
+#define VB_NBYTES(vb)		howmany((vb)->vb_nbits, NBBY)
+#define VB_LASTSIZE(vb)		((vb)->vb_nbits ?			\
+				    ((vb)->vb_nbits - 1) % NBBY + 1 : 0)
 
 /*
  * Create a new variable-sized bitmap.
@@ -58,25 +198,14 @@ struct psc_vbitmap *
 psc_vbitmap_newf(size_t nelems, int flags)
 {
 	struct psc_vbitmap *vb;
-	size_t bytes;
 
 	vb = PSCALLOC(sizeof(*vb));
 	vb->vb_flags = flags;
-
-	bytes = howmany(nelems, NBBY);
-	/*
- 	 * Note that if bytes is zero, vb_start can still return
- 	 * a non-NULL value, which should be used to call free().
- 	 */
-	vb->vb_start = PSCALLOC(bytes);
-	vb->vb_pos = vb->vb_start;
-	if (bytes)
-		vb->vb_end = vb->vb_start + bytes - 1;
-	else
-		vb->vb_end = vb->vb_start;
-	vb->vb_lastsize = nelems % NBBY;
-	if (nelems && vb->vb_lastsize == 0)
-		vb->vb_lastsize = NBBY;
+	vb->vb_nbits = nelems;
+	vb->vb_nwords = VB_NWORDS(nelems);
+	vb->vb_words = PSCALLOC(VB_WORDSZ(vb->vb_nwords));
+	vb->vb_summary = PSCALLOC(VB_SUMSZ(vb->vb_nwords));
+	vb_sumrebuild(vb);
 	return (vb);
 }
 
@@ -84,10 +213,13 @@ void
 _psc_vbitmap_free(struct psc_vbitmap *vb)
 {
 	if ((vb->vb_flags & PVBF_EXTALLOC) == 0)
-		PSCFREE(vb->vb_start);
-	vb->vb_start = NULL;
-	vb->vb_end = NULL;
-	vb->vb_pos = NULL;
+		PSCFREE(vb->vb_words);
+	PSCFREE(vb->vb_summary);
+	vb->vb_words = NULL;
+	vb->vb_summary = NULL;
+	vb->vb_nbits = 0;
+	vb->vb_nwords = 0;
+	vb->vb_pos = 0;
 	if ((vb->vb_flags & PVBF_STATIC) == 0)
 		PSCFREE(vb);
 }
@@ -102,18 +234,21 @@ _psc_vbitmap_free(struct psc_vbitmap *vb)
 int
 psc_vbitmap_setval(struct psc_vbitmap *vb, size_t pos, int set)
 {
-	size_t shft, bytes;
+	uint64_t bit;
+	size_t w;
 	int oldval;
 
 	pfl_assert(pos < psc_vbitmap_getsize(vb));
 
-	bytes = pos / NBBY;
-	shft = pos % NBBY;
-	oldval = (vb->vb_start[bytes] >> shft) & 1;
+	w = pos / VB_NBITS;
+	bit = (uint64_t)1 << (pos % VB_NBITS);
+	oldval = (vb->vb_words[w] & bit) != 0;
 	if (set)
-		vb->vb_start[bytes] |= (1 << shft);
+		vb->vb_words[w] |= bit;
 	else
-		vb->vb_start[bytes] &= ~(1 << shft);
+		vb->vb_words[w] &= ~bit;
+	if (oldval != !!set)
+		vb_sumupdate(vb, w);
 	return (oldval);
 }
 
@@ -128,42 +263,27 @@ int
 psc_vbitmap_setval_range(struct psc_vbitmap *vb,
     size_t pos, size_t size, int val)
 {
-	size_t shft, bytes, len;
-	unsigned char *p;
+	size_t w, lw, end;
+	uint64_t mask;
 
 	if (pos + size > psc_vbitmap_getsize(vb))
 		return (EINVAL);
-
-	bytes = pos / NBBY;
-	shft = pos % NBBY;
-
-	p = &vb->vb_start[bytes];
-
-	/* change bits in first byte */
-	if (shft) {
-		len = MIN(size, NBBY - shft);
-		if (val)
-			*p++ |= ~(0xff << len) << shft;
-		else
-			*p++ &= (0xff << (len + shft)) |
-			    (0xff >> (NBBY - shft));
-		size -= len;
-	}
-
-	/* change whole bytes */
-	if (val)
-		for (; size >= 8; p++, size -= 8)
-			*p = 0xff;
-	else
-		for (; size >= 8; p++, size -= 8)
-			*p = 0;
-
-	/* change bits in last byte */
-	if (size) {
+	if (size == 0)
+		return (0);
+
+	end = pos + size;
+	lw = (end - 1) / VB_NBITS;
+	for (w = pos / VB_NBITS; w <= lw; w++) {
+		mask = VB_ALLONES;
+		if (w == pos / VB_NBITS)
+			mask &= VB_MASK_FROM(pos % VB_NBITS);
+		if (w == lw)
+			mask &= VB_MASK_BELOW(end - lw * VB_NBITS);
 		if (val)
-			*p |= 0xff >> (NBBY - size);
+			vb->vb_words[w] |= mask;
 		else
-			*p &= 0xff >> (NBBY - size);
+			vb->vb_words[w] &= ~mask;
+		vb_sumupdate(vb, w);
 	}
 	return (0);
 }
@@ -176,13 +296,9 @@ psc_vbitmap_setval_range(struct psc_vbitmap *vb,
 int
 psc_vbitmap_get(const struct psc_vbitmap *vb, size_t pos)
 {
-	size_t shft, bytes;
-
 	pfl_assert(pos < psc_vbitmap_getsize(vb));
 
-	bytes = pos / NBBY;
-	shft = pos % NBBY;
-	return ((vb->vb_start[bytes] & (1 << shft)) >> shft);
+	return ((vb->vb_words[pos / VB_NBITS] >> (pos % VB_NBITS)) & 1);
 }
 
 /*
@@ -193,15 +309,11 @@ psc_vbitmap_get(const struct psc_vbitmap *vb, size_t pos)
 int
 psc_vbitmap_nfree(const struct psc_vbitmap *vb)
 {
-	unsigned char *p;
-	int n, j;
-
-	for (n = 0, p = vb->vb_start; p <= vb->vb_end; p++)
-		for (j = 0; j < (p == vb->vb_end ?
-		    vb->vb_lastsize : NBBY); j++)
-			if ((*p & (1 << j)) == 0)
-				n++;
-	return (n);
+	size_t w, n = 0;
+
+	for (w = 0; w < vb->vb_nwords; w++)
+		n += VB_POPCNT(vb->vb_words[w]);
+	return (vb->vb_nbits - n);
 }
 
 /*
@@ -211,96 +323,91 @@ psc_vbitmap_nfree(const struct psc_vbitmap *vb)
 void
 psc_vbitmap_invert(struct psc_vbitmap *vb)
 {
-	unsigned char *p;
+	size_t w;
 
-	for (p = vb->vb_start; p < vb->vb_end ||
-	    (p == vb->vb_end && vb->vb_lastsize); p++)
-		*p = ~(*p);
+	for (w = 0; w < vb->vb_nwords; w++)
+		vb->vb_words[w] = ~vb->vb_words[w] & vb_validmask(vb, w);
+	vb_sumrebuild(vb);
 }
 
 /*
  * Toggle on all bits in a vbitmap.
- * XXX this should just be a call to setval_range()
  * @vb: variable bitmap.
  */
 void
 psc_vbitmap_setall(struct psc_vbitmap *vb)
 {
-	unsigned char *p;
-
-	for (p = vb->vb_start; p < vb->vb_end ||
-	    (p == vb->vb_end && vb->vb_lastsize); p++)
-		*p = 0xff;
+	psc_vbitmap_setval_range(vb, 0, vb->vb_nbits, 1);
 }
 
 /*
  * Toggle off all bits in a vbitmap.
- * XXX this should just be a call to setval_range()
  * @vb: variable bitmap.
  */
 void
 psc_vbitmap_clearall(struct psc_vbitmap *vb)
 {
-	unsigned char *p;
-
-	for (p = vb->vb_start; p < vb->vb_end ||
-	    (p == vb->vb_end && vb->vb_lastsize); p++)
-		*p = 0;
+	psc_vbitmap_setval_range(vb, 0, vb->vb_nbits, 0);
 }
 
 /*
- * Determine if there are any empty slots in a range.
+ * Determine if all bits in a range are set to the given value.
  * @vb: variable bitmap.
+ * @val: value to check for.
+ * @start: first bit of range.
+ * @len: length of range.
+ *
+ * Whole words in the middle of the range are OR-reduced four at a time
+ * (after XOR with the fill value) in a branch-light loop the compiler
+ * can turn into vector code.
  */
 int
 pfl_vbitmap_israngeset(struct psc_vbitmap *vb, int val,
     size_t start, size_t len)
 {
-	unsigned char *p, fv;
-	size_t adj;
+	const uint64_t *p;
+	uint64_t fv, mask, acc;
+	size_t w, lw, end, n;
 
 	if (len == 0)
 		return (1);
 
-	fv = val ? 0xff : 0;
+	fv = val ? VB_ALLONES : 0;
 	pfl_assert(start < psc_vbitmap_getsize(vb));
 	pfl_assert(start + len > start);
 	pfl_assert(start + len <= psc_vbitmap_getsize(vb));
-	p = vb->vb_start;
-	p += start / NBBY;
-	adj = start & 7;
-	if (adj) {
-		int mask;
-
-		mask = ((1 << MIN(len, NBBY)) - 1) << adj;
-		if ((*p & mask) != (fv & mask))
-			return (0);
-		if (len < NBBY)
-			return (1);
 
-		if (adj > len)
-			len = 0;
-		else
-			len -= NBBY - adj;
-		p++;
-	}
-	// XXX use native word size for speed
-	for (; p < vb->vb_end && len >= NBBY; p++, len -= 8)
-		if (*p != fv)
-			return (0);
-	if (len == 0)
+	end = start + len;
+	w = start / VB_NBITS;
+	lw = (end - 1) / VB_NBITS;
+
+	/* Check the first (possibly partial) word. */
+	mask = VB_MASK_FROM(start % VB_NBITS);
+	if (w == lw)
+		mask &= VB_MASK_BELOW(end - lw * VB_NBITS);
+	if ((vb->vb_words[w] ^ fv) & mask)
+		return (0);
+	if (w == lw)
 		return (1);
 
-	pfl_assert(len <= 8);
-
-	/* Check last byte. */
-	if (fv) {
-		if ((0xff & (*p | (0xff << len))) != 0xff)
-			return (0);
-	} else {
-		if (*p & ~(0xff << len))
+	/* Check whole words in between. */
+	p = vb->vb_words + w + 1;
+	n = lw - w - 1;
+	for (; n >= 4; p += 4, n -= 4) {
+		acc = (p[0] ^ fv) | (p[1] ^ fv) |
+		    (p[2] ^ fv) | (p[3] ^ fv);
+		if (acc)
 			return (0);
 	}
+	for (acc = 0; n > 0; p++, n--)
+		acc |= *p ^ fv;
+	if (acc)
+		return (0);
+
+	/* Check the last (possibly partial) word. */
+	mask = VB_MASK_BELOW(end - lw * VB_NBITS);
+	if ((vb->vb_words[lw] ^ fv) & mask)
+		return (0);
 	return (1);
 }
 
@@ -312,32 +419,14 @@ pfl_vbitmap_israngeset(struct psc_vbitmap *vb, int val,
 int
 psc_vbitmap_lcr(struct psc_vbitmap *vb)
 {
-	unsigned char *p;
-	int i, n = 0, r = 0;
-
-	VB_CLEAR_UNALLOC(vb);
-	for (p = vb->vb_start; p < vb->vb_end ||
-	    (p == vb->vb_end && vb->vb_lastsize); p++) {
-		if (*p == 0)
-			n += NBBY;
-		else if (*p == 0xff) {
-			if (n > r)
-				r = n;
-			n = 0;
-		} else {
-			for (i = 0; i < NBBY; i++) {
-				if ((*p & (1 << i)) == 0)
-					n++;
-				else {
-					if (n > r)
-						r = n;
-					n = 0;
-				}
-			}
-		}
+	size_t s, e, r = 0;
+
+	for (s = vb_nextzero(vb, 0); s < vb->vb_nbits;
+	    s = vb_nextzero(vb, e)) {
+		e = vb_nextone(vb, s);
+		if (e - s > r)
+			r = e - s;
 	}
-	if (n > r)
-		r = n;
 	return (r);
 }
 
@@ -348,37 +437,33 @@ psc_vbitmap_lcr(struct psc_vbitmap *vb)
  *	On output, informs the caller of the starting slot.
  * Returns: number of slots assigned, 0 for none.
  *
- * XXX: adjust this to take into account vb_lastsize.
+ * The first free region of at least 'N' slots is used; failing that,
+ * the first largest region is assigned.
  */
 int
 psc_vbitmap_getncontig(struct psc_vbitmap *vb, int *nslots)
 {
-	unsigned char *p;
-	int i=0, sbit=0, ebit=0, t1=0, t2=0;
-
-#define TEST_AND_SET					\
-	do {						\
-		if ((t2 - t1) > (ebit - sbit)) {	\
-			sbit = t1;			\
-			ebit = t2;			\
-		}					\
-		t1 = t2 + 1;				\
-	} while (0)
-
-	for (p = vb->vb_start; p <= vb->vb_end; p++)
-		for (i = 0; i < (p == vb->vb_end ?
-		    vb->vb_lastsize : NBBY); i++, t2++) {
-			if (*p & (1 << i))
-				TEST_AND_SET;
-			else if (t2 - t1 == *nslots)
-				goto mark_bits;
+	size_t s, e, sbit = 0, ebit = 0;
+
+	if (*nslots == 0)
+		return (0);
+
+	for (s = vb_nextzero(vb, 0); s < vb->vb_nbits;
+	    s = vb_nextzero(vb, e)) {
+		e = vb_nextone(vb, s);
+		if (*nslots > 0 && e - s >= (size_t)*nslots) {
+			sbit = s;
+			ebit = s + *nslots;
+			break;
+		}
+		if (e - s > ebit - sbit) {
+			sbit = s;
+			ebit = e;
 		}
- mark_bits:
-	TEST_AND_SET;
+	}
 
 	if (ebit - sbit) {
-		for (i = sbit; i < ebit; i++)
-			vb->vb_start[i / NBBY] |= 1 << (i % NBBY);
+		psc_vbitmap_setval_range(vb, sbit, ebit - sbit, 1);
 		/* Inform the caller of the start bit */
 		*nslots = sbit;
 	}
@@ -394,27 +479,24 @@ psc_vbitmap_getncontig(struct psc_vbitmap *vb, int *nslots)
 int
 psc_vbitmap_next(struct psc_vbitmap *vb, size_t *elem)
 {
-	unsigned char *start, *pos;
-	int bytepos;
+	size_t w, bit;
 
  retry:
-	pos = start = vb->vb_pos;
-	do {
-		/* Check if byte is completely full. */
-		if (pos == vb->vb_end) {
-			if (vb->vb_lastsize == NBBY) {
-				if (*pos != 0xff)
-					goto found;
-			} else if (pos && *pos != ~(char)(0x100 -
-			    (1 << vb->vb_lastsize)))
-				goto found;
-			pos = vb->vb_start;	/* last byte is full, wrap around */
-		} else {
-			if (*pos != 0xff)
-				goto found;
-			pos++;			/* current byte is full, advance */
-		}
-	} while (pos != start);
+	/* Fast path: the word we last allocated from still has room. */
+	w = vb->vb_pos;
+	if (w < vb->vb_nwords &&
+	    (vb->vb_words[w] | ~vb_validmask(vb, w)) != VB_ALLONES)
+		goto found;
+
+	w = vb_findnonfull(vb, vb->vb_pos);
+	if (w >= vb->vb_nwords) {
+		/* wrap around */
+		w = vb_findnonfull(vb, 0);
+		if (w >= vb->vb_pos)
+			w = vb->vb_nwords;
+	}
+	if (w < vb->vb_nwords)
+		goto found;
 
 	if ((vb->vb_flags & (PVBF_AUTO | PVBF_EXTALLOC)) == PVBF_AUTO) {
 		size_t newsiz;
@@ -430,11 +512,14 @@ psc_vbitmap_next(struct psc_vbitmap *vb, size_t *elem)
 	return (0);
 
  found:
-	/* We now have a byte from the bitmap that has a zero. */
-	vb->vb_pos = pos;
-	bytepos = ffs(~*pos) - 1;
-	*pos |= 1 << bytepos;
-	*elem = NBBY * (pos - vb->vb_start) + bytepos;
+	/* We now have a word from the bitmap that has a zero. */
+	vb->vb_pos = w;
+	bit = VB_CTZ(~vb->vb_words[w]);
+	vb->vb_words[w] |= (uint64_t)1 << bit;
+	if ((vb->vb_words[w] | ~vb_validmask(vb, w)) == VB_ALLONES)
+		vb->vb_summary[w / VB_NBITS] &=
+		    ~((uint64_t)1 << (w % VB_NBITS));
+	*elem = w * VB_NBITS + bit;
 	return (1);
 }
 
@@ -447,7 +532,7 @@ void
 psc_vbitmap_setnextpos(struct psc_vbitmap *vb, size_t pos)
 {
 	pfl_assert(pos < psc_vbitmap_getsize(vb));
-	vb->vb_pos = vb->vb_start + pos / NBBY;
+	vb->vb_pos = pos / VB_NBITS;
 }
 
 /*
@@ -458,37 +543,32 @@ psc_vbitmap_setnextpos(struct psc_vbitmap *vb, size_t pos)
 int
 psc_vbitmap_resize(struct psc_vbitmap *vb, size_t newsize)
 {
-	size_t nsiz, osiz;
-	ptrdiff_t pos;
-
-	pos = vb->vb_pos - vb->vb_start;
-	osiz = howmany(psc_vbitmap_getsize(vb), NBBY);
-	nsiz = howmany(newsize, NBBY);
-	if (vb->vb_start && nsiz == osiz)
-		/*
-		 * Resizing inside a byte; no mem alloc changes
-		 * necessary.
-		 */
-		VB_CLEAR_UNALLOC(vb);
-	else {
+	size_t nw, ow;
+
+	ow = vb->vb_nwords;
+	nw = VB_NWORDS(newsize);
+	if (vb->vb_words == NULL || nw != ow) {
 		/* XXX check return code ? */
-		vb->vb_start = psc_realloc(vb->vb_start, nsiz, 0);
-		if (nsiz)
-			vb->vb_end = vb->vb_start + nsiz - 1;
-		else
-			vb->vb_end = vb->vb_start;
+		vb->vb_words = psc_realloc(vb->vb_words,
+		    VB_WORDSZ(nw), 0);
+		vb->vb_summary = psc_realloc(vb->vb_summary,
+		    VB_SUMSZ(nw), 0);
 
 		/* Initialize new sections of the bitmap to zero. */
-		if (nsiz > (size_t)osiz)
-			memset(vb->vb_start + osiz, 0, nsiz - osiz);
+		if (nw > ow)
+			memset(vb->vb_words + ow, 0,
+			    (nw - ow) * sizeof(*vb->vb_words));
 	}
-	vb->vb_lastsize = newsize % NBBY;
-	vb->vb_pos = vb->vb_start + pos;
-	if (vb->vb_pos > vb->vb_end)
-		vb->vb_pos = vb->vb_start;
+	vb->vb_nbits = newsize;
+	vb->vb_nwords = nw;
+
+	/* Clear any bits in the last word now outside the bitmap. */
+	if (nw)
+		vb->vb_words[nw - 1] &= vb_validmask(vb, nw - 1);
+	vb_sumrebuild(vb);
 
-	if (newsize && vb->vb_lastsize == 0)
-		vb->vb_lastsize = NBBY;
+	if (vb->vb_pos >= vb->vb_nwords)
+		vb->vb_pos = 0;
 	return (0);
 }
 
@@ -498,63 +578,57 @@ psc_vbitmap_resize(struct psc_vbitmap *vb, size_t newsize)
 char *
 pfl_vbitmap_getbinstring(const struct psc_vbitmap *vb)
 {
-	unsigned char *p;
 	char *str, *t;
-	ptrdiff_t len;
-	int i;
+	size_t i;
 
-	len = psc_vbitmap_getsize(vb) + 1;
-	str = PSCALLOC(len);
-	for (p = vb->vb_start, t = str; p < vb->vb_end; p++)
-		for (i = 0; i < NBBY; i++) {
-			*t++ = ((*p >> i) & 1) ? '1' : '0';
-			if (t - str >= len)
-				goto done;
-		}
-	for (i = 0; i < vb->vb_lastsize && t - str < len; i++)
-		*t++ = ((*p >> i) & 1) ? '1' : '0';
-
- done:
+	str = PSCALLOC(psc_vbitmap_getsize(vb) + 1);
+	for (i = 0, t = str; i < vb->vb_nbits; i++)
+		*t++ = psc_vbitmap_get(vb, i) ? '1' : '0';
 	*t = '\0';
 	return (str);
 }
 
 /*
  * Get an abbreviated binary representation of a vbitmap.
+ *
+ * All but the last byte are run-length encoded; the bits of the last
+ * byte are printed verbatim.
  */
 char *
 pfl_vbitmap_getabbrbinstring(const struct psc_vbitmap *vb)
 {
-	int i, runlen = 0, n, thisval, lastval = *vb->vb_start & 1;
-	unsigned char *p;
+	int runlen = 0, n, thisval, lastval;
 	char *str, *t;
 	ptrdiff_t len;
+	size_t i, nrle;
 
 	len = psc_vbitmap_getsize(vb) + 1;
 	str = PSCALLOC(len);
-	for (p = vb->vb_start, t = str; p < vb->vb_end; p++) {
-		if ((*p == 0 || *p == 0xff) &&
-		    (*p & lastval) == lastval) {
-			runlen += NBBY;
+	t = str;
+	nrle = vb->vb_nbits - VB_LASTSIZE(vb);
+	lastval = vb->vb_nbits ? psc_vbitmap_get(vb, 0) : 0;
+	for (i = 0; i < nrle; i++) {
+		if (i % VB_NBITS == 0 && i + VB_NBITS <= nrle &&
+		    vb->vb_words[i / VB_NBITS] == (lastval ? VB_ALLONES : 0)) {
+			runlen += VB_NBITS;
+			i += VB_NBITS - 1;
 			continue;
 		}
-		for (i = 0; i < NBBY; i++) {
-			thisval = (*p >> i) & 1;
-			if (thisval != lastval) {
-				*t++ = lastval ? '1' : '0';
-				lastval = thisval;
-				if (runlen > 3) {
-					n = snprintf(t, len - (t - str),
-					    ":%d,", runlen);
-					pfl_assert(n != -1);
-					t += n;
-				}
-				runlen = 0;
-				if (t - str >= len)
-					goto done;
+		thisval = psc_vbitmap_get(vb, i);
+		if (thisval != lastval) {
+			*t++ = lastval ? '1' : '0';
+			lastval = thisval;
+			if (runlen > 3) {
+				n = snprintf(t, len - (t - str),
+				    ":%d,", runlen);
+				pfl_assert(n != -1);
+				t += n;
 			}
-			runlen++;
+			runlen = 0;
+			if (t - str >= len)
+				goto done;
 		}
+		runlen++;
 	}
 	if (runlen) {
 		*t++ = lastval ? '1' : '0';
@@ -562,8 +636,8 @@ pfl_vbitmap_getabbrbinstring(const struct psc_vbitmap *vb)
 		pfl_assert(n != -1);
 		t += n;
 	}
-	for (i = 0; i < vb->vb_lastsize && t - str < len; i++)
-		*t++ = ((*p >> i) & 1) ? '1' : '0';
+	for (; i < vb->vb_nbits && t - str < len; i++)
+		*t++ = psc_vbitmap_get(vb, i) ? '1' : '0';
 
  done:
 	*t = '\0';
@@ -577,23 +651,27 @@ pfl_vbitmap_getabbrbinstring(const struct psc_vbitmap *vb)
 void
 psc_vbitmap_printbin(const struct psc_vbitmap *vb)
 {
-	unsigned char *p;
+	size_t i, nbytes;
+	unsigned char c;
 	int j;
 
-	for (p = vb->vb_start; p < vb->vb_end; p++) {
+	nbytes = VB_NBYTES(vb);
+	for (i = 0; i + 1 < nbytes; i++) {
+		c = VB_BYTE(vb, i);
 		printf("%d%d%d%d%d%d%d%d ",
-		    (*p >> 0) & 1, (*p >> 1) & 1,
-		    (*p >> 2) & 1, (*p >> 3) & 1,
-		    (*p >> 4) & 1, (*p >> 5) & 1,
-		    (*p >> 6) & 1, (*p >> 7) & 1);
-		if (((p + 1 - vb->vb_start) % 8) == 0 ||
-		    p == vb->vb_end)
+		    (c >> 0) & 1, (c >> 1) & 1,
+		    (c >> 2) & 1, (c >> 3) & 1,
+		    (c >> 4) & 1, (c >> 5) & 1,
+		    (c >> 6) & 1, (c >> 7) & 1);
+		if (((i + 1) % 8) == 0)
 			printf("\n");
 	}
-	for (j = 0; j < vb->vb_lastsize; j++)
-		printf("%d", (*p >> j) & 1);
-	if (vb->vb_lastsize)
+	if (nbytes) {
+		c = VB_BYTE(vb, nbytes - 1);
+		for (j = 0; j < (int)VB_LASTSIZE(vb); j++)
+			printf("%d", (c >> j) & 1);
 		printf("\n");
+	}
 }
 
 /*
@@ -603,15 +681,14 @@ psc_vbitmap_printbin(const struct psc_vbitmap *vb)
 void
 psc_vbitmap_printhex(const struct psc_vbitmap *vb)
 {
-	const unsigned char *p;
+	size_t i, nbytes;
 
-	for (p = vb->vb_start; p <= vb->vb_end; p++) {
-		printf("%02x", *p);
-		if (((p + 1 - vb->vb_start) % 32) == 0 ||
-		    p == vb->vb_end)
+	nbytes = VB_NBYTES(vb);
+	for (i = 0; i < nbytes; i++) {
+		printf("%02x", VB_BYTE(vb, i));
+		if (((i + 1) % 32) == 0 || i + 1 == nbytes)
 			printf("\n");
-		else if (((p + 1 - vb->vb_start) % 4) == 0 ||
-		    p == vb->vb_end)
+		else if (((i + 1) % 4) == 0)
 			printf(" ");
 	}
 }
@@ -623,11 +700,8 @@ psc_vbitmap_printhex(const struct psc_vbitmap *vb)
 void
 psc_vbitmap_getstats(struct psc_vbitmap *vb, int *used, int *total)
 {
-	VB_CLEAR_UNALLOC(vb);
-	*used = pfl_bitstr_nset(vb->vb_start,
-	    (vb->vb_lastsize ? 1 : 0) +
-	    vb->vb_end - vb->vb_start);
 	*total = psc_vbitmap_getsize(vb);
+	*used = *total - psc_vbitmap_nfree(vb);
 }
 
 /*
@@ -22,8 +22,10 @@
  */
 
 /*
- * Variable-sized bitmaps.  Internally, bitmaps are arrays
- * of chars that are realloc(3)'d to different lengths.
+ * Variable-sized bitmaps.  Internally, bitmaps are arrays of 64-bit
+ * words that are realloc(3)'d to different lengths.  A summary layer
+ * holds one bit per word that still has a free (unset) bit so free
+ * slots can be found without scanning full regions.
  *
  * This API is not thread-safe!
  */
@@ -34,21 +36,25 @@
 #include <sys/types.h>
 
 #include <limits.h>
+#include <stdint.h>
 
 struct psc_vbitmap {
-	unsigned char		*vb_start;
-	unsigned char		*vb_end;
-	unsigned char		*vb_pos;	/* ptr to current slot for speed */
-	int			 vb_lastsize;	/* #ents in last byte, for sizes not multiple of NBBY */
+	uint64_t		*vb_words;	/* bits, LSB first */
+	uint64_t		*vb_summary;	/* bit per word with a free bit */
+	size_t			 vb_nbits;
+	size_t			 vb_nwords;
+	size_t			 vb_pos;	/* word psc_vbitmap_next() resumes at */
 	int			 vb_flags;	/* see PVBF_* flags below */
 };
 
+#define PFL_VBITMAP_WORDBITS	64
+
 /* vb_flags */
 #define PVBF_AUTO		(1 << 0)	/* auto grow bitmap as necessary */
 #define PVBF_STATIC		(1 << 1)	/* vbitmap is statically allocated */
 #define PVBF_EXTALLOC		(1 << 2)	/* bitmap mem is externally alloc'd */
 
-#define VBITMAP_INIT_AUTO	{ NULL, NULL, NULL, 0, PVBF_AUTO | PVBF_STATIC }
+#define VBITMAP_INIT_AUTO	{ NULL, NULL, 0, 0, 0, PVBF_AUTO | PVBF_STATIC }
 
 #define psc_vbitmap_new(siz)	psc_vbitmap_newf((siz), 0)
 
@@ -66,10 +72,16 @@ struct psc_vbitmap {
  * Get the number of elements a bitmap represents.
  * @vb: variable bitmap.
  */
-#define psc_vbitmap_getsize(vb)						\
-	((size_t)(((vb)->vb_end - (vb)->vb_start) * NBBY + (vb)->vb_lastsize))
+#define psc_vbitmap_getsize(vb)			((vb)->vb_nbits)
+
+#define psc_vbitmap_getnextpos(vb)		((vb)->vb_pos * PFL_VBITMAP_WORDBITS)
 
-#define psc_vbitmap_getnextpos(vb)		(((vb)->vb_pos - (vb)->vb_start) * NBBY)
+/*
+ * Get the Nth byte of a bitmap, as if it were stored as an array of
+ * chars.
+ */
+#define psc_vbitmap_getbyte(vb, n)					\
+	((unsigned char)((vb)->vb_words[(n) / 8] >> ((n) % 8 * NBBY)))
 
 #define psc_vbitmap_set(vb, pos)		((void)psc_vbitmap_setval((vb), (pos), 1))
 #define psc_vbitmap_xset(vb, pos)		(psc_vbitmap_setval((vb), (pos), 1) == 0)
@@ -88,15 +100,18 @@ struct psc_vbitmap {
 
 #define psc_vbitmap_printbin1(vb)						\
 	do {									\
-		const unsigned char *_p;					\
+		unsigned char _c;						\
 		char *_s, _buf[LINE_MAX];					\
+		size_t _n;							\
 		int _i;								\
 										\
-		for (_p = (vb)->vb_start, _s = _buf;				\
-		    _p <= (vb)->vb_end && _s + 10 < _buf + sizeof(_buf);	\
-		    _p++, *_s++ = ' ')						\
-			for (_i = 0; _i < 8; _i++, _s++)			\
-				if ((*_p >> _i) & 1)				\
+		for (_n = 0, _s = _buf;						\
+		    _n < howmany((vb)->vb_nbits, NBBY) &&			\
+		    _s + 10 < _buf + sizeof(_buf);				\
+		    _n++, *_s++ = ' ')						\
+			for (_c = psc_vbitmap_getbyte((vb), _n), _i = 0;	\
+			    _i < 8; _i++, _s++)					\
+				if ((_c >> _i) & 1)				\
 					*_s = '1';				\
 				else						\
 					*_s = '0';				\
@@ -96,6 +96,7 @@ _pfl_waitq_waitabs(struct pfl_waitq *q, enum pfl_lockprim type,
     void *lockp, const struct timespec *abstime)
 {
 	struct psc_thread *thr;
+	uint64_t pts;
 	int rc;
 
 	thr = pscthr_get_canfail();
@@ -106,6 +107,7 @@ _pfl_waitq_waitabs(struct pfl_waitq *q, enum pfl_lockprim type,
 
 	if (thr)
 		thr->pscthr_waitq = q->wq_name;
+	PFL_MUTEX_PROF_SUSPEND(&q->wq_mut, pts);
 	if (abstime) {
 		rc = pthread_cond_timedwait(&q->wq_cond,
 		    &q->wq_mut.pm_mutex, abstime);
@@ -121,6 +123,7 @@ _pfl_waitq_waitabs(struct pfl_waitq *q, enum pfl_lockprim type,
 			psc_fatalx("pthread_cond_wait: %s",
 			    strerror(rc));
 	}
+	PFL_MUTEX_PROF_RESUME(&q->wq_mut, pts);
 
 	if (thr)
 		thr->pscthr_waitq = NULL;
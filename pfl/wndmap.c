@@ -23,99 +23,117 @@
 
 #include <sys/param.h>
 
+#include <stdint.h>
 #include <string.h>
 
-#include "pfl/list.h"
-#include "pfl/lockedlist.h"
 #include "pfl/alloc.h"
 #include "pfl/atomic.h"
+#include "pfl/dynarray.h"
 #include "pfl/lock.h"
+#include "pfl/log.h"
 #include "pfl/wndmap.h"
 
-#define WMBSZ (sizeof(((struct pfl_wndmap_block *)NULL)->pwmb_buf) * NBBY)
+#define WMB_NWORDS	PFL_WNDMAP_BLKWORDS
+#define WMB_NBITS	PFL_WNDMAP_BLKBITS
 
-__static struct pfl_wndmap_block *
-pfl_wndmap_addblock(struct pfl_wndmap *wm)
+#define WM_NINITBLKS	4
+
+/*
+ * pfl_wndmap_isset() reads the window without taking pwm_lock.  Anyone
+ * moving the window (sliding pwm_min or growing pwm_blks) bumps pwm_gen
+ * to odd before and back to even after, so readers can detect that
+ * their view was torn and retry.  Outgrown block arrays are kept until
+ * pfl_wndmap_free() so a stale reader never touches freed memory.
+ */
+#define WM_BARRIER()	__sync_synchronize()
+
+#define WM_BLK(wm, i)	(wm)->pwm_blks[((wm)->pwm_head + (i)) &		\
+			    ((wm)->pwm_nblks - 1)]
+
+static __inline void
+pfl_wndmap_movestart(struct pfl_wndmap *wm)
 {
-	struct pfl_wndmap_block *wb;
+	psc_atomic64_inc(&wm->pwm_gen);
+}
 
-	wb = PSCALLOC(sizeof(*wb));
-	pll_addtail(&wm->pwm_wmbs, wb);
-	return (wb);
+static __inline void
+pfl_wndmap_moveend(struct pfl_wndmap *wm)
+{
+	psc_atomic64_inc(&wm->pwm_gen);
 }
 
-__static int
-pfl_wndmap_block_empty(const struct pfl_wndmap_block *wb)
+/*
+ * Double the number of blocks in the window.  The new array is laid out
+ * linearly starting from the current head.
+ */
+__static void
+pfl_wndmap_grow(struct pfl_wndmap *wm)
 {
-	size_t n;
+	struct pfl_wndmap_block **blks;
+	int i, n;
 
-	for (n = 0; n < sizeof(*wb); n++)
-		if (wb->pwmb_buf[n])
-			return (0);
-	return (1);
+	LOCK_ENSURE(&wm->pwm_lock);
+	n = wm->pwm_nblks * 2;
+	blks = PSCALLOC(n * sizeof(*blks));
+	for (i = 0; i < wm->pwm_nblks; i++)
+		blks[i] = WM_BLK(wm, i);
+	for (; i < n; i++)
+		blks[i] = PSCALLOC(sizeof(*blks[i]));
+
+	pfl_wndmap_movestart(wm);
+	psc_dynarray_add(&wm->pwm_retired, wm->pwm_blks);
+	wm->pwm_blks = blks;
+	wm->pwm_nblks = n;
+	wm->pwm_head = 0;
+	pfl_wndmap_moveend(wm);
 }
 
 void
 pfl_wndmap_init(struct pfl_wndmap *wm, size_t min)
 {
-	wm->pwm_min = wm->pwm_nextmin = min;
-	INIT_SPINLOCK(&wm->pwm_lock);
-	pll_init(&wm->pwm_wmbs, struct pfl_wndmap_block,
-	    pwmb_lentry, &wm->pwm_lock);
-	pfl_wndmap_addblock(wm);
-}
+	int i;
 
-int
-pfl_wndmap_find(struct pfl_wndmap *wm, size_t pos,
-    struct pfl_wndmap_block **wbp, size_t *np)
-{
-	size_t bmin, bmax, ymin, ymax, n;
-	struct pfl_wndmap_block *wb;
-	int j;
-
-	LOCK_ENSURE(&wm->pwm_lock);
-	bmin = wm->pwm_min;
-	PLL_FOREACH(wb, &wm->pwm_wmbs) {
-		bmax = bmin + (WMBSZ - 1);
-
-		/* check if pos falls in this block */
-		if ((bmin > bmax && (bmin <= pos || pos <= bmax)) ||
-		    (bmin < bmax && (bmin <= pos && pos <= bmax))) {
-			ymin = bmin;
-			for (n = 0; n < WMBSZ; n++, ymin += NBBY) {
-				ymax = ymin + (NBBY - 1);
-
-				/* check if pos falls in this byte */
-				if ((ymin > ymax && (ymin <= pos || pos <= ymax)) ||
-				    (ymin < ymax && (ymin <= pos && pos <= ymax))) {
-					for (j = 0; j < NBBY; j++, n++) {
-						if (n == pos) {
-							*wbp = wb;
-							*np = n;
-							return (1);
-						}
-					}
-					psc_fatalx("shouldn't reach here");
-				}
-			}
-			psc_fatalx("shouldn't reach here");
-		}
-	}
-	return (0);
+	memset(wm, 0, sizeof(*wm));
+	wm->pwm_min = wm->pwm_nextmin = wm->pwm_hwm = min;
+	INIT_SPINLOCK(&wm->pwm_lock);
+	psc_dynarray_init(&wm->pwm_retired);
+	wm->pwm_nblks = WM_NINITBLKS;
+	wm->pwm_blks = PSCALLOC(wm->pwm_nblks * sizeof(*wm->pwm_blks));
+	for (i = 0; i < wm->pwm_nblks; i++)
+		wm->pwm_blks[i] = PSCALLOC(sizeof(*wm->pwm_blks[i]));
 }
 
+/*
+ * Determine whether a position is in use.  This does not take the
+ * window map lock.
+ */
 int
 pfl_wndmap_isset(struct pfl_wndmap *wm, size_t pos)
 {
 	struct pfl_wndmap_block *wb;
-	size_t n;
-	int rc = 0;
+	uint64_t gen;
+	size_t off;
+	int rc;
+
+	for (;;) {
+		gen = psc_atomic64_read(&wm->pwm_gen);
+		if (gen & 1)
+			continue;
+		WM_BARRIER();
+
+		rc = 0;
+		off = pos - wm->pwm_min;
+		if (pos >= wm->pwm_min &&
+		    off < (size_t)wm->pwm_nblks * WMB_NBITS) {
+			wb = WM_BLK(wm, off / WMB_NBITS);
+			off %= WMB_NBITS;
+			rc = (wb->pwmb_words[off / 64] >> (off % 64)) & 1;
+		}
 
-	WNDMAP_LOCK(wm);
-	if (pfl_wndmap_find(wm, pos, &wb, &n) &&
-	    wb->pwmb_buf[n / NBBY] & (1 << (n % NBBY - 1)))
-		rc = 1;
-	WNDMAP_ULOCK(wm);
+		WM_BARRIER();
+		if ((uint64_t)psc_atomic64_read(&wm->pwm_gen) == gen)
+			break;
+	}
 	return (rc);
 }
 
@@ -123,49 +141,84 @@ void
 pfl_wndmap_clearpos(struct pfl_wndmap *wm, size_t pos)
 {
 	struct pfl_wndmap_block *wb;
-	size_t n;
+	uint64_t bit;
+	size_t off;
+	int moved = 0;
 
 	WNDMAP_LOCK(wm);
-	pfl_assert(pfl_wndmap_find(wm, pos, &wb, &n));
-	pfl_assert(wb->pwmb_buf[n / NBBY] & (1 << (n % NBBY - 1)));
-	wb->pwmb_buf[n / NBBY] &= ~(1 << (n % NBBY - 1));
-
-	if (pos == wm->pwm_nextmin)
-		wm->pwm_nextmin++;
-
-	/* if the first block is now empty, advance window */
-	if (pfl_wndmap_block_empty(wb)) {
-		wm->pwm_min += WMBSZ;
-
-		pll_remove(&wm->pwm_wmbs, wb);
-		pll_addtail(&wm->pwm_wmbs, wb);
+	off = pos - wm->pwm_min;
+	pfl_assert(pos >= wm->pwm_min);
+	pfl_assert(off < (size_t)wm->pwm_nblks * WMB_NBITS);
+	wb = WM_BLK(wm, off / WMB_NBITS);
+	off %= WMB_NBITS;
+	bit = (uint64_t)1 << (off % 64);
+	pfl_assert(wb->pwmb_words[off / 64] & bit);
+	wb->pwmb_words[off / 64] &= ~bit;
+	wb->pwmb_nset--;
+
+	if (pos < wm->pwm_nextmin)
+		wm->pwm_nextmin = pos;
+
+	/*
+	 * Slide the window past any bottom blocks whose positions have
+	 * all been handed out and since cleared.  Such blocks are all
+	 * zero already, so recycling them to the top is just a matter
+	 * of advancing the head.
+	 */
+	while (WM_BLK(wm, 0)->pwmb_nset == 0 &&
+	    wm->pwm_min + WMB_NBITS <= wm->pwm_hwm) {
+		if (!moved) {
+			pfl_wndmap_movestart(wm);
+			moved = 1;
+		}
+		wm->pwm_head = (wm->pwm_head + 1) & (wm->pwm_nblks - 1);
+		wm->pwm_min += WMB_NBITS;
+	}
+	if (moved) {
+		pfl_wndmap_moveend(wm);
+		if (wm->pwm_nextmin < wm->pwm_min)
+			wm->pwm_nextmin = wm->pwm_min;
 	}
 	WNDMAP_ULOCK(wm);
 }
 
+/*
+ * Allocate the lowest unused position in the window, growing the
+ * window if it is full.
+ */
 size_t
 pfl_wndmap_getnext(struct pfl_wndmap *wm)
 {
 	struct pfl_wndmap_block *wb;
-	size_t pos, n, j;
+	size_t w, nw, pos;
+	uint64_t v;
+	int bit;
 
 	WNDMAP_LOCK(wm);
-	pos = wm->pwm_nextmin;
-	PLL_FOREACH(wb, &wm->pwm_wmbs)
-		for (n = 0; n < WMBSZ; n++) {
-			if (wb->pwmb_buf[n / NBBY] != 0xff) {
-				j = ffs(~wb->pwmb_buf[n / NBBY]);
-				pfl_assert(j != NBBY + 1);
-				pos += j;
-				wb->pwmb_buf[n / NBBY] |=
-				    1 << (n % NBBY - 1);
-				goto out;
-			} else
-				pos += NBBY;
+	for (;;) {
+		nw = (size_t)wm->pwm_nblks * WMB_NWORDS;
+		for (w = (wm->pwm_nextmin - wm->pwm_min) / 64; w < nw;
+		    w++) {
+			wb = WM_BLK(wm, w / WMB_NWORDS);
+			if (wb->pwmb_nset == WMB_NBITS) {
+				/* skip the rest of a full block */
+				w |= WMB_NWORDS - 1;
+				continue;
+			}
+			v = ~wb->pwmb_words[w % WMB_NWORDS];
+			if (v == 0)
+				continue;
+			bit = __builtin_ctzll(v);
+			wb->pwmb_words[w % WMB_NWORDS] |= (uint64_t)1 << bit;
+			wb->pwmb_nset++;
+			pos = wm->pwm_min + w * 64 + bit;
+			wm->pwm_nextmin = pos + 1;
+			if (wm->pwm_hwm < pos + 1)
+				wm->pwm_hwm = pos + 1;
+			goto out;
 		}
-	/* no space available, return first bit in a new block */
-	wb = pfl_wndmap_addblock(wm);
-	wb->pwmb_buf[0] = 1;
+		pfl_wndmap_grow(wm);
+	}
  out:
 	WNDMAP_ULOCK(wm);
 	return (pos);
@@ -174,12 +227,16 @@ pfl_wndmap_getnext(struct pfl_wndmap *wm)
 void
 pfl_wndmap_free(struct pfl_wndmap *wm)
 {
-	struct pfl_wndmap_block *wb, *next;
+	void *p;
+	int i;
 
 	WNDMAP_LOCK(wm);
-	PLL_FOREACH_SAFE(wb, next, &wm->pwm_wmbs) {
-		pll_remove(&wm->pwm_wmbs, wb);
-		PSCFREE(wb);
-	}
+	for (i = 0; i < wm->pwm_nblks; i++)
+		PSCFREE(wm->pwm_blks[i]);
+	PSCFREE(wm->pwm_blks);
+	DYNARRAY_FOREACH(p, i, &wm->pwm_retired)
+		PSCFREE(p);
+	psc_dynarray_free(&wm->pwm_retired);
+	wm->pwm_nblks = 0;
 	WNDMAP_ULOCK(wm);
 }
@@ -21,23 +21,41 @@
  * %END_LICENSE%
  */
 
+/*
+ * Window maps track which positions of a sliding window (e.g. sequence
+ * numbers or IDs) are in use.  The window is a circular array of
+ * fixed-size blocks of 64-bit words addressed arithmetically from
+ * pwm_min; blocks at the bottom of the window are recycled to the top
+ * once every position in them has been handed out and cleared.
+ */
+
 #ifndef _PFL_WNDMAP_H_
 #define _PFL_WNDMAP_H_
 
-#include "pfl/list.h"
-#include "pfl/lockedlist.h"
+#include <stdint.h>
+
+#include "pfl/atomic.h"
+#include "pfl/dynarray.h"
 #include "pfl/lock.h"
 
+#define PFL_WNDMAP_BLKWORDS	16
+#define PFL_WNDMAP_BLKBITS	(PFL_WNDMAP_BLKWORDS * 64)
+
+struct pfl_wndmap_block {
+	uint64_t		 pwmb_words[PFL_WNDMAP_BLKWORDS];
+	int			 pwmb_nset;
+};
+
 struct pfl_wndmap {
 	size_t			 pwm_min;	/* bottom edge of window */
-	size_t			 pwm_nextmin;
+	size_t			 pwm_nextmin;	/* all of [min,nextmin) are set */
+	size_t			 pwm_hwm;	/* one past highest pos handed out */
+	struct pfl_wndmap_block	**pwm_blks;	/* circular array of blocks */
+	int			 pwm_nblks;	/* power of two */
+	int			 pwm_head;	/* block holding pwm_min */
+	psc_atomic64_t		 pwm_gen;	/* odd while window is moving */
 	psc_spinlock_t		 pwm_lock;
-	struct psc_lockedlist	 pwm_wmbs;
-};
-
-struct pfl_wndmap_block {
-	struct psclist_head	 pwmb_lentry;
-	unsigned char		 pwmb_buf[32];
+	struct psc_dynarray	 pwm_retired;	/* outgrown pwm_blks arrays */
 };
 
 #define WNDMAP_LOCK(wm)		spinlock(&(wm)->pwm_lock)
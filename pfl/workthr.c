@@ -21,9 +21,16 @@
  * %END_LICENSE%
  */
 
+#include <sys/param.h>
+
+#include <sched.h>
+#include <string.h>
+
+#include "pfl/atomic.h"
 #include "pfl/cdefs.h"
 #include "pfl/listcache.h"
 #include "pfl/pool.h"
+#include "pfl/sys.h"
 #include "pfl/thread.h"
 #include "pfl/workthr.h"
 
@@ -31,15 +38,51 @@ struct psc_poolmaster	 pfl_workrq_poolmaster;
 struct psc_poolmgr	*pfl_workrq_pool;
 struct psc_listcache	 pfl_workq;
 
+struct pfl_wk_thread	*pfl_wkthrv[PFL_WKTHR_MAX];
+psc_atomic32_t		 pfl_wkthr_n;
+int			 pfl_wkthr_bindcpu;
+
+psc_atomic32_t		 pfl_wkthr_next;
+volatile int		 pfl_wkthr_dying;
+
+/* workers that stopped touching each other's deques during shutdown */
+__static struct psc_spinlock pfl_wkthr_exitlock = SPINLOCK_INIT;
+__static struct pfl_waitq pfl_wkthr_exitwq = PFL_WAITQ_INIT("wkthr-exit");
+__static int		 pfl_wkthr_nexited;
+
+/*
+ * Return the worker structure of the calling thread or NULL if the
+ * caller is not a shared work queue worker.
+ */
+__static struct pfl_wk_thread *
+pfl_wkthr_self(void)
+{
+	struct psc_thread *thr;
+
+	thr = pscthr_get_canfail();
+	if (thr == NULL || (thr->pscthr_flags & PTF_WORKER) == 0)
+		return (NULL);
+	return (pfl_wkthr(thr));
+}
+
 void *
 _pfl_workq_getitem(const char *typename, int (*cb)(void *), size_t len,
     int flags)
 {
+	struct pfl_wk_thread *wkt;
 	struct pfl_workrq *wk;
 	void *p;
 
 	pfl_assert(len <= pfl_workrq_pool->ppm_entsize - sizeof(*wk));
-	if (flags & PFL_WKF_NONBLOCK) {
+
+	/* Recycle from the worker's private cache when possible. */
+	wkt = pfl_wkthr_self();
+	if (wkt && wkt->wkt_ncache) {
+		wk = psc_listhd_first_obj(&wkt->wkt_cache,
+		    struct pfl_workrq, wkrq_lentry);
+		psclist_del(&wk->wkrq_lentry, &wkt->wkt_cache);
+		wkt->wkt_ncache--;
+	} else if (flags & PFL_WKF_NONBLOCK) {
 		wk = psc_pool_tryget(pfl_workrq_pool);
 		if (wk == NULL)
 			return (NULL);
@@ -47,16 +90,153 @@ _pfl_workq_getitem(const char *typename, int (*cb)(void *), size_t len,
 		wk = psc_pool_get(pfl_workrq_pool);
 	wk->wkrq_cbf = cb;
 	wk->wkrq_type = typename;
+	wk->wkrq_pri = PFL_WKPRI_NORMAL;
 	p = PSC_AGP(wk, sizeof(*wk));
 	memset(p, 0, len);
 	return (p);
 }
 
+/*
+ * Release a finished work item, preferring the worker's cache over the
+ * shared pool.
+ */
+__static void
+pfl_workq_freeitem(struct pfl_wk_thread *wkt, struct pfl_workrq *wk)
+{
+	if (wkt && wkt->wkt_ncache < PFL_WKTHR_CACHE_MAX) {
+		psclist_add_head(&wk->wkrq_lentry, &wkt->wkt_cache);
+		wkt->wkt_ncache++;
+	} else
+		psc_pool_return(pfl_workrq_pool, wk);
+}
+
+#define WKTHR_BARRIER()		__sync_synchronize()
+
+/*
+ * Wake a worker if it is idle.  The idle flag is cleared under the
+ * worker's lock so a worker about to sleep notices and stays up.
+ * @wkt: worker.
+ * Returns whether the worker was idle.
+ */
+__static int
+pfl_wkthr_wake(struct pfl_wk_thread *wkt)
+{
+	int idle;
+
+	spinlock(&wkt->wkt_lock);
+	idle = wkt->wkt_idle;
+	wkt->wkt_idle = 0;
+	freelock(&wkt->wkt_lock);
+	if (idle)
+		pfl_waitq_wakeone(&wkt->wkt_wq);
+	return (idle);
+}
+
+/*
+ * Wake an idle worker so it may pick up or steal new work.
+ */
+__static void
+pfl_wkthr_wakeidle(void)
+{
+	struct pfl_wk_thread *wkt;
+	int i, n, start;
+
+	n = psc_atomic32_read(&pfl_wkthr_n);
+	if (n == 0)
+		return;
+	start = psc_atomic32_inc_getnew(&pfl_wkthr_next);
+	for (i = 0; i < n; i++) {
+		wkt = pfl_wkthrv[(uint32_t)(start + i) % n];
+		if (wkt->wkt_idle && pfl_wkthr_wake(wkt))
+			break;
+	}
+}
+
+/*
+ * Enqueue a work item on a worker deque.  Workers enqueue onto their
+ * own deques; other threads spread submissions round-robin.  If the
+ * target is busy, an idle worker is woken to steal the item.
+ * @wkt: target worker.
+ * @wk: work item.
+ * @tail: whether to append instead of prepend.
+ */
+__static void
+pfl_wkthr_push(struct pfl_wk_thread *wkt, struct pfl_workrq *wk,
+    int tail)
+{
+	struct psclist_head *hd;
+	int idle;
+
+	hd = &wkt->wkt_q[wk->wkrq_pri];
+	spinlock(&wkt->wkt_lock);
+	if (tail)
+		psclist_add_tail(&wk->wkrq_lentry, hd);
+	else
+		psclist_add_head(&wk->wkrq_lentry, hd);
+	wkt->wkt_nqueued++;
+	idle = wkt->wkt_idle;
+	wkt->wkt_idle = 0;
+	freelock(&wkt->wkt_lock);
+
+	if (idle)
+		pfl_waitq_wakeone(&wkt->wkt_wq);
+	else {
+		/* pairs with the barrier in pfl_wkthr_idle() */
+		WKTHR_BARRIER();
+		pfl_wkthr_wakeidle();
+	}
+}
+
+void
+_pfl_workq_putitem_pri(void *p, int pri, int tail)
+{
+	struct pfl_wk_thread *wkt;
+	struct pfl_workrq *wk;
+	int n;
+
+	pfl_assert(p);
+	pfl_assert(pri >= 0 && pri < PFL_WKPRI_MAX);
+	wk = PSC_AGP(p, -sizeof(*wk));
+	wk->wkrq_pri = pri;
+
+	wkt = pfl_wkthr_self();
+	if (wkt == NULL) {
+		n = psc_atomic32_read(&pfl_wkthr_n);
+		if (n == 0) {
+			/* No workers yet; they drain this on startup. */
+			psclog_debug("placing work %p on queue %p", wk,
+			    &pfl_workq);
+			if (tail)
+				lc_addtail(&pfl_workq, wk);
+			else
+				lc_addhead(&pfl_workq, wk);
+
+			/*
+			 * A worker registered since may have already
+			 * looked at the queue and gone to sleep.  Pairs
+			 * with the barrier in pfl_wkthr_idle().
+			 */
+			WKTHR_BARRIER();
+			pfl_wkthr_wakeidle();
+			return;
+		}
+		wkt = pfl_wkthrv[(uint32_t)psc_atomic32_inc_getnew(
+		    &pfl_wkthr_next) % n];
+	}
+	psclog_debug("placing work %p on worker %p", wk, wkt);
+	pfl_wkthr_push(wkt, wk, tail);
+}
+
 void
 _pfl_workq_putitemq(struct psc_listcache *lc, void *p, int tails)
 {
 	struct pfl_workrq *wk;
 
+	if (lc == &pfl_workq) {
+		_pfl_workq_putitem_pri(p, PFL_WKPRI_NORMAL, tails);
+		return;
+	}
+
 	pfl_assert(p);
 	wk = PSC_AGP(p, -sizeof(*wk));
 	psclog_debug("placing work %p on queue %p", wk, lc);
@@ -66,14 +246,148 @@ _pfl_workq_putitemq(struct psc_listcache *lc, void *p, int tails)
 		lc_addhead(lc, wk);
 }
 
-void
-pfl_wkthr_main(struct psc_thread *thr)
+/*
+ * Take the next item off a worker's own deques in priority order.
+ * @wkt: worker, locked.
+ */
+__static struct pfl_workrq *
+pfl_wkthr_pop(struct pfl_wk_thread *wkt)
+{
+	struct pfl_workrq *wk;
+	int pri;
+
+	LOCK_ENSURE(&wkt->wkt_lock);
+	for (pri = 0; pri < PFL_WKPRI_MAX; pri++) {
+		wk = psc_listhd_first_obj(&wkt->wkt_q[pri],
+		    struct pfl_workrq, wkrq_lentry);
+		if (wk) {
+			psclist_del(&wk->wkrq_lentry, &wkt->wkt_q[pri]);
+			wkt->wkt_nqueued--;
+			return (wk);
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Steal up to half the queued items of the first victim with any,
+ * starting from a random one.  Only one worker lock is held at a time.
+ * Items are taken from the tails opposite to where the owner consumes.
+ * @wkt: thief.
+ * Returns the number of items moved.
+ */
+__static int
+pfl_wkthr_steal(struct pfl_wk_thread *wkt)
+{
+	struct psclist_head stolen[PFL_WKPRI_MAX];
+	struct pfl_wk_thread *victim;
+	struct pfl_workrq *wk;
+	int i, n, nv, pri, want, got = 0;
+	uint32_t r;
+
+	n = psc_atomic32_read(&pfl_wkthr_n);
+	if (n < 2)
+		return (0);
+
+	for (pri = 0; pri < PFL_WKPRI_MAX; pri++)
+		INIT_PSCLIST_HEAD(&stolen[pri]);
+
+	/* xorshift32 */
+	r = wkt->wkt_rand;
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	wkt->wkt_rand = r;
+
+	/* Start at a random victim but visit all so no work is missed. */
+	for (i = 0; i < n && got == 0; i++) {
+		victim = pfl_wkthrv[(r + i) % n];
+		if (victim == wkt || victim->wkt_nqueued == 0)
+			continue;
+
+		spinlock(&victim->wkt_lock);
+		nv = victim->wkt_nqueued;
+		want = MIN((nv + 1) / 2, PFL_WKTHR_STEAL_MAX);
+		for (pri = 0; pri < PFL_WKPRI_MAX && got < want; pri++)
+			while (got < want) {
+				wk = psc_listhd_last_obj(
+				    &victim->wkt_q[pri],
+				    struct pfl_workrq, wkrq_lentry);
+				if (wk == NULL)
+					break;
+				psclist_del(&wk->wkrq_lentry,
+				    &victim->wkt_q[pri]);
+				psclist_add_head(&wk->wkrq_lentry,
+				    &stolen[pri]);
+				got++;
+			}
+		victim->wkt_nqueued -= got;
+		victim->wkt_nstolen += got;
+		freelock(&victim->wkt_lock);
+	}
+	if (got == 0)
+		return (0);
+
+	spinlock(&wkt->wkt_lock);
+	for (pri = 0; pri < PFL_WKPRI_MAX; pri++)
+		while ((wk = psc_listhd_last_obj(&stolen[pri],
+		    struct pfl_workrq, wkrq_lentry)) != NULL) {
+			psclist_del(&wk->wkrq_lentry, &stolen[pri]);
+			psclist_add_head(&wk->wkrq_lentry,
+			    &wkt->wkt_q[pri]);
+		}
+	wkt->wkt_nqueued += got;
+	wkt->wkt_nsteals += got;
+	freelock(&wkt->wkt_lock);
+	return (got);
+}
+
+/*
+ * Sleep until work is pushed to this worker or an idle worker is
+ * wanted to steal.  Before sleeping the worker advertises itself as
+ * idle and then looks for work once more, including on the shared
+ * queue, so a push that did not see the idle flag is always seen here.
+ * @wkt: worker.
+ */
+__static void
+pfl_wkthr_idle(struct pfl_wk_thread *wkt)
+{
+	int i, n;
+
+	spinlock(&wkt->wkt_lock);
+	if (wkt->wkt_nqueued) {
+		freelock(&wkt->wkt_lock);
+		return;
+	}
+	wkt->wkt_idle = 1;
+	freelock(&wkt->wkt_lock);
+
+	/* pairs with the barrier in pfl_wkthr_push() */
+	WKTHR_BARRIER();
+	n = psc_atomic32_read(&pfl_wkthr_n);
+	for (i = 0; i < n; i++)
+		if (pfl_wkthrv[i]->wkt_nqueued)
+			break;
+
+	spinlock(&wkt->wkt_lock);
+	if (wkt->wkt_idle && i == n && !lc_nitems(&pfl_workq) &&
+	    !pfl_wkthr_dying) {
+		pfl_waitq_wait(&wkt->wkt_wq, &wkt->wkt_lock);
+		spinlock(&wkt->wkt_lock);
+	}
+	wkt->wkt_idle = 0;
+	freelock(&wkt->wkt_lock);
+}
+
+/*
+ * Legacy worker loop servicing a private list cache.
+ */
+__static void
+pfl_wkthr_main_lc(struct psc_thread *thr, struct psc_listcache *lc)
 {
-	struct psc_listcache *lc;
 	struct pfl_workrq *wkrq;
 	void *p;
 
-	lc = pfl_wkthr(thr)->wkt_workq;
 	while (pscthr_run(thr)) {
 		wkrq = lc_getwait(lc);
 		if (wkrq == NULL)
@@ -92,6 +406,110 @@ pfl_wkthr_main(struct psc_thread *thr)
 	}
 }
 
+/*
+ * Tear down a worker leaving its loop, whether all workers are dying
+ * or this one alone was stopped.
+ * @wkt: worker.
+ */
+__static void
+pfl_wkthr_exit(struct pfl_wk_thread *wkt)
+{
+	struct pfl_workrq *wkrq;
+
+	/* Leave any work still queued to us for the others. */
+	if (!pfl_wkthr_dying) {
+		for (;;) {
+			spinlock(&wkt->wkt_lock);
+			wkrq = pfl_wkthr_pop(wkt);
+			freelock(&wkt->wkt_lock);
+			if (wkrq == NULL)
+				break;
+			lc_addtail(&pfl_workq, wkrq);
+		}
+		pfl_wkthr_wakeidle();
+	}
+
+	/*
+	 * Other workers may still be scanning our deques for work to
+	 * steal, so our structure must outlive all of them.
+	 */
+	spinlock(&pfl_wkthr_exitlock);
+	pfl_wkthr_nexited++;
+	pfl_waitq_wakeall(&pfl_wkthr_exitwq);
+	while (pfl_wkthr_nexited < psc_atomic32_read(&pfl_wkthr_n)) {
+		pfl_waitq_wait(&pfl_wkthr_exitwq, &pfl_wkthr_exitlock);
+		spinlock(&pfl_wkthr_exitlock);
+	}
+	freelock(&pfl_wkthr_exitlock);
+
+	/* Our item cache goes away with us. */
+	while ((wkrq = psc_listhd_first_obj(&wkt->wkt_cache,
+	    struct pfl_workrq, wkrq_lentry)) != NULL) {
+		psclist_del(&wkrq->wkrq_lentry, &wkt->wkt_cache);
+		wkt->wkt_ncache--;
+		psc_pool_return(pfl_workrq_pool, wkrq);
+	}
+}
+
+void
+pfl_wkthr_main(struct psc_thread *thr)
+{
+	struct pfl_wk_thread *wkt;
+	struct pfl_workrq *wkrq;
+	void *p;
+
+	wkt = pfl_wkthr(thr);
+	if (wkt->wkt_workq != &pfl_workq) {
+		pfl_wkthr_main_lc(thr, wkt->wkt_workq);
+		return;
+	}
+
+#ifdef CPU_SET
+	if (wkt->wkt_cpu != -1) {
+		cpu_set_t mask;
+
+		CPU_ZERO(&mask);
+		CPU_SET(wkt->wkt_cpu, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask) == -1)
+			psclog_warn("sched_setaffinity cpu=%d",
+			    wkt->wkt_cpu);
+	}
+#endif
+
+	while (pscthr_run(thr)) {
+		spinlock(&wkt->wkt_lock);
+		wkrq = pfl_wkthr_pop(wkt);
+		freelock(&wkt->wkt_lock);
+
+		if (wkrq == NULL)
+			wkrq = lc_getnb(&pfl_workq);
+		if (wkrq == NULL && pfl_wkthr_steal(wkt))
+			continue;
+		if (wkrq == NULL) {
+			if (pfl_wkthr_dying)
+				break;
+			pfl_wkthr_idle(wkt);
+			continue;
+		}
+
+		wkt->wkt_nrun++;
+		p = PSC_AGP(wkrq, sizeof(*wkrq));
+		if (wkrq->wkrq_cbf(p)) {
+			spinlock(&wkt->wkt_lock);
+			psclist_add_tail(&wkrq->wkrq_lentry,
+			    &wkt->wkt_q[wkrq->wkrq_pri]);
+			if (++wkt->wkt_nqueued == 1)
+				pfl_waitq_waitrel_us(&wkt->wkt_wq,
+				    &wkt->wkt_lock, 1);
+			else
+				freelock(&wkt->wkt_lock);
+		} else
+			pfl_workq_freeitem(wkt, wkrq);
+	}
+
+	pfl_wkthr_exit(wkt);
+}
+
 void
 pfl_workq_init(size_t bufsiz, int min, int total)
 {
@@ -106,13 +524,33 @@ pfl_workq_init(size_t bufsiz, int min, int total)
 void
 pfl_wkthr_spawn(int thrtype, int nthr, int extra, const char *thrname)
 {
+	struct pfl_wk_thread *wkt;
 	struct psc_thread *thr;
-	int i;
+	int i, idx, pri, ncpu;
 
+	ncpu = pfl_getnprocessors();
 	for (i = 0; i < nthr; i++) {
 		thr = pscthr_init(thrtype, pfl_wkthr_main,
 		    sizeof(struct pfl_wk_thread)+extra, thrname, i);
-		pfl_wkthr(thr)->wkt_workq = &pfl_workq;
+		wkt = pfl_wkthr(thr);
+		wkt->wkt_workq = &pfl_workq;
+		wkt->wkt_thread = thr;
+		INIT_SPINLOCK(&wkt->wkt_lock);
+		pfl_waitq_init(&wkt->wkt_wq, "wkthr");
+		for (pri = 0; pri < PFL_WKPRI_MAX; pri++)
+			INIT_PSCLIST_HEAD(&wkt->wkt_q[pri]);
+		INIT_PSCLIST_HEAD(&wkt->wkt_cache);
+		wkt->wkt_cpu = pfl_wkthr_bindcpu ? i % ncpu : -1;
+		wkt->wkt_rand = (uint32_t)(uintptr_t)wkt | 1;
+
+		idx = psc_atomic32_read(&pfl_wkthr_n);
+		if (idx >= PFL_WKTHR_MAX)
+			psc_fatalx("too many worker threads");
+		/* Publish the slot before the count so readers see it. */
+		pfl_wkthrv[idx] = wkt;
+		psc_atomic32_inc(&pfl_wkthr_n);
+
+		thr->pscthr_flags |= PTF_WORKER;
 		pscthr_setready(thr);
 	}
 }
@@ -120,5 +558,14 @@ pfl_wkthr_spawn(int thrtype, int nthr, int extra, const char *thrname)
 void
 pfl_wkthr_killall(void)
 {
+	int i, n;
+
+	/* Exiting workers wait on this lock, keeping them around. */
+	spinlock(&pfl_wkthr_exitlock);
+	pfl_wkthr_dying = 1;
+	n = psc_atomic32_read(&pfl_wkthr_n);
+	for (i = 0; i < n; i++)
+		pfl_wkthr_wake(pfl_wkthrv[i]);
+	freelock(&pfl_wkthr_exitlock);
 	lc_kill(&pfl_workq);
 }
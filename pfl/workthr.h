@@ -24,23 +24,62 @@
 #ifndef _PFL_WORKTHR_H_
 #define _PFL_WORKTHR_H_
 
+#include <stdint.h>
+
+#include "pfl/atomic.h"
 #include "pfl/list.h"
 #include "pfl/listcache.h"
+#include "pfl/lock.h"
+#include "pfl/waitq.h"
+
+struct psc_thread;
+
+/* work item priority classes, in order of service */
+enum {
+	PFL_WKPRI_URGENT,
+	PFL_WKPRI_NORMAL,
+	PFL_WKPRI_BACKGROUND,
+	PFL_WKPRI_MAX
+};
 
 struct pfl_workrq {
 	int				(*wkrq_cbf)(void *);
 	const char 			 *wkrq_type;
 	struct psc_listentry		  wkrq_lentry;
+	int				  wkrq_pri;
 };
 
+/*
+ * Each worker owns a deque per priority class.  Items submitted by a
+ * worker go onto its own deques; items from other threads are spread
+ * across workers, and an idle worker is woken to steal from any worker
+ * that is busy with items queued behind it.
+ */
 struct pfl_wk_thread {
-	struct psc_listcache		 *wkt_workq;
+	struct psc_listcache		 *wkt_workq;	/* legacy: private queue */
+	struct psc_thread		 *wkt_thread;
+	struct psc_spinlock		  wkt_lock;
+	struct pfl_waitq		  wkt_wq;
+	struct psclist_head		  wkt_q[PFL_WKPRI_MAX];
+	struct psclist_head		  wkt_cache;	/* recycled items */
+	int				  wkt_ncache;
+	int				  wkt_nqueued;
+	int				  wkt_idle;
+	int				  wkt_cpu;	/* bound CPU or -1 */
+	uint32_t			  wkt_rand;	/* victim selection */
+	uint64_t			  wkt_nrun;
+	uint64_t			  wkt_nsteals;	/* items taken from others */
+	uint64_t			  wkt_nstolen;	/* items taken by others */
 };
 
 #define pfl_wkthr(thr)			((struct pfl_wk_thread *)(thr)->pscthr_private)
 
 #define PFL_WKF_NONBLOCK		(1 << 0)
 
+#define PFL_WKTHR_MAX			256	/* max #workers in the shared pool */
+#define PFL_WKTHR_CACHE_MAX		32	/* max recycled items per worker */
+#define PFL_WKTHR_STEAL_MAX		16	/* max items moved per steal */
+
 #define pfl_workq_getitem(cb, type)	_pfl_workq_getitem(#type, (cb), sizeof(type), 0)
 #define pfl_workq_getitem_nb(cb, type)	_pfl_workq_getitem(#type, (cb), sizeof(type), PFL_WKF_NONBLOCK)
 
@@ -54,16 +93,21 @@ void   pfl_wkthr_spawn(int, int, int, const char *);
 void *_pfl_workq_getitem(const char *, int (*)(void *), size_t, int);
 void   pfl_workq_init(size_t, int, int);
 void  _pfl_workq_putitemq(struct psc_listcache *, void *, int);
+void  _pfl_workq_putitem_pri(void *, int, int);
 void   pfl_wkthr_killall(void);
 
-#define _pfl_workq_putitem(p, tail)	_pfl_workq_putitemq(&pfl_workq, (p), (tail))
+#define _pfl_workq_putitem(p, tail)	_pfl_workq_putitem_pri((p), PFL_WKPRI_NORMAL, (tail))
 #define  pfl_workq_putitem_head(p)	_pfl_workq_putitem((p), 0)
 #define  pfl_workq_putitem_tail(p)	_pfl_workq_putitem((p), 1)
 #define  pfl_workq_putitem(p)		_pfl_workq_putitem((p), 1)
+#define  pfl_workq_putitem_pri(p, pri)	_pfl_workq_putitem_pri((p), (pri), 1)
 #define  pfl_workq_putitemq(lc, p)	_pfl_workq_putitemq((lc), (p), 1)
 #define  pfl_workq_putitemq_head(lc, p)	_pfl_workq_putitemq((lc), (p), 0)
 
 extern struct psc_listcache		 pfl_workq;
 extern struct psc_poolmgr		*pfl_workrq_pool;
+extern struct pfl_wk_thread		*pfl_wkthrv[PFL_WKTHR_MAX];
+extern psc_atomic32_t			 pfl_wkthr_n;
+extern int				 pfl_wkthr_bindcpu;
 
 #endif /* _PFL_WORKTHR_H_ */